@@ -0,0 +1,361 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Unit test for the PSI section assembler in src/common/tspsi.c.
+ *
+ * Packetizes generated sections by hand and checks what ts_psi_push_packet
+ * hands to the section callback: sections spanning several packets,
+ * several sections in one packet, a section ending behind pointer_field in
+ * the packet that starts the next one, adaptation fields, duplicate and
+ * lost packets, CRC_32 mismatches and PID changes made from the callback.
+ *
+ * Build:
+ *   make check in src/rbifilter
+ * or
+ *   gcc -o tspsi_test tspsi_test.c ../tspsi.c -I.. $(pkg-config --cflags --libs glib-2.0)
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "tspsi.h"
+#include "crc32mpeg.h"
+
+#define PID_A (0x100)
+#define PID_B (0x101)
+
+typedef struct _TestState
+{
+   TsPsi *psi;
+   int count;
+   int pids[8];
+   int lens[8];
+   unsigned char sections[8][TS_PSI_PRIVATE_SECTION_MAX];
+   int switchPid;
+   guint errors;
+} TestState;
+
+static TestState state;
+
+static void section_cb( void *userData, int pid, const unsigned char *section, int len )
+{
+   (void)userData;
+
+   if ( state.count < 8 ) {
+      state.pids[state.count]= pid;
+      state.lens[state.count]= len;
+      memcpy( state.sections[state.count], section, len );
+   }
+   ++state.count;
+
+   if ( state.switchPid && (pid == PID_A) ) {
+      ts_psi_remove_pid( state.psi, PID_A );
+      ts_psi_add_pid( state.psi, state.switchPid );
+   }
+}
+
+static void reset( void )
+{
+   if ( state.psi ) {
+      ts_psi_free( state.psi );
+   }
+   memset( &state, 0, sizeof(state) );
+   state.psi= ts_psi_new( section_cb, NULL );
+   ts_psi_add_pid( state.psi, PID_A );
+}
+
+/* Section of bodyLen bytes after the 8 byte long form header, with a
+   valid CRC_32 when syntax is set and a wrong one otherwise */
+static int make_section( unsigned char *section, int tableId, int bodyLen, gboolean syntax, int seed )
+{
+   int total= 8 + bodyLen + 4, i;
+   uint32_t crc;
+
+   section[0]= tableId;
+   section[1]= (syntax ? 0xB0 : 0x30) | (((total - 3) >> 8) & 0x0F);
+   section[2]= (total - 3) & 0xFF;
+   for( i= 3; i < total - 4; ++i ) {
+      section[i]= (unsigned char)((i + seed) & 0x7F);
+   }
+   crc= crc32_mpeg( section, total - 4 );
+   if ( !syntax ) {
+      crc ^= 0x5A5A5A5A;
+   }
+   section[total-4]= (crc >> 24) & 0xFF;
+   section[total-3]= (crc >> 16) & 0xFF;
+   section[total-2]= (crc >> 8) & 0xFF;
+   section[total-1]= crc & 0xFF;
+
+   return total;
+}
+
+/* Builds one packet around len payload bytes, padded with stuffing */
+static void make_packet( unsigned char *packet, int pid, gboolean pusi, int cc, int afLen,
+                         const unsigned char *payload, int len )
+{
+   int pos= 4;
+
+   memset( packet, 0xFF, 188 );
+   packet[0]= 0x47;
+   packet[1]= (pusi ? 0x40 : 0x00) | ((pid >> 8) & 0x1F);
+   packet[2]= pid & 0xFF;
+   packet[3]= (afLen ? 0x30 : 0x10) | (cc & 0x0F);
+   if ( afLen ) {
+      packet[4]= afLen - 1;
+      packet[5]= 0x00;
+      pos += afLen;
+   }
+   memcpy( packet + pos, payload, len );
+}
+
+/* Carries one section starting at pointer_field 0, returns the packet count */
+static int packetize( unsigned char *packets, int pid, int *cc, const unsigned char *section, int len )
+{
+   unsigned char payload[184];
+   int count= 0, offset= 0, n;
+
+   while( offset < len ) {
+      if ( offset == 0 ) {
+         payload[0]= 0;
+         n= MIN( 183, len );
+         memcpy( payload + 1, section, n );
+         make_packet( packets + count*188, pid, TRUE, (*cc)++, 0, payload, n + 1 );
+      } else {
+         n= MIN( 184, len - offset );
+         make_packet( packets + count*188, pid, FALSE, (*cc)++, 0, section + offset, n );
+      }
+      offset += n;
+      ++count;
+   }
+
+   return count;
+}
+
+static void push( const unsigned char *packets, int count )
+{
+   int i;
+
+   for( i= 0; i < count; ++i ) {
+      ts_psi_push_packet( state.psi, packets + i*188 );
+   }
+}
+
+static void expect( const char *name, int count, guint64 crcErrors, guint64 continuityErrors )
+{
+   if ( (state.count != count) ||
+        (state.psi->crcErrors != crcErrors) ||
+        (state.psi->continuityErrors != continuityErrors) ) {
+      printf( "%s: %d sections, %llu crc errors, %llu continuity errors, expected %d, %llu, %llu\n",
+              name, state.count, (unsigned long long)state.psi->crcErrors,
+              (unsigned long long)state.psi->continuityErrors, count,
+              (unsigned long long)crcErrors, (unsigned long long)continuityErrors );
+      ++state.errors;
+   }
+}
+
+static void expect_section( const char *name, int index, int pid, const unsigned char *section, int len )
+{
+   if ( (index >= state.count) || (state.pids[index] != pid) || (state.lens[index] != len) ||
+        memcmp( state.sections[index], section, len ) ) {
+      printf( "%s: section %d does not match\n", name, index );
+      ++state.errors;
+   }
+}
+
+static int report( const char *name )
+{
+   printf( "%s: %s\n", name, state.errors ? "FAIL" : "PASS" );
+   return (state.errors != 0);
+}
+
+static int test_split( void )
+{
+   unsigned char section[TS_PSI_PRIVATE_SECTION_MAX], packets[32*188];
+   int cc= 0, len, count;
+
+   reset();
+   len= make_section( section, 0x02, 500, TRUE, 1 );
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, count );
+   expect( "split", 1, 0, 0 );
+   expect_section( "split", 0, PID_A, section, len );
+
+   /* private sections up to 4096 bytes */
+   len= make_section( section, 0xFC, TS_PSI_PRIVATE_SECTION_MAX - 12, FALSE, 2 );
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, count );
+   expect( "split", 2, 0, 0 );
+   expect_section( "split", 1, PID_A, section, len );
+
+   return report( "split" );
+}
+
+static int test_pointer_field( void )
+{
+   unsigned char first[512], second[64], third[64], payload[184], packets[2*188];
+   int firstLen, secondLen, thirdLen, tail, pos;
+
+   reset();
+   firstLen= make_section( first, 0x02, 300, TRUE, 3 );
+   secondLen= make_section( second, 0x02, 20, TRUE, 4 );
+   thirdLen= make_section( third, 0x02, 10, TRUE, 5 );
+
+   /* first section starts in packet 0 and ends behind pointer_field in
+      packet 1, which then starts two more sections */
+   payload[0]= 0;
+   memcpy( payload + 1, first, 183 );
+   make_packet( packets, PID_A, TRUE, 0, 0, payload, 184 );
+   tail= firstLen - 183;
+   payload[0]= tail;
+   pos= 1;
+   memcpy( payload + pos, first + 183, tail );
+   pos += tail;
+   memcpy( payload + pos, second, secondLen );
+   pos += secondLen;
+   memcpy( payload + pos, third, thirdLen );
+   pos += thirdLen;
+   make_packet( packets + 188, PID_A, TRUE, 1, 0, payload, pos );
+
+   push( packets, 2 );
+   expect( "pointer_field", 3, 0, 0 );
+   expect_section( "pointer_field", 0, PID_A, first, firstLen );
+   expect_section( "pointer_field", 1, PID_A, second, secondLen );
+   expect_section( "pointer_field", 2, PID_A, third, thirdLen );
+
+   /* pointer_field running past the payload drops the packet */
+   payload[0]= 184;
+   make_packet( packets, PID_A, TRUE, 2, 0, payload, 184 );
+   push( packets, 1 );
+   expect( "pointer_field", 3, 0, 0 );
+
+   return report( "pointer_field" );
+}
+
+static int test_adaptation_field( void )
+{
+   unsigned char section[64], payload[184], packet[188];
+   int len;
+
+   reset();
+   len= make_section( section, 0x02, 20, TRUE, 6 );
+   payload[0]= 0;
+   memcpy( payload + 1, section, len );
+   make_packet( packet, PID_A, TRUE, 0, 8, payload, len + 1 );
+   push( packet, 1 );
+   expect( "adaptation_field", 1, 0, 0 );
+   expect_section( "adaptation_field", 0, PID_A, section, len );
+
+   return report( "adaptation_field" );
+}
+
+static int test_continuity( void )
+{
+   unsigned char section[512], packets[4*188];
+   int cc= 0, len, count;
+
+   reset();
+   len= make_section( section, 0x02, 400, TRUE, 7 );
+
+   /* a repeated packet is ignored */
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, 2 );
+   push( packets + 188, 1 );
+   push( packets + 2*188, count - 2 );
+   expect( "continuity", 1, 0, 0 );
+
+   /* a lost continuation packet drops the section */
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, 1 );
+   push( packets + 2*188, count - 2 );
+   expect( "continuity", 1, 0, 1 );
+
+   /* and the next section is assembled again */
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, count );
+   expect( "continuity", 2, 0, 1 );
+   expect_section( "continuity", 1, PID_A, section, len );
+
+   return report( "continuity" );
+}
+
+static int test_crc( void )
+{
+   unsigned char section[512], packets[4*188];
+   int cc= 0, len, count;
+
+   reset();
+   len= make_section( section, 0x02, 300, TRUE, 8 );
+   section[40] ^= 0x01;
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, count );
+   expect( "crc", 0, 1, 0 );
+
+   /* without section_syntax_indicator the CRC is left to the callback */
+   len= make_section( section, 0xFC, 30, FALSE, 9 );
+   count= packetize( packets, PID_A, &cc, section, len );
+   push( packets, count );
+   expect( "crc", 1, 1, 0 );
+
+   return report( "crc" );
+}
+
+static int test_pid_switch( void )
+{
+   unsigned char section[64], packets[2*188];
+   int ccA= 0, ccB= 0, len;
+
+   reset();
+   state.switchPid= PID_B;
+   len= make_section( section, 0x00, 8, TRUE, 10 );
+   packetize( packets, PID_A, &ccA, section, len );
+   push( packets, 1 );
+   if ( ts_psi_is_psi_pid( state.psi, PID_A ) || !ts_psi_is_psi_pid( state.psi, PID_B ) ) {
+      printf( "pid_switch: PID set not updated from the callback\n" );
+      ++state.errors;
+   }
+
+   /* PID_A is ignored now, PID_B assembled */
+   packetize( packets, PID_A, &ccA, section, len );
+   packetize( packets + 188, PID_B, &ccB, section, len );
+   push( packets, 2 );
+   expect( "pid_switch", 2, 0, 0 );
+   expect_section( "pid_switch", 1, PID_B, section, len );
+
+   return report( "pid_switch" );
+}
+
+int main( int argc, char **argv )
+{
+   int failed= 0;
+
+   (void)argc;
+   (void)argv;
+
+   failed |= test_split();
+   failed |= test_pointer_field();
+   failed |= test_adaptation_field();
+   failed |= test_continuity();
+   failed |= test_crc();
+   failed |= test_pid_switch();
+
+   ts_psi_free( state.psi );
+
+   return failed;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "tspsi.h"
+#include "crc32mpeg.h"
+
+#define TS_PACKET_SIZE (188)
+
+static TsPsiPid* ts_psi_find_pid( TsPsi *psi, int pid )
+{
+   int i;
+
+   for( i= 0; i < TS_PSI_MAX_PIDS; ++i ) {
+      if ( psi->pids[i].pid == pid ) {
+         return &psi->pids[i];
+      }
+   }
+
+   return NULL;
+}
+
+static void ts_psi_reset_pid( TsPsiPid *state )
+{
+   state->continuity= -1;
+   state->collecting= FALSE;
+   state->sectionLen= 0;
+   state->sectionTotal= 0;
+}
+
+static void ts_psi_section( TsPsi *psi, TsPsiPid *state )
+{
+   /* section_syntax_indicator set means the section ends with a CRC_32 */
+   if ( state->section[1] & 0x80 ) {
+      if ( (state->sectionTotal < 12) || (crc32_mpeg( state->section, state->sectionTotal ) != 0) ) {
+         ++psi->crcErrors;
+         return;
+      }
+   }
+
+   ++psi->sectionCount;
+   if ( psi->sectionCB ) {
+      psi->sectionCB( psi->userData, state->pid, state->section, state->sectionTotal );
+   }
+}
+
+static int ts_psi_append( TsPsi *psi, TsPsiPid *state, const unsigned char *data, int len )
+{
+   int consumed= 0, avail;
+
+   if ( state->sectionLen < 3 ) {
+      avail= MIN( 3 - state->sectionLen, len );
+      memcpy( state->section + state->sectionLen, data, avail );
+      state->sectionLen += avail;
+      consumed += avail;
+      if ( state->sectionLen < 3 ) {
+         return consumed;
+      }
+      state->sectionTotal= 3 + (((state->section[1] & 0x0F) << 8) | state->section[2]);
+      if ( state->sectionTotal > TS_PSI_PRIVATE_SECTION_MAX ) {
+         state->collecting= FALSE;
+         state->sectionLen= 0;
+         return len;
+      }
+   }
+
+   avail= MIN( state->sectionTotal - state->sectionLen, len - consumed );
+   memcpy( state->section + state->sectionLen, data + consumed, avail );
+   state->sectionLen += avail;
+   consumed += avail;
+
+   if ( state->sectionLen == state->sectionTotal ) {
+      ts_psi_section( psi, state );
+      state->collecting= FALSE;
+      state->sectionLen= 0;
+   }
+
+   return consumed;
+}
+
+TsPsi* ts_psi_new( TsPsiSectionCB sectionCB, void *userData )
+{
+   TsPsi *psi;
+
+   psi= (TsPsi*)g_malloc0( sizeof(TsPsi) );
+   if ( psi ) {
+      psi->sectionCB= sectionCB;
+      psi->userData= userData;
+      ts_psi_reset( psi );
+   }
+
+   return psi;
+}
+
+void ts_psi_free( TsPsi *psi )
+{
+   if ( psi ) {
+      g_free( psi );
+   }
+}
+
+gboolean ts_psi_add_pid( TsPsi *psi, int pid )
+{
+   TsPsiPid *state;
+
+   if ( (pid < 0) || (pid > 0x1FFF) ) {
+      return FALSE;
+   }
+
+   if ( ts_psi_find_pid( psi, pid ) ) {
+      return TRUE;
+   }
+
+   state= ts_psi_find_pid( psi, -1 );
+   if ( !state ) {
+      return FALSE;
+   }
+
+   ++psi->pidCount;
+   state->pid= pid;
+   ts_psi_reset_pid( state );
+   psi->pidMap[pid>>5] |= (1U<<(pid&0x1F));
+
+   return TRUE;
+}
+
+void ts_psi_remove_pid( TsPsi *psi, int pid )
+{
+   TsPsiPid *state;
+
+   if ( (pid < 0) || (pid > 0x1FFF) ) {
+      return;
+   }
+
+   /* slots are released in place so a section callback may change the
+      PID set while the packet that completed the section is being parsed */
+   state= ts_psi_find_pid( psi, pid );
+   if ( state ) {
+      --psi->pidCount;
+      state->pid= -1;
+      ts_psi_reset_pid( state );
+      psi->pidMap[pid>>5] &= ~(1U<<(pid&0x1F));
+   }
+}
+
+void ts_psi_reset( TsPsi *psi )
+{
+   int i;
+
+   memset( psi->pidMap, 0, sizeof(psi->pidMap) );
+   for( i= 0; i < TS_PSI_MAX_PIDS; ++i ) {
+      psi->pids[i].pid= -1;
+      ts_psi_reset_pid( &psi->pids[i] );
+   }
+   psi->pidCount= 0;
+   psi->sectionCount= 0;
+   psi->crcErrors= 0;
+   psi->continuityErrors= 0;
+}
+
+void ts_psi_push_packet( TsPsi *psi, const unsigned char *packet )
+{
+   TsPsiPid *state;
+   const unsigned char *payload;
+   int pid, afc, cc, payloadLen, pointer, n;
+   gboolean pusi;
+
+   pid= ((packet[1] & 0x1F) << 8) | packet[2];
+   if ( !ts_psi_is_psi_pid( psi, pid ) ) {
+      return;
+   }
+   state= ts_psi_find_pid( psi, pid );
+   if ( !state ) {
+      return;
+   }
+
+   pusi= (packet[1] & 0x40) ? TRUE : FALSE;
+   afc= (packet[3] >> 4) & 0x03;
+   cc= packet[3] & 0x0F;
+
+   if ( !(afc & 0x01) ) {
+      return;
+   }
+
+   payload= packet + 4;
+   payloadLen= TS_PACKET_SIZE - 4;
+   if ( afc & 0x02 ) {
+      payload += 1 + packet[4];
+      payloadLen -= 1 + packet[4];
+   }
+   if ( payloadLen <= 0 ) {
+      return;
+   }
+
+   if ( state->continuity >= 0 ) {
+      if ( cc == state->continuity ) {
+         /* duplicate packet */
+         return;
+      }
+      if ( cc != ((state->continuity + 1) & 0x0F) ) {
+         ++psi->continuityErrors;
+         state->collecting= FALSE;
+         state->sectionLen= 0;
+      }
+   }
+   state->continuity= cc;
+
+   if ( pusi ) {
+      pointer= payload[0];
+      ++payload;
+      --payloadLen;
+      if ( pointer > payloadLen ) {
+         state->collecting= FALSE;
+         state->sectionLen= 0;
+         return;
+      }
+      if ( state->collecting ) {
+         ts_psi_append( psi, state, payload, pointer );
+      }
+      state->collecting= FALSE;
+      state->sectionLen= 0;
+      payload += pointer;
+      payloadLen -= pointer;
+
+      /* one or more sections start here, 0xFF is stuffing */
+      while( (payloadLen > 0) && (payload[0] != 0xFF) ) {
+         state->collecting= TRUE;
+         n= ts_psi_append( psi, state, payload, payloadLen );
+         payload += n;
+         payloadLen -= n;
+         if ( state->collecting || (state->pid != pid) ) {
+            break;
+         }
+      }
+   } else if ( state->collecting ) {
+      ts_psi_append( psi, state, payload, payloadLen );
+   }
+}
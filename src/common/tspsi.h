@@ -0,0 +1,92 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * MPEG-2 transport stream section assembler shared by dtcpenc, which
+ * rewrites the PAT and PMT, and rbifilter, which reads SCTE-35
+ * splice_info_sections.
+ */
+
+#ifndef __TS_PSI_H__
+#define __TS_PSI_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define TS_PSI_MAX_PIDS (8)
+/* PAT and PMT sections are at most 1024 bytes, private sections such as
+   splice_info_section up to 4096 */
+#define TS_PSI_SECTION_MAX (1024)
+#define TS_PSI_PRIVATE_SECTION_MAX (4096)
+
+/**
+ * Called for every complete section. Sections with section_syntax_indicator
+ * set are only passed on when their CRC_32 checks out; for the others the
+ * callback checks any CRC itself. section points to table_id and len
+ * includes the CRC_32
+*/
+typedef void (*TsPsiSectionCB)( void *userData, int pid, const unsigned char *section, int len );
+
+typedef struct _TsPsiPid
+{
+   int pid;
+   int continuity;
+   gboolean collecting;
+   int sectionLen;
+   int sectionTotal;
+   unsigned char section[TS_PSI_PRIVATE_SECTION_MAX];
+} TsPsiPid;
+
+/**
+ * Streaming PSI section assembler. Sections may span any number of TS
+ * packets and a packet may carry several sections. Only PIDs added with
+ * ts_psi_add_pid are assembled; everything else is rejected by a PID
+ * bitmap lookup so callers can test each packet with ts_psi_is_psi_pid
+ * before doing any further work on it
+*/
+typedef struct _TsPsi
+{
+   guint32 pidMap[8192/32];
+   int pidCount;
+   TsPsiPid pids[TS_PSI_MAX_PIDS];
+   TsPsiSectionCB sectionCB;
+   void *userData;
+   guint64 sectionCount;
+   guint64 crcErrors;
+   guint64 continuityErrors;
+} TsPsi;
+
+#define ts_psi_is_psi_pid( psi, pid ) ((psi)->pidMap[(pid)>>5] & (1U<<((pid)&0x1F)))
+
+TsPsi* ts_psi_new( TsPsiSectionCB sectionCB, void *userData );
+void ts_psi_free( TsPsi *psi );
+gboolean ts_psi_add_pid( TsPsi *psi, int pid );
+void ts_psi_remove_pid( TsPsi *psi, int pid );
+void ts_psi_reset( TsPsi *psi );
+
+/**
+ * Feed one 188 byte TS packet (no timestamp prefix). Packets on PIDs that
+ * are not registered are ignored
+*/
+void ts_psi_push_packet( TsPsi *psi, const unsigned char *packet );
+
+G_END_DECLS
+
+#endif /* __TS_PSI_H__ */
@@ -52,6 +52,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "gstdtcpenc.h"
+#include "crc32mpeg.h"
 #include "safec_lib.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_dtcp_enc_debug);
@@ -61,60 +62,6 @@ GST_DEBUG_CATEGORY_STATIC (gst_dtcp_enc_debug);
 #define TTS_PACKET_SIZE (192)
 #define MAX_PIDS (8)
 
-static unsigned int packet_count;
-static GMutex* packet_count_mutex;
-
-static unsigned long crc32_table[256];
-static int crc32_initialized = 0;
-
-static void init_crc32()
-{
-	if(crc32_initialized) return;
-	unsigned int k, i, j;
-	for(i = 0; i < 256; i++)
-	{
-		k = 0;
-		for(j = (i << 24) | 0x800000; j != 0x80000000; j <<= 1)
-		{
-			k = (k << 1) ^ (((k ^ j) & 0x80000000) ? 0x04c11db7 : 0);
-		}
-		crc32_table[i] = k;
-	}
-	crc32_initialized = 1;
-}
-
-static unsigned long get_crc32(unsigned char *data, int size, int initial )
-{
-	int i;
-	unsigned long int result = initial;
-	init_crc32();
-	for(i = 0; i < size; i++)
-	{
-		result = (result << 8) ^ crc32_table[(result >> 24) ^ data[i]];
-	}
-	return result;
-}
-
-static void putPmtByte( GstDtcpEnc * filter, unsigned char* pmt, int* index, unsigned char byte, int pmtPid )
-{
-   int ttsSize = 0;
-   if(filter->tspacketsize == TTS_PACKET_SIZE)
-   	  ttsSize = 4;
-
-   pmt[(*index)++]= byte;
-   if ( (*index) > (filter->tspacketsize-1) )
-   {
-      GST_INFO_OBJECT(filter, "putPmtByte :: pmt data exceeded %d bytes (index-%d) so continuing with sencond ts packet...\n", filter->tspacketsize, *index);
-      pmt += filter->tspacketsize;
-      pmt[0+ttsSize]= 0x47;
-      pmt[1+ttsSize]= 0x20;
-      pmt[1+ttsSize]= (unsigned char) ((pmtPid >> 8) & 0x1F);
-      pmt[2+ttsSize]= (unsigned char) (0xFF & pmtPid);
-      pmt[3+ttsSize]= 0x10;  // 2 bits Scrambling = no; 2 bits adaptation field = no adaptation; 4 bits continuity counter
-      (*index) += filter->tspacketsize+ttsSize+4;
-   }
-}
-
 static void dumpPacket( GstDtcpEnc * filter, unsigned char *packet )
 {
    int i;
@@ -196,9 +143,20 @@ enum
   PROP_BUFFER_SIZE,
   PROP_REMOTE_IP,
   PROP_KEY_LABEL,
-  PROP_RESET
+  PROP_RESET,
+  PROP_INSERT_DTCP_DESC,
+  PROP_PACKETS_IN_FLIGHT,
+  PROP_PACKETS_PROCESSED,
+  PROP_BYTES_PROCESSED,
+  PROP_THREADS
 };
 
+#define DEFAULT_INSERT_DTCP_DESC (FALSE)
+#define DEFAULT_THREADS (0)
+
+/* Buffers that must start their own PCP before encrypting in parallel */
+#define DTCP_ENC_PARALLEL_PROBE (2)
+
 /* the capabilities of the inputs and outputs.
  *
  * describe the real formats here.
@@ -257,10 +215,19 @@ static gboolean gst_dtcp_enc_generate_pmt( GstDtcpEnc *filter,
                                               int dataComponentCount, int *dataPids, int *dataTypes );
                                               
 static gboolean gst_dtcp_enc_examine_buffer( GstDtcpEnc *filter, GstBuffer *buf );
+static void gst_dtcp_enc_psi_section( void *userData, int pid, const unsigned char *section, int len );
+static void gst_dtcp_enc_reset_psi( GstDtcpEnc *filter );
+static void gst_dtcp_enc_finalize (GObject * object);
+static GstFlowReturn gst_dtcp_enc_drain( GstDtcpEnc *filter, gboolean discard );
+static void gst_dtcp_enc_reset_workers( GstDtcpEnc *filter );
+static void gst_dtcp_enc_start_workers( GstDtcpEnc *filter );
+static void gst_dtcp_enc_stop_workers( GstDtcpEnc *filter );
 #ifdef USE_GST1
 static GstFlowReturn gst_dtcp_enc_chain (GstPad * pad, GstObject *parent, GstBuffer * buf);
+static gboolean gst_dtcp_enc_sink_event (GstPad * pad, GstObject * parent, GstEvent * event);
 #else
 static GstFlowReturn gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf);
+static gboolean gst_dtcp_enc_sink_event (GstPad * pad, GstEvent * event);
 
 #endif
 
@@ -294,9 +261,16 @@ gst_dtcp_enc_change_state (GstElement * element, GstStateChange transition)
             }
             GST_DEBUG_OBJECT(filter, "%s:: filter->pDtcpSession = %lu", __FUNCTION__, filter->pDtcpSession);  //CID:28136 - Print args
             filter->tspacketsize=0;
-            g_mutex_lock (packet_count_mutex);
-            packet_count = 0;
-            g_mutex_unlock (packet_count_mutex);
+            gst_dtcp_enc_reset_psi( filter );
+#ifdef USE_GST1
+            gst_buffer_pool_set_active( filter->headerPool, TRUE );
+            gst_buffer_pool_set_active( filter->wrapPool, TRUE );
+#endif
+            gst_dtcp_enc_start_workers( filter );
+            g_atomic_int_set (&filter->packetsProcessed, 0);
+            GST_OBJECT_LOCK (filter);
+            filter->bytesProcessed = 0;
+            GST_OBJECT_UNLOCK (filter);
             filter->isFirstPacket = TRUE;
         }   //CID:18753 - Forward null
 
@@ -342,11 +316,26 @@ gst_dtcp_enc_change_state (GstElement * element, GstStateChange transition)
   
     case GST_STATE_CHANGE_PAUSED_TO_READY:
 //         GST_INFO_OBJECT(element, "GST_STATE_CHANGE_PAUSED_TO_READY\n");
+      /* streaming has stopped, drop whatever the workers still hold */
+      if(NULL != filter)
+      {
+          if (filter->workers)
+          {
+              gst_dtcp_enc_drain (filter, TRUE);
+          }
+          /* the next stream is probed afresh, it may come from another source */
+          gst_dtcp_enc_reset_workers (filter);
+      }
       break;
   
     case GST_STATE_CHANGE_READY_TO_NULL:
          GST_DEBUG_OBJECT(element, "GST_STATE_CHANGE_READY_TO_NULL:: destroying DTCP Stream and DTCPSession\n");
 
+	 if(NULL != filter)
+	 {
+	     gst_dtcp_enc_stop_workers (filter);
+	 }
+
   	 if(NULL != filter && 0 != filter->pDtcpSession)
   	 {
   	     GST_INFO_OBJECT(element, "destroying DTCPSession\n");
@@ -356,9 +345,19 @@ gst_dtcp_enc_change_state (GstElement * element, GstStateChange transition)
 		 }
 	     filter->pDtcpSession = 0;
 	  }
-	 g_mutex_lock (packet_count_mutex);
-	 g_print ("dtcpenc:: packet count = %d\n", packet_count);
-	 g_mutex_unlock (packet_count_mutex);
+#ifdef USE_GST1
+	 if(NULL != filter)
+	 {
+	     gst_buffer_pool_set_active( filter->headerPool, FALSE );
+	     gst_buffer_pool_set_active( filter->wrapPool, FALSE );
+	 }
+#endif
+	 if(NULL != filter)
+	 {
+	     g_print ("dtcpenc:: packet count = %u processed = %u\n",
+	              dtcp_packet_pool_get_outstanding (filter->packetPool),
+	              (guint) g_atomic_int_get (&filter->packetsProcessed));
+	 }
       break;
   
     default:
@@ -414,6 +413,7 @@ gst_dtcp_enc_class_init (GstDtcpEncClass * klass)
 
   gobject_class->set_property = gst_dtcp_enc_set_property;
   gobject_class->get_property = gst_dtcp_enc_get_property;
+  gobject_class->finalize = gst_dtcp_enc_finalize;
   gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_dtcp_enc_change_state);
 
   g_object_class_install_property (gobject_class, PROP_SILENT,
@@ -444,6 +444,27 @@ gst_dtcp_enc_class_init (GstDtcpEncClass * klass)
       g_param_spec_boolean ("reset", "Reset", "Reset the dtcp session to clean up residue data default:FALSE",
           FALSE, (GParamFlags)G_PARAM_WRITABLE));
 
+  g_object_class_install_property (gobject_class, PROP_INSERT_DTCP_DESC,
+      g_param_spec_boolean ("insert-dtcp-desc", "Insert DTCP Desc", "Insert the DTCP descriptor into the PMT of QAM source streams Default:FALSE",
+          DEFAULT_INSERT_DTCP_DESC, (GParamFlags)G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_PACKETS_IN_FLIGHT,
+      g_param_spec_uint ("packets-in-flight", "Packets In Flight", "Encrypted buffers pushed downstream and not yet released",
+          0, G_MAXUINT, 0, (GParamFlags)G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_PACKETS_PROCESSED,
+      g_param_spec_uint ("packets-processed", "Packets Processed", "Buffers encrypted since the element left NULL state",
+          0, G_MAXUINT, 0, (GParamFlags)G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_BYTES_PROCESSED,
+      g_param_spec_uint64 ("bytes-processed", "Bytes Processed", "Bytes encrypted since the element left NULL state",
+          0, G_MAXUINT64, 0, (GParamFlags)G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_uint ("threads", "Threads", "Worker threads encrypting in parallel when the DTCP manager starts a PCP per buffer, 0: streaming thread. "
+          "More than 1 needs a build with --enable-dtcpmgr-reentrant, otherwise 1 is used. Applied when leaving NULL state Default:0",
+          0, DTCP_ENC_MAX_THREADS, DEFAULT_THREADS, (GParamFlags)G_PARAM_READWRITE));
+
 #ifdef USE_GST1
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&src_factory));
@@ -455,9 +476,6 @@ gst_dtcp_enc_class_init (GstDtcpEncClass * klass)
       "Accepts and forwards mpegts data applying optional DTCP encryption",
       "Comcast");
 #endif
-  packet_count_mutex = g_mutex_new();
-
-  init_crc32();
 }
 
 /* initialize the new element
@@ -473,7 +491,7 @@ gst_dtcp_enc_init (GstDtcpEnc * filter,
     GstDtcpEncClass * gclass)
 #endif
 {
-  GST_INFO_OBJECT(filter, "%s:: filter=%p packet_count_mutex=%p\n", __FUNCTION__, filter, packet_count_mutex);
+  GST_INFO_OBJECT(filter, "%s:: filter=%p\n", __FUNCTION__, filter);
 
   filter->sinkpad = gst_pad_new_from_static_template (&sink_factory, "sink");
 #ifndef USE_GST1
@@ -484,6 +502,8 @@ gst_dtcp_enc_init (GstDtcpEnc * filter,
 #endif
   gst_pad_set_chain_function (filter->sinkpad,
                               GST_DEBUG_FUNCPTR(gst_dtcp_enc_chain));
+  gst_pad_set_event_function (filter->sinkpad,
+                              GST_DEBUG_FUNCPTR(gst_dtcp_enc_sink_event));
 
   filter->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
 #ifdef USE_GST1
@@ -509,14 +529,79 @@ gst_dtcp_enc_init (GstDtcpEnc * filter,
       ERR_CHK(rc);
       return;
   }
-  filter->havePAT= FALSE;
-  filter->havePMT= FALSE;
-  filter->haveNewPMT= FALSE;
-  filter->newPMTSize= 0;
-  filter->program= -1;
-  filter->pmtPid= -1;
-  filter->pcrPid= -1;
+  filter->insertDtcpDesc= DEFAULT_INSERT_DTCP_DESC;
+  filter->psi= ts_psi_new( gst_dtcp_enc_psi_section, filter );
+  gst_dtcp_enc_reset_psi( filter );
   filter->tspacketsize= 0;
+
+  filter->packetPool= dtcp_packet_pool_new( DTCP_PACKET_POOL_MAX_FREE );
+
+  filter->threads= DEFAULT_THREADS;
+  filter->workers= NULL;
+  filter->parallel= FALSE;
+  filter->jobWindow= 1;
+  #ifdef GLIB_VERSION_2_32
+  g_mutex_init( &filter->jobLock );
+  g_cond_init( &filter->jobCond );
+  #else
+  filter->jobLock= g_mutex_new();
+  filter->jobCond= g_cond_new();
+  #endif
+#ifdef USE_GST1
+  {
+    GstStructure *config;
+
+    filter->headerPool= gst_buffer_pool_new();
+    config= gst_buffer_pool_get_config( filter->headerPool );
+    gst_buffer_pool_config_set_params( config, NULL, DTCP_PCP_HEADER_MAX, 0, 0 );
+    gst_buffer_pool_set_config( filter->headerPool, config );
+
+    filter->wrapPool= gst_dtcp_enc_wrap_pool_new();
+  }
+#endif
+}
+
+static void
+gst_dtcp_enc_finalize (GObject * object)
+{
+  GstDtcpEnc *filter = GST_DTCPENC (object);
+
+  if ( filter->psi )
+  {
+    ts_psi_free( filter->psi );
+    filter->psi= NULL;
+  }
+
+#ifdef USE_GST1
+  if ( filter->headerPool )
+  {
+    gst_object_unref( filter->headerPool );
+    filter->headerPool= NULL;
+  }
+  if ( filter->wrapPool )
+  {
+    gst_object_unref( filter->wrapPool );
+    filter->wrapPool= NULL;
+  }
+#endif
+
+  gst_dtcp_enc_stop_workers( filter );
+  #ifdef GLIB_VERSION_2_32
+  g_mutex_clear( &filter->jobLock );
+  g_cond_clear( &filter->jobCond );
+  #else
+  g_mutex_free( filter->jobLock );
+  g_cond_free( filter->jobCond );
+  #endif
+
+  /* packets still held downstream keep the pool alive until released */
+  if ( filter->packetPool )
+  {
+    dtcp_packet_pool_unref( filter->packetPool );
+    filter->packetPool= NULL;
+  }
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static unsigned char gst_dtcp_enc_get_emi(unsigned char cci)
@@ -584,6 +669,12 @@ gst_dtcp_enc_set_property (GObject * object, guint prop_id,
       filter->exchange_key_label = g_value_get_uint (value);
 	  g_print("%s:: exchange_key_label = %x\n", __FUNCTION__, filter->exchange_key_label);
       break;
+    case PROP_INSERT_DTCP_DESC:
+      filter->insertDtcpDesc = g_value_get_boolean (value);
+      break;
+    case PROP_THREADS:
+      filter->threads = g_value_get_uint (value);
+      break;
     case PROP_RESET:
 	  GST_INFO_OBJECT(filter, "%s:: RESETTING THE DTCP SESSION TO CLEANUP RESIDUE\n", __FUNCTION__);
   	  GST_INFO_OBJECT(filter, "destroying DTCPSession\n");
@@ -630,6 +721,23 @@ gst_dtcp_enc_get_property (GObject * object, guint prop_id,
     case PROP_KEY_LABEL:
       g_value_set_uint(value, filter->exchange_key_label);
       break;
+    case PROP_INSERT_DTCP_DESC:
+      g_value_set_boolean(value, filter->insertDtcpDesc);
+      break;
+    case PROP_PACKETS_IN_FLIGHT:
+      g_value_set_uint(value, dtcp_packet_pool_get_outstanding (filter->packetPool));
+      break;
+    case PROP_PACKETS_PROCESSED:
+      g_value_set_uint(value, (guint) g_atomic_int_get (&filter->packetsProcessed));
+      break;
+    case PROP_BYTES_PROCESSED:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64(value, filter->bytesProcessed);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_THREADS:
+      g_value_set_uint(value, filter->threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -654,592 +762,1256 @@ gst_dtcp_enc_set_caps (GstPad * pad, GstCaps * caps)
 }
 #endif
 
-static gboolean gst_dtcp_enc_generate_pmt( GstDtcpEnc *filter, 
-                                              int videoComponentCount, int *videoPids, int *videoTypes,
-                                              int audioComponentCount, int *audioPids, int *audioTypes, char **audioLanguages,
-                                              int dataComponentCount, int *dataPids, int *dataTypes )
+/* Write the 6 byte DTCP_descriptor for cci at desc */
+static void gst_dtcp_enc_put_dtcp_descriptor( GstDtcpEnc *filter, unsigned char *desc, unsigned char cci )
+{
+   unsigned char aps = ((unsigned char)(cci & 0x20)) >> 5;
+   unsigned char epn = !((unsigned char)(cci & 0x03)) & (aps & 0x01);
+   unsigned char ict = (unsigned char)(cci & 0x10);
+
+   if(epn)
+	  filter->EMI = 0x0A; //Copy One Generation
+
+   desc[0] = 0x88; //descriptor_tag
+   desc[1] = 0x04; //descriptor_length
+   desc[2] = 0x0f; //upper 8 bits of CA_System_ID
+   desc[3] = 0xff; //lower 8 bits of CA_System_ID
+
+   desc[4] = 0xC0; //descriptor id(1 bit-1), retention_move_mode(1 bit-1), retention state(3 bits- 000)
+   if(epn)
+      desc[4] |= 0x04; //EPN(1 bit)
+   desc[4] |= (unsigned char)(cci & 0x03); //dtcp_cci (2 bits)
+
+   desc[5] = 0xF8; //reserved (3 bits-111), DOT(1 bit-1), AST(1 bit-1)
+   if(ict)
+      desc[5] |= 0x04; //Image_Constraint_Token (1)
+   desc[5] |= (unsigned char)(cci>>2 & 0x03); //APS(2)
+}
+
+/* Split the generated PMT section into TS packets in newPMT, laid out at
+ * the stream's packet size so a spliced packet is a single memcpy */
+static gboolean gst_dtcp_enc_packetize_pmt( GstDtcpEnc *filter )
 {
-   gboolean result= TRUE;
-   int i, pi, temp, pmtSize, dtcpDescSize;
-   int pmtPacketCount, pmtSectionLen, pmtPid;
-   unsigned char *crcData;
-   int crc, crcLenTotal, crcLen;
-   unsigned char byte;
-   unsigned char *pmtPacket;
-   errno_t rc = -1;
-   
-   pmtPid= filter->pmtPid;
-   unsigned char cci = filter->cci;
-   GST_INFO_OBJECT( filter, "CCI of the program is %X\n", cci);
    int ttsSize = 0;
    int ts_packet_size = filter->tspacketsize;
+   int offset, avail, packetCount;
+   unsigned char *pmtPacket, *payload;
+
    if(filter->tspacketsize == TTS_PACKET_SIZE)
    {
 	  ttsSize = 4;
    }
-   
+
+   // pointer_field plus section, 184 bytes of payload per packet
+   packetCount= (1 + filter->pmtSectionSize + (PACKET_SIZE-4) - 1) / (PACKET_SIZE-4);
+   if ( packetCount*ts_packet_size > MAX_PACKET_SIZE )
+   {
+      GST_ERROR_OBJECT(filter, "%s:: pmt requires more than 3 TS packets\n",__FUNCTION__);
+      return FALSE;
+   }
+
+   memset( filter->newPMT, 0xFF, MAX_PACKET_SIZE );
+   offset= 0;
+   pmtPacket= filter->newPMT;
+   while( offset < filter->pmtSectionSize )
+   {
+      if ( ttsSize )
+      {
+         memset( pmtPacket, 0, ttsSize );
+      }
+      pmtPacket[0+ttsSize]= 0x47;
+      pmtPacket[1+ttsSize]= ((offset == 0) ? 0x60 : 0x20);
+      pmtPacket[1+ttsSize] |= (unsigned char) ((filter->pmtPid >> 8) & 0x1F);
+      pmtPacket[2+ttsSize]= (unsigned char) (0xFF & filter->pmtPid);
+      pmtPacket[3+ttsSize]= 0x10; // 2 bits Scrambling = no; 2 bits adaptation field = no adaptation; 4 bits continuity counter
+
+      payload= pmtPacket+ttsSize+4;
+      avail= PACKET_SIZE-4;
+      if ( offset == 0 )
+      {
+         *(payload++)= 0x00; // pointer_field
+         --avail;
+      }
+      avail= MIN( avail, filter->pmtSectionSize-offset );
+      memcpy( payload, filter->pmtSection+offset, avail );
+      offset += avail;
+      pmtPacket += ts_packet_size;
+   }
+
+   filter->newPMTPacketCount= packetCount;
+   filter->newPMTSize= packetCount*ts_packet_size;
+   filter->newPMTVersion= filter->versionPMT;
+   filter->newPMTCci= filter->cci;
+   filter->newPMTPacketSize= ts_packet_size;
+   filter->pmtSpliceWarned= FALSE;
+
+   dumpPackets( filter, filter->newPMT, filter->newPMTSize );
+
+   return TRUE;
+}
+
+/* Bring the cached PMT packets up to date with the current CCI and packet
+ * size. Only the DTCP descriptor and CRC_32 depend on the CCI, so the
+ * section is patched in place rather than rebuilt */
+static gboolean gst_dtcp_enc_update_pmt( GstDtcpEnc *filter )
+{
+   unsigned char cci = filter->cci;
+   int crcOffset;
+   guint32 crc;
+
+   if ( (filter->newPMTVersion == filter->versionPMT) &&
+        (filter->newPMTCci == cci) &&
+        (filter->newPMTPacketSize == filter->tspacketsize) )
+   {
+      return TRUE;
+   }
+
+   if ( filter->newPMTCci != cci )
+   {
+      GST_INFO_OBJECT( filter, "CCI of the program changed %X -> %X\n", filter->newPMTCci, cci);
+      gst_dtcp_enc_put_dtcp_descriptor( filter, &filter->pmtSection[12], cci );
+      crcOffset= filter->pmtSectionSize-4;
+      crc= crc32_mpeg( filter->pmtSection, crcOffset );
+      filter->pmtSection[crcOffset+0]= ((crc >> 24) & 0xFF);
+      filter->pmtSection[crcOffset+1]= ((crc >> 16) & 0xFF);
+      filter->pmtSection[crcOffset+2]= ((crc >> 8) & 0xFF);
+      filter->pmtSection[crcOffset+3]= (crc & 0xFF);
+   }
+
+   return gst_dtcp_enc_packetize_pmt( filter );
+}
+
+static gboolean gst_dtcp_enc_generate_pmt( GstDtcpEnc *filter, 
+                                              int videoComponentCount, int *videoPids, int *videoTypes,
+                                              int audioComponentCount, int *audioPids, int *audioTypes, char **audioLanguages,
+                                              int dataComponentCount, int *dataPids, int *dataTypes )
+{
+   int i, pi, temp, dtcpDescSize, pmtSectionLen;
+   unsigned char *pmt= filter->pmtSection;
+   guint32 crc;
+
+   unsigned char cci = filter->cci;
+   GST_INFO_OBJECT( filter, "CCI of the program is %X\n", cci);
+
    dtcpDescSize= 6;
 
-   pmtSize = ttsSize;
-   pmtSize += 17;
-   pmtSize += dtcpDescSize;
-   pmtSize += videoComponentCount*5;
+   // fixed header, DTCP descriptor and CRC_32, then 5 bytes per component plus any language descriptor
+   pmtSectionLen= 12 + dtcpDescSize + 4;
+   pmtSectionLen += videoComponentCount*5;
    for( i= 0; i < audioComponentCount; ++i )
    {
-      pmtSize += 5;
       int nameLen= audioLanguages[i] ? strlen(audioLanguages[i]) : 0;
+      pmtSectionLen += 5;
       if ( nameLen )
       {
-         pmtSize += (3 + nameLen);
-      }      
+         pmtSectionLen += (3 + nameLen);
+      }
    }
-   pmtSize += dataComponentCount*5;
-   pmtSize += 4; //crc
+   pmtSectionLen += dataComponentCount*5;
 
-   pmtPacketCount= 1;
-   i= pmtSize-(ts_packet_size-17);
-   while( i > 0 )
+   if ( pmtSectionLen > TS_PSI_SECTION_MAX )
    {
-   	  GST_INFO_OBJECT( filter, "%s::%d, pmt exceedes 1 TSPacketSize\n", __FUNCTION__, __LINE__);
-      ++pmtPacketCount;
-      i -= (ts_packet_size-8);
-   }
-   
-   if ( pmtPacketCount > 3 )
-   {
-      GST_ERROR_OBJECT(filter, "%s:: pmt requires more than 3 TS packets\n",__FUNCTION__);
+      GST_ERROR_OBJECT(filter, "%s:: pmt section of %d bytes is too large\n",__FUNCTION__, pmtSectionLen);
       return FALSE;
    }
 
-   pmtPacket= filter->newPMT;
-   
-   pmtPacket[0+ttsSize]= 0x47;
-   pmtPacket[1+ttsSize]= 0x60;
-   pmtPacket[1+ttsSize] |= (unsigned char) ((filter->pmtPid >> 8) & 0x1F);
-   pmtPacket[2+ttsSize]= (unsigned char) (0xFF & filter->pmtPid);
-   pmtPacket[3+ttsSize]= 0x10; // 2 bits Scrambling = no; 2 bits adaptation field = no adaptation; 4 bits continuity counter
-
-   pmtSectionLen= pmtSize-ttsSize-8;
-   pmtPacket[4+ttsSize]= 0x00;
-   pmtPacket[5+ttsSize]= 0x02;
-   pmtPacket[6+ttsSize]= (0xB0 | ((pmtSectionLen>>8)&0xF));
-   pmtPacket[7+ttsSize]= (pmtSectionLen & 0xFF); //lower 8 bits of Section length
-
-   pmtPacket[8+ttsSize]= ((filter->program>>8)&0xFF);
-   pmtPacket[9+ttsSize]= (filter->program&0xFF);
+   pmt[0]= 0x02;
+   pmt[1]= (0xB0 | (((pmtSectionLen-3)>>8)&0xF));
+   pmt[2]= ((pmtSectionLen-3) & 0xFF); //lower 8 bits of Section length
+
+   pmt[3]= ((filter->program>>8)&0xFF);
+   pmt[4]= (filter->program&0xFF);
 
    temp= filter->versionPMT << 1;
    temp= temp & 0x3E; //Masking first 2 bits and last one bit : 0011 1110 (3E)
-   pmtPacket[10+ttsSize]= 0xC1 | temp; //C1 : 1100 0001 : setting reserved bits as 1, current_next_indicator as 1
-
-   pmtPacket[11+ttsSize]= 0x00;
-   pmtPacket[12+ttsSize]= 0x00;
+   pmt[5]= 0xC1 | temp; //C1 : 1100 0001 : setting reserved bits as 1, current_next_indicator as 1
 
-   pmtPacket[13+ttsSize]= 0xE0;
-   pmtPacket[13+ttsSize] |= (unsigned char) ((filter->pcrPid >> 8) & 0x1F);
-   pmtPacket[14+ttsSize]= (unsigned char) (0xFF & filter->pcrPid);
-   pmtPacket[15+ttsSize]= 0xF0;
-   pmtPacket[16+ttsSize]= 0x00; //pgm info length.
+   pmt[6]= 0x00;
+   pmt[7]= 0x00;
 
-   pmtPacket[16+ttsSize]= dtcpDescSize & 0xFF; // Since desc_size is 6(110) only last 4 bits
-   pmtPacket[16+ttsSize]= dtcpDescSize;
+   pmt[8]= 0xE0;
+   pmt[8] |= (unsigned char) ((filter->pcrPid >> 8) & 0x1F);
+   pmt[9]= (unsigned char) (0xFF & filter->pcrPid);
+   pmt[10]= 0xF0;
+   pmt[11]= dtcpDescSize; //pgm info length.
 
    //DTCP_descriptor...
-   pmtPacket[17+ttsSize] = 0x88; //descriptor_tag
-   pmtPacket[18+ttsSize] = 0x04; //descriptor_length
-   pmtPacket[19+ttsSize] = 0x0f; //upper 8 bits of CA_System_ID
-   pmtPacket[20+ttsSize] = 0xff; //lower 8 bits of CA_System_ID
-
-   unsigned char aps = ((unsigned char)(cci & 0x20)) >> 5;
-   unsigned char epn = !((unsigned char)(cci & 0x03)) & (aps & 0x01);
-   unsigned char ict = (unsigned char)(cci & 0x10);
-
-   if(epn)
-	  filter->EMI = 0x0A; //Copy One Generation 
+   gst_dtcp_enc_put_dtcp_descriptor( filter, &pmt[12], cci );
 
-   pmtPacket[21+ttsSize] = 0xC0; //descriptor id(1 bit-1), retention_move_mode(1 bit-1), retention state(3 bits- 000)
-   if(epn)
-   	  pmtPacket[21+ttsSize] |= 0x04; //EPN(1 bit)
-   pmtPacket[21+ttsSize] |= (unsigned char)(cci & 0x03); //dtcp_cci (2 bits)
-
-   pmtPacket[22+ttsSize] = 0xF8; //reserved (3 bits-111), DOT(1 bit-1), AST(1 bit-1)
-   if(ict)
-	  pmtPacket[22+ttsSize] |= 0x04; //Image_Constraint_Token (1)
-   pmtPacket[22+ttsSize] |= (unsigned char)(cci>>2 & 0x03); //APS(2)
-   
-   pi= 23+ttsSize;
+   pi= 12+dtcpDescSize;
    for( i= 0; i < videoComponentCount; ++i )
    {
       int videoPid= videoPids[i];
-      putPmtByte( filter, pmtPacket, &pi, videoTypes[i], pmtPid ); 
-      byte= (0xE0 | (unsigned char) ((videoPid >> 8) & 0x1F));
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid );
-      byte= (unsigned char) (0xFF & videoPid);
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid ); 
-      putPmtByte( filter, pmtPacket, &pi, 0xF0, pmtPid ); 
-      putPmtByte( filter, pmtPacket, &pi, 0x00, pmtPid ); 
+      pmt[pi++]= videoTypes[i];
+      pmt[pi++]= (0xE0 | (unsigned char) ((videoPid >> 8) & 0x1F));
+      pmt[pi++]= (unsigned char) (0xFF & videoPid);
+      pmt[pi++]= 0xF0;
+      pmt[pi++]= 0x00;
    }
    for( i= 0; i < audioComponentCount; ++i )
    {
       int audioPid= audioPids[i];
       int nameLen= audioLanguages[i] ? strlen(audioLanguages[i]) : 0;
-      putPmtByte( filter, pmtPacket, &pi, audioTypes[i], pmtPid ); 
-      byte= (0xE0 | (unsigned char) ((audioPid >> 8) & 0x1F));
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid );
-      byte= (unsigned char) (0xFF & audioPid);
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid ); 
-      putPmtByte( filter, pmtPacket, &pi, 0xF0, pmtPid );
+      pmt[pi++]= audioTypes[i];
+      pmt[pi++]= (0xE0 | (unsigned char) ((audioPid >> 8) & 0x1F));
+      pmt[pi++]= (unsigned char) (0xFF & audioPid);
+      pmt[pi++]= 0xF0;
       if ( nameLen )
       {
-         putPmtByte( filter, pmtPacket, &pi, (3+nameLen), pmtPid ); 
-         putPmtByte( filter, pmtPacket, &pi, 0x0A, pmtPid );
-         putPmtByte( filter, pmtPacket, &pi, (1+nameLen), pmtPid ); 
-		 int j;
-         for( j= 0; j < nameLen; ++j )
-         {
-            putPmtByte( filter, pmtPacket, &pi, audioLanguages[i][j], pmtPid );
-         } 
+         pmt[pi++]= (3+nameLen);
+         pmt[pi++]= 0x0A;
+         pmt[pi++]= (1+nameLen);
+         memcpy( &pmt[pi], audioLanguages[i], nameLen );
+         pi += nameLen;
       }
-      putPmtByte( filter, pmtPacket, &pi, 0x00, pmtPid ); 
+      pmt[pi++]= 0x00;
    }
    for( i= 0; i < dataComponentCount; ++i )
    {
       int dataPid= dataPids[i];
-      putPmtByte( filter, pmtPacket, &pi, dataTypes[i], pmtPid ); 
-      byte= (0xE0 | (unsigned char) ((dataPid >> 8) & 0x1F));
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid );
-      byte= (unsigned char) (0xFF & dataPid);
-      putPmtByte( filter, pmtPacket, &pi, byte, pmtPid ); 
-      putPmtByte( filter, pmtPacket, &pi, 0xF0, pmtPid ); 
-      putPmtByte( filter, pmtPacket, &pi, 0x00, pmtPid ); 
+      pmt[pi++]= dataTypes[i];
+      pmt[pi++]= (0xE0 | (unsigned char) ((dataPid >> 8) & 0x1F));
+      pmt[pi++]= (unsigned char) (0xFF & dataPid);
+      pmt[pi++]= 0xF0;
+      pmt[pi++]= 0x00;
    }
 
    // Calculate crc
-   crcData= &pmtPacket[5+ttsSize];
-   crcLenTotal= pmtSize-ttsSize-5-4;
-   crcLen= ((crcLenTotal > (ts_packet_size-ttsSize-5)) ? (ts_packet_size-ttsSize-5) : crcLenTotal);
-   crc= 0xffffffff;
-   while( crcLenTotal )
+   crc= crc32_mpeg( pmt, pi );
+   pmt[pi++]= ((crc >> 24) & 0xFF);
+   pmt[pi++]= ((crc >> 16) & 0xFF);
+   pmt[pi++]= ((crc >> 8) & 0xFF);
+   pmt[pi++]= (crc & 0xFF);
+
+   filter->pmtSectionSize= pi;
+
+   return gst_dtcp_enc_packetize_pmt( filter );
+}
+
+static void gst_dtcp_enc_parse_pat( GstDtcpEnc *filter, const unsigned char *section, int len )
+{
+   const unsigned char *entry, *entryEnd;
+   int version, current, program, pmtPid;
+
+   version= section[5];
+   current= (version & 0x01);
+   version= ((version >> 1)&0x1F);
+
+   if ( !current || (filter->havePAT && (version == filter->versionPAT)) )
    {
-      crc= get_crc32( crcData, crcLen, crc);
-      crcData += crcLen;
-	  crcLen = crcLenTotal - crcLen;
-      crcLenTotal = crcLen;
+      return;
    }
-   putPmtByte( filter, pmtPacket, &pi, ((crc >> 24) & 0xFF), pmtPid );
-   putPmtByte( filter, pmtPacket, &pi, ((crc >> 16) & 0xFF), pmtPid );
-   putPmtByte( filter, pmtPacket, &pi, ((crc >> 8) & 0xFF), pmtPid );
-   putPmtByte( filter, pmtPacket, &pi, (crc & 0xFF), pmtPid );
-   
-   // Fill stuffing bytes for rest of TS packet
-   rc = memset_s( pmtPacket+pi, MAX_PACKET_SIZE-pi, 0xFF, MAX_PACKET_SIZE-pi );
-   ERR_CHK(rc);
-
-   filter->newPMTSize= pmtSize;
-
-   dumpPackets( filter, filter->newPMT, pmtSize);
-            
-   return result;
-}                                              
 
-static gboolean gst_dtcp_enc_examine_buffer( GstDtcpEnc *filter, GstBuffer *buf )
-{
-   gboolean result= TRUE;
-   int size = 0;
-   unsigned char *packet = NULL, *bufferEnd = NULL;
-   int pid = 0, payloadStart = 0, adaptation = 0;
-   int packetCount= 0;
-   int ttsSize = 0;
-   int ts_packet_size = filter->tspacketsize;
-   errno_t rc = -1;
-#ifdef USE_GST1
-   GstMapInfo map =  {0};
-#endif
+   program= -1;
+   pmtPid= -1;
+   entry= &section[8];
+   entryEnd= section+len-4;
+   while ( entry+4 <= entryEnd )
+   {
+      int entryProgram= ((entry[0]<<8)+entry[1]);
+      int entryPid= (((entry[2]&0x1F)<<8)+entry[3]);
+      // program 0 carries the network pid, prefer the program already being protected
+      if ( entryProgram != 0 )
+      {
+         if ( (program == -1) || (entryProgram == filter->program) )
+         {
+            program= entryProgram;
+            pmtPid= entryPid;
+         }
+      }
+      entry += 4;
+   }
 
-   if(filter->tspacketsize == TTS_PACKET_SIZE)
+   filter->havePAT= TRUE;
+   filter->versionPAT= version;
+
+   if ( (program <= 0) || (pmtPid <= 0) )
    {
-	  ttsSize = 4;
+      GST_WARNING_OBJECT( filter, "%s:: ignoring PAT version %d with no usable program", __FUNCTION__, version );
+      return;
    }
 
-#ifdef USE_GST1
-   gst_buffer_map (buf, &map, GST_MAP_READWRITE);
+   GST_INFO_OBJECT( filter, "got PAT: program %X pmtPid %X\n", program, pmtPid );
+   if ( (program != filter->program) || (pmtPid != filter->pmtPid) )
+   {
+      if ( filter->havePMT )
+      {
+         GST_INFO_OBJECT( filter, "%s:: pmt change detected in pat", __FUNCTION__ );
+      }
+      if ( filter->pmtPid > 0 )
+      {
+         ts_psi_remove_pid( filter->psi, filter->pmtPid );
+      }
+      filter->program= program;
+      filter->pmtPid= pmtPid;
+      filter->havePMT= FALSE;
+      filter->haveNewPMT= FALSE;
+      filter->pmtPacketIndex= -1;
+      ts_psi_add_pid( filter->psi, pmtPid );
+   }
+   GST_DEBUG_OBJECT( filter, "%s:: acquired PAT version %d program %X pmt pid %X",
+                     __FUNCTION__, version, filter->program, filter->pmtPid );
+}
 
-   size = map.size;
-   packet = map.data;
-#else
-   size = GST_BUFFER_SIZE (buf);   
-   packet= GST_BUFFER_DATA (buf);
-#endif
+static void gst_dtcp_enc_parse_pmt( GstDtcpEnc *filter, const unsigned char *section, int len )
+{
+   const unsigned char *programInfo, *programInfoEnd;
+   int videoComponentCount, audioComponentCount, dataComponentCount;
+   int videoPids[MAX_PIDS], audioPids[MAX_PIDS], dataPids[MAX_PIDS];
+   int videoTypes[MAX_PIDS], audioTypes[MAX_PIDS], dataTypes[MAX_PIDS];
+   char* audioLanguages[MAX_PIDS];
+   int program, version, current, pcrPid, infoLength;
+   int streamType, pid, esLen, i;
+   gboolean result;
+
+   program= ((section[3]<<8)+section[4]);
+   if ( program != filter->program )
+   {
+      GST_WARNING_OBJECT( filter, "%s:: Warning: ignoring pmt with mismatched program of %x (expecting %x)",
+                          __FUNCTION__, program, filter->program );
+      return;
+   }
 
-   if (NULL == packet)
+   version= section[5];
+   current= (version & 0x01);
+   version= ((version >> 1)&0x1F);
+
+   if ( !current || (filter->havePMT && (version == filter->versionPMT)) )
    {
-      GST_ERROR_OBJECT(filter, "%s:: Packet is NULL \n",__FUNCTION__);
-#ifdef USE_GST1
-    gst_buffer_unmap (buf, &map);
-#endif
-	  return FALSE;
+      return;
    }
-   
-   // For the moment, insist on buffers being TS packet aligned
-   if ( !((packet[0+ttsSize] == 0x47) && ((size%ts_packet_size) == 0)) )
+
+   if ( filter->havePMT )
    {
-      GST_ERROR_OBJECT(filter, "%s:: data buffer not TS packet aligned tspacketsize = %d\n",__FUNCTION__, ts_packet_size);
-#ifdef USE_GST1
-    gst_buffer_unmap (buf, &map);
-#endif
-      //assert( false );
-	  return FALSE;
+      GST_INFO_OBJECT( filter, "%s:: pmt change detected: version %d -> %d", __FUNCTION__, filter->versionPMT, version );
    }
+   filter->havePMT= FALSE;
+   filter->haveNewPMT= FALSE;
 
-   bufferEnd= packet+size;
-   while( packet < bufferEnd )
+   pcrPid= (((section[8]&0x1F)<<8)+section[9]);
+   infoLength= (((section[10]&0x0F)<<8)+section[11]);
+
+   videoComponentCount= audioComponentCount= dataComponentCount= 0;
+   programInfo= &section[12+infoLength];
+   programInfoEnd= section+len-4;
+   while ( programInfo+5 <= programInfoEnd )
    {
-      pid= (((packet[1+ttsSize] << 8) | packet[2+ttsSize]) & 0x1FFF);
-      
-      if ( pid == 0 )
+      streamType= programInfo[0];
+      pid= (((programInfo[1]&0x1F)<<8)+programInfo[2]);
+      esLen= (((programInfo[3]&0x0F)<<8)+programInfo[4]);
+      if ( programInfo+5+esLen > programInfoEnd )
       {
-         payloadStart= (packet[1+ttsSize] & 0x40);
-
-         if ( payloadStart )
-         {
-            adaptation= ((packet[3+ttsSize] & 0x30)>>4);
-            if ( adaptation == 0x01 )
+         GST_WARNING_OBJECT( filter, "%s:: pmt es info for pid %X overruns the section", __FUNCTION__, pid );
+         break;
+      }
+      switch( streamType )
+      {
+         case 0x02: // MPEG2 Video
+         case 0x80: // ATSC Video
+            if ( videoComponentCount < MAX_PIDS )
             {
-               int tableid= packet[5+ttsSize];
-               if ( tableid == 0x00 )
-               {
-                  int version= packet[10+ttsSize];
-                  int current= (version & 0x01);
-                  version= ((version >> 1)&0x1F);
-                  
-                  if ( !filter->havePAT || (current && (version != filter->versionPAT)) )
-                  {
-                     dumpPacket( filter, packet );
-                     int length= ((packet[6+ttsSize]&0x0F)<<8)+(packet[7+ttsSize]);
-                     if ( length == 13 )
-                     {
-                        filter->havePAT= TRUE;
-                        filter->versionPAT= version;
-                        filter->program= ((packet[13+ttsSize]<<8)+packet[14+ttsSize]);
-                        filter->pmtPid= (((packet[15+ttsSize]&0x1F)<<8)+packet[16+ttsSize]);
-                        GST_INFO_OBJECT( filter, "got PAT: program %X pmtPid %X\n", filter->program, filter->pmtPid );
-                        if ( (filter->program != 0) && (filter->pmtPid != 0) )
-                        {
-                           if ( filter->havePMT )
-                           {
-                              GST_INFO_OBJECT( filter, "%s:: pmt change detected in pat", __FUNCTION__ );
-                           }
-                           filter->havePMT= FALSE;
-                           filter->haveNewPMT= FALSE;
-                           GST_DEBUG_OBJECT( filter, "%s:: acquired PAT version %d program %X pmt pid %X", 
-                                             __FUNCTION__, version, filter->program, filter->pmtPid );
-                        }
-                        else
-                        {
-                           GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 TS packet with suspect program %x and pmtPid %x", 
-                                               __FUNCTION__, filter->program, filter->pmtPid );
-                           dumpPacket( filter, packet );
-                           filter->program= -1;
-                           filter->pmtPid= -1;
-                        }
-                     }
-                     else
-                     {
-                        GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 TS packet with length of %d", __FUNCTION__, length );
-                     }
-                  }
-               }
-               else
-               {
-                  GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 TS packet with tableid of %x", __FUNCTION__, tableid );
-               }
+               videoPids[videoComponentCount]= pid;
+               videoTypes[videoComponentCount]= streamType;
+               ++videoComponentCount;
             }
-            else
+            break;
+         case 0x03: // MPEG1 Audio
+         case 0x04: // MPEG2 Audio
+         case 0x0F: // MPEG2 AAC Audio
+         case 0x11: // MPEG4 LATM AAC Audio
+         case 0x81: // ATSC AC3 Audio
+         case 0x82: // HDMV DTS Audio
+         case 0x83: // LPCM Audio
+         case 0x84: // SDDS Audio
+         case 0x86: // DTS-HD Audio
+         case 0x87: // ATSC E-AC3 Audio
+         case 0x8A: // DTS Audio
+         case 0x91: // A52b/AC3 Audio
+         case 0x94: // SDDS Audio
+            if ( audioComponentCount >= MAX_PIDS )
             {
-               GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 TS packet with adaptation of %x", __FUNCTION__, adaptation );
+               break;
             }
-         }
-         else
-         {
-            GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 TS without payload start indicator", __FUNCTION__ );
-         }
-      }
-      else if ( pid == filter->pmtPid )
-      {
-         payloadStart= (packet[1+ttsSize] & 0x40);
-         if ( payloadStart )
-         {
-            adaptation= ((packet[3+ttsSize] & 0x30)>>4);
-            if ( adaptation == 0x01 )
+            audioPids[audioComponentCount]= pid;
+            audioTypes[audioComponentCount]= streamType;
+            audioLanguages[audioComponentCount]= 0;
+            if( esLen > 2 )
             {
-               int tableid= packet[5+ttsSize];
-               if ( tableid == 0x02 )
+               int descIdx, maxIdx;
+               int descrTag, descrLen;
+
+               descIdx= 5;
+               maxIdx= descIdx+esLen;
+
+               while ( descIdx+2 <= maxIdx )
                {
-                  int program= ((packet[8+ttsSize]<<8)+packet[9+ttsSize]);
-                  if ( program == filter->program )
+                  descrTag= programInfo[descIdx];
+                  descrLen= programInfo[descIdx+1];
+                  if ( descIdx+2+descrLen > maxIdx )
                   {
-                     int version= packet[10+ttsSize];
-                     int current= (version & 0x01);
-                     version= ((version >> 1)&0x1F);
-
-                     if ( !filter->havePMT || (current && (version != filter->versionPMT)) )
-                     {
-                        dumpPacket( filter, packet );
-                        if ( filter->havePMT && (version != filter->versionPMT) )
-                        {
-                           GST_INFO_OBJECT( filter, "%s:: pmt change detected: version %d -> %d", __FUNCTION__, filter->versionPMT, version );
-                           filter->havePMT= FALSE;
-                           filter->haveNewPMT= FALSE;
-                        }
+                     break;
+                  }
 
-                        if ( !filter->havePMT )
+                  switch ( descrTag )
+                  {
+                     // ISO_639_language_descriptor
+                     case 0x0A:
+                        if ( !audioLanguages[audioComponentCount] )
                         {
-                           int sectionLength= (((packet[6+ttsSize]&0x0F)<<8)+packet[7+ttsSize]);
-                           // Check if pmt payload fits in one TS packet: raw packat size less tts header,
-                           // less TS header, less fix size portion of pmt, minus trailing CRC
-                           if ( sectionLength < (ts_packet_size-5-12-4-ttsSize) )
-                           {
-                              unsigned char *programInfo, *programInfoEnd;
-                              int videoComponentCount, audioComponentCount, dataComponentCount;                           
-                              int videoPids[MAX_PIDS], audioPids[MAX_PIDS], dataPids[MAX_PIDS];
-                              int videoTypes[MAX_PIDS], audioTypes[MAX_PIDS], dataTypes[MAX_PIDS];
-                              char* audioLanguages[MAX_PIDS];
-                              int streamType, pid, len, langLen;
-                              char work[32];
-                              
-                              int pcrPid= (((packet[13+ttsSize]&0x1F)<<8)+packet[14+ttsSize]);
-                              int infoLength= (((packet[15+ttsSize]&0x0F)<<8)+packet[16+ttsSize]);
-                              
-                              videoComponentCount= audioComponentCount= dataComponentCount= 0;
-                              programInfo= &packet[infoLength+17+ttsSize];
-                              programInfoEnd= packet+ttsSize+8+sectionLength-4;
-                              while ( programInfo < programInfoEnd )
-                              {
-                                 streamType= programInfo[0];
-                                 pid= (((programInfo[1]&0x1F)<<8)+programInfo[2]);
-                                 len= (((programInfo[3]&0x0F)<<8)+programInfo[4]);
-                                 switch( streamType )
-                                 {
-                                    case 0x02: // MPEG2 Video
-                                    case 0x80: // ATSC Video
-                                       videoPids[videoComponentCount]= pid;
-                                       videoTypes[videoComponentCount]= streamType;
-                                       ++videoComponentCount;
-                                       break;                                    
-                                    case 0x03: // MPEG1 Audio                                    
-                                    case 0x04: // MPEG2 Audio                                    
-                                    case 0x0F: // MPEG2 AAC Audio                                    
-                                    case 0x11: // MPEG4 LATM AAC Audio                                    
-                                    case 0x81: // ATSC AC3 Audio                                    
-                                    case 0x82: // HDMV DTS Audio                                    
-                                    case 0x83: // LPCM Audio                                    
-                                    case 0x84: // SDDS Audio                                    
-                                    case 0x86: // DTS-HD Audio                                    
-                                    case 0x87: // ATSC E-AC3 Audio                                    
-                                    case 0x8A: // DTS Audio                                    
-                                    case 0x91: // A52b/AC3 Audio                                    
-                                    case 0x94: // SDDS Audio
-                                       audioPids[audioComponentCount]= pid;
-                                       audioTypes[audioComponentCount]= streamType;
-                                       audioLanguages[audioComponentCount]= 0;
-                                       if( len > 2 )
-                                       {
-                                          int descIdx, maxIdx;
-                                          int descrTag, descrLen;
-                                          
-                                          descIdx= 5;
-                                          maxIdx= descIdx+len;
-                                          
-                                          while ( descIdx < maxIdx )
-                                          {
-                                             descrTag= programInfo[descIdx];
-                                             descrLen= programInfo[descIdx+1];
-                                             
-                                             switch ( descrTag )
-                                             {
-                                                // ISO_639_language_descriptor
-                                                case 0x0A:
-                                                   rc = memcpy_s( work, sizeof(work), &programInfo[descIdx+2], descrLen );
-                                                   if(rc != EOK)
-                                                   {
-                                                       ERR_CHK(rc);
-                                                       return FALSE;
-                                                   }
-                                                   work[descrLen]= '\0';
-                                                   audioLanguages[audioComponentCount]= strdup(work);
-                                                   break;
-                                             }
-                                             
-                                             descIdx += (2+descrLen);
-                                          }
-                                       }
-                                       ++audioComponentCount;
-                                       break;
-                                    case 0x01: // MPEG1 Video
-                                    case 0x05: // ISO 13818-1 private sections
-                                    case 0x06: // ISO 13818-1 PES private data
-                                    case 0x07: // ISO 13522 MHEG
-                                    case 0x08: // ISO 13818-1 DSM-CC
-                                    case 0x09: // ISO 13818-1 auxiliary
-                                    case 0x0a: // ISO 13818-6 multi-protocol encap	
-                                    case 0x0b: // ISO 13818-6 DSM-CC U-N msgs
-                                    case 0x0c: // ISO 13818-6 stream descriptors
-                                    case 0x0d: // SO 13818-6 sections
-                                    case 0x0e: // ISO 13818-1 auxiliary
-                                    case 0x10: // MPEG4 Video
-                                    case 0x12: // MPEG-4 generic
-                                    case 0x13: // ISO 14496-1 SL-packetized
-                                    case 0x14: // ISO 13818-6 Synchronized Download Protocol
-                                    case 0x1B: // H.264 Video
-                                    case 0x85: // ATSC Program ID
-                                    case 0x92: // DVD_SPU vls Subtitle
-                                    case 0xA0: // MSCODEC Video
-                                    case 0xea: // Private ES (VC-1)
-                                    default:
-                                       if ( (streamType == 0x6) || (streamType >= 0x80) )
-                                       {
-                                          dataPids[dataComponentCount]= pid;
-                                          dataTypes[dataComponentCount]= streamType;
-                                          ++dataComponentCount;
-                                       }
-                                       else
-                                       {
-                                          GST_WARNING_OBJECT( filter, "%s:: pmt contains unsupported stream type %X", __FUNCTION__, streamType );
-                                       }
-                                       break;
-                                 }
-                                 programInfo += (5 + len);
-                              }
-                              
-                              GST_INFO_OBJECT( filter, "%s:: found %d video, %d audio, and %d data pids in program %x with pcr pid %x",
-                                       __FUNCTION__, videoComponentCount, audioComponentCount, dataComponentCount, filter->program, pcrPid );
-
-                              filter->pcrPid= pcrPid;
-                              filter->versionPMT= version;
-
-                              result= gst_dtcp_enc_generate_pmt( filter,
-                                                                    videoComponentCount, videoPids, videoTypes,
-                                                                    audioComponentCount, audioPids, audioTypes, audioLanguages,
-                                                                    dataComponentCount, dataPids, dataTypes );
-                              if ( result )
-                              {
-                                 filter->haveNewPMT= TRUE;
-                                 dumpPackets( filter, filter->newPMT, ts_packet_size );
-                              }
-                              
-							  int i;
-                              for( i= 0; i < audioComponentCount; ++i )
-                              {
-                                 if ( audioLanguages[i] )
-                                 {
-                                    free( audioLanguages[i] );
-                                 }
-                              }
-
-                              filter->havePMT= TRUE;
-                           }
-                           else
-                           {
-                              GST_WARNING_OBJECT( filter, "%s:: ignoring multi-packet pmt (section length %d)", __FUNCTION__, sectionLength );
-                           }
+                           audioLanguages[audioComponentCount]= g_strndup( (const gchar*)&programInfo[descIdx+2], descrLen );
                         }
-                     }                     
+                        break;
                   }
-                  else
-                  {
-                     GST_WARNING_OBJECT( filter, "%s:: Warning: ignoring pmt TS packet with mismatched program of %x (expecting %x)", 
-                                         __FUNCTION__, program, filter->program );
-                  }                  
+
+                  descIdx += (2+descrLen);
                }
-               else
+            }
+            ++audioComponentCount;
+            break;
+         case 0x01: // MPEG1 Video
+         case 0x05: // ISO 13818-1 private sections
+         case 0x06: // ISO 13818-1 PES private data
+         case 0x07: // ISO 13522 MHEG
+         case 0x08: // ISO 13818-1 DSM-CC
+         case 0x09: // ISO 13818-1 auxiliary
+         case 0x0a: // ISO 13818-6 multi-protocol encap
+         case 0x0b: // ISO 13818-6 DSM-CC U-N msgs
+         case 0x0c: // ISO 13818-6 stream descriptors
+         case 0x0d: // SO 13818-6 sections
+         case 0x0e: // ISO 13818-1 auxiliary
+         case 0x10: // MPEG4 Video
+         case 0x12: // MPEG-4 generic
+         case 0x13: // ISO 14496-1 SL-packetized
+         case 0x14: // ISO 13818-6 Synchronized Download Protocol
+         case 0x1B: // H.264 Video
+         case 0x85: // ATSC Program ID
+         case 0x92: // DVD_SPU vls Subtitle
+         case 0xA0: // MSCODEC Video
+         case 0xea: // Private ES (VC-1)
+         default:
+            if ( (streamType == 0x6) || (streamType >= 0x80) )
+            {
+               if ( dataComponentCount < MAX_PIDS )
                {
-                  GST_TRACE_OBJECT( filter, "%s:: Warning: ignoring pmt TS packet with tableid of %x", __FUNCTION__, tableid );
+                  dataPids[dataComponentCount]= pid;
+                  dataTypes[dataComponentCount]= streamType;
+                  ++dataComponentCount;
                }
             }
             else
             {
-               GST_WARNING_OBJECT( filter, "%s:: Warning: ignoring pmt TS packet with adaptation of %x", __FUNCTION__, adaptation );
+               GST_WARNING_OBJECT( filter, "%s:: pmt contains unsupported stream type %X", __FUNCTION__, streamType );
             }
-            
-            if ( filter->haveNewPMT )
-            {
-			   if(ttsSize)
-			   {
-                  filter->newPMT[0]= packet[0];
-                  filter->newPMT[1]= packet[1];
-                  filter->newPMT[2]= packet[2];
-                  filter->newPMT[3]= packet[3];
-			   }
-               filter->newPMT[3+ttsSize]= packet[3+ttsSize];
-               rc = memcpy_s( packet, ts_packet_size, filter->newPMT, ts_packet_size );
-               if(rc != EOK)
-               {
-                   ERR_CHK(rc);
-                   return FALSE;
-               }
-               dumpPackets( filter, packet, ts_packet_size );
+            break;
+      }
+      programInfo += (5 + esLen);
+   }
+
+   GST_INFO_OBJECT( filter, "%s:: found %d video, %d audio, and %d data pids in program %x with pcr pid %x",
+            __FUNCTION__, videoComponentCount, audioComponentCount, dataComponentCount, filter->program, pcrPid );
+
+   filter->pcrPid= pcrPid;
+   filter->versionPMT= version;
+
+   result= gst_dtcp_enc_generate_pmt( filter,
+                                      videoComponentCount, videoPids, videoTypes,
+                                      audioComponentCount, audioPids, audioTypes, audioLanguages,
+                                      dataComponentCount, dataPids, dataTypes );
+   if ( result )
+   {
+      filter->haveNewPMT= TRUE;
+   }
+
+   for( i= 0; i < audioComponentCount; ++i )
+   {
+      g_free( audioLanguages[i] );
+   }
+
+   filter->havePMT= TRUE;
+}
+
+static void gst_dtcp_enc_psi_section( void *userData, int pid, const unsigned char *section, int len )
+{
+   GstDtcpEnc *filter= (GstDtcpEnc*)userData;
+   int tableid= section[0];
+
+   if ( len < 16 )
+   {
+      return;
+   }
+
+   if ( pid == 0 )
+   {
+      if ( tableid == 0x00 )
+      {
+         gst_dtcp_enc_parse_pat( filter, section, len );
+      }
+      else
+      {
+         GST_WARNING_OBJECT( filter, "%s:: ignoring pid 0 section with tableid of %x", __FUNCTION__, tableid );
+      }
+   }
+   else if ( pid == filter->pmtPid )
+   {
+      if ( tableid == 0x02 )
+      {
+         gst_dtcp_enc_parse_pmt( filter, section, len );
+      }
+      else
+      {
+         GST_TRACE_OBJECT( filter, "%s:: Warning: ignoring pmt pid section with tableid of %x", __FUNCTION__, tableid );
+      }
+   }
+}
+
+/* Decide at the start of each PMT section whether it is the version the
+ * generated PMT was built from. If so the section's packets are replaced
+ * one for one by the cached PMT packets, then by stuffing, keeping each
+ * original continuity counter. The cache is only refreshed here when the
+ * CCI or packet size has changed since it was built */
+static void gst_dtcp_enc_splice_pmt( GstDtcpEnc *filter, unsigned char *packet, int ttsSize )
+{
+   unsigned char *ts= packet+ttsSize;
+   int payloadStart= (ts[1] & 0x40);
+   int adaptation= ((ts[3] & 0x30)>>4);
+   int cc= (ts[3] & 0x0F);
+
+   if ( payloadStart )
+   {
+      filter->pmtPacketIndex= -1;
+      if ( filter->haveNewPMT && (adaptation == 0x01) && (ts[4] == 0x00) && (ts[5] == 0x02) )
+      {
+         int program= ((ts[8]<<8)+ts[9]);
+         int version= ts[10];
+         int current= (version & 0x01);
+         int sectionLength= (((ts[6]&0x0F)<<8)+ts[7]);
+         int sectionPackets= (1 + 3 + sectionLength + (PACKET_SIZE-4) - 1) / (PACKET_SIZE-4);
+         version= ((version >> 1)&0x1F);
+         if ( current && (program == filter->program) && (version == filter->versionPMT) &&
+              gst_dtcp_enc_update_pmt( filter ) )
+         {
+            if ( sectionPackets >= filter->newPMTPacketCount )
+            {
+               filter->pmtPacketIndex= 0;
+            }
+            else if ( !filter->pmtSpliceWarned )
+            {
+               GST_WARNING_OBJECT( filter, "%s:: pmt of %d packets has no room for %d generated packets, passing it unchanged",
+                                   __FUNCTION__, sectionPackets, filter->newPMTPacketCount );
+               filter->pmtSpliceWarned= TRUE;
+            }
+            else
+            {
+               GST_TRACE_OBJECT( filter, "%s:: pmt of %d packets has no room for %d generated packets",
+                                 __FUNCTION__, sectionPackets, filter->newPMTPacketCount );
             }
          }
-         else
+      }
+   }
+   else if ( adaptation != 0x01 )
+   {
+      filter->pmtPacketIndex= -1;
+   }
+
+   if ( filter->pmtPacketIndex >= 0 )
+   {
+      if ( filter->pmtPacketIndex < filter->newPMTPacketCount )
+      {
+         memcpy( ts, filter->newPMT+(filter->pmtPacketIndex*filter->tspacketsize)+ttsSize, PACKET_SIZE );
+         ts[3]= (ts[3] & 0xF0) | cc;
+      }
+      else
+      {
+         memset( ts+4, 0xFF, PACKET_SIZE-4 );
+      }
+      ++filter->pmtPacketIndex;
+   }
+}
+
+static gboolean gst_dtcp_enc_examine_buffer( GstDtcpEnc *filter, GstBuffer *buf )
+{
+   gboolean result= TRUE;
+   int size = 0;
+   unsigned char *packet = NULL, *bufferEnd = NULL;
+   int pid = 0;
+   int ttsSize = 0;
+   int ts_packet_size = filter->tspacketsize;
+#ifdef USE_GST1
+   GstMapInfo map =  {0};
+#endif
+
+   if ( NULL == filter->psi )
+   {
+      return TRUE;
+   }
+
+   if(filter->tspacketsize == TTS_PACKET_SIZE)
+   {
+	  ttsSize = 4;
+   }
+
+#ifdef USE_GST1
+   if ( !gst_buffer_map (buf, &map, GST_MAP_READWRITE) )
+   {
+      GST_ERROR_OBJECT(filter, "%s:: unable to map buffer writable\n",__FUNCTION__);
+      return FALSE;
+   }
+
+   size = map.size;
+   packet = map.data;
+#else
+   size = GST_BUFFER_SIZE (buf);
+   packet= GST_BUFFER_DATA (buf);
+#endif
+
+   if (NULL == packet)
+   {
+      GST_ERROR_OBJECT(filter, "%s:: Packet is NULL \n",__FUNCTION__);
+#ifdef USE_GST1
+    gst_buffer_unmap (buf, &map);
+#endif
+	  return FALSE;
+   }
+
+   // For the moment, insist on buffers being TS packet aligned; unaligned data is passed on unexamined
+   if ( !((packet[0+ttsSize] == 0x47) && ((size%ts_packet_size) == 0)) )
+   {
+      GST_WARNING_OBJECT(filter, "%s:: data buffer not TS packet aligned tspacketsize = %d\n",__FUNCTION__, ts_packet_size);
+#ifdef USE_GST1
+    gst_buffer_unmap (buf, &map);
+#endif
+	  return TRUE;
+   }
+
+   bufferEnd= packet+size;
+   while( packet < bufferEnd )
+   {
+      pid= (((packet[1+ttsSize] << 8) | packet[2+ttsSize]) & 0x1FFF);
+
+      if ( ts_psi_is_psi_pid( filter->psi, pid ) )
+      {
+         ts_psi_push_packet( filter->psi, packet+ttsSize );
+
+         if ( (pid == filter->pmtPid) && (pid != 0) )
          {
-            GST_WARNING_OBJECT( filter, "%s:: Warning: ignoring pmt TS without payload start indicator", __FUNCTION__ );
-         }               
+            gst_dtcp_enc_splice_pmt( filter, packet, ttsSize );
+         }
+      }
+
+      packet += ts_packet_size;
+   }
+
+#ifdef USE_GST1
+  gst_buffer_unmap (buf, &map);
+#endif
+   return result;
+}
+
+static void gst_dtcp_enc_reset_psi( GstDtcpEnc *filter )
+{
+  filter->havePAT= FALSE;
+  filter->havePMT= FALSE;
+  filter->haveNewPMT= FALSE;
+  filter->pmtPacketIndex= -1;
+  filter->newPMTSize= 0;
+  filter->newPMTPacketCount= 0;
+  filter->newPMTVersion= -1;
+  filter->newPMTPacketSize= 0;
+  filter->pmtSpliceWarned= FALSE;
+  filter->program= -1;
+  filter->pmtPid= -1;
+  filter->pcrPid= -1;
+  if ( filter->psi )
+  {
+    ts_psi_reset( filter->psi );
+    ts_psi_add_pid( filter->psi, 0 );
+  }
+}
+
+static void gst_dtcpencrypt_buf_delete( void *packet )
+{
+  if(packet)
+  {
+    GST_LOG("buffer to delete = %p\n", packet);
+    DTCPMgrReleasePacket(packet);
+    dtcp_packet_pool_release (packet);
+  }
+}
+
+#ifdef USE_GST1
+/* Wrap encrypted output in a recycled buffer from the element's wrap pool */
+static GstBuffer* gst_dtcp_enc_wrap_data( GstDtcpEnc *filter, guint8 *data, gsize size,
+                                          gpointer userData, GDestroyNotify notify )
+{
+  GstBuffer *buffer = NULL;
+  GstMemory *memory;
+
+  if ( GST_FLOW_OK != gst_buffer_pool_acquire_buffer (filter->wrapPool, &buffer, NULL) )
+  {
+    return gst_buffer_new_wrapped_full (0, data, size, 0, size, userData, notify);
+  }
+
+  memory = gst_memory_new_wrapped (0, data, size, 0, size, userData, notify);
+  if ( NULL == memory )
+  {
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+  gst_buffer_append_memory (buffer, memory);
+
+  return buffer;
+}
+
+/* Copy the PCP header into a buffer from the element's header pool */
+static GstBuffer* gst_dtcp_enc_header_buffer( GstDtcpEnc *filter, const guint8 *header, gsize size )
+{
+  GstBuffer *buffer = NULL;
+
+  if ( (size > DTCP_PCP_HEADER_MAX) ||
+       (GST_FLOW_OK != gst_buffer_pool_acquire_buffer (filter->headerPool, &buffer, NULL)) )
+  {
+    return NULL;
+  }
+
+  gst_buffer_fill (buffer, 0, header, size);
+  gst_buffer_set_size (buffer, size);
+
+  return buffer;
+}
+#endif
+
+void onError(GstDtcpEnc* filter, int err_code, char* err_string)
+{
+    GstMessage *message;
+    GError *error = NULL;
+
+    error = g_error_new (GST_CORE_ERROR, err_code, err_string);
+    if (error == NULL)
+        GST_ERROR("error null");
+    if(filter){
+        GstElement *parent= GST_ELEMENT_PARENT (filter);    //CID:18616 - forward null
+        message = gst_message_new_error (GST_OBJECT(parent), error, "DTCP AKE failed");
+        if (message == NULL){
+           GST_ERROR("DTCP error message creation failed");
+        }
+        else {
+           if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_ERROR)
+               GST_ERROR("DTCP error message type failed");
+
+           if (GST_MESSAGE_SRC (message) == NULL)
+               GST_ERROR("DTCP error message src not found");
+
+           if (gst_element_post_message (GST_ELEMENT (filter), message) == FALSE)
+           {
+               GST_ERROR("This element has no bus, therefore no message sent!");
+           }
+        }   //CID:18610 - Forward null
+    }
+    if (error)
+        g_error_free (error);
+
+    error = NULL;
+}
+
+/* Builds the output buffer list for an encrypted packet and pushes it.
+ * Takes ownership of 'packet'
+ */
+static GstFlowReturn gst_dtcp_enc_push_packet( GstDtcpEnc *filter, DTCPIP_Packet *packet )
+{
+  GstFlowReturn  ret = GST_FLOW_OK;
+  errno_t rc = -1;
+
+  if(filter->isFirstPacket)
+  {
+    if( packet->pcpHeaderOffset == 0 && packet->pcpHeader && packet->pcpHeaderLength )
+    {
+      GST_INFO_OBJECT (filter, "dtcpenc::Received first packet[%d]. header: ", packet->dataLength);
+      int ix;
+      for(ix=0; ix<14; ix++)
+        g_print("%02X ", packet->pcpHeader[ix]);
+      g_print("\n");
+    }
+    else
+    {
+      GST_ERROR_OBJECT (filter, "dtcpenc::Received first packet. NO DTCP HEADER . ERROR ERROR ERROR \n");
+    }
+    filter->isFirstPacket = FALSE;
+  }
+
+  GstBuffer *dtcpHeaderBuf = NULL;
+  GstBuffer *dtcpDataBuf = NULL;
+  GstBuffer *dtcpDataBuf2 = NULL;
+  GstBufferList *bufferlist_to_send = gst_buffer_list_new();
+#ifndef USE_GST1
+  GstBufferListIterator *it = gst_buffer_list_iterate (bufferlist_to_send);
+
+  gst_buffer_list_iterator_add_group(it);
+#endif
+
+  if( packet->pcpHeaderOffset >= 0 && packet->pcpHeader && packet->pcpHeaderLength )
+  {
+#ifdef USE_GST1
+    dtcpHeaderBuf = gst_dtcp_enc_header_buffer (filter, packet->pcpHeader, packet->pcpHeaderLength);
+    if ( NULL == dtcpHeaderBuf )
+    {
+      uint8_t *pcpHeaderBuf = (uint8_t *)g_malloc0(sizeof(uint8_t) * packet->pcpHeaderLength);
+      if (NULL == pcpHeaderBuf) {
+        GST_ERROR_OBJECT(filter, "Error while allocating pcpHeaderBuf of size %d.. \n", packet->pcpHeaderLength);
+        gst_buffer_list_unref(bufferlist_to_send);
+        ret = GST_FLOW_ERROR;
+        goto out;
+      }
+
+      rc = memcpy_s(pcpHeaderBuf, sizeof(uint8_t) * packet->pcpHeaderLength, packet->pcpHeader, sizeof(uint8_t) * packet->pcpHeaderLength);
+      if(rc != EOK)
+      {
+         ERR_CHK(rc);
+         g_free(pcpHeaderBuf);
+         gst_buffer_list_unref(bufferlist_to_send);
+         ret = GST_FLOW_ERROR;
+         goto out;
+      }
+
+      // pcpHeaderBuf g_malloc'd above will be free using g_free when dtcpHeaderBuf is unreffed
+      dtcpHeaderBuf = gst_buffer_new_wrapped (pcpHeaderBuf, packet->pcpHeaderLength);
+      if (NULL == dtcpHeaderBuf) {
+        GST_ERROR_OBJECT(filter, "Error while allocating the GST buffer of size %d.. \n", packet->pcpHeaderLength);
+        g_free(pcpHeaderBuf);
+        gst_buffer_list_unref(bufferlist_to_send);
+        ret = GST_FLOW_ERROR;
+        goto out;
+      }
+    }
+#else
+    dtcpHeaderBuf = gst_buffer_new_and_alloc (packet->pcpHeaderLength);
+
+	if (NULL == dtcpHeaderBuf)
+	{
+      GST_ERROR_OBJECT(filter, "%s::Error while allocating the GST buffer of size %d.. \n", __FUNCTION__, packet->pcpHeaderLength);
+      gst_buffer_list_iterator_free(it);
+      gst_buffer_list_unref(bufferlist_to_send);
+      ret = GST_FLOW_ERROR;
+      goto out;
+	}
+
+      rc =  memcpy_s(GST_BUFFER_DATA(dtcpHeaderBuf), GST_BUFFER_SIZE(dtcpHeaderBuf), packet->pcpHeader, packet->pcpHeaderLength);
+      if(rc != EOK)
+      {
+          ERR_CHK(rc);
+          gst_buffer_list_iterator_free(it);
+          gst_buffer_list_unref(bufferlist_to_send);
+          ret = GST_FLOW_ERROR;
+          goto out;
+      }
+	
+#endif
+  }
+
+  if ( NULL == dtcpHeaderBuf ) 
+  {
+#ifdef USE_GST1
+    dtcpDataBuf = gst_dtcp_enc_wrap_data (filter,
+                                          packet->dataOutPtr,
+                                          packet->dataLength,
+                                          packet,
+                                          gst_dtcpencrypt_buf_delete);
+
+    gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf);
+#else
+    dtcpDataBuf = gst_buffer_new();
+    GST_BUFFER_DATA(dtcpDataBuf)= packet->dataOutPtr;
+    GST_BUFFER_MALLOCDATA(dtcpDataBuf)= packet;
+    GST_BUFFER_FREE_FUNC(dtcpDataBuf)= gst_dtcpencrypt_buf_delete;
+    GST_BUFFER_SIZE(dtcpDataBuf)= packet->dataLength;
+    GST_BUFFER_OFFSET(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_OFFSET_END(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
+
+    gst_buffer_list_iterator_add (it, dtcpDataBuf);
+#endif
+  }
+  else
+  {
+    // we may need to split data to 2 part to insert PCP header here,
+    unsigned int first_section_size = (packet->pcpHeaderOffset > 0) ? packet->pcpHeaderOffset : 0;
+    unsigned int second_section_size = (packet->dataLength > packet->pcpHeaderOffset) ? packet->dataLength - packet->pcpHeaderOffset : 0;
+  
+    if ( 0 != first_section_size ) 
+	{
+#ifdef USE_GST1
+      if (0 == second_section_size)
+      {
+        /* No second section, pass ownership of 'packet' to the first buffer */
+        dtcpDataBuf = gst_dtcp_enc_wrap_data (filter,
+                                              packet->dataOutPtr,
+                                              first_section_size,
+                                              packet,
+                                              gst_dtcpencrypt_buf_delete);
+      }
+      else
+      {
+        /* The second buffer will take owernship of 'packet' */
+        dtcpDataBuf = gst_dtcp_enc_wrap_data (filter,
+                                              packet->dataOutPtr,
+                                              first_section_size,
+                                              NULL,
+                                              NULL);
+      }
+
+      //Inserting first section
+      gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf);
+#else
+      dtcpDataBuf = gst_buffer_new();
+      GST_BUFFER_DATA(dtcpDataBuf)= packet->dataOutPtr;
+      if(0 == second_section_size)
+      {
+        GST_BUFFER_MALLOCDATA(dtcpDataBuf)= packet;
+        GST_BUFFER_FREE_FUNC(dtcpDataBuf)= gst_dtcpencrypt_buf_delete;
+      }
+      GST_BUFFER_SIZE(dtcpDataBuf)= first_section_size;
+      GST_BUFFER_OFFSET(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
+      GST_BUFFER_OFFSET_END(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
+
+      //Inserting first section
+      gst_buffer_list_iterator_add (it, dtcpDataBuf);
+#endif
+    } 
+
+    //Inserting pcp header
+#ifdef USE_GST1
+    gst_buffer_list_add (bufferlist_to_send, dtcpHeaderBuf);
+#else
+    gst_buffer_list_iterator_add (it, dtcpHeaderBuf);
+#endif
+  
+    if ( 0 != second_section_size ) 
+	{
+#ifdef USE_GST1
+      dtcpDataBuf2 = gst_dtcp_enc_wrap_data (filter,
+                                             (guint8*)packet->dataOutPtr + first_section_size,
+                                             second_section_size,
+                                             packet,
+                                             gst_dtcpencrypt_buf_delete);
+
+      //Inserting second section
+      gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf2);
+#else
+      dtcpDataBuf2 = gst_buffer_new();
+      GST_BUFFER_DATA(dtcpDataBuf2)= packet->dataOutPtr + first_section_size;
+      GST_BUFFER_SIZE(dtcpDataBuf2)= second_section_size;
+      GST_BUFFER_OFFSET(dtcpDataBuf2)= GST_BUFFER_OFFSET_NONE;
+      GST_BUFFER_OFFSET_END(dtcpDataBuf2)= GST_BUFFER_OFFSET_NONE;
+//      if(0 == first_section_size)
+      {
+        GST_BUFFER_MALLOCDATA(dtcpDataBuf2)= packet;
+        GST_BUFFER_FREE_FUNC(dtcpDataBuf2)= gst_dtcpencrypt_buf_delete;
       }
 
-      packet += ts_packet_size;
-      ++packetCount;
-   }
+      //Inserting second section
+      gst_buffer_list_iterator_add (it, dtcpDataBuf2);
+#endif
+    }        
+  }
+
+  g_atomic_int_inc (&filter->packetsProcessed);
+  /* 64 bit so it does not wrap at 4GB on 32 bit targets; the object lock
+     keeps readers there from seeing half an update */
+  GST_OBJECT_LOCK (filter);
+  filter->bytesProcessed += packet->dataLength;
+  GST_OBJECT_UNLOCK (filter);
+
+  /* We pass the ownership of 'packet' to the buffer */
+  packet = NULL;
+
+  //Sending data
+  ret = gst_pad_push_list(filter->srcpad, bufferlist_to_send);
+  if(ret < GST_FLOW_OK)
+  {
+	if(ret == -2 /*GST_FLOW_FLUSHING*/) 
+	  GST_LOG_OBJECT(filter, "%s::PEER PAD IS FLUSHING... \n", __FUNCTION__);
+	GST_LOG_OBJECT(filter, "%s::gst_pad_push_list ret = %d\n", __FUNCTION__, ret);
+  }
+
+#ifndef USE_GST1
+  gst_buffer_list_iterator_free(it);
+#endif
+
+out:
+  if (packet) {
+    DTCPMgrReleasePacket(packet);
+    dtcp_packet_pool_release (packet);
+  }
+
+  return ret;
+}
+
+static void gst_dtcp_enc_job_lock( GstDtcpEnc *filter )
+{
+  #ifdef GLIB_VERSION_2_32
+  g_mutex_lock( &filter->jobLock );
+  #else
+  g_mutex_lock( filter->jobLock );
+  #endif
+}
+
+static void gst_dtcp_enc_job_unlock( GstDtcpEnc *filter )
+{
+  #ifdef GLIB_VERSION_2_32
+  g_mutex_unlock( &filter->jobLock );
+  #else
+  g_mutex_unlock( filter->jobLock );
+  #endif
+}
+
+/* Worker pool thread function: encrypts one job and marks it complete */
+static void gst_dtcp_enc_worker( gpointer data, gpointer userData )
+{
+  GstDtcpEncJob *job= (GstDtcpEncJob*)data;
+  GstDtcpEnc *filter= (GstDtcpEnc*)userData;
+  gint result;
+
+  result= DTCPMgrProcessPacket( job->packet->session, job->packet );
+
+  gst_dtcp_enc_job_lock( filter );
+  job->result= result;
+  job->done= TRUE;
+  #ifdef GLIB_VERSION_2_32
+  g_cond_broadcast( &filter->jobCond );
+  #else
+  g_cond_broadcast( filter->jobCond );
+  #endif
+  gst_dtcp_enc_job_unlock( filter );
+}
+
+/* Buffers can only be encrypted out of order if the DTCP manager starts a
+ * new PCP at the head of each of them. Check that on the first buffers
+ * encrypted in the streaming thread before dispatching to the workers.
+ */
+static void gst_dtcp_enc_probe_parallel( GstDtcpEnc *filter, DTCPIP_Packet *packet )
+{
+  if ( !filter->workers || filter->parallel || (filter->parallelProbe < 0) )
+  {
+    return;
+  }
+
+  if ( (packet->pcpHeaderOffset == 0) && packet->pcpHeader && packet->pcpHeaderLength )
+  {
+    if ( ++filter->parallelProbe >= DTCP_ENC_PARALLEL_PROBE )
+    {
+      GST_INFO_OBJECT(filter, "%s:: encrypting on %u worker threads\n", __FUNCTION__, filter->workerThreads);
+      filter->parallel= TRUE;
+    }
+  }
+  else
+  {
+    GST_WARNING_OBJECT(filter, "%s:: DTCP manager continues PCPs across buffers, encrypting in the streaming thread\n", __FUNCTION__);
+    filter->parallelProbe= -1;
+  }
+}
+
+/* Completes the oldest outstanding job: pushes its output downstream, or
+ * drops it when discarding or after a failed push. Returns FALSE without
+ * waiting if 'wait' is not set and the job is still with a worker.
+ */
+static gboolean gst_dtcp_enc_push_job( GstDtcpEnc *filter, gboolean wait, gboolean discard )
+{
+  GstDtcpEncJob *job= &filter->jobs[filter->pushSeq % filter->jobWindow];
+  GstFlowReturn ret= GST_FLOW_OK;
+
+  gst_dtcp_enc_job_lock( filter );
+  while( !job->done )
+  {
+    if ( !wait )
+    {
+      gst_dtcp_enc_job_unlock( filter );
+      return FALSE;
+    }
+    #ifdef GLIB_VERSION_2_32
+    g_cond_wait( &filter->jobCond, &filter->jobLock );
+    #else
+    g_cond_wait( filter->jobCond, filter->jobLock );
+    #endif
+  }
+  gst_dtcp_enc_job_unlock( filter );
+
+  if ( job->seq != filter->pushSeq )
+  {
+    GST_ERROR_OBJECT(filter, "%s:: job sequence %llu expected %llu\n", __FUNCTION__,
+                     (unsigned long long)job->seq, (unsigned long long)filter->pushSeq);
+  }
+  ++filter->pushSeq;
+
+  if ( 0 > job->result )
+  {
+    GST_ERROR_OBJECT(filter, "%s::Error while encrypting... \n", __FUNCTION__);
+    dtcp_packet_pool_release (job->packet);
+    ret = GST_FLOW_ERROR;
+  }
+  else if ( discard || (filter->parallelFlow < GST_FLOW_OK) )
+  {
+    DTCPMgrReleasePacket(job->packet);
+    dtcp_packet_pool_release (job->packet);
+  }
+  else
+  {
+    if ( filter->parallel &&
+         !((job->packet->pcpHeaderOffset == 0) && job->packet->pcpHeader && job->packet->pcpHeaderLength) )
+    {
+      /* jobs already submitted still go out, later buffers are encrypted in order */
+      GST_WARNING_OBJECT(filter, "%s:: DTCP manager continued a PCP across buffers, leaving parallel mode\n", __FUNCTION__);
+      filter->parallel= FALSE;
+      filter->parallelProbe= -1;
+    }
+    ret = gst_dtcp_enc_push_packet (filter, job->packet);
+  }
+
+#ifdef USE_GST1
+  gst_buffer_unmap (job->buf, &job->map);
+#endif
+  gst_buffer_unref (job->buf);
+  job->buf= NULL;
+  job->packet= NULL;
+
+  if ( (ret < GST_FLOW_OK) && !discard && (filter->parallelFlow == GST_FLOW_OK) )
+  {
+    filter->parallelFlow= ret;
+  }
+
+  return TRUE;
+}
+
+/* Completes all outstanding jobs in order, returns the first failed push */
+static GstFlowReturn gst_dtcp_enc_drain( GstDtcpEnc *filter, gboolean discard )
+{
+  while( filter->pushSeq != filter->submitSeq )
+  {
+    gst_dtcp_enc_push_job( filter, TRUE, discard );
+  }
+
+  return filter->parallelFlow;
+}
+
+/* Returns the ring slot for the next job, completing the oldest job first
+ * if the window is full.
+ */
+static GstDtcpEncJob* gst_dtcp_enc_next_job( GstDtcpEnc *filter )
+{
+  GstDtcpEncJob *job;
+
+  while( (filter->submitSeq - filter->pushSeq) >= filter->jobWindow )
+  {
+    gst_dtcp_enc_push_job( filter, TRUE, FALSE );
+  }
+
+  job= &filter->jobs[filter->submitSeq % filter->jobWindow];
+  job->seq= filter->submitSeq;
+  job->result= 0;
+  job->done= FALSE;
+
+  return job;
+}
+
+/* Hands a filled job to the workers, then pushes whatever has completed
+ * in order without waiting.
+ */
+static GstFlowReturn gst_dtcp_enc_run_job( GstDtcpEnc *filter, GstDtcpEncJob *job )
+{
+  ++filter->submitSeq;
+  g_thread_pool_push( filter->workers, job, NULL );
+
+  while( (filter->pushSeq != filter->submitSeq) && gst_dtcp_enc_push_job( filter, FALSE, FALSE ) );
+
+  return filter->parallelFlow;
+}
+
+/* Back to probing in the streaming thread with no outstanding jobs */
+static void gst_dtcp_enc_reset_workers( GstDtcpEnc *filter )
+{
+  filter->parallel= FALSE;
+  filter->parallelProbe= 0;
+  filter->submitSeq= 0;
+  filter->pushSeq= 0;
+  filter->parallelFlow= GST_FLOW_OK;
+}
+
+static void gst_dtcp_enc_start_workers( GstDtcpEnc *filter )
+{
+  GError *error= NULL;
+
+  gst_dtcp_enc_reset_workers( filter );
 
-#ifdef USE_GST1
-  gst_buffer_unmap (buf, &map);
+  if ( filter->threads && !filter->workers )
+  {
+    filter->workerThreads= filter->threads;
+#ifndef DTCP_MGR_REENTRANT_SESSION
+    /* One worker calls into the session at a time and, taking jobs from
+     * the pool in push order, in submission order; encryption still runs
+     * beside the streaming thread */
+    if ( filter->workerThreads > 1 )
+    {
+      GST_WARNING_OBJECT(filter, "%s:: DTCP manager not built re-entrant, using 1 worker thread instead of %u\n",
+                         __FUNCTION__, filter->threads);
+      filter->workerThreads= 1;
+    }
 #endif
-   return result;
+    filter->jobWindow= 2*filter->workerThreads;
+    filter->workers= g_thread_pool_new( gst_dtcp_enc_worker, filter, filter->workerThreads, TRUE, &error );
+    if ( !filter->workers )
+    {
+      GST_ERROR_OBJECT(filter, "%s:: unable to create %u worker threads: %s\n", __FUNCTION__,
+                       filter->workerThreads, (error ? error->message : ""));
+      if ( error )
+      {
+        g_error_free( error );
+      }
+    }
+  }
 }
 
-static void gst_dtcpencrypt_buf_delete( void *packet )
+static void gst_dtcp_enc_stop_workers( GstDtcpEnc *filter )
 {
-  if(packet)
+  if ( filter->workers )
   {
-    GST_LOG("buffer to delete = %p\n", packet);
-    DTCPMgrReleasePacket(packet);
-    g_mutex_lock (packet_count_mutex);
-    packet_count--;
-    g_mutex_unlock (packet_count_mutex);
-    g_slice_free (DTCPIP_Packet, packet);
+    gst_dtcp_enc_drain( filter, TRUE );
+    g_thread_pool_free( filter->workers, FALSE, TRUE );
+    filter->workers= NULL;
   }
+  filter->parallel= FALSE;
 }
 
-void onError(GstDtcpEnc* filter, int err_code, char* err_string)
+/* sink pad event handler: serialized events stay behind the buffers
+ * still with the workers, a flush drops them
+ */
+static gboolean
+#ifdef USE_GST1
+gst_dtcp_enc_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+#else
+gst_dtcp_enc_sink_event (GstPad * pad, GstEvent * event)
+#endif
 {
-    GstMessage *message;
-    GError *error = NULL;
+  GstDtcpEnc *filter = GST_DTCPENC (GST_OBJECT_PARENT (pad));
 
-    error = g_error_new (GST_CORE_ERROR, err_code, err_string);
-    if (error == NULL)
-        GST_ERROR("error null");
-    if(filter){
-        GstElement *parent= GST_ELEMENT_PARENT (filter);    //CID:18616 - forward null
-        message = gst_message_new_error (GST_OBJECT(parent), error, "DTCP AKE failed");
-        if (message == NULL){
-           GST_ERROR("DTCP error message creation failed");
+  if ( filter->workers )
+  {
+    switch (GST_EVENT_TYPE (event))
+    {
+      case GST_EVENT_FLUSH_STOP:
+        gst_dtcp_enc_drain (filter, TRUE);
+        filter->parallelFlow = GST_FLOW_OK;
+        break;
+      default:
+        if ( GST_EVENT_IS_SERIALIZED (event) )
+        {
+          gst_dtcp_enc_drain (filter, FALSE);
         }
-        else {
-           if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_ERROR)
-               GST_ERROR("DTCP error message type failed");
-
-           if (GST_MESSAGE_SRC (message) == NULL)
-               GST_ERROR("DTCP error message src not found");
-
-           if (gst_element_post_message (GST_ELEMENT (filter), message) == FALSE)
-           {
-               GST_ERROR("This element has no bus, therefore no message sent!");
-           }
-        }   //CID:18610 - Forward null
+        break;
     }
-    if (error)
-        g_error_free (error);
+  }
 
-    error = NULL;
+#ifdef USE_GST1
+  return gst_pad_event_default (pad, parent, event);
+#else
+  return gst_pad_event_default (pad, event);
+#endif
 }
 
 #define ALIGNMENT_BUF_LEN (188*4)
@@ -1262,7 +2034,6 @@ gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf)
   int dataLen;
   DTCPIP_Packet *packet = NULL;
   GstFlowReturn  ret = GST_FLOW_OK;
-  errno_t rc = -1;
 
   if(NULL == pad) /*Coverity fix for issue 16638*/
   {
@@ -1311,6 +2082,19 @@ gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf)
   	GST_INFO_OBJECT (filter, "dtcpenc ts packet size = %d", filter->tspacketsize );
   }
 
+#ifndef XG5_GW
+  if ( filter->insertDtcpDesc && (QAMSRC == filter->srctype) && buf )
+  {
+    GST_LOG_OBJECT(filter, "%s::inserting PMT\n", __FUNCTION__);
+    buf = gst_buffer_make_writable (buf);
+    if ( !gst_dtcp_enc_examine_buffer( filter, buf ) ) {
+      GST_ERROR_OBJECT(filter, "%s:: Failed to add dtcp descriptors... returning....\n", __FUNCTION__);
+      gst_buffer_unref (buf);
+      return GST_FLOW_ERROR;
+    }
+  }
+#endif
+
 #ifdef USE_GST1
  gst_buffer_map (buf, &map, (GstMapFlags) GST_MAP_READ);
 
@@ -1329,20 +2113,6 @@ gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf)
   }
 #endif
 
-#ifndef XG5_GW 
-//Temporarily disabling insert dtcpdesc for debugging DELIA-2022
-/*
-  if(QAMSRC == filter->srctype)
-  {
-  	GST_LOG_OBJECT(filter, "%s::inserting PMT\n", __FUNCTION__);
-    if ( !gst_dtcp_enc_examine_buffer( filter, buf ) ) {
-      GST_ERROR_OBJECT(filter, "%s:: Failed to add dtcp descriptors... returning....\n", __FUNCTION__);
-      ret = GST_FLOW_ERROR;
-      goto out;
-    }
-  }
-*/
-#endif
 
 #ifdef USE_GST1
   virtualAddress = map.data;
@@ -1365,7 +2135,21 @@ gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf)
     goto out;
   }
 
-  packet = g_slice_new0 (DTCPIP_Packet);
+  if ( filter->workers )
+  {
+    /* after leaving parallel mode the workers' buffers go out first */
+    if ( !filter->parallel && (filter->pushSeq != filter->submitSeq) )
+    {
+      gst_dtcp_enc_drain (filter, FALSE);
+    }
+    if ( filter->parallelFlow < GST_FLOW_OK )
+    {
+      ret = filter->parallelFlow;
+      goto out;
+    }
+  }
+
+  packet = dtcp_packet_pool_acquire (filter->packetPool);
   if(packet == NULL) {
     GST_ERROR_OBJECT(filter, "Error while allocating memory for dtcp packet of size %d... \n", sizeof(DTCPIP_Packet));
     ret = GST_FLOW_ERROR;
@@ -1407,232 +2191,36 @@ gst_dtcp_enc_chain (GstPad * pad, GstBuffer * buf)
   packet->dataOutPhyPtr = physicalAddress;
   packet->pcpHeader = NULL;
 
+  if ( filter->parallel )
+  {
+    GstDtcpEncJob *job = gst_dtcp_enc_next_job (filter);
+
+    /* the job owns the mapped buffer and the packet from here */
+    job->buf = buf;
+#ifdef USE_GST1
+    job->map = map;
+#endif
+    job->packet = packet;
+    return gst_dtcp_enc_run_job (filter, job);
+  }
+
   if(0 > DTCPMgrProcessPacket(filter->pDtcpSession, packet))
   {
     GST_ERROR_OBJECT(filter, "%s::Error while encrypting... \n", __FUNCTION__);
     /* Don't have to call DTCPMgrReleasePacket() if DTCPMgrProcessPacket()
      * failed */
-    g_slice_free (DTCPIP_Packet, packet);
+    dtcp_packet_pool_release (packet);
     packet = NULL;
     ret = GST_FLOW_ERROR;
     goto out;
   }
 
-  if(filter->isFirstPacket)
-  {
-    if( packet->pcpHeaderOffset == 0 && packet->pcpHeader && packet->pcpHeaderLength )
-    {
-      GST_INFO_OBJECT (filter, "dtcpenc::Received first packet[%d]. header: ", dataLen);
-      int ix;
-      for(ix=0; ix<14; ix++)
-        g_print("%02X ", packet->pcpHeader[ix]);
-      g_print("\n");
-    }
-    else
-    {
-      GST_ERROR_OBJECT (filter, "dtcpenc::Received first packet. NO DTCP HEADER . ERROR ERROR ERROR \n");
-    }
-    filter->isFirstPacket = FALSE;
-  }
-
-  GstBuffer *dtcpHeaderBuf = NULL;
-  GstBuffer *dtcpDataBuf = NULL;
-  GstBuffer *dtcpDataBuf2 = NULL;
-  GstBufferList *bufferlist_to_send = gst_buffer_list_new();
-#ifndef USE_GST1
-  GstBufferListIterator *it = gst_buffer_list_iterate (bufferlist_to_send);
-
-  gst_buffer_list_iterator_add_group(it);
-#endif
-
-  if( packet->pcpHeaderOffset >= 0 && packet->pcpHeader && packet->pcpHeaderLength )
-  {
-#ifdef USE_GST1
-    uint8_t *pcpHeaderBuf = (uint8_t *)g_malloc0(sizeof(uint8_t) * packet->pcpHeaderLength);
-	if (NULL == pcpHeaderBuf) {
-      GST_ERROR_OBJECT(filter, "Error while allocating pcpHeaderBuf of size %d.. \n", packet->pcpHeaderLength);
-      gst_buffer_list_unref(bufferlist_to_send);
-      ret = GST_FLOW_ERROR;
-      goto out;
-    }
-
-    rc = memcpy_s(pcpHeaderBuf, sizeof(uint8_t) * packet->pcpHeaderLength, packet->pcpHeader, sizeof(uint8_t) * packet->pcpHeaderLength);
-    if(rc != EOK)
-    {
-       ERR_CHK(rc);
-       g_free(pcpHeaderBuf);
-       gst_buffer_list_unref(bufferlist_to_send);
-       ret = GST_FLOW_ERROR;
-       goto out;
-    }
-
-    // pcpHeaderBuf g_malloc'd above will be free using g_free when dtcpHeaderBuf is unreffed
-    dtcpHeaderBuf = gst_buffer_new_wrapped (pcpHeaderBuf, packet->pcpHeaderLength);
-	if (NULL == dtcpHeaderBuf) {
-      GST_ERROR_OBJECT(filter, "Error while allocating the GST buffer of size %d.. \n", packet->pcpHeaderLength);
-      g_free(pcpHeaderBuf);
-      gst_buffer_list_unref(bufferlist_to_send);
-      ret = GST_FLOW_ERROR;
-      goto out;
-	}
-#else
-    dtcpHeaderBuf = gst_buffer_new_and_alloc (packet->pcpHeaderLength);
-
-	if (NULL == dtcpHeaderBuf)
-	{
-      GST_ERROR_OBJECT(filter, "%s::Error while allocating the GST buffer of size %d.. \n", __FUNCTION__, packet->pcpHeaderLength);
-      gst_buffer_list_iterator_free(it);
-      gst_buffer_list_unref(bufferlist_to_send);
-      ret = GST_FLOW_ERROR;
-      goto out;
-	}
-
-      rc =  memcpy_s(GST_BUFFER_DATA(dtcpHeaderBuf), GST_BUFFER_SIZE(dtcpHeaderBuf), packet->pcpHeader, packet->pcpHeaderLength);
-      if(rc != EOK)
-      {
-          ERR_CHK(rc);
-          gst_buffer_list_iterator_free(it);
-          gst_buffer_list_unref(bufferlist_to_send);
-          ret = GST_FLOW_ERROR;
-          goto out;
-      }
-	
-#endif
-  }
-
-  if ( NULL == dtcpHeaderBuf ) 
-  {
-#ifdef USE_GST1
-    dtcpDataBuf = gst_buffer_new_wrapped_full (0,
-                                               packet->dataOutPtr,
-                                               packet->dataLength,
-                                               0,
-                                               packet->dataLength,
-                                               packet,
-                                               gst_dtcpencrypt_buf_delete);
-
-    gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf);
-#else
-    dtcpDataBuf = gst_buffer_new();
-    GST_BUFFER_DATA(dtcpDataBuf)= packet->dataOutPtr;
-    GST_BUFFER_MALLOCDATA(dtcpDataBuf)= packet;
-    GST_BUFFER_FREE_FUNC(dtcpDataBuf)= gst_dtcpencrypt_buf_delete;
-    GST_BUFFER_SIZE(dtcpDataBuf)= packet->dataLength;
-    GST_BUFFER_OFFSET(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
-    GST_BUFFER_OFFSET_END(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
-
-    gst_buffer_list_iterator_add (it, dtcpDataBuf);
-#endif
-  }
-  else
-  {
-    // we may need to split data to 2 part to insert PCP header here,
-    unsigned int first_section_size = (packet->pcpHeaderOffset > 0) ? packet->pcpHeaderOffset : 0;
-    unsigned int second_section_size = (packet->dataLength > packet->pcpHeaderOffset) ? packet->dataLength - packet->pcpHeaderOffset : 0;
-  
-    if ( 0 != first_section_size ) 
-	{
-#ifdef USE_GST1
-      if (0 == second_section_size)
-      {
-        /* No second section, pass ownership of 'packet' to the first buffer */
-        dtcpDataBuf = gst_buffer_new_wrapped_full (0,
-                                                   packet->dataOutPtr,
-                                                   first_section_size,
-                                                   0,
-                                                   first_section_size,
-                                                   packet,
-                                                   gst_dtcpencrypt_buf_delete);
-      }
-      else
-      {
-        /* The second buffer will take owernship of 'packet' */
-        dtcpDataBuf = gst_buffer_new_wrapped_full (0,
-                                                   packet->dataOutPtr,
-                                                   first_section_size,
-                                                   0,
-                                                   first_section_size,
-                                                   NULL,
-                                                   NULL);
-      }
-
-      //Inserting first section
-      gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf);
-#else
-      dtcpDataBuf = gst_buffer_new();
-      GST_BUFFER_DATA(dtcpDataBuf)= packet->dataOutPtr;
-      if(0 == second_section_size)
-      {
-        GST_BUFFER_MALLOCDATA(dtcpDataBuf)= packet;
-        GST_BUFFER_FREE_FUNC(dtcpDataBuf)= gst_dtcpencrypt_buf_delete;
-      }
-      GST_BUFFER_SIZE(dtcpDataBuf)= first_section_size;
-      GST_BUFFER_OFFSET(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
-      GST_BUFFER_OFFSET_END(dtcpDataBuf)= GST_BUFFER_OFFSET_NONE;
-
-      //Inserting first section
-      gst_buffer_list_iterator_add (it, dtcpDataBuf);
-#endif
-    } 
-
-    //Inserting pcp header
-#ifdef USE_GST1
-    gst_buffer_list_add (bufferlist_to_send, dtcpHeaderBuf);
-#else
-    gst_buffer_list_iterator_add (it, dtcpHeaderBuf);
-#endif
-  
-    if ( 0 != second_section_size ) 
-	{
-#ifdef USE_GST1
-      dtcpDataBuf2 = gst_buffer_new_wrapped_full (0,
-                                                  packet->dataOutPtr + first_section_size,
-                                                  second_section_size,
-                                                  0,
-                                                  second_section_size,
-                                                  packet,
-                                                  gst_dtcpencrypt_buf_delete);
-
-      //Inserting second section
-      gst_buffer_list_add (bufferlist_to_send, dtcpDataBuf2);
-#else
-      dtcpDataBuf2 = gst_buffer_new();
-      GST_BUFFER_DATA(dtcpDataBuf2)= packet->dataOutPtr + first_section_size;
-      GST_BUFFER_SIZE(dtcpDataBuf2)= second_section_size;
-      GST_BUFFER_OFFSET(dtcpDataBuf2)= GST_BUFFER_OFFSET_NONE;
-      GST_BUFFER_OFFSET_END(dtcpDataBuf2)= GST_BUFFER_OFFSET_NONE;
-//      if(0 == first_section_size)
-      {
-        GST_BUFFER_MALLOCDATA(dtcpDataBuf2)= packet;
-        GST_BUFFER_FREE_FUNC(dtcpDataBuf2)= gst_dtcpencrypt_buf_delete;
-      }
-
-      //Inserting second section
-      gst_buffer_list_iterator_add (it, dtcpDataBuf2);
-#endif
-    }        
-  }
+  gst_dtcp_enc_probe_parallel (filter, packet);
 
-  /* We pass the ownership of 'packet' to the buffer */
+  /* We pass the ownership of 'packet' to the output buffers */
+  ret = gst_dtcp_enc_push_packet (filter, packet);
   packet = NULL;
 
-	g_mutex_lock (packet_count_mutex);
-	packet_count++;
-	g_mutex_unlock (packet_count_mutex);
-
-  //Sending data
-  ret = gst_pad_push_list(filter->srcpad, bufferlist_to_send);
-  if(ret < GST_FLOW_OK)
-  {
-	if(ret == -2 /*GST_FLOW_FLUSHING*/) 
-	  GST_LOG_OBJECT(filter, "%s::PEER PAD IS FLUSHING... \n", __FUNCTION__);
-	GST_LOG_OBJECT(filter, "%s::gst_pad_push_list ret = %d\n", __FUNCTION__, ret);
-  }
-
-#ifndef USE_GST1
-  gst_buffer_list_iterator_free(it);
-#endif
-
 out:
 #ifdef USE_GST1
   gst_buffer_unmap (buf, &map);
@@ -1643,7 +2231,7 @@ out:
 
   if (packet) {
     DTCPMgrReleasePacket(packet);
-    g_slice_free (DTCPIP_Packet, packet);
+    dtcp_packet_pool_release (packet);
   }
 
   return ret;
@@ -32,6 +32,12 @@
   *  - remoteip   - Remote IP (client ip) address
   *  - keylabel   - DTCP Exchange Key Label Default:0
   *  - reset      - Reset the dtcp session to clean up residue data
+  *  - insert-dtcp-desc - Insert the DTCP descriptor into the PMT of QAM source streams Default:FALSE
+  *  - packets-in-flight - Encrypted buffers pushed downstream and not yet released (read only)
+  *  - packets-processed - Buffers encrypted since the element left NULL state (read only)
+  *  - bytes-processed   - Bytes encrypted since the element left NULL state (read only)
+  *  - threads    - Worker threads encrypting in parallel when the DTCP manager starts a PCP per buffer, 0: streaming thread Default:0.
+  *                 More than 1 needs a build configured with --enable-dtcpmgr-reentrant, otherwise 1 is used
   *  @ingroup  GST_PLUGINS
  **/
 
@@ -49,6 +55,8 @@
 
 #include <gst/gst.h>
 #include "dtcpmgr.h"
+#include "tspsi.h"
+#include "gstdtcpencpool.h"
 
 G_BEGIN_DECLS
 
@@ -80,6 +88,25 @@ typedef struct _GstDtcpEncClass GstDtcpEncClass;
 
 #define MAX_PACKET_SIZE (3*(188+4))
 
+#define DTCP_ENC_MAX_THREADS (8)
+#define DTCP_ENC_MAX_JOBS (2*DTCP_ENC_MAX_THREADS)
+
+/**
+ * One input buffer handed to the worker pool. Jobs live in a ring indexed
+ * by sequence number and are pushed downstream strictly in that order
+*/
+typedef struct _GstDtcpEncJob
+{
+  guint64 seq;                        /**< Submission order of the buffer */
+  GstBuffer *buf;                     /**< Input buffer, kept mapped until the output is pushed */
+#ifdef USE_GST1
+  GstMapInfo map;                     /**< Mapping of buf */
+#endif
+  DTCPIP_Packet *packet;              /**< Packet being encrypted */
+  gint result;                        /**< DTCPMgrProcessPacket result */
+  gboolean done;                      /**< Set by the worker under jobLock */
+} GstDtcpEncJob;
+
 struct _GstDtcpEnc
 {
   GstElement element;                 /**< Gstreamer Element */
@@ -115,6 +142,40 @@ struct _GstDtcpEnc
   gboolean haveNewPMT;                /**< Indicates the PMT Change  */
   gint newPMTSize;                    /**< Size of new PMT table     */
   guchar newPMT[MAX_PACKET_SIZE];     /**< New PMT table              */
+  gint newPMTPacketCount;             /**< TS packets in the new PMT table */
+  gint newPMTVersion;                 /**< PMT version the new PMT table was built for */
+  guchar newPMTCci;                   /**< CCI the new PMT table was built for */
+  gint newPMTPacketSize;              /**< Packet size the new PMT table was built for */
+  gboolean pmtSpliceWarned;           /**< A PMT too short for the new PMT table was reported */
+  guchar pmtSection[TS_PSI_SECTION_MAX]; /**< Generated PMT section with the DTCP descriptor */
+  gint pmtSectionSize;                /**< Size of the generated PMT section */
+  gboolean insertDtcpDesc;            /**< Rewrite the PMT with the DTCP descriptor */
+  gint pmtPacketIndex;                /**< Packet index within the PMT section being replaced, -1 if none */
+  TsPsi *psi;                         /**< PAT/PMT section assembler */
+  DtcpPacketPool *packetPool;         /**< Free-list of DTCP packet descriptors, also counts packets in flight */
+  gint packetsProcessed;              /**< Buffers encrypted, updated atomically */
+  guint64 bytesProcessed;             /**< Bytes encrypted, updated by the streaming thread under the object lock */
+#ifdef USE_GST1
+  GstBufferPool *headerPool;          /**< Pool of PCP header buffers */
+  GstBufferPool *wrapPool;            /**< Pool of buffers wrapping encrypted output */
+#endif
+  guint threads;                      /**< Configured worker thread count, 0 for none */
+  guint workerThreads;                /**< Worker threads running, threads clamped to 1 for a non re-entrant manager */
+  GThreadPool *workers;               /**< Worker pool running DTCPMgrProcessPacket */
+  gboolean parallel;                  /**< Buffers are currently dispatched to the workers */
+  gint parallelProbe;                 /**< Buffers seen starting their own PCP, -1 once disqualified */
+  guint jobWindow;                    /**< Maximum outstanding jobs */
+  guint64 submitSeq;                  /**< Sequence number of the next job submitted */
+  guint64 pushSeq;                    /**< Sequence number of the next job to push */
+  GstFlowReturn parallelFlow;         /**< First failed push of a job, returned from chain */
+  GstDtcpEncJob jobs[DTCP_ENC_MAX_JOBS]; /**< Reorder ring of outstanding jobs */
+#ifdef GLIB_VERSION_2_32
+  GMutex jobLock;                     /**< Protects job completion state */
+  GCond jobCond;                      /**< Signalled when a job completes */
+#else
+  GMutex *jobLock;
+  GCond *jobCond;
+#endif
 };
 
 struct _GstDtcpEncClass 
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup dtcpencrypt
+* @{
+**/
+
+#include <string.h>
+
+#include "gstdtcpencpool.h"
+
+typedef struct _DtcpPooledPacket
+{
+   DTCPIP_Packet packet;
+   DtcpPacketPool *pool;
+   struct _DtcpPooledPacket *next;
+} DtcpPooledPacket;
+
+struct _DtcpPacketPool
+{
+   #ifdef GLIB_VERSION_2_32
+   GMutex lock;
+   #else
+   GMutex *lock;
+   #endif
+   gint refCount;
+   guint maxFree;
+   guint freeCount;
+   DtcpPooledPacket *freeList;
+   guint64 allocations;
+   gint outstanding;
+};
+
+static void dtcp_packet_pool_lock( DtcpPacketPool *pool )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_lock( &pool->lock );
+   #else
+   g_mutex_lock( pool->lock );
+   #endif
+}
+
+static void dtcp_packet_pool_unlock( DtcpPacketPool *pool )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_unlock( &pool->lock );
+   #else
+   g_mutex_unlock( pool->lock );
+   #endif
+}
+
+DtcpPacketPool* dtcp_packet_pool_new( guint maxFree )
+{
+   DtcpPacketPool *pool;
+
+   pool= (DtcpPacketPool*)g_malloc0( sizeof(DtcpPacketPool) );
+   if ( pool ) {
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_init( &pool->lock );
+      #else
+      pool->lock= g_mutex_new();
+      #endif
+      pool->refCount= 1;
+      pool->maxFree= maxFree;
+   }
+
+   return pool;
+}
+
+void dtcp_packet_pool_unref( DtcpPacketPool *pool )
+{
+   DtcpPooledPacket *pooled;
+
+   if ( pool && g_atomic_int_dec_and_test( &pool->refCount ) ) {
+      while( pool->freeList ) {
+         pooled= pool->freeList;
+         pool->freeList= pooled->next;
+         g_slice_free( DtcpPooledPacket, pooled );
+      }
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_clear( &pool->lock );
+      #else
+      g_mutex_free( pool->lock );
+      #endif
+      g_free( pool );
+   }
+}
+
+DTCPIP_Packet* dtcp_packet_pool_acquire( DtcpPacketPool *pool )
+{
+   DtcpPooledPacket *pooled;
+
+   dtcp_packet_pool_lock( pool );
+   pooled= pool->freeList;
+   if ( pooled ) {
+      pool->freeList= pooled->next;
+      --pool->freeCount;
+   } else {
+      ++pool->allocations;
+   }
+   dtcp_packet_pool_unlock( pool );
+
+   if ( pooled ) {
+      memset( &pooled->packet, 0, sizeof(DTCPIP_Packet) );
+   } else {
+      pooled= g_slice_new0( DtcpPooledPacket );
+      if ( !pooled ) {
+         return NULL;
+      }
+   }
+
+   g_atomic_int_inc( &pool->refCount );
+   g_atomic_int_inc( &pool->outstanding );
+   pooled->pool= pool;
+   pooled->next= NULL;
+
+   return &pooled->packet;
+}
+
+void dtcp_packet_pool_release( DTCPIP_Packet *packet )
+{
+   DtcpPooledPacket *pooled= (DtcpPooledPacket*)packet;
+   DtcpPacketPool *pool;
+
+   if ( !packet ) {
+      return;
+   }
+
+   pool= pooled->pool;
+   g_atomic_int_add( &pool->outstanding, -1 );
+   dtcp_packet_pool_lock( pool );
+   if ( pool->freeCount < pool->maxFree ) {
+      pooled->next= pool->freeList;
+      pool->freeList= pooled;
+      ++pool->freeCount;
+      pooled= NULL;
+   }
+   dtcp_packet_pool_unlock( pool );
+
+   if ( pooled ) {
+      g_slice_free( DtcpPooledPacket, pooled );
+   }
+
+   dtcp_packet_pool_unref( pool );
+}
+
+guint64 dtcp_packet_pool_get_allocations( DtcpPacketPool *pool )
+{
+   guint64 allocations;
+
+   dtcp_packet_pool_lock( pool );
+   allocations= pool->allocations;
+   dtcp_packet_pool_unlock( pool );
+
+   return allocations;
+}
+
+guint dtcp_packet_pool_get_outstanding( DtcpPacketPool *pool )
+{
+   return (guint)g_atomic_int_get( &pool->outstanding );
+}
+
+#ifdef USE_GST1
+typedef struct _GstDtcpEncWrapPool
+{
+   GstBufferPool parent;
+} GstDtcpEncWrapPool;
+
+typedef struct _GstDtcpEncWrapPoolClass
+{
+   GstBufferPoolClass parent_class;
+} GstDtcpEncWrapPoolClass;
+
+G_DEFINE_TYPE (GstDtcpEncWrapPool, gst_dtcp_enc_wrap_pool, GST_TYPE_BUFFER_POOL);
+
+static GstFlowReturn gst_dtcp_enc_wrap_pool_alloc_buffer( GstBufferPool *pool, GstBuffer **buffer,
+                                                          GstBufferPoolAcquireParams *params )
+{
+   *buffer= gst_buffer_new();
+
+   return (*buffer ? GST_FLOW_OK : GST_FLOW_ERROR);
+}
+
+static void gst_dtcp_enc_wrap_pool_reset_buffer( GstBufferPool *pool, GstBuffer *buffer )
+{
+   /* dropping the wrapped memory releases the DTCP packet it belongs to */
+   gst_buffer_remove_all_memory( buffer );
+
+   GST_BUFFER_POOL_CLASS (gst_dtcp_enc_wrap_pool_parent_class)->reset_buffer( pool, buffer );
+
+   /* the pool discards buffers whose memory was changed, these are meant to change */
+   GST_BUFFER_FLAG_UNSET( buffer, GST_BUFFER_FLAG_TAG_MEMORY );
+}
+
+static void gst_dtcp_enc_wrap_pool_class_init( GstDtcpEncWrapPoolClass *klass )
+{
+   GstBufferPoolClass *pool_class= (GstBufferPoolClass*)klass;
+
+   pool_class->alloc_buffer= gst_dtcp_enc_wrap_pool_alloc_buffer;
+   pool_class->reset_buffer= gst_dtcp_enc_wrap_pool_reset_buffer;
+}
+
+static void gst_dtcp_enc_wrap_pool_init( GstDtcpEncWrapPool *pool )
+{
+}
+
+GstBufferPool* gst_dtcp_enc_wrap_pool_new( void )
+{
+   GstBufferPool *pool;
+   GstStructure *config;
+
+   pool= (GstBufferPool*)g_object_new( gst_dtcp_enc_wrap_pool_get_type(), NULL );
+   gst_object_ref_sink( pool );
+
+   config= gst_buffer_pool_get_config( pool );
+   gst_buffer_pool_config_set_params( config, NULL, 0, 0, 0 );
+   gst_buffer_pool_set_config( pool, config );
+
+   return pool;
+}
+#endif
+
+/** @} */
+/** @} */
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup dtcpencrypt
+* @{
+**/
+
+
+#ifndef __GST_DTCPENC_POOL_H__
+#define __GST_DTCPENC_POOL_H__
+
+#include <gst/gst.h>
+#include "dtcpmgr.h"
+
+G_BEGIN_DECLS
+
+/**
+  *  @addtogroup DTCP_ENCRYPT
+  *  @{
+ **/
+
+/* Free packet descriptors kept per element beyond those in flight */
+#define DTCP_PACKET_POOL_MAX_FREE (16)
+
+/* PCP headers are 14 bytes; larger ones bypass the header pool */
+#define DTCP_PCP_HEADER_MAX (64)
+
+typedef struct _DtcpPacketPool DtcpPacketPool;
+
+/**
+ * Free-list of DTCPIP_Packet descriptors. A packet handed out keeps a
+ * reference on the pool, so packets still held by buffers downstream can
+ * be released after the element is gone. Acquired packets are zeroed
+*/
+DtcpPacketPool* dtcp_packet_pool_new( guint maxFree );
+void dtcp_packet_pool_unref( DtcpPacketPool *pool );
+DTCPIP_Packet* dtcp_packet_pool_acquire( DtcpPacketPool *pool );
+void dtcp_packet_pool_release( DTCPIP_Packet *packet );
+guint64 dtcp_packet_pool_get_allocations( DtcpPacketPool *pool );
+
+/* Packets acquired and not yet released, safe to call from any thread */
+guint dtcp_packet_pool_get_outstanding( DtcpPacketPool *pool );
+
+#ifdef USE_GST1
+/**
+ * Buffer pool of memory-less GstBuffers used to wrap encrypted output.
+ * Memory appended to a pooled buffer is removed when the buffer returns
+ * to the pool, which runs the memory's destroy notify, so the buffer
+ * itself is recycled
+*/
+GstBufferPool* gst_dtcp_enc_wrap_pool_new( void );
+#endif
+
+/** @} */
+
+G_END_DECLS
+
+#endif /* __GST_DTCPENC_POOL_H__ */
+
+/** @} */
+/** @} */
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Allocation benchmark for the dtcpenc output path in src/dtcpencrypt.
+ *
+ * Pushes buffers through a dtcpenc element running against the stand-in
+ * DTCP manager in dtcpmgr_standin.c, so every output buffer list is built
+ * by gst_dtcp_enc_push_packet. Runs once with the element's PCP header and
+ * wrap GstBufferPools deactivated, which makes push_packet allocate its
+ * header and wrapper buffers per packet as it did before the pools, and
+ * once with the pools active. Counts heap calls per input buffer in steady
+ * state (including the input buffer and the stand-in's output payload,
+ * which are the same for both runs) and the time each run takes.
+ *
+ * Build:
+ *   make dtcpenc_alloc_bench
+ * or
+ *   gcc -O2 -DUSE_GST1 -o dtcpenc_alloc_bench dtcpenc_alloc_bench.c dtcpmgr_standin.c \
+ *       ../gstdtcpenc.c ../gstdtcpencpool.c ../../common/tspsi.c -DVERSION='"test"' \
+ *       -I. -I.. -I../../common -I<dtcpmgr include dir> \
+ *       $(pkg-config --cflags --libs gstreamer-1.0 libsafec)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gst/gst.h>
+
+#include "gstdtcpenc.h"
+#include "dtcpmgr_standin.h"
+
+#define PAYLOAD_SIZE (188*7*16)
+#define ITERATIONS (200000)
+#define WARMUP (1000)
+
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t count, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void *__libc_memalign( size_t alignment, size_t size );
+
+static volatile long heapCalls= 0;
+static long outputLists= 0;
+
+void *malloc( size_t size )
+{
+   ++heapCalls;
+   return __libc_malloc( size );
+}
+
+void *calloc( size_t count, size_t size )
+{
+   ++heapCalls;
+   return __libc_calloc( count, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+   ++heapCalls;
+   return __libc_realloc( ptr, size );
+}
+
+int posix_memalign( void **ptr, size_t alignment, size_t size )
+{
+   ++heapCalls;
+   *ptr= __libc_memalign( alignment, size );
+   return (*ptr ? 0 : 12);
+}
+
+static double now_seconds( void )
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static GstFlowReturn drop_list( GstPad *pad, GstObject *parent, GstBufferList *list )
+{
+   (void)pad;
+   (void)parent;
+
+   ++outputLists;
+   gst_buffer_list_unref( list );
+
+   return GST_FLOW_OK;
+}
+
+static GstFlowReturn drop_buffer( GstPad *pad, GstObject *parent, GstBuffer *buffer )
+{
+   (void)pad;
+   (void)parent;
+
+   ++outputLists;
+   gst_buffer_unref( buffer );
+
+   return GST_FLOW_OK;
+}
+
+static gboolean push_buffers( GstPad *src, long count )
+{
+   long i;
+
+   for( i= 0; i < count; ++i ) {
+      GstBuffer *buffer= gst_buffer_new_allocate( NULL, PAYLOAD_SIZE, NULL );
+
+      if ( gst_pad_push( src, buffer ) != GST_FLOW_OK ) {
+         printf( "push of buffer %ld failed\n", i );
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+/* Measures one run, with the element's buffer pools active or not */
+static gboolean run( const char *name, gboolean pooled )
+{
+   GstElement *enc;
+   GstPad *src, *sink, *encSink, *encSrc;
+   GstSegment segment;
+   GstDtcpEnc *filter;
+   gboolean ok;
+   long calls;
+   double start, elapsed;
+
+   dtcpmgr_standin_pcp_every= 1;
+   dtcpmgr_standin_delay_us= 0;
+   outputLists= 0;
+
+   enc= gst_element_factory_make( "dtcpenc", NULL );
+   g_object_set( G_OBJECT(enc), "srctype", HNSRC, "remoteip", "127.0.0.1", NULL );
+   filter= GST_DTCPENC(enc);
+
+   src= gst_pad_new( "src", GST_PAD_SRC );
+   sink= gst_pad_new( "sink", GST_PAD_SINK );
+   gst_pad_set_chain_function( sink, drop_buffer );
+   gst_pad_set_chain_list_function( sink, drop_list );
+
+   encSink= gst_element_get_static_pad( enc, "sink" );
+   encSrc= gst_element_get_static_pad( enc, "src" );
+   gst_pad_link( src, encSink );
+   gst_pad_link( encSrc, sink );
+   gst_pad_set_active( src, TRUE );
+   gst_pad_set_active( sink, TRUE );
+   gst_element_set_state( enc, GST_STATE_PLAYING );
+
+   if ( !pooled ) {
+      /* acquire now fails, sending push_packet down its per-packet allocations */
+      gst_buffer_pool_set_active( filter->headerPool, FALSE );
+      gst_buffer_pool_set_active( filter->wrapPool, FALSE );
+   }
+
+   gst_pad_push_event( src, gst_event_new_stream_start( "dtcpenc-bench" ) );
+   gst_pad_push_event( src, gst_event_new_caps( gst_caps_from_string( "video/mpegts, systemstream=(boolean)true, packetsize=(int)188" ) ) );
+   gst_segment_init( &segment, GST_FORMAT_BYTES );
+   gst_pad_push_event( src, gst_event_new_segment( &segment ) );
+
+   ok= push_buffers( src, WARMUP );
+   calls= heapCalls;
+   start= now_seconds();
+   ok= ok && push_buffers( src, ITERATIONS );
+   elapsed= now_seconds() - start;
+   calls= heapCalls - calls;
+
+   if ( ok && (outputLists == WARMUP + ITERATIONS) ) {
+      printf( "%10s %16.2f %12.1f %14llu\n", name, (double)calls / ITERATIONS, elapsed * 1e9 / ITERATIONS,
+              (unsigned long long)dtcp_packet_pool_get_allocations( filter->packetPool ) );
+   } else {
+      printf( "%10s failed, %ld of %d buffers output\n", name, outputLists, WARMUP + ITERATIONS );
+      ok= FALSE;
+   }
+
+   gst_pad_push_event( src, gst_event_new_eos() );
+   gst_element_set_state( enc, GST_STATE_NULL );
+   gst_object_unref( encSink );
+   gst_object_unref( encSrc );
+   gst_object_unref( src );
+   gst_object_unref( sink );
+   gst_object_unref( enc );
+
+   return ok;
+}
+
+int main( int argc, char **argv )
+{
+   gboolean ok;
+
+   gst_init( &argc, &argv );
+   gst_element_register( NULL, "dtcpenc", GST_RANK_NONE, GST_TYPE_DTCPENC );
+
+   printf( "%10s %16s %12s %14s\n", "path", "heap calls/buf", "ns/buf", "descriptors" );
+   ok= run( "unpooled", FALSE );
+   ok= run( "pooled", TRUE ) && ok;
+
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Output ordering test for dtcpenc with the threads property set.
+ *
+ * Runs dtcpenc against the stand-in DTCP manager in dtcpmgr_standin.c,
+ * which completes packets out of order when they are encrypted on several
+ * threads. Pushes numbered buffers through the element and checks each
+ * output buffer list decrypts to the next buffer in sequence, that its
+ * PCP header belongs to that buffer, that EOS is only forwarded after the
+ * last buffer and that nothing is lost, that the workers never call
+ * into the DTCP session at the same time unless built for a re-entrant
+ * manager, and that going to READY leaves parallel mode. Repeats with the
+ * stand-in continuing PCPs across buffers, where dtcpenc must stay in the
+ * streaming thread.
+ *
+ * Build:
+ *   gcc -O2 -DUSE_GST1 -o dtcpenc_parallel_test dtcpenc_parallel_test.c dtcpmgr_standin.c \
+ *       ../gstdtcpenc.c ../gstdtcpencpool.c ../../common/tspsi.c -DVERSION='"test"' \
+ *       -I. -I.. -I../../common -I<dtcpmgr include dir> \
+ *       $(pkg-config --cflags --libs gstreamer-1.0 libsafec)
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "gstdtcpenc.h"
+#include "dtcpmgr_standin.h"
+
+#define BUFFER_COUNT (400)
+#define BUFFER_SIZE (188*7)
+
+typedef struct _TestState
+{
+   guint expected;
+   guint errors;
+   gboolean gotEos;
+   guint afterEos;
+} TestState;
+
+static TestState state;
+
+static void fill_buffer( guint8 *data, guint seq )
+{
+   guint i;
+
+   for( i= 0; i < BUFFER_SIZE; ++i ) {
+      data[i]= (guint8)(seq + i);
+   }
+   data[0]= (seq >> 24) & 0xFF;
+   data[1]= (seq >> 16) & 0xFF;
+   data[2]= (seq >> 8) & 0xFF;
+   data[3]= seq & 0xFF;
+}
+
+static GstFlowReturn collect_list( GstPad *pad, GstObject *parent, GstBufferList *list )
+{
+   guint8 expect[BUFFER_SIZE], payload[BUFFER_SIZE], header[DTCPMGR_STANDIN_PCP_HEADER_SIZE];
+   guint count, i;
+   gsize size;
+   GstBuffer *data;
+
+   (void)pad;
+   (void)parent;
+
+   if ( state.gotEos ) {
+      ++state.afterEos;
+   }
+
+   count= gst_buffer_list_length( list );
+   data= gst_buffer_list_get( list, count - 1 );
+   size= gst_buffer_get_size( data );
+   if ( (size != BUFFER_SIZE) || (count > 2) ) {
+      printf( "buffer %u: unexpected output layout, %u buffers, payload %u bytes\n",
+              state.expected, count, (guint)size );
+      ++state.errors;
+      goto done;
+   }
+
+   gst_buffer_extract( data, 0, payload, BUFFER_SIZE );
+   for( i= 0; i < BUFFER_SIZE; ++i ) {
+      payload[i] ^= DTCPMGR_STANDIN_KEY;
+   }
+   fill_buffer( expect, state.expected );
+   if ( memcmp( payload, expect, BUFFER_SIZE ) ) {
+      printf( "buffer %u: got buffer %u\n", state.expected,
+              (payload[0]<<24)|(payload[1]<<16)|(payload[2]<<8)|payload[3] );
+      ++state.errors;
+   }
+
+   if ( count == 2 ) {
+      if ( (gst_buffer_get_size( gst_buffer_list_get( list, 0 ) ) != DTCPMGR_STANDIN_PCP_HEADER_SIZE) ||
+           (gst_buffer_extract( gst_buffer_list_get( list, 0 ), 0, header, sizeof(header) ) != sizeof(header)) ||
+           memcmp( header + 2, expect, 8 ) ) {
+         printf( "buffer %u: PCP header does not belong to the buffer\n", state.expected );
+         ++state.errors;
+      }
+   }
+
+done:
+   ++state.expected;
+   gst_buffer_list_unref( list );
+
+   return GST_FLOW_OK;
+}
+
+static GstFlowReturn collect_buffer( GstPad *pad, GstObject *parent, GstBuffer *buffer )
+{
+   GstBufferList *list= gst_buffer_list_new();
+
+   gst_buffer_list_add( list, buffer );
+
+   return collect_list( pad, parent, list );
+}
+
+static gboolean collect_event( GstPad *pad, GstObject *parent, GstEvent *event )
+{
+   if ( GST_EVENT_TYPE(event) == GST_EVENT_EOS ) {
+      if ( state.expected != BUFFER_COUNT ) {
+         printf( "EOS after %u of %u buffers\n", state.expected, BUFFER_COUNT );
+         ++state.errors;
+      }
+      state.gotEos= TRUE;
+   }
+
+   return gst_pad_event_default( pad, parent, event );
+}
+
+static int run( guint threads, int pcpEvery, gboolean expectParallel )
+{
+   GstElement *enc;
+   GstPad *src, *sink, *encSink, *encSrc;
+   GstSegment segment;
+   guint i, processed= 0;
+   int failed;
+
+   memset( &state, 0, sizeof(state) );
+   dtcpmgr_standin_pcp_every= pcpEvery;
+   dtcpmgr_standin_max_concurrent= 0;
+
+   enc= gst_element_factory_make( "dtcpenc", NULL );
+   g_object_set( G_OBJECT(enc), "threads", threads, "srctype", HNSRC, "remoteip", "127.0.0.1", NULL );
+
+   src= gst_pad_new( "src", GST_PAD_SRC );
+   sink= gst_pad_new( "sink", GST_PAD_SINK );
+   gst_pad_set_chain_function( sink, collect_buffer );
+   gst_pad_set_chain_list_function( sink, collect_list );
+   gst_pad_set_event_function( sink, collect_event );
+
+   encSink= gst_element_get_static_pad( enc, "sink" );
+   encSrc= gst_element_get_static_pad( enc, "src" );
+   gst_pad_link( src, encSink );
+   gst_pad_link( encSrc, sink );
+   gst_pad_set_active( src, TRUE );
+   gst_pad_set_active( sink, TRUE );
+   gst_element_set_state( enc, GST_STATE_PLAYING );
+
+   gst_pad_push_event( src, gst_event_new_stream_start( "dtcpenc-test" ) );
+   gst_pad_push_event( src, gst_event_new_caps( gst_caps_from_string( "video/mpegts, systemstream=(boolean)true, packetsize=(int)188" ) ) );
+   gst_segment_init( &segment, GST_FORMAT_BYTES );
+   gst_pad_push_event( src, gst_event_new_segment( &segment ) );
+
+   for( i= 0; i < BUFFER_COUNT; ++i ) {
+      GstBuffer *buffer= gst_buffer_new_allocate( NULL, BUFFER_SIZE, NULL );
+      GstMapInfo map;
+
+      gst_buffer_map( buffer, &map, GST_MAP_WRITE );
+      fill_buffer( map.data, i );
+      gst_buffer_unmap( buffer, &map );
+      if ( gst_pad_push( src, buffer ) != GST_FLOW_OK ) {
+         printf( "push of buffer %u failed\n", i );
+         ++state.errors;
+         break;
+      }
+   }
+   gst_pad_push_event( src, gst_event_new_eos() );
+
+   if ( !state.gotEos || state.afterEos ) {
+      printf( "EOS %s, %u buffers after it\n", state.gotEos ? "seen" : "missing", state.afterEos );
+      ++state.errors;
+   }
+   g_object_get( G_OBJECT(enc), "packets-processed", &processed, NULL );
+   if ( processed != BUFFER_COUNT ) {
+      printf( "packets-processed %u expected %u\n", processed, BUFFER_COUNT );
+      ++state.errors;
+   }
+   if ( GST_DTCPENC(enc)->parallel != expectParallel ) {
+      printf( "parallel mode %s\n", GST_DTCPENC(enc)->parallel ? "on" : "off" );
+      ++state.errors;
+   }
+#ifndef DTCP_MGR_REENTRANT_SESSION
+   if ( threads && GST_DTCPENC(enc)->workerThreads != 1 ) {
+      printf( "%u worker threads on a non re-entrant session\n", GST_DTCPENC(enc)->workerThreads );
+      ++state.errors;
+   }
+   if ( dtcpmgr_standin_max_concurrent > 1 ) {
+      printf( "%d concurrent calls on the DTCP session\n", dtcpmgr_standin_max_concurrent );
+      ++state.errors;
+   }
+#endif
+
+   gst_element_set_state( enc, GST_STATE_READY );
+   if ( GST_DTCPENC(enc)->parallel || GST_DTCPENC(enc)->parallelProbe ) {
+      printf( "parallel mode not reset in READY\n" );
+      ++state.errors;
+   }
+
+   gst_element_set_state( enc, GST_STATE_NULL );
+   gst_object_unref( encSink );
+   gst_object_unref( encSrc );
+   gst_object_unref( src );
+   gst_object_unref( sink );
+   gst_object_unref( enc );
+
+   failed= (state.errors != 0);
+   printf( "threads %u pcp every %d: %s\n", threads, pcpEvery, failed ? "FAIL" : "PASS" );
+
+   return failed;
+}
+
+int main( int argc, char **argv )
+{
+   int failed= 0;
+
+   gst_init( &argc, &argv );
+   gst_element_register( NULL, "dtcpenc", GST_RANK_NONE, GST_TYPE_DTCPENC );
+
+   failed |= run( 0, 1, FALSE );
+   failed |= run( 1, 1, TRUE );
+   failed |= run( 4, 1, TRUE );
+   failed |= run( DTCP_ENC_MAX_THREADS, 1, TRUE );
+   failed |= run( 4, 4, FALSE );
+
+   return failed;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Stand-in for the DTCP manager library used by the dtcpenc tests.
+ *
+ * "Encrypts" by XOR with DTCPMGR_STANDIN_KEY into a buffer it allocates,
+ * and sleeps a pseudo random 0 to dtcpmgr_standin_delay_us per packet so
+ * packets processed on several threads complete out of order. By default every packet starts
+ * its own PCP: a 14 byte header at offset 0 carrying the first 8 input
+ * bytes as nonce and the payload length. With dtcpmgr_standin_pcp_every
+ * set to N > 1 only every Nth packet gets a header, like a manager that
+ * continues a PCP across buffers. Records how many calls overlapped in
+ * dtcpmgr_standin_max_concurrent.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dtcpmgr.h"
+#include "dtcpmgr_standin.h"
+
+int dtcpmgr_standin_pcp_every= 1;
+int dtcpmgr_standin_delay_us= 2000;
+int dtcpmgr_standin_max_concurrent= 0;
+
+static unsigned int standinCalls= 0;
+static int standinActive= 0;
+
+int DTCPMgrCreateSourceSession( char *remoteIp, int keyLabel, int pcpPacketSize, int maxPacketSize,
+                                DTCP_SESSION_HANDLE *session )
+{
+   (void)remoteIp;
+   (void)keyLabel;
+   (void)pcpPacketSize;
+   (void)maxPacketSize;
+
+   *session= (DTCP_SESSION_HANDLE)1;
+
+   return 0;
+}
+
+int DTCPMgrDeleteDTCPSession( DTCP_SESSION_HANDLE session )
+{
+   (void)session;
+
+   return 0;
+}
+
+int DTCPMgrProcessPacket( DTCP_SESSION_HANDLE session, DTCPIP_Packet *packet )
+{
+   unsigned char *alloc, *in, *out;
+   unsigned int i, call;
+   int active, seen;
+
+   (void)session;
+
+   call= __sync_fetch_and_add( &standinCalls, 1 );
+   active= __sync_add_and_fetch( &standinActive, 1 );
+   while( (seen= dtcpmgr_standin_max_concurrent) < active ) {
+      __sync_bool_compare_and_swap( &dtcpmgr_standin_max_concurrent, seen, active );
+   }
+
+   alloc= (unsigned char*)malloc( DTCPMGR_STANDIN_PCP_HEADER_SIZE + packet->dataLength );
+   if ( !alloc ) {
+      __sync_sub_and_fetch( &standinActive, 1 );
+      return -1;
+   }
+   in= (unsigned char*)packet->dataInPtr;
+   out= alloc + DTCPMGR_STANDIN_PCP_HEADER_SIZE;
+   for( i= 0; i < packet->dataLength; ++i ) {
+      out[i]= in[i] ^ DTCPMGR_STANDIN_KEY;
+   }
+
+   packet->pcpHeader= alloc;
+   packet->dataOutPtr= out;
+   if ( (dtcpmgr_standin_pcp_every <= 1) || ((call % dtcpmgr_standin_pcp_every) == 0) ) {
+      alloc[0]= packet->emi;
+      alloc[1]= 0;
+      memcpy( alloc + 2, in, 8 );
+      alloc[10]= (packet->dataLength >> 24) & 0xFF;
+      alloc[11]= (packet->dataLength >> 16) & 0xFF;
+      alloc[12]= (packet->dataLength >> 8) & 0xFF;
+      alloc[13]= packet->dataLength & 0xFF;
+      packet->pcpHeaderLength= DTCPMGR_STANDIN_PCP_HEADER_SIZE;
+      packet->pcpHeaderOffset= 0;
+   } else {
+      packet->pcpHeaderLength= 0;
+      packet->pcpHeaderOffset= -1;
+   }
+
+   if ( dtcpmgr_standin_delay_us > 0 ) {
+      usleep( ((call * 2654435761U) >> 16) % dtcpmgr_standin_delay_us );
+   }
+   __sync_sub_and_fetch( &standinActive, 1 );
+
+   return 0;
+}
+
+int DTCPMgrReleasePacket( DTCPIP_Packet *packet )
+{
+   free( packet->pcpHeader );
+   packet->pcpHeader= NULL;
+   packet->dataOutPtr= NULL;
+
+   return 0;
+}
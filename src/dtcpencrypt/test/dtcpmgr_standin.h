@@ -0,0 +1,35 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __DTCPMGR_STANDIN_H__
+#define __DTCPMGR_STANDIN_H__
+
+#define DTCPMGR_STANDIN_KEY (0x5A)
+#define DTCPMGR_STANDIN_PCP_HEADER_SIZE (14)
+
+/* Emit a PCP header on every Nth packet only, 1 for every packet */
+extern int dtcpmgr_standin_pcp_every;
+
+/* Upper bound of the random delay per packet in microseconds, 0 for none */
+extern int dtcpmgr_standin_delay_us;
+
+/* Most DTCPMgrProcessPacket calls seen running at the same time */
+extern int dtcpmgr_standin_max_concurrent;
+
+#endif /* __DTCPMGR_STANDIN_H__ */
@@ -34,6 +34,7 @@
 #include <linux/dvb/dmx.h>
 
 #include "gstdtvsource.h"
+#include "crc32mpeg.h"
 #include "safec_lib.h"
 
 #define SPTS_BUFFER_SIZE   (188 * 4096)
@@ -60,8 +61,6 @@ static gboolean gst_dtv_source_is_seekable(GstBaseSrc * bsrc);
 static void* gst_dtv_read_data_thread(void *arg);
 
 static void dtv_source_create_pat(guchar *pat, guint service_id, guint pmt_pid, guint8 version);
-static void dtv_source_init_crc_table(void);
-static guint32 dtv_source_calc_crc32(guchar *data, guint size);
 static gint64 dtv_source_get_clock_msecs(void);
 
 
@@ -70,8 +69,6 @@ static gint64 dtv_source_get_clock_msecs(void);
    "  systemstream=(boolean)true, " \
    "  packetsize=(int)188;"
 
-static guint32 crc32_table[256];
-
 static GstStaticPadTemplate gst_dtv_source_pad_template = GST_STATIC_PAD_TEMPLATE("src",
    GST_PAD_SRC,
    GST_PAD_ALWAYS,
@@ -204,8 +201,6 @@ static void gst_dtv_source_init(GstDtvSource *src)
    src->pat_count = 0;
    src->pat_version = 0;
 
-   dtv_source_init_crc_table();
-
    pthread_mutex_init(&src->buffer_mutex, 0);
    pthread_cond_init(&src->data_in_buffer, 0);
 
@@ -904,7 +899,7 @@ static void dtv_source_create_pat(guchar *pat, guint service_id, guint pmt_pid,
    pat[15] = 0xE0 | ((pmt_pid >> 8) & 0x1F);
    pat[16] = (guchar)(pmt_pid & 0xFF);
 
-   crc = dtv_source_calc_crc32(&pat[5], 12);
+   crc = crc32_mpeg(&pat[5], 12);
 
    // 4 bytes of CRC
    pat[17] = (crc >> 24) & 0xFF;
@@ -919,36 +914,6 @@ static void dtv_source_create_pat(guchar *pat, guint service_id, guint pmt_pid,
    }
 }
 
-static void dtv_source_init_crc_table(void)
-{
-   guint32 i, j, k;
-
-   for (i = 0; i < 256; i++)
-   {
-      k = 0;
-
-      for (j = (i << 24) | 0x800000; j != 0x80000000; j <<= 1)
-      {
-         k = (k << 1) ^ (((k ^ j) & 0x80000000) ? 0x04c11db7 : 0);
-      }
-
-      crc32_table[i] = k;
-   }
-}
-
-static guint32 dtv_source_calc_crc32(guchar *data, guint size)
-{
-   guint i;
-   guint32 result = 0xffffffff;
-
-   for (i = 0; i < size; i++)
-   {
-      result = (result << 8) ^ crc32_table[(result >> 24) ^ data[i]];
-   }
-
-   return result;
-}
-
 static gboolean dtvsource_init(GstPlugin *plugin)
 {
    gst_element_register(plugin, "dtvsource", GST_RANK_NONE, gst_dtv_source_get_type());
@@ -43,12 +43,62 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#if defined(USE_GST1) && defined(HAVE_GST_ALLOCATORS)
+#include <gst/allocators/gstfdmemory.h>
+#include <sys/sendfile.h>
+#define HTTPSINK_HAVE_SENDFILE 1
+#endif
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HTTPSINK_HAVE_ZEROCOPY 1
+#endif
+#ifdef SO_MAX_PACING_RATE
+#define HTTPSINK_HAVE_PACING_RATE 1
+#endif
+
 #define DATA_BUFFER_SIZE       32
 
 #define GST_PACKAGE_ORIGIN "http://gstreamer.net/"
 
 #define DEFAULT_SOURCE_TYPE "QAM_SRC"
 #define DEFAULT_SOURCE_ID "ocap://0x0000"
+#define DEFAULT_USE_SENDFILE TRUE
+#define DEFAULT_ZEROCOPY_THRESHOLD 0
+
+/* Upper bound on how long outstanding zerocopy completions are awaited
+ * before the held buffers are released anyway */
+#define ZEROCOPY_DRAIN_TIMEOUT_MS 200
+
+#define DEFAULT_ASYNC FALSE
+#define DEFAULT_MAX_QUEUE_BUFFERS 256
+#define DEFAULT_MAX_QUEUE_BYTES (4 * 1024 * 1024)
+#define DEFAULT_OVERFLOW_POLICY GST_HTTP_SINK_OVERFLOW_BLOCK
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_SHARED_WRITER FALSE
+#define DEFAULT_WRITER_THREADS 1
+#define DEFAULT_WRITER_BACKEND GST_HTTP_SINK_WRITER_EPOLL
+#define DEFAULT_START_OFFSET 0
+#define DEFAULT_PACING GST_HTTP_SINK_PACING_NONE
+#define DEFAULT_PACING_BURST (188 * 7 * 32)
+
+/* Bitrate estimation window and the margin paced sends get on top of the
+ * estimate, so that the client keeps up with rate changes of the stream */
+#define PACING_RATE_WINDOW_US (2 * G_USEC_PER_SEC)
+#define PACING_HEADROOM_PERCENT 125
+
+/* Buffers the shared writer sends to one client before serving the others */
+#define WRITER_CLIENT_BUDGET 16
+#define WRITER_MAX_EVENTS 64
+#define WRITER_URING_ENTRIES 256
 
 static void
 gst_http_sink_dispose (GObject * object);
@@ -62,6 +112,10 @@ static gboolean
 gst_http_sink_start (GstBaseSink * bsink);
 static gboolean
 gst_http_sink_stop (GstBaseSink * bsink);
+static gboolean
+gst_http_sink_unlock (GstBaseSink * bsink);
+static gboolean
+gst_http_sink_unlock_stop (GstBaseSink * bsink);
 static GstFlowReturn
 gst_http_sink_render (GstBaseSink * sink, GstBuffer * buf);
 static gboolean 
@@ -76,6 +130,49 @@ gst_http_sink_pad_query (GstPad * pad, GstQuery * query);
 #endif
 
 
+static void
+gst_http_sink_zerocopy_flush (GstHttpSinkClient * client);
+static void
+gst_http_sink_lock_queue (GstHttpSinkClient * client);
+static void
+gst_http_sink_unlock_queue (GstHttpSinkClient * client);
+static gboolean
+gst_http_sink_start_sender (GstHttpSinkClient * client);
+static void
+gst_http_sink_stop_sender (GstHttpSinkClient * client);
+static void
+gst_http_sink_start_stats (GstHttpSink * httpsink);
+static void
+gst_http_sink_stop_stats (GstHttpSink * httpsink);
+static void
+gst_http_sink_set_stats_interval (GstHttpSink * httpsink, guint interval);
+static GstHttpSinkClient *
+gst_http_sink_client_new (GstHttpSink * httpsink, gint fd, gboolean chunked);
+static GstHttpSinkClient *
+gst_http_sink_client_ref (GstHttpSinkClient * client);
+static void
+gst_http_sink_client_unref (GstHttpSinkClient * client);
+static gboolean
+gst_http_sink_writer_acquire (GstHttpSinkWriterBackend backend, guint n_threads);
+static void
+gst_http_sink_writer_release (void);
+static gboolean
+gst_http_sink_writer_attach (GstHttpSinkClient * client);
+static void
+gst_http_sink_writer_attach_or_fallback (GstHttpSinkClient * client);
+static void
+gst_http_sink_writer_detach (GstHttpSinkClient * client);
+static void
+gst_http_sink_writer_wakeup (GstHttpSinkClient * client);
+static void
+gst_http_sink_writer_drop_item (GstHttpSinkClient * client);
+static gboolean
+gst_http_sink_add_client (GstHttpSink * httpsink, gint fd, gboolean chunked);
+static gboolean
+gst_http_sink_remove_client (GstHttpSink * httpsink, gint fd);
+static GstStructure *
+gst_http_sink_create_stats (GstHttpSink * httpsink);
+
 static GstStaticPadTemplate gst_http_sink_pad_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
@@ -97,8 +194,89 @@ enum
   PROP_SOURCE_ID,
   PROP_SEND_DATA_TIME,
   PROP_SEND_STATUS,
+  PROP_USE_SENDFILE,
+  PROP_ZEROCOPY_THRESHOLD,
+  PROP_ASYNC,
+  PROP_MAX_QUEUE_BUFFERS,
+  PROP_MAX_QUEUE_BYTES,
+  PROP_OVERFLOW_POLICY,
+  PROP_QUEUE_LEVEL_BUFFERS,
+  PROP_QUEUE_LEVEL_BYTES,
+  PROP_DROPPED_BUFFERS,
+  PROP_DROPPED_BYTES,
+  PROP_NUM_CLIENTS,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_SHARED_WRITER,
+  PROP_WRITER_THREADS,
+  PROP_WRITER_BACKEND,
+  PROP_START_OFFSET,
+  PROP_PACING,
+  PROP_PACING_BURST,
+  PROP_STREAM_BITRATE,
+};
+
+enum
+{
+  SIGNAL_ADD_CLIENT,
+  SIGNAL_REMOVE_CLIENT,
+  LAST_SIGNAL
 };
 
+static guint gst_http_sink_signals[LAST_SIGNAL] = { 0 };
+
+GType
+gst_http_sink_overflow_policy_get_type (void)
+{
+  static GType overflow_policy_type = 0;
+  static const GEnumValue overflow_policies[] = {
+    {GST_HTTP_SINK_OVERFLOW_BLOCK, "Block upstream until there is room", "block"},
+    {GST_HTTP_SINK_OVERFLOW_DROP_TO_KEYFRAME, "Drop oldest buffers up to the next keyframe", "drop-to-keyframe"},
+    {GST_HTTP_SINK_OVERFLOW_DISCONNECT, "Disconnect the client", "disconnect"},
+    {0, NULL, NULL}
+  };
+
+  if (!overflow_policy_type) {
+    overflow_policy_type =
+        g_enum_register_static ("GstHttpSinkOverflowPolicy", overflow_policies);
+  }
+  return overflow_policy_type;
+}
+
+GType
+gst_http_sink_writer_backend_get_type (void)
+{
+  static GType writer_backend_type = 0;
+  static const GEnumValue writer_backends[] = {
+    {GST_HTTP_SINK_WRITER_EPOLL, "Non-blocking sendmsg() driven by epoll", "epoll"},
+    {GST_HTTP_SINK_WRITER_IO_URING, "Batched sendmsg submitted through io_uring", "io-uring"},
+    {0, NULL, NULL}
+  };
+
+  if (!writer_backend_type) {
+    writer_backend_type =
+        g_enum_register_static ("GstHttpSinkWriterBackend", writer_backends);
+  }
+  return writer_backend_type;
+}
+
+GType
+gst_http_sink_pacing_get_type (void)
+{
+  static GType pacing_type = 0;
+  static const GEnumValue pacings[] = {
+    {GST_HTTP_SINK_PACING_NONE, "Send at line rate", "none"},
+    {GST_HTTP_SINK_PACING_KERNEL, "Limit the socket with SO_MAX_PACING_RATE", "kernel"},
+    {GST_HTTP_SINK_PACING_USERSPACE, "Spread sends with a token bucket", "userspace"},
+    {0, NULL, NULL}
+  };
+
+  if (!pacing_type) {
+    pacing_type = g_enum_register_static ("GstHttpSinkPacing", pacings);
+  }
+  return pacing_type;
+}
+
 #ifdef USE_GST1
 #define gst_http_sink_parent_class parent_class
 G_DEFINE_TYPE (GstHttpSink, gst_http_sink, GST_TYPE_BASE_SINK);
@@ -114,6 +292,7 @@ gst_http_sink_change_state (GstElement * element, GstStateChange transition)
 
   GstPad *pad =  gst_element_get_static_pad (element, "sink");
   GstHttpSink *httpsink = GST_HTTP_SINK (GST_OBJECT_PARENT (pad));
+  GList *l;
 
 //  GST_INFO_OBJECT(element, "change state from %s to %s\n",
 //      gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
@@ -129,16 +308,33 @@ gst_http_sink_change_state (GstElement * element, GstStateChange transition)
     }
     case GST_STATE_CHANGE_READY_TO_PAUSED:
     {
-		httpsink->sendError = FALSE;
+		g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+		for (l = httpsink->clients; l; l = l->next)
+			((GstHttpSinkClient *) l->data)->sendError = FALSE;
+		g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
 //         GST_INFO_OBJECT(element, "GST_STATE_CHANGE_READY_TO_PAUSED\n");
       break;
     }
 
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
     {
-  		httpsink->sent_data_size= 0;
-		httpsink->packetcount = 0;
-		httpsink->sendError = FALSE;
+		g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+		for (l = httpsink->clients; l; l = l->next) {
+			GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+			client->sent_data_size= 0;
+			client->packetcount = 0;
+			client->sendError = FALSE;
+			client->send_calls = 0;
+			client->short_writes = 0;
+			client->blocked_time = 0;
+			client->max_block_time = 0;
+			client->first_send_time = 0;
+			client->rate_window_start = 0;
+			client->bitrate = 0;
+			client->latency_count = 0;
+			memset (client->latency_hist, 0, sizeof (client->latency_hist));
+		}
+		g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
 //         GST_INFO_OBJECT(element, "GST_STATE_CHANGE_PAUSED_TO_PLAYING\n");
       break;
     }
@@ -254,10 +450,123 @@ gst_http_sink_class_init (GstHttpSinkClass * klass)
       g_param_spec_boolean ("send_status", "send status", "current send status",
           FALSE, (GParamFlags) G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_USE_SENDFILE,
+      g_param_spec_boolean ("use-sendfile", "use sendfile", "Send file/memfd backed buffers with sendfile() in linear mode",
+          DEFAULT_USE_SENDFILE, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ZEROCOPY_THRESHOLD,
+      g_param_spec_uint ("zerocopy-threshold", "zerocopy threshold", "Send payloads of at least this many bytes with MSG_ZEROCOPY (0: disabled)",
+          0, G_MAXUINT, DEFAULT_ZEROCOPY_THRESHOLD, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC,
+      g_param_spec_boolean ("async", "async", "Send from a dedicated thread per client fed by a bounded queue so a slow client does not block upstream (applied on start)",
+          DEFAULT_ASYNC, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUE_BUFFERS,
+      g_param_spec_uint ("max-queue-buffers", "max queue buffers", "Maximum number of buffers in each async send queue (applied on start)",
+          1, G_MAXUINT, DEFAULT_MAX_QUEUE_BUFFERS, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUE_BYTES,
+      g_param_spec_uint ("max-queue-bytes", "max queue bytes", "Maximum number of bytes in each async send queue",
+          1, G_MAXUINT, DEFAULT_MAX_QUEUE_BYTES, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_OVERFLOW_POLICY,
+      g_param_spec_enum ("overflow-policy", "overflow policy", "Action taken when the async send queue is full",
+          GST_TYPE_HTTP_SINK_OVERFLOW_POLICY, DEFAULT_OVERFLOW_POLICY, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_LEVEL_BUFFERS,
+      g_param_spec_uint ("queue-level-buffers", "queue level buffers", "Current number of buffers in the async send queues of all clients",
+          0, G_MAXUINT, 0, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_LEVEL_BYTES,
+      g_param_spec_uint64 ("queue-level-bytes", "queue level bytes", "Current number of bytes in the async send queues of all clients",
+          0, G_MAXUINT64, 0, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DROPPED_BUFFERS,
+      g_param_spec_uint64 ("dropped-buffers", "dropped buffers", "Buffers discarded because the async send queue was full",
+          0, G_MAXUINT64, 0, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DROPPED_BYTES,
+      g_param_spec_uint64 ("dropped-bytes", "dropped bytes", "Bytes discarded because the async send queue was full",
+          0, G_MAXUINT64, 0, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_NUM_CLIENTS,
+      g_param_spec_uint ("num-clients", "num clients", "Number of clients the stream is written to, including http obj",
+          0, G_MAXUINT, 0, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "stats", "Bytes, bitrates, send() calls, short writes, time blocked in send(), queue depth and arrival-to-wire latency percentiles of every client",
+          GST_TYPE_STRUCTURE, (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "stats interval", "Post the stats as httpsink-stats element message every N ms while streaming (0: disabled)",
+          0, G_MAXUINT, DEFAULT_STATS_INTERVAL, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_WRITER,
+      g_param_spec_boolean ("shared-writer", "shared writer", "Queue buffers for the process wide epoll writer instead of sending from the streaming thread (applied on start)",
+          DEFAULT_SHARED_WRITER, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_WRITER_THREADS,
+      g_param_spec_uint ("writer-threads", "writer threads", "Number of threads of the shared writer, used by the element that starts it first",
+          1, 64, DEFAULT_WRITER_THREADS, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_WRITER_BACKEND,
+      g_param_spec_enum ("writer-backend", "writer backend", "How the shared writer sends, used by the element that starts it first. io-uring falls back to epoll when unavailable",
+          GST_TYPE_HTTP_SINK_WRITER_BACKEND, DEFAULT_WRITER_BACKEND, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_START_OFFSET,
+      g_param_spec_uint64 ("start-offset", "start offset", "Byte offset in the stream the client already has, data before it is not sent (resumed downloads)",
+          0, G_MAXUINT64, DEFAULT_START_OFFSET, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_PACING,
+      g_param_spec_enum ("pacing", "pacing", "Send at the estimated stream bitrate instead of forwarding upstream bursts at line rate",
+          GST_TYPE_HTTP_SINK_PACING, DEFAULT_PACING, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_PACING_BURST,
+      g_param_spec_uint ("pacing-burst", "pacing burst", "Bytes userspace pacing sends back to back, larger buffers are sent in slices of this size",
+          188, G_MAXUINT, DEFAULT_PACING_BURST, (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_BITRATE,
+      g_param_spec_uint64 ("stream-bitrate", "stream bitrate", "Bitrate of the stream estimated from buffer timestamps, bit/s (0: not known yet)",
+          0, G_MAXUINT64, 0, (GParamFlags) G_PARAM_READABLE));
+
+  /**
+   * GstHttpSink::add-client:
+   * @fd: connected socket
+   * @chunked: send with chunked transfer encoding
+   *
+   * Writes the stream to @fd as well, sharing the buffers with the other
+   * clients. Returns FALSE if @fd is invalid or already added.
+   */
+  gst_http_sink_signals[SIGNAL_ADD_CLIENT] =
+      g_signal_new ("add-client", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstHttpSinkClass, add_client), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 2, G_TYPE_INT, G_TYPE_BOOLEAN);
+
+  /**
+   * GstHttpSink::remove-client:
+   * @fd: socket passed to add-client
+   *
+   * Stops writing to @fd. Once it returns the caller owns @fd again and may
+   * close it.
+   */
+  gst_http_sink_signals[SIGNAL_REMOVE_CLIENT] =
+      g_signal_new ("remove-client", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstHttpSinkClass, remove_client), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 1, G_TYPE_INT);
+
+  klass->add_client = gst_http_sink_add_client;
+  klass->remove_client = gst_http_sink_remove_client;
+
   gstbasesink_class->get_times = 0;
   gstbasesink_class->start = gst_http_sink_start;
   gstbasesink_class->stop = gst_http_sink_stop;
   gstbasesink_class->render = gst_http_sink_render;
+  gstbasesink_class->unlock = gst_http_sink_unlock;
+  gstbasesink_class->unlock_stop = gst_http_sink_unlock_stop;
+  gstbasesink_class->event = gst_http_sink_event;
   
   gstelement_class->query = gst_http_sink_query;
 
@@ -284,12 +593,35 @@ gst_http_sink_init (GstHttpSink *httpsink, GstHttpSinkClass *g_class )
   GstPad *pad;
   pad = GST_BASE_SINK_PAD (httpsink);
   httpsink->silent= TRUE;
-  httpsink->http_obj= -1;
-  httpsink->is_chunked= TRUE;
+  httpsink->http_client= gst_http_sink_client_new (httpsink, -1, TRUE);
+  httpsink->clients= g_list_append (NULL, httpsink->http_client);
+  httpsink->started= FALSE;
   httpsink->last_timestamp= 0LL;
-  httpsink->sent_data_size= 0;
-  httpsink->sendError = FALSE;
-  httpsink->last_send_time= 0LL;
+  httpsink->use_sendfile= DEFAULT_USE_SENDFILE;
+  httpsink->zerocopy_threshold= DEFAULT_ZEROCOPY_THRESHOLD;
+  httpsink->async= DEFAULT_ASYNC;
+  httpsink->max_queue_buffers= DEFAULT_MAX_QUEUE_BUFFERS;
+  httpsink->max_queue_bytes= DEFAULT_MAX_QUEUE_BYTES;
+  httpsink->overflow_policy= DEFAULT_OVERFLOW_POLICY;
+  httpsink->stats_interval= DEFAULT_STATS_INTERVAL;
+  httpsink->shared_writer= DEFAULT_SHARED_WRITER;
+  httpsink->writer_threads= DEFAULT_WRITER_THREADS;
+  httpsink->writer_backend= DEFAULT_WRITER_BACKEND;
+  httpsink->start_offset= DEFAULT_START_OFFSET;
+  httpsink->pacing= DEFAULT_PACING;
+  httpsink->pacing_burst= DEFAULT_PACING_BURST;
+  httpsink->byte_offset= 0;
+  httpsink->writer_acquired= FALSE;
+  httpsink->last_stats_post= 0;
+  httpsink->stats_thread= NULL;
+  httpsink->stats_running= FALSE;
+#ifdef GLIB_VERSION_2_32
+  g_mutex_init (&httpsink->stats_lock);
+  g_cond_init (&httpsink->stats_cond);
+#else
+  httpsink->stats_lock= g_mutex_new ();
+  httpsink->stats_cond= g_cond_new ();
+#endif
   g_static_rec_mutex_init (&httpsink->http_obj_mutex);
   gst_pad_set_query_function (pad, GST_DEBUG_FUNCPTR (gst_http_sink_pad_query));
   gst_base_sink_set_sync (GST_BASE_SINK (httpsink), FALSE);
@@ -304,7 +636,21 @@ gst_http_sink_dispose (GObject * object)
   if (sink->caps)
     gst_caps_unref (sink->caps);
 
+  if (sink->clients) {
+    g_list_foreach (sink->clients, (GFunc) gst_http_sink_client_unref, NULL);
+    g_list_free (sink->clients);
+    sink->clients = NULL;
+    sink->http_client = NULL;
+  }
+
   g_static_rec_mutex_free (&sink->http_obj_mutex);
+#ifdef GLIB_VERSION_2_32
+  g_mutex_clear (&sink->stats_lock);
+  g_cond_clear (&sink->stats_cond);
+#else
+  g_mutex_free (sink->stats_lock);
+  g_cond_free (sink->stats_cond);
+#endif
 
   GST_HTTP_SINK_GET_CLASS(sink)->parent_dispose(object);
 }
@@ -322,13 +668,24 @@ gst_http_sink_set_property (GObject * object, guint prop_id,
       sink->silent = g_value_get_boolean (value);
       break;
     case PROP_HTTP_OBJ:
-      g_static_rec_mutex_lock (&sink->http_obj_mutex);
-      sink->http_obj = g_value_get_int (value);
-      g_static_rec_mutex_unlock (&sink->http_obj_mutex);
-      GST_INFO_OBJECT(sink, "HTTP_OBJ socket 0x%x", sink->http_obj);
+      g_static_rec_mutex_lock (&sink->http_client->write_mutex);
+      if (sink->http_client->writer_thread)
+        gst_http_sink_writer_detach (sink->http_client);
+      sink->http_client->fd = g_value_get_int (value);
+      /* a new connection after a socket error resumes output without a state change */
+      if (sink->http_client->fd != -1)
+        sink->http_client->sendError = FALSE;
+      if (sink->http_client->zerocopy_fd != sink->http_client->fd)
+        gst_http_sink_zerocopy_flush (sink->http_client);
+      /* a new connection may support zerocopy even if it reuses the fd number */
+      sink->http_client->zerocopy_failed_fd = -1;
+      if (sink->http_client->queue_ring && sink->writer_acquired && sink->http_client->fd != -1)
+        gst_http_sink_writer_attach_or_fallback (sink->http_client);
+      g_static_rec_mutex_unlock (&sink->http_client->write_mutex);
+      GST_INFO_OBJECT(sink, "HTTP_OBJ socket 0x%x", sink->http_client->fd);
       break;
     case PROP_STREAM_TYPE:
-      sink->is_chunked = g_value_get_boolean (value);
+      sink->http_client->is_chunked = g_value_get_boolean (value);
       break;
     case PROP_SOURCE_TYPE:
       rc = strcpy_s( sink->source_type, sizeof(sink->source_type), g_value_get_string (value) );
@@ -346,6 +703,45 @@ gst_http_sink_set_property (GObject * object, guint prop_id,
       }
       GST_INFO_OBJECT(sink, "Source Id: %s", sink->source_id);
       break;
+    case PROP_USE_SENDFILE:
+      sink->use_sendfile = g_value_get_boolean (value);
+      break;
+    case PROP_ZEROCOPY_THRESHOLD:
+      sink->zerocopy_threshold = g_value_get_uint (value);
+      break;
+    case PROP_ASYNC:
+      sink->async = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_QUEUE_BUFFERS:
+      sink->max_queue_buffers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_QUEUE_BYTES:
+      sink->max_queue_bytes = g_value_get_uint (value);
+      break;
+    case PROP_OVERFLOW_POLICY:
+      sink->overflow_policy = (GstHttpSinkOverflowPolicy) g_value_get_enum (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      gst_http_sink_set_stats_interval (sink, g_value_get_uint (value));
+      break;
+    case PROP_SHARED_WRITER:
+      sink->shared_writer = g_value_get_boolean (value);
+      break;
+    case PROP_WRITER_THREADS:
+      sink->writer_threads = g_value_get_uint (value);
+      break;
+    case PROP_WRITER_BACKEND:
+      sink->writer_backend = (GstHttpSinkWriterBackend) g_value_get_enum (value);
+      break;
+    case PROP_START_OFFSET:
+      sink->start_offset = g_value_get_uint64 (value);
+      break;
+    case PROP_PACING:
+      sink->pacing = (GstHttpSinkPacing) g_value_get_enum (value);
+      break;
+    case PROP_PACING_BURST:
+      sink->pacing_burst = g_value_get_uint (value);
+      break;
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -364,13 +760,13 @@ gst_http_sink_get_property (GObject * object, guint prop_id,
       g_value_set_boolean (value, sink->silent);
       break;
     case PROP_HTTP_OBJ:
-      g_value_set_int (value, sink->http_obj);
+      g_value_set_int (value, sink->http_client->fd);
       break;
     case PROP_STREAM_TYPE:
-      g_value_set_boolean (value, sink->is_chunked);
+      g_value_set_boolean (value, sink->http_client->is_chunked);
       break;
     case PROP_SENT_DATA_SIZE:
-      g_value_set_uint64 (value, sink->sent_data_size);
+      g_value_set_uint64 (value, sink->http_client->sent_data_size);
       break;
     case PROP_SOURCE_TYPE:
       g_value_set_string (value, sink->source_type);
@@ -379,11 +775,90 @@ gst_http_sink_get_property (GObject * object, guint prop_id,
       g_value_set_string (value, sink->source_id);
       break;
     case PROP_SEND_DATA_TIME:
-      g_value_set_uint64 (value, sink->last_send_time);
+      g_value_set_uint64 (value, sink->http_client->last_send_time);
       break;
     case PROP_SEND_STATUS:
-      g_value_set_boolean (value, sink->is_blocked);
+      g_value_set_boolean (value, sink->http_client->is_blocked);
+      break;
+    case PROP_USE_SENDFILE:
+      g_value_set_boolean (value, sink->use_sendfile);
+      break;
+    case PROP_ZEROCOPY_THRESHOLD:
+      g_value_set_uint (value, sink->zerocopy_threshold);
+      break;
+    case PROP_ASYNC:
+      g_value_set_boolean (value, sink->async);
+      break;
+    case PROP_MAX_QUEUE_BUFFERS:
+      g_value_set_uint (value, sink->max_queue_buffers);
+      break;
+    case PROP_MAX_QUEUE_BYTES:
+      g_value_set_uint (value, sink->max_queue_bytes);
       break;
+    case PROP_OVERFLOW_POLICY:
+      g_value_set_enum (value, sink->overflow_policy);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_http_sink_create_stats (sink));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, sink->stats_interval);
+      break;
+    case PROP_SHARED_WRITER:
+      g_value_set_boolean (value, sink->shared_writer);
+      break;
+    case PROP_WRITER_THREADS:
+      g_value_set_uint (value, sink->writer_threads);
+      break;
+    case PROP_WRITER_BACKEND:
+      g_value_set_enum (value, sink->writer_backend);
+      break;
+    case PROP_START_OFFSET:
+      g_value_set_uint64 (value, sink->start_offset);
+      break;
+    case PROP_PACING:
+      g_value_set_enum (value, sink->pacing);
+      break;
+    case PROP_PACING_BURST:
+      g_value_set_uint (value, sink->pacing_burst);
+      break;
+    case PROP_STREAM_BITRATE:
+      g_value_set_uint64 (value, sink->stream_rate * 8);
+      break;
+    case PROP_QUEUE_LEVEL_BUFFERS:
+    case PROP_QUEUE_LEVEL_BYTES:
+    case PROP_DROPPED_BUFFERS:
+    case PROP_DROPPED_BYTES:
+    case PROP_NUM_CLIENTS:
+    {
+      guint64 total = 0;
+      GList *l;
+
+      g_static_rec_mutex_lock (&sink->http_obj_mutex);
+      for (l = sink->clients; l; l = l->next) {
+        GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+        gst_http_sink_lock_queue (client);
+        if (prop_id == PROP_QUEUE_LEVEL_BUFFERS)
+          total += client->queue_count;
+        else if (prop_id == PROP_QUEUE_LEVEL_BYTES)
+          total += client->queue_bytes;
+        else if (prop_id == PROP_DROPPED_BUFFERS)
+          total += client->dropped_buffers;
+        else if (prop_id == PROP_DROPPED_BYTES)
+          total += client->dropped_bytes;
+        else if (client->fd != -1)
+          total++;
+        gst_http_sink_unlock_queue (client);
+      }
+      g_static_rec_mutex_unlock (&sink->http_obj_mutex);
+
+      if (prop_id == PROP_QUEUE_LEVEL_BUFFERS || prop_id == PROP_NUM_CLIENTS)
+        g_value_set_uint (value, (guint) total);
+      else
+        g_value_set_uint64 (value, total);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -394,11 +869,12 @@ static gboolean
 gst_http_sink_start (GstBaseSink * bsink)
 {
   GstHttpSink *httpsink;
+  GList *l;
 
   httpsink = GST_HTTP_SINK (bsink);
   GST_DEBUG_OBJECT(httpsink, "gst_http_sink_start: enter");
 
-  if ( httpsink->http_obj < 0 ) {
+  if ( httpsink->http_client->fd < 0 ) {
 /*
     GST_ELEMENT_ERROR (httpsink, RESOURCE, OPEN_READ, (("No http_obj set.")),
         ("Missing http_obj property"));
@@ -407,6 +883,32 @@ gst_http_sink_start (GstBaseSink * bsink)
      GST_INFO_OBJECT(httpsink, "http_obj not set...");
   }
 
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  httpsink->started = TRUE;
+  httpsink->byte_offset = 0;
+  httpsink->stream_rate = 0;
+  httpsink->rate_bytes = 0;
+  if (httpsink->shared_writer) {
+    if (!gst_http_sink_writer_acquire (httpsink->writer_backend, httpsink->writer_threads)) {
+      g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+      GST_ELEMENT_ERROR (httpsink, RESOURCE, FAILED, (("Unable to start shared writer.")), (NULL));
+      return FALSE;
+    }
+    httpsink->writer_acquired = TRUE;
+  }
+  if (httpsink->async || httpsink->writer_acquired) {
+    for (l = httpsink->clients; l; l = l->next) {
+      if (!gst_http_sink_start_sender ((GstHttpSinkClient *) l->data)) {
+        g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+        GST_ELEMENT_ERROR (httpsink, RESOURCE, FAILED, (("Unable to start sender thread.")), (NULL));
+        return FALSE;
+      }
+    }
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  gst_http_sink_start_stats (httpsink);
+
   GST_DEBUG_OBJECT(httpsink, "gst_http_sink_start: exit normal");
 
   return TRUE;
@@ -416,21 +918,57 @@ static gboolean
 gst_http_sink_stop (GstBaseSink * bsink)
 {
   GstHttpSink *httpsink;
+  GList *l;
 
   httpsink = GST_HTTP_SINK (bsink);
   GST_DEBUG_OBJECT(httpsink, "gst_http_sink_stop: enter");
 
-  GST_DEBUG_OBJECT(httpsink, "gst_http_sink_stop: reset HTTP_OBJ socket to %x", httpsink->http_obj);
+  GST_DEBUG_OBJECT(httpsink, "gst_http_sink_stop: reset HTTP_OBJ socket to %x", httpsink->http_client->fd);
+
+  /* before http_obj_mutex, the stats thread takes it to build the message */
+  gst_http_sink_stop_stats (httpsink);
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  httpsink->started = FALSE;
+  for (l = httpsink->clients; l; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+    gst_http_sink_stop_sender (client);
+    g_static_rec_mutex_lock (&client->write_mutex);
+    gst_http_sink_zerocopy_flush (client);
+    g_static_rec_mutex_unlock (&client->write_mutex);
+  }
+  if (httpsink->writer_acquired) {
+    gst_http_sink_writer_release ();
+    httpsink->writer_acquired = FALSE;
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
 
   GST_DEBUG_OBJECT(httpsink, "gst_http_sink_stop: exit normal");
   return TRUE;
 }
 
-void onError (GstHttpSink *sink, int err_code, char* err_string)
+/* Called with the client write_mutex held. A failing default client stops
+ * the pipeline as before, a client added with add-client is only marked as
+ * gone so that the stream to the other clients goes on */
+void onError (GstHttpSinkClient *client, int err_code, char* err_string)
 {
+	GstHttpSink *sink = client->sink;
 	GstMessage *message;
 	GError *error = NULL;
 
+	if (client != sink->http_client) {
+		GST_INFO_OBJECT (sink, "streaming error occurred on client %d : %s", client->fd, err_string);
+		client->sendError = TRUE;
+		gst_http_sink_zerocopy_flush (client);
+		message = gst_message_new_element (GST_OBJECT (sink),
+				gst_structure_new ("httpsink-client-closed",
+						"fd", G_TYPE_INT, client->fd,
+						"reason", G_TYPE_STRING, err_string, NULL));
+		gst_element_post_message (GST_ELEMENT (sink), message);
+		return;
+	}
+
 	GST_INFO ("streaming error occurred : %s", err_string);
 
 	error = g_error_new (GST_CORE_ERROR, err_code, "Client Closed Connection");
@@ -462,114 +1000,478 @@ void onError (GstHttpSink *sink, int err_code, char* err_string)
 		goto done;
 	}
 
-	sink->sendError = TRUE;
-	sink->http_obj = -1;
+	client->sendError = TRUE;
+	client->fd = -1;
+	gst_http_sink_zerocopy_flush (client);
 done:
 	g_clear_error (&error);
 }
 
-static GstFlowReturn
-gst_http_sink_render (GstBaseSink * sink, GstBuffer * buf)
+static gsize
+gst_http_sink_buffer_size (GstBuffer * buf)
 {
-  GstHttpSink *httpsink;
-  int fd;
-  errno_t rc = -1;
 #ifdef USE_GST1
-  GstMapInfo map;
+  return gst_buffer_get_size (buf);
+#else
+  return GST_BUFFER_SIZE (buf);
 #endif
+}
 
-  httpsink = GST_HTTP_SINK (sink);
-  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+/* Accounts one socket write of requested bytes that returned sent and
+ * started at start (monotonic time) */
+static void
+gst_http_sink_client_count_send (GstHttpSinkClient * client, gint64 start,
+    gsize requested, gssize sent)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 blocked = now - start;
+
+  client->send_calls++;
+  if (sent >= 0 && (gsize) sent < requested)
+    client->short_writes++;
+  client->blocked_time += blocked;
+  if (blocked > client->max_block_time)
+    client->max_block_time = blocked;
+
+  if (!client->first_send_time)
+    client->first_send_time = start;
+  if (now - client->rate_window_start >= G_USEC_PER_SEC) {
+    if (client->rate_window_start)
+      client->bitrate = (client->sent_data_size - client->rate_window_bytes) * 8 *
+          G_USEC_PER_SEC / (now - client->rate_window_start);
+    client->rate_window_start = now;
+    client->rate_window_bytes = client->sent_data_size;
+  }
+}
 
-  fd = httpsink->http_obj;
+/* Accounts the time from the arrival of a buffer in render until its last
+ * byte was handed to the socket */
+static void
+gst_http_sink_client_count_latency (GstHttpSinkClient * client, gint64 arrival)
+{
+  gint64 latency = g_get_monotonic_time () - arrival;
+  guint bucket = 0;
 
-  if(buf == NULL)
-  {
-     GST_ERROR("NULL buf passed Error!!!");
-     return GST_FLOW_ERROR;
+  /* bucket n holds latencies in [2^(n-1), 2^n) microseconds */
+  while (latency > 0 && bucket < HTTPSINK_LATENCY_BUCKETS - 1) {
+    latency >>= 1;
+    bucket++;
   }
+  client->latency_hist[bucket]++;
+  client->latency_count++;
+}
 
-#if 0 
-  FILE *fp = NULL;
-  
-  fp = fopen("/test_hs.ts", "a+"); 
+/* Upper bound of the bucket the given percentile falls into, in ns */
+static GstClockTime
+gst_http_sink_client_latency_percentile (GstHttpSinkClient * client, guint percent)
+{
+  guint64 target, seen = 0;
+  guint bucket;
 
-  fwrite(buf->data, 1, buf->size, fp); 
-  fclose(fp);
-#endif //if 0
+  if (!client->latency_count)
+    return 0;
 
-#ifdef USE_GST1
-  gst_buffer_map (buf, &map, GST_MAP_READ);
-#endif
+  target = (client->latency_count * percent + 99) / 100;
+  for (bucket = 0; bucket < HTTPSINK_LATENCY_BUCKETS; bucket++) {
+    seen += client->latency_hist[bucket];
+    if (seen >= target)
+      break;
+  }
+  return ((G_GUINT64_CONSTANT (1) << bucket)) * GST_USECOND;
+}
 
-  httpsink->last_timestamp= GST_BUFFER_TIMESTAMP(buf);
-#ifdef USE_GST1
-  if(httpsink->isFirstPacket && (map.size >=16))
-#else
-  if(httpsink->isFirstPacket && (buf->size >=16))
-#endif
+#ifdef HTTPSINK_HAVE_SENDFILE
+/* Returns TRUE when at least one memory block of buf is backed by a file
+ * descriptor (file, memfd) so that it can be handed to sendfile() */
+static gboolean
+gst_http_sink_buffer_has_fd_memory (GstBuffer * buf)
+{
+  guint i, n;
+
+  n = gst_buffer_n_memory (buf);
+  for (i = 0; i < n; i++) {
+    if (gst_is_fd_memory (gst_buffer_peek_memory (buf, i)))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Writes all of mem with send(), retrying short writes. Returns the number
+ * of bytes written or -1 on error, *sent holds the bytes written in both
+ * cases */
+static gssize
+gst_http_sink_send_mapped_memory (int fd, GstMemory * mem, gsize * sent)
+{
+  GstMapInfo map;
+  gsize size;
+  ssize_t sockRet;
+
+  *sent = 0;
+  if (!gst_memory_map (mem, &map, GST_MAP_READ))
   {
+    errno = EINVAL;
+    return -1;
+  }
+  size = map.size;
+  while (*sent < size) {
+    sockRet = send(fd, map.data + *sent, size - *sent, 0);
+    if (sockRet == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (sockRet == 0) {
+      errno = EPIPE;
+      break;
+    }
+    *sent += sockRet;
+  }
+  gst_memory_unmap (mem, &map);
+  return (*sent == size) ? (gssize) size : -1;
+}
+
+/* Writes buf to the socket memory block by memory block, using sendfile()
+ * for fd-backed memory and send() for everything else. Only returns once
+ * every block is written in full. Returns the number of bytes written or
+ * -1 on error, *sent holds the bytes written in both cases */
+static gssize
+gst_http_sink_sendfile_buffer (GstHttpSink * httpsink, int fd, GstBuffer * buf, gsize * sent)
+{
+  guint i, n;
+  gssize total = 0;
+
+  *sent = 0;
+
+  n = gst_buffer_n_memory (buf);
+  for (i = 0; i < n; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buf, i);
+    gsize offset, size, partial;
+    off_t fileOffset;
+    ssize_t sockRet;
+
+    if (!gst_is_fd_memory (mem)) {
+      sockRet = gst_http_sink_send_mapped_memory (fd, mem, &partial);
+      total += partial;
+      *sent = total;
+      if (sockRet == -1)
+        return -1;
+      continue;
+    }
+
+    size = gst_memory_get_sizes (mem, &offset, NULL);
+    fileOffset = (off_t) offset;
+    while (size > 0) {
+      sockRet = sendfile (fd, gst_fd_memory_get_fd (mem), &fileOffset, size);
+      if (sockRet == -1) {
+        if (errno == EINTR)
+          continue;
+        if ((errno == EINVAL || errno == ENOSYS) && fileOffset == (off_t) offset) {
+          /* fd type not supported by sendfile (e.g. dmabuf), copy it instead */
+          GST_DEBUG_OBJECT (httpsink, "sendfile not supported for fd %d, falling back to send",
+              gst_fd_memory_get_fd (mem));
+          sockRet = gst_http_sink_send_mapped_memory (fd, mem, &partial);
+          total += partial;
+          *sent = total;
+          if (sockRet == -1)
+            return -1;
+          break;
+        }
+        return -1;
+      }
+      if (sockRet == 0) {
+        /* the file ended before the memory block did */
+        GST_WARNING_OBJECT (httpsink, "sendfile hit end of fd %d with %" G_GSIZE_FORMAT " bytes left",
+            gst_fd_memory_get_fd (mem), size);
+        errno = EIO;
+        return -1;
+      }
+      size -= sockRet;
+      total += sockRet;
+      *sent = total;
+    }
+  }
+  return total;
+}
+#endif
+
+#ifdef HTTPSINK_HAVE_ZEROCOPY
+typedef struct _GstHttpSinkZerocopyItem
+{
+  GstBuffer *buf;                    /* Reference held until the kernel is done with the pages */
 #ifdef USE_GST1
-    GST_INFO_OBJECT(httpsink, "httpsink::Received first packet[%d]: ", map.size);
-#else
-    GST_INFO_OBJECT(httpsink, "httpsink::Received first packet[%d]: ", buf->size);
+  GstMapInfo map;
 #endif
-	int ix;
-    for(ix=0; ix<16; ix++)
+  guint32 id;                        /* Completion id the kernel assigned to this send */
+} GstHttpSinkZerocopyItem;
+
+static void
+gst_http_sink_zerocopy_item_free (GstHttpSinkZerocopyItem * item)
+{
 #ifdef USE_GST1
-      g_print("%02X ", map.data[ix]);
-#else
-      g_print("%02X ", buf->data[ix]);
+  gst_buffer_unmap (item->buf, &item->map);
 #endif
-    g_print("\n");
-	httpsink->isFirstPacket = FALSE;
+  gst_buffer_unref (item->buf);
+  g_slice_free (GstHttpSinkZerocopyItem, item);
+}
+
+/* Reads the completion notifications queued on the socket error queue and
+ * releases every buffer whose pages the kernel no longer references */
+static void
+gst_http_sink_zerocopy_reap (GstHttpSinkClient * client, int fd)
+{
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+
+  while (!g_queue_is_empty (client->zerocopy_pending)) {
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+      break;
+
+    for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm)) {
+      struct sock_extended_err *serr;
+      guint32 hi;
+
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+        continue;
+
+      serr = (struct sock_extended_err *) CMSG_DATA (cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      /* ids [ee_info, ee_data] completed; completions arrive in order */
+      hi = serr->ee_data;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        client->zerocopy_copied += (hi - serr->ee_info + 1);
+
+      while (!g_queue_is_empty (client->zerocopy_pending)) {
+        GstHttpSinkZerocopyItem *item =
+            (GstHttpSinkZerocopyItem *) g_queue_peek_head (client->zerocopy_pending);
+        if ((gint32) (hi - item->id) < 0)
+          break;
+        g_queue_pop_head (client->zerocopy_pending);
+        gst_http_sink_zerocopy_item_free (item);
+      }
+    }
   }
+}
 
-  int sockRet=-1;
-  if(!httpsink->is_chunked)
-  {
-		GST_DEBUG("Stream Type : Linear");
-		//int n;
+/* Sends a payload with MSG_ZEROCOPY. Returns the send() result, or -2 when
+ * the caller should fall back to a copying send */
+static int
+gst_http_sink_send_zerocopy (GstHttpSinkClient * client, int fd, GstBuffer * buf)
+{
+  GstHttpSinkZerocopyItem *item;
+  int sockRet;
+  int err;
+
+  if (client->zerocopy_fd != fd) {
+    int one = 1;
+
+    /* already refused on this socket, copy without retrying the setsockopt */
+    if (client->zerocopy_failed_fd == fd)
+      return -2;
+
+    gst_http_sink_zerocopy_flush (client);
+    if (setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) < 0) {
+      GST_WARNING_OBJECT (client->sink, "SO_ZEROCOPY not supported on socket %x: %s", fd, strerror (errno));
+      client->zerocopy_failed_fd = fd;
+      return -2;
+    }
+    client->zerocopy_fd = fd;
+    client->zerocopy_next_id = 0;
+  }
 
-		/* How many bytes we send in this iteration */
-		if (fd != -1) 
-		{
-			struct timeval timeout;
-			timeout.tv_sec = 1;
-			timeout.tv_usec = 0;
-			if (setsockopt (httpsink->http_obj, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,  sizeof(timeout)) < 0)
-			{
-				GST_ERROR_OBJECT(httpsink,"Failed to set socket timeout for send()\n");
-			}
-			//n = write(fd, buf->data, buf->size);
+  item = g_slice_new0 (GstHttpSinkZerocopyItem);
+  item->buf = gst_buffer_ref (buf);
 #ifdef USE_GST1
-			sockRet = send(fd, map.data, map.size, 0);
+  if (!gst_buffer_map (buf, &item->map, GST_MAP_READ)) {
+    gst_buffer_unref (item->buf);
+    g_slice_free (GstHttpSinkZerocopyItem, item);
+    return -2;
+  }
+  sockRet = send (fd, item->map.data, item->map.size, MSG_ZEROCOPY);
 #else
-			sockRet = send(fd, buf->data, buf->size, 0);
+  sockRet = send (fd, buf->data, buf->size, MSG_ZEROCOPY);
 #endif
-			if(sockRet == -1)
-			{
-            	GST_INFO_OBJECT(httpsink, "gst_http_sink_render: send B on socket %x fails err %X", fd, errno);
-				onError(httpsink, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
-				goto error;
-			}
-		}
-		httpsink->sent_data_size += sockRet;
-		GST_LOG("Linear : sockRet = %d:%s: send returned = %d", errno, strerror(errno), sockRet );
+  if (sockRet == -1) {
+    err = errno;
+    gst_http_sink_zerocopy_item_free (item);
+    /* ENOBUFS: too many notifications outstanding (optmem), copy this one */
+    if (err == ENOBUFS)
+      sockRet = -2;
+    errno = err;
+  } else {
+    item->id = client->zerocopy_next_id++;
+    g_queue_push_tail (client->zerocopy_pending, item);
   }
-  else
-  {
-		//GST_DEBUG("Stream Type : Chunked");
-		char data[DATA_BUFFER_SIZE];
-		int  len;
 
-		if (fd != -1 && (httpsink->sendError != TRUE))
-		{
-#ifdef ENABLE_SEND_TIMEOUT
+  gst_http_sink_zerocopy_reap (client, fd);
+
+  return sockRet;
+}
+#endif
+
+/* Waits a bounded time for outstanding zerocopy completions, then drops
+ * every buffer still held. Called with the client write_mutex held */
+static void
+gst_http_sink_zerocopy_flush (GstHttpSinkClient * client)
+{
+#ifdef HTTPSINK_HAVE_ZEROCOPY
+  int fd = client->zerocopy_fd;
+  gint64 deadline;
+
+  if (fd != -1 && !g_queue_is_empty (client->zerocopy_pending)) {
+    deadline = g_get_monotonic_time () + ZEROCOPY_DRAIN_TIMEOUT_MS * 1000;
+    gst_http_sink_zerocopy_reap (client, fd);
+    while (!g_queue_is_empty (client->zerocopy_pending) &&
+           g_get_monotonic_time () < deadline) {
+      struct pollfd pfd;
+
+      pfd.fd = fd;
+      pfd.events = 0;
+      pfd.revents = 0;
+      if (poll (&pfd, 1, 10) < 0 || (pfd.revents & (POLLHUP | POLLNVAL)))
+        break;
+      gst_http_sink_zerocopy_reap (client, fd);
+    }
+    if (!g_queue_is_empty (client->zerocopy_pending))
+      GST_INFO_OBJECT (client->sink, "releasing %u buffers with zerocopy completion outstanding",
+          g_queue_get_length (client->zerocopy_pending));
+    GST_DEBUG_OBJECT (client->sink, "zerocopy sends copied by the kernel: %" G_GUINT64_FORMAT,
+        client->zerocopy_copied);
+  }
+  while (!g_queue_is_empty (client->zerocopy_pending))
+    gst_http_sink_zerocopy_item_free ((GstHttpSinkZerocopyItem *) g_queue_pop_head (client->zerocopy_pending));
+  client->zerocopy_fd = -1;
+#else
+  (void) client;
+#endif
+}
+
+/* Writes the buffer payload, using MSG_ZEROCOPY when enabled and the payload
+ * is large enough */
+static int
+gst_http_sink_send_payload (GstHttpSinkClient * client, int fd, GstBuffer * buf,
+    const guint8 * data, gsize size)
+{
+#ifdef HTTPSINK_HAVE_ZEROCOPY
+  if (client->sink->zerocopy_threshold && size >= client->sink->zerocopy_threshold) {
+    int sockRet = gst_http_sink_send_zerocopy (client, fd, buf);
+    if (sockRet != -2)
+      return sockRet;
+  }
+#endif
+  return send (fd, data, size, 0);
+}
+
+
+/* Writes one buffer to the client socket. Called with the client write_mutex
+ * held, either from render or from the client sender thread. Returns FALSE
+ * when the buffer was dropped */
+static gboolean
+gst_http_sink_write_buffer (GstHttpSinkClient * client, GstBuffer * buf)
+{
+  GstHttpSink *httpsink = client->sink;
+  int fd;
+  errno_t rc = -1;
+#ifdef USE_GST1
+  GstMapInfo map;
+  gboolean mapped = FALSE;
+#endif
+#ifdef HTTPSINK_HAVE_SENDFILE
+  gboolean use_sendfile = FALSE;
+#endif
+  gint64 sendStart;
+
+  fd = client->fd;
+
+#if 0 
+  FILE *fp = NULL;
+  
+  fp = fopen("/test_hs.ts", "a+"); 
+
+  fwrite(buf->data, 1, buf->size, fp); 
+  fclose(fp);
+#endif //if 0
+
+#ifdef HTTPSINK_HAVE_SENDFILE
+  /* fd-backed buffers are not mapped, the data goes from the file to the socket */
+  use_sendfile = !client->is_chunked && httpsink->use_sendfile && gst_http_sink_buffer_has_fd_memory (buf);
+  if (use_sendfile)
+  {
+    map.data = NULL;
+    map.size = gst_buffer_get_size (buf);
+  }
+  else
+#endif
+#ifdef USE_GST1
+  mapped = gst_buffer_map (buf, &map, GST_MAP_READ);
+#endif
+
+  int sockRet=-1;
+  if(!client->is_chunked)
+  {
+		GST_DEBUG("Stream Type : Linear");
+		//int n;
+
+		/* How many bytes we send in this iteration */
+		if (fd != -1) 
+		{
+			struct timeval timeout;
+			timeout.tv_sec = 1;
+			timeout.tv_usec = 0;
+			if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,  sizeof(timeout)) < 0)
+			{
+				GST_ERROR_OBJECT(httpsink,"Failed to set socket timeout for send()\n");
+			}
+			//n = write(fd, buf->data, buf->size);
+			sendStart = g_get_monotonic_time ();
+#ifdef HTTPSINK_HAVE_SENDFILE
+			if (use_sendfile)
+			{
+				gsize partial = 0;
+
+				sockRet = gst_http_sink_sendfile_buffer(httpsink, fd, buf, &partial);
+				/* bytes that reached the peer before a failure still count */
+				if (sockRet == -1)
+					client->sent_data_size += partial;
+			}
+			else
+#endif
+#ifdef USE_GST1
+			sockRet = gst_http_sink_send_payload(client, fd, buf, map.data, map.size);
+#else
+			sockRet = gst_http_sink_send_payload(client, fd, buf, buf->data, buf->size);
+#endif
+			gst_http_sink_client_count_send (client, sendStart, gst_http_sink_buffer_size (buf), sockRet);
+			if(sockRet == -1)
+			{
+            	GST_INFO_OBJECT(httpsink, "gst_http_sink_render: send B on socket %x fails err %X", fd, errno);
+				onError(client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
+				goto error;
+			}
+		}
+		client->sent_data_size += sockRet;
+		GST_LOG("Linear : sockRet = %d:%s: send returned = %d", errno, strerror(errno), sockRet );
+  }
+  else
+  {
+		//GST_DEBUG("Stream Type : Chunked");
+		char data[DATA_BUFFER_SIZE];
+		int  len;
+
+		if (fd != -1 && (client->sendError != TRUE))
+		{
+#ifdef ENABLE_SEND_TIMEOUT
 			struct timeval timeout;
 			timeout.tv_sec = 1;
 			timeout.tv_usec = 0;
-			if (setsockopt (httpsink->http_obj, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,  sizeof(timeout)) < 0)
+			if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,  sizeof(timeout)) < 0)
 			{
 				GST_ERROR_OBJECT(httpsink,"Failed to set socket timeout for send()\n");
 			}
@@ -593,31 +1495,35 @@ gst_http_sink_render (GstBaseSink * sink, GstBuffer * buf)
 #endif
 			struct timeval time;
 			gettimeofday( &time, NULL );
-			httpsink->last_send_time = time.tv_sec;
-			httpsink->is_blocked = TRUE;
+			client->last_send_time = time.tv_sec;
+			client->is_blocked = TRUE;
 
+			sendStart = g_get_monotonic_time ();
 			sockRet = send(fd, data, len, 0);
+			gst_http_sink_client_count_send (client, sendStart, len, sockRet);
 			if(sockRet == -1)
 			{
             	//GST_INFO_OBJECT(httpsink, "gst_http_sink_render: send A on socket %x fails err %X", fd, errno);
-				onError(httpsink, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
+				onError(client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
 				goto error;
 			}
-			httpsink->sent_data_size += sockRet;
+			client->sent_data_size += sockRet;
 		 	//GST_LOG("1. chunked : sockRet = %d:%s: send returned = %d", errno, strerror(errno), sockRet );	
 
+			sendStart = g_get_monotonic_time ();
 #ifdef USE_GST1
-			sockRet = send(fd, map.data, map.size, 0);
+			sockRet = gst_http_sink_send_payload(client, fd, buf, map.data, map.size);
 #else
-			sockRet = send(fd, buf->data, buf->size, 0);
+			sockRet = gst_http_sink_send_payload(client, fd, buf, buf->data, buf->size);
 #endif
+			gst_http_sink_client_count_send (client, sendStart, gst_http_sink_buffer_size (buf), sockRet);
 			if(sockRet == -1)
 			{
             	//GST_INFO_OBJECT(httpsink, "gst_http_sink_render: send B on socket %x fails err %X", fd, errno);
-				onError(httpsink, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
+				onError(client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
 				goto error;
 			}
-			httpsink->sent_data_size += sockRet;
+			client->sent_data_size += sockRet;
 			// GST_DEBUG("2. chunked : sockRet = %d:%s: send returned = %d", errno, strerror(errno), sockRet );	
 
 			rc = sprintf_s(data, DATA_BUFFER_SIZE, "\r\n");
@@ -627,123 +1533,2021 @@ gst_http_sink_render (GstBaseSink * sink, GstBuffer * buf)
 				goto error;
 			}
 			len = rc;
+			sendStart = g_get_monotonic_time ();
 			sockRet = send(fd, data, len, 0);
+			gst_http_sink_client_count_send (client, sendStart, len, sockRet);
 			if(sockRet == -1)
 			{
             	//GST_INFO_OBJECT(httpsink, "gst_http_sink_render: send C on socket %x fails err %X", fd, errno);
-				onError(httpsink, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
+				onError(client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror(errno));
 				goto error;
 			}
-			httpsink->sent_data_size += sockRet;
+			client->sent_data_size += sockRet;
 			//GST_LOG("3. chunked : sockRet = %d:%s: send returned = %d", errno, strerror(errno), sockRet );	
 		}
 		//GST_DEBUG("Stream Type : Chunked3");
 
   }
 
-  if (httpsink->packetcount < 5)
+  if (client->packetcount < 5)
   {
-	if (buf != NULL && (httpsink->packetcount == 0 || httpsink->packetcount == 4))
+	if (buf != NULL && (client->packetcount == 0 || client->packetcount == 4))
 	{
 #ifdef USE_GST1
 		GST_INFO_OBJECT(httpsink, "Source Type: %s packet[%d] Source Id: %s sent [%d bytes] on ConnId [%d]",
-          				httpsink->source_type, httpsink->packetcount+1, httpsink->source_id, map.size, fd);
+          				httpsink->source_type, client->packetcount+1, httpsink->source_id, map.size, fd);
 #else
 		int bufSize = buf->size;
 		GST_INFO_OBJECT(httpsink, "Source Type: %s packet[%d] Source Id: %s sent [%d bytes] on ConnId [%d]",
-          				httpsink->source_type, httpsink->packetcount+1, httpsink->source_id, bufSize, fd);
+          				httpsink->source_type, client->packetcount+1, httpsink->source_id, bufSize, fd);
 #endif
 	}
 	else if (buf == NULL)
 	{
 		GST_INFO_OBJECT(httpsink, "Source Type: %s packet[%d] Source Id: %s buf is NULL on ConnId [%d]",
-						httpsink->source_type, httpsink->packetcount+1, httpsink->source_id, fd);
+						httpsink->source_type, client->packetcount+1, httpsink->source_id, fd);
 	}
-    httpsink->packetcount++;
+    client->packetcount++;
   }
-  httpsink->is_blocked = FALSE;
-  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+  client->is_blocked = FALSE;
 
 #ifdef USE_GST1
-  gst_buffer_unmap (buf, &map);
+  if (mapped)
+    gst_buffer_unmap (buf, &map);
 #endif
  
-  return GST_FLOW_OK;
+  return TRUE;
 
 error:
-  httpsink->is_blocked = FALSE;
-  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+  client->is_blocked = FALSE;
 #ifdef USE_GST1
-  gst_buffer_unmap (buf, &map);
+  if (mapped)
+    gst_buffer_unmap (buf, &map);
 #endif
   //GST_INFO_OBJECT(httpsink, "gst_http_sink_render: dropped buffer");
-  return GST_FLOW_OK;
+  return FALSE;
 }
 
-static gboolean
-gst_http_sink_query (GstElement * element, GstQuery * query)
+
+static void
+gst_http_sink_lock_queue (GstHttpSinkClient * client)
 {
-  GstHttpSink *self;
-  GstFormat format;
+#ifdef GLIB_VERSION_2_32
+  g_mutex_lock (&client->queue_lock);
+#else
+  g_mutex_lock (client->queue_lock);
+#endif
+}
 
-  self = GST_HTTP_SINK (element);
+static void
+gst_http_sink_unlock_queue (GstHttpSinkClient * client)
+{
+#ifdef GLIB_VERSION_2_32
+  g_mutex_unlock (&client->queue_lock);
+#else
+  g_mutex_unlock (client->queue_lock);
+#endif
+}
 
-  switch (GST_QUERY_TYPE (query)) {
-    case GST_QUERY_POSITION:
-      gst_query_parse_position (query, &format, NULL);
-      switch (format) {
-        case GST_FORMAT_DEFAULT:
-        case GST_FORMAT_TIME:
-          gst_query_set_position (query, GST_FORMAT_TIME, self->last_timestamp);
-         GST_INFO_OBJECT(self, "gst_http_sink_query: GST_FORMAT_TIME position %llx", self->last_timestamp);
-          return TRUE;
-        default:
-          return FALSE;
-      }
+#ifdef GLIB_VERSION_2_32
+#define HTTPSINK_QUEUE_WAIT(client, cond) g_cond_wait (&(client)->cond, &(client)->queue_lock)
+#define HTTPSINK_QUEUE_SIGNAL(client, cond) g_cond_broadcast (&(client)->cond)
+#else
+#define HTTPSINK_QUEUE_WAIT(client, cond) g_cond_wait ((client)->cond, (client)->queue_lock)
+#define HTTPSINK_QUEUE_SIGNAL(client, cond) g_cond_broadcast ((client)->cond)
+#endif
 
-    case GST_QUERY_FORMATS:
-      gst_query_set_formats (query, 2, GST_FORMAT_DEFAULT, GST_FORMAT_TIME);
-      return TRUE;
-    default:
-      return GST_HTTP_SINK_GET_CLASS(self)->parent_query(element,query);
+static void
+gst_http_sink_lock_stats (GstHttpSink * httpsink)
+{
+#ifdef GLIB_VERSION_2_32
+  g_mutex_lock (&httpsink->stats_lock);
+#else
+  g_mutex_lock (httpsink->stats_lock);
+#endif
+}
+
+static void
+gst_http_sink_unlock_stats (GstHttpSink * httpsink)
+{
+#ifdef GLIB_VERSION_2_32
+  g_mutex_unlock (&httpsink->stats_lock);
+#else
+  g_mutex_unlock (httpsink->stats_lock);
+#endif
+}
+
+#ifdef GLIB_VERSION_2_32
+#define HTTPSINK_STATS_WAIT(sink) g_cond_wait (&(sink)->stats_cond, &(sink)->stats_lock)
+#define HTTPSINK_STATS_SIGNAL(sink) g_cond_broadcast (&(sink)->stats_cond)
+#else
+#define HTTPSINK_STATS_WAIT(sink) g_cond_wait ((sink)->stats_cond, (sink)->stats_lock)
+#define HTTPSINK_STATS_SIGNAL(sink) g_cond_broadcast ((sink)->stats_cond)
+#endif
+
+/* Waits on stats_cond until end_time (monotonic, us) at the latest,
+ * called with stats_lock held */
+static void
+gst_http_sink_stats_wait_until (GstHttpSink * httpsink, gint64 end_time)
+{
+#ifdef GLIB_VERSION_2_32
+  g_cond_wait_until (&httpsink->stats_cond, &httpsink->stats_lock, end_time);
+#else
+  GTimeVal tv;
+
+  g_get_current_time (&tv);
+  g_time_val_add (&tv, end_time - g_get_monotonic_time ());
+  g_cond_timed_wait (httpsink->stats_cond, httpsink->stats_lock, &tv);
+#endif
+}
+
+/* Waits on queue_not_full until end_time (monotonic, us) at the latest,
+ * called with queue_lock held */
+static void
+gst_http_sink_queue_wait_until (GstHttpSinkClient * client, gint64 end_time)
+{
+#ifdef GLIB_VERSION_2_32
+  g_cond_wait_until (&client->queue_not_full, &client->queue_lock, end_time);
+#else
+  GTimeVal tv;
+
+  g_get_current_time (&tv);
+  g_time_val_add (&tv, end_time - g_get_monotonic_time ());
+  g_cond_timed_wait (client->queue_not_full, client->queue_lock, &tv);
+#endif
+}
+
+/* Estimates the stream bitrate from the buffer timestamps, or from the
+ * arrival times for streams without them. Bursts of the source average out
+ * over the window, the estimate follows rate changes through an EWMA */
+static void
+gst_http_sink_estimate_rate (GstHttpSink * httpsink, GstBuffer * buf, gint64 arrival)
+{
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  gint64 span;
+  guint64 rate;
+
+  if (httpsink->rate_bytes && GST_CLOCK_TIME_IS_VALID (ts) &&
+      GST_CLOCK_TIME_IS_VALID (httpsink->rate_base_ts) && ts < httpsink->rate_base_ts)
+    httpsink->rate_bytes = 0;   /* discontinuity */
+
+  if (!httpsink->rate_bytes) {
+    httpsink->rate_base_ts = ts;
+    httpsink->rate_base_arrival = arrival;
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (ts) && GST_CLOCK_TIME_IS_VALID (httpsink->rate_base_ts))
+    span = (ts - httpsink->rate_base_ts) / GST_USECOND;
+  else
+    span = arrival - httpsink->rate_base_arrival;
+
+  if (span < PACING_RATE_WINDOW_US) {
+    httpsink->rate_bytes += gst_http_sink_buffer_size (buf);
+    return;
+  }
+
+  rate = httpsink->rate_bytes * G_USEC_PER_SEC / span;
+  httpsink->stream_rate = httpsink->stream_rate ? (httpsink->stream_rate * 7 + rate) / 8 : rate;
+  httpsink->rate_bytes = 0;
+  GST_LOG_OBJECT (httpsink, "stream rate %" G_GUINT64_FORMAT " bytes/s", httpsink->stream_rate);
+
+  /* this buffer opens the next window */
+  gst_http_sink_estimate_rate (httpsink, buf, arrival);
+}
+
+/* Rate paced sends go out at, bytes/s, 0 when not known yet */
+static guint64
+gst_http_sink_pacing_rate (GstHttpSink * httpsink)
+{
+  return httpsink->stream_rate * PACING_HEADROOM_PERCENT / 100;
+}
+
+/* Keeps SO_MAX_PACING_RATE of the client socket in line with the stream
+ * bitrate, called with write_mutex held before each buffer is sent. The
+ * shared writer cannot sleep per client, it uses kernel pacing for both modes */
+static void
+gst_http_sink_client_apply_pacing (GstHttpSinkClient * client)
+{
+  GstHttpSink *httpsink = client->sink;
+  guint64 rate = 0;
+
+  if (httpsink->pacing == GST_HTTP_SINK_PACING_KERNEL ||
+      (httpsink->pacing == GST_HTTP_SINK_PACING_USERSPACE && client->writer_thread))
+    rate = gst_http_sink_pacing_rate (httpsink);
+
+  /* only follow changes of more than 1/8 */
+  if (client->fd == -1 || rate == client->pacing_applied ||
+      (rate && client->pacing_applied &&
+       (rate > client->pacing_applied ? rate - client->pacing_applied : client->pacing_applied - rate) <
+       client->pacing_applied / 8))
+    return;
+
+#ifdef HTTPSINK_HAVE_PACING_RATE
+  {
+    unsigned int value = rate ? (unsigned int) MIN (rate, G_MAXUINT - 1) : G_MAXUINT;
+
+    if (setsockopt (client->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof (value)) < 0) {
+      GST_WARNING_OBJECT (httpsink, "SO_MAX_PACING_RATE on socket %x failed: %s", client->fd, strerror (errno));
+      rate = 0;
+    } else {
+      GST_DEBUG_OBJECT (httpsink, "socket %x paced at %" G_GUINT64_FORMAT " bytes/s", client->fd, rate);
+    }
+  }
+#else
+  GST_WARNING_OBJECT (httpsink, "kernel pacing not supported by this build");
+  rate = 0;
+#endif
+  client->pacing_applied = rate;
+}
+
+/* Token bucket of userspace pacing: waits until size bytes may be sent.
+ * Returns FALSE when flushing interrupted the wait */
+static gboolean
+gst_http_sink_client_pace (GstHttpSinkClient * client, gsize size, guint64 rate)
+{
+  gint64 burst = client->sink->pacing_burst;
+  gint64 need = MIN ((gint64) size, burst);
+  gboolean ret = TRUE;
+
+  gst_http_sink_lock_queue (client);
+  for (;;) {
+    gint64 now = g_get_monotonic_time ();
+
+    if (client->pacing_last)
+      client->pacing_tokens += (now - client->pacing_last) * (gint64) rate / G_USEC_PER_SEC;
+    else
+      client->pacing_tokens = burst;
+    client->pacing_tokens = MIN (client->pacing_tokens, burst);
+    client->pacing_last = now;
+
+    if (client->pacing_tokens >= need) {
+      client->pacing_tokens -= size;
+      break;
+    }
+    if (client->queue_flushing) {
+      ret = FALSE;
+      break;
+    }
+    gst_http_sink_queue_wait_until (client,
+        now + (need - client->pacing_tokens) * G_USEC_PER_SEC / (gint64) rate + 1);
   }
+  gst_http_sink_unlock_queue (client);
+  return ret;
 }
 
+/* Sends one buffer from render or the sender thread, without write_mutex
+ * held. Userspace pacing cuts it into pacing-burst slices sent at the
+ * stream bitrate. Returns FALSE when the buffer was not completely sent */
 static gboolean
+gst_http_sink_send_buffer (GstHttpSinkClient * client, GstBuffer * buf)
+{
+  GstHttpSink *httpsink = client->sink;
+  guint64 rate = gst_http_sink_pacing_rate (httpsink);
+  gsize size, offset, len;
+  gboolean ret = FALSE;
+
+  if (httpsink->pacing != GST_HTTP_SINK_PACING_USERSPACE || !rate) {
+    g_static_rec_mutex_lock (&client->write_mutex);
+    gst_http_sink_client_apply_pacing (client);
+    if (client->fd != -1 && !client->sendError)
+      ret = gst_http_sink_write_buffer (client, buf);
+    g_static_rec_mutex_unlock (&client->write_mutex);
+    return ret;
+  }
+
+  size = gst_http_sink_buffer_size (buf);
+  for (offset = 0; offset < size; offset += len) {
+    GstBuffer *part;
+
+    len = MIN (size - offset, httpsink->pacing_burst);
+    if (!gst_http_sink_client_pace (client, len, rate))
+      return FALSE;
+
+    if (len == size)
+      part = gst_buffer_ref (buf);
+    else
 #ifdef USE_GST1
-gst_http_sink_pad_query (GstPad * pad, GstObject *parent, GstQuery * query)
+      part = gst_buffer_copy_region (buf, GST_BUFFER_COPY_ALL, offset, len);
 #else
-gst_http_sink_pad_query (GstPad * pad, GstQuery * query)
+      part = gst_buffer_create_sub (buf, offset, len);
 #endif
+
+    g_static_rec_mutex_lock (&client->write_mutex);
+    gst_http_sink_client_apply_pacing (client);
+    ret = client->fd != -1 && !client->sendError && gst_http_sink_write_buffer (client, part);
+    g_static_rec_mutex_unlock (&client->write_mutex);
+    gst_buffer_unref (part);
+    if (!ret)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Takes the oldest buffer off the async queue, called with queue_lock held.
+ * arrival, if not NULL, is set to the time render queued the buffer */
+static GstBuffer *
+gst_http_sink_queue_pop (GstHttpSinkClient * client, gint64 * arrival)
 {
-  GstHttpSink *self;
-  GstFormat format;
+  GstBuffer *buf;
+
+  buf = client->queue_ring[client->queue_head];
+  if (arrival)
+    *arrival = client->queue_arrival[client->queue_head];
+  client->queue_ring[client->queue_head] = NULL;
+  client->queue_head = (client->queue_head + 1) % client->queue_capacity;
+  client->queue_count--;
+  client->queue_bytes -= gst_http_sink_buffer_size (buf);
+  return buf;
+}
 
-  self = GST_HTTP_SINK (GST_PAD_PARENT (pad));
+/* Drops everything queued, called with queue_lock held */
+static void
+gst_http_sink_queue_clear (GstHttpSinkClient * client)
+{
+  while (client->queue_count)
+    gst_buffer_unref (gst_http_sink_queue_pop (client, NULL));
+  client->queue_head = 0;
+  HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+}
 
-  switch (GST_QUERY_TYPE (query)) {
-    case GST_QUERY_POSITION:
-      gst_query_parse_position (query, &format, NULL);
-      switch (format) {
-        case GST_FORMAT_DEFAULT:
-        case GST_FORMAT_TIME:
-          gst_query_set_position (query, GST_FORMAT_TIME, self->last_timestamp);
-         GST_INFO_OBJECT(self, "gst_http_sink_pad_query: GST_FORMAT_TIME position %llx", self->last_timestamp);
-          return TRUE;
-        default:
-          return FALSE;
-      }
+/* Makes room for a new buffer by dropping the oldest queued one and then any
+ * delta units behind it, so that the client resumes on a keyframe */
+static void
+gst_http_sink_queue_drop_to_keyframe (GstHttpSinkClient * client)
+{
+  GstBuffer *buf;
 
-    case GST_QUERY_FORMATS:
-      gst_query_set_formats (query, 2, GST_FORMAT_DEFAULT, GST_FORMAT_TIME);
-      return TRUE;
-    default:
+  do {
+    buf = gst_http_sink_queue_pop (client, NULL);
+    client->dropped_buffers++;
+    client->dropped_bytes += gst_http_sink_buffer_size (buf);
+    gst_buffer_unref (buf);
+  } while (client->queue_count &&
+      GST_BUFFER_FLAG_IS_SET (client->queue_ring[client->queue_head], GST_BUFFER_FLAG_DELTA_UNIT));
+
+  /* queue ran dry before a keyframe: keep dropping incoming delta units */
+  client->drop_to_keyframe = (client->queue_count == 0);
+
+  GST_DEBUG_OBJECT (client->sink, "queue of client %d full, dropped %" G_GUINT64_FORMAT " buffers so far",
+      client->fd, client->dropped_buffers);
+}
+
+/* While catching up to a keyframe, counts an incoming delta unit as dropped
+ * and returns TRUE; a keyframe ends the catch-up */
+static gboolean
+gst_http_sink_queue_skip_delta (GstHttpSinkClient * client, GstBuffer * buf,
+    gsize size)
+{
+  if (!client->drop_to_keyframe)
+    return FALSE;
+  if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    client->dropped_buffers++;
+    client->dropped_bytes += size;
+    return TRUE;
+  }
+  client->drop_to_keyframe = FALSE;
+  return FALSE;
+}
+
+static gboolean
+gst_http_sink_queue_is_full (GstHttpSinkClient * client, gsize size)
+{
+  if (client->queue_count == client->queue_capacity)
+    return TRUE;
+  /* always accept one buffer, however large, into an empty queue */
+  return client->queue_count &&
+      client->queue_bytes + size > client->sink->max_queue_bytes;
+}
+
+/* Render side of async mode: hands buf to the client sender thread, applying
+ * the overflow policy when the queue is full. The buffer itself is shared by
+ * all clients, each queue only holds a reference */
+static GstFlowReturn
+gst_http_sink_queue_buffer (GstHttpSinkClient * client, GstBuffer * buf,
+    gint64 arrival)
+{
+  GstHttpSink *httpsink = client->sink;
+  gsize size = gst_http_sink_buffer_size (buf);
+  guint tail;
+
+  if (client->sendError) {
+    GST_LOG_OBJECT (httpsink, "client %d gone, dropping buffer", client->fd);
+    return GST_FLOW_OK;
+  }
+
+  gst_http_sink_lock_queue (client);
+  if (!client->sender_running) {
+    /* client removed while render was busy with the other clients */
+    gst_http_sink_unlock_queue (client);
+    return GST_FLOW_OK;
+  }
+
+  if (gst_http_sink_queue_skip_delta (client, buf, size)) {
+    gst_http_sink_unlock_queue (client);
+    return GST_FLOW_OK;
+  }
+
+  while (!client->queue_flushing && gst_http_sink_queue_is_full (client, size)) {
+    switch (httpsink->overflow_policy) {
+      case GST_HTTP_SINK_OVERFLOW_DROP_TO_KEYFRAME:
+        gst_http_sink_queue_drop_to_keyframe (client);
+        break;
+      case GST_HTTP_SINK_OVERFLOW_DISCONNECT:
+        GST_WARNING_OBJECT (httpsink, "send queue of client %d full (%u buffers, %" G_GUINT64_FORMAT " bytes), disconnecting",
+            client->fd, client->queue_count, client->queue_bytes);
+        gst_http_sink_queue_clear (client);
+        gst_http_sink_unlock_queue (client);
+        g_static_rec_mutex_lock (&client->write_mutex);
+        if (!client->sendError)
+          onError (client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, (char *) "send queue overflow");
+        g_static_rec_mutex_unlock (&client->write_mutex);
+        return GST_FLOW_OK;
+      case GST_HTTP_SINK_OVERFLOW_BLOCK:
+      default:
+        HTTPSINK_QUEUE_WAIT (client, queue_not_full);
+        break;
+    }
+  }
+
+  if (client->queue_flushing) {
+    gst_http_sink_unlock_queue (client);
 #ifdef USE_GST1
-      return gst_pad_query_default (pad, parent, query);
+    return GST_FLOW_FLUSHING;
 #else
-      return gst_pad_query_default (pad, query);
+    return GST_FLOW_WRONG_STATE;
 #endif
   }
+
+  /* making room may have emptied the queue before reaching a keyframe */
+  if (gst_http_sink_queue_skip_delta (client, buf, size)) {
+    gst_http_sink_unlock_queue (client);
+    return GST_FLOW_OK;
+  }
+
+  tail = (client->queue_head + client->queue_count) % client->queue_capacity;
+  client->queue_ring[tail] = gst_buffer_ref (buf);
+  client->queue_arrival[tail] = arrival;
+  client->queue_count++;
+  client->queue_bytes += size;
+  HTTPSINK_QUEUE_SIGNAL (client, queue_not_empty);
+  if (client->writer_thread)
+    gst_http_sink_writer_wakeup (client);
+  gst_http_sink_unlock_queue (client);
+
+  return GST_FLOW_OK;
+}
+
+static gpointer
+gst_http_sink_sender_thread (gpointer data)
+{
+  GstHttpSinkClient *client = (GstHttpSinkClient *) data;
+  GstBuffer *buf;
+  gint64 arrival;
+
+  GST_DEBUG_OBJECT (client->sink, "sender thread of client %d started", client->fd);
+
+  gst_http_sink_lock_queue (client);
+  while (client->sender_running) {
+    if (!client->queue_count) {
+      HTTPSINK_QUEUE_WAIT (client, queue_not_empty);
+      continue;
+    }
+
+    buf = gst_http_sink_queue_pop (client, &arrival);
+    client->queue_writing = TRUE;
+    HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+    gst_http_sink_unlock_queue (client);
+
+    if (gst_http_sink_send_buffer (client, buf))
+      gst_http_sink_client_count_latency (client, arrival);
+    gst_buffer_unref (buf);
+
+    gst_http_sink_lock_queue (client);
+    client->queue_writing = FALSE;
+    HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+  }
+  gst_http_sink_unlock_queue (client);
+
+  GST_DEBUG_OBJECT (client->sink, "sender thread of client %d stopped", client->fd);
+  return NULL;
+}
+
+/* Sets up the async queue of a client and whatever drains it: the shared
+ * writer when the element holds it, a sender thread of its own otherwise */
+static gboolean
+gst_http_sink_start_sender (GstHttpSinkClient * client)
+{
+  GstHttpSink *httpsink = client->sink;
+
+  if (client->queue_ring)
+    return TRUE;
+
+  gst_http_sink_lock_queue (client);
+  client->queue_capacity = httpsink->max_queue_buffers;
+  client->queue_ring = g_new0 (GstBuffer *, client->queue_capacity);
+  client->queue_arrival = g_new0 (gint64, client->queue_capacity);
+  client->queue_head = 0;
+  client->queue_count = 0;
+  client->queue_bytes = 0;
+  client->queue_flushing = FALSE;
+  client->drop_to_keyframe = FALSE;
+  client->sender_running = TRUE;
+  gst_http_sink_unlock_queue (client);
+
+  if (httpsink->writer_acquired) {
+    g_static_rec_mutex_lock (&client->write_mutex);
+    if (client->fd != -1)
+      gst_http_sink_writer_attach_or_fallback (client);
+    g_static_rec_mutex_unlock (&client->write_mutex);
+    GST_INFO_OBJECT (httpsink, "client %d queued for the shared writer: %u buffers, %u bytes, overflow policy %d",
+        client->fd, httpsink->max_queue_buffers, httpsink->max_queue_bytes, httpsink->overflow_policy);
+    return TRUE;
+  }
+
+#ifdef GLIB_VERSION_2_32
+  client->sender_thread = g_thread_try_new ("httpsink-sender", gst_http_sink_sender_thread, client, NULL);
+#else
+  client->sender_thread = g_thread_create (gst_http_sink_sender_thread, client, TRUE, NULL);
+#endif
+  if (!client->sender_thread) {
+    gst_http_sink_lock_queue (client);
+    client->sender_running = FALSE;
+    g_free (client->queue_ring);
+    g_free (client->queue_arrival);
+    client->queue_ring = NULL;
+    client->queue_arrival = NULL;
+    gst_http_sink_unlock_queue (client);
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (httpsink, "client %d async send queue: %u buffers, %u bytes, overflow policy %d",
+      client->fd, httpsink->max_queue_buffers, httpsink->max_queue_bytes, httpsink->overflow_policy);
+  return TRUE;
+}
+
+static void
+gst_http_sink_stop_sender (GstHttpSinkClient * client)
+{
+  if (!client->queue_ring)
+    return;
+
+  gst_http_sink_lock_queue (client);
+  client->sender_running = FALSE;
+  client->queue_flushing = TRUE;
+  HTTPSINK_QUEUE_SIGNAL (client, queue_not_empty);
+  HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+  gst_http_sink_unlock_queue (client);
+
+  if (client->sender_thread) {
+    g_thread_join (client->sender_thread);
+    client->sender_thread = NULL;
+  }
+
+  g_static_rec_mutex_lock (&client->write_mutex);
+  gst_http_sink_writer_detach (client);
+  gst_http_sink_writer_drop_item (client);
+  g_static_rec_mutex_unlock (&client->write_mutex);
+
+  gst_http_sink_lock_queue (client);
+  gst_http_sink_queue_clear (client);
+  g_free (client->queue_ring);
+  g_free (client->queue_arrival);
+  client->queue_ring = NULL;
+  client->queue_arrival = NULL;
+  client->queue_capacity = 0;
+  client->queue_writing = FALSE;
+  gst_http_sink_unlock_queue (client);
+}
+
+/* Waits until the sender thread has written everything queued so far */
+static void
+gst_http_sink_queue_drain (GstHttpSinkClient * client)
+{
+  gst_http_sink_lock_queue (client);
+  while (!client->queue_flushing && client->sender_running &&
+      (client->queue_count || client->queue_writing))
+    HTTPSINK_QUEUE_WAIT (client, queue_not_full);
+  gst_http_sink_unlock_queue (client);
+}
+
+/* Shared writer: a process wide set of threads that own the sockets of every
+ * httpsink started with shared-writer. Render only queues the buffer and
+ * wakes the thread the client is attached to.
+ * With the epoll backend the thread writes with non-blocking sendmsg() and
+ * waits for EPOLLOUT when the socket is full, so a slow client costs an epoll
+ * registration instead of a parked thread.
+ * With the io_uring backend every client has at most one IORING_OP_SENDMSG
+ * in flight; the sends of all ready clients are submitted with one
+ * io_uring_enter() and the next buffer of a client is queued from the
+ * completion of the previous one. */
+struct _GstHttpSinkWriterThread
+{
+  GThread *thread;
+  GstHttpSinkWriterBackend backend;
+  int epfd;                          /* Client sockets (EPOLLOUT, edge triggered) and wakefd */
+  int wakefd;                        /* eventfd signalled when ready or cancel get a client */
+  GStaticMutex lock;                 /* Protects ready, cancel and clients */
+  GList *ready;                      /* Clients with queued data, referenced */
+  GList *cancel;                     /* Detached clients with a send in flight, referenced */
+  GHashTable *clients;               /* Attached clients by socket, referenced */
+  gboolean running;
+#ifdef HAVE_LIBURING
+  struct io_uring ring;
+  gboolean ring_initialized;
+  eventfd_t wake_value;              /* Target of the read armed on wakefd */
+  guint inflight;                    /* Sends submitted and not completed yet */
+#endif
+};
+
+typedef struct
+{
+  gint refcount;                     /* Started elements using the writer */
+  GstHttpSinkWriterBackend backend;
+  guint n_threads;
+  guint next_thread;                 /* Round robin assignment of new clients */
+  GstHttpSinkWriterThread *threads;
+} GstHttpSinkWriter;
+
+static GStaticMutex shared_writer_lock = G_STATIC_MUTEX_INIT;
+static GstHttpSinkWriter *shared_writer = NULL;
+
+/* Drops the buffer the writer was sending, called with write_mutex held. A
+ * buffer io_uring still sends from is dropped by the completion instead */
+static void
+gst_http_sink_writer_drop_item (GstHttpSinkClient * client)
+{
+  if (!client->writer_buf || client->writer_inflight)
+    return;
+
+#ifdef USE_GST1
+  gst_buffer_unmap (client->writer_buf, &client->writer_map);
+#endif
+  gst_buffer_unref (client->writer_buf);
+  client->writer_buf = NULL;
+}
+
+/* Drops the current item and everything queued once the client is gone,
+ * called with write_mutex held */
+static void
+gst_http_sink_writer_discard (GstHttpSinkClient * client)
+{
+  gst_http_sink_writer_drop_item (client);
+  gst_http_sink_lock_queue (client);
+  if (client->queue_ring)
+    gst_http_sink_queue_clear (client);
+  client->queue_writing = FALSE;
+  gst_http_sink_unlock_queue (client);
+}
+
+/* Takes the next queued buffer as the item to send, called with write_mutex
+ * held. Returns FALSE when the queue is empty */
+static gboolean
+gst_http_sink_writer_next_item (GstHttpSinkClient * client)
+{
+  GstBuffer *buf;
+  gint64 arrival;
+  int len;
+
+  gst_http_sink_lock_queue (client);
+  if (!client->queue_count) {
+    client->queue_writing = FALSE;
+    HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+    gst_http_sink_unlock_queue (client);
+    return FALSE;
+  }
+  buf = gst_http_sink_queue_pop (client, &arrival);
+  client->queue_writing = TRUE;
+  HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+  gst_http_sink_unlock_queue (client);
+
+#ifdef USE_GST1
+  if (!gst_buffer_map (buf, &client->writer_map, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (client->sink, "unable to map buffer, dropping it");
+    gst_buffer_unref (buf);
+    return TRUE;
+  }
+  client->writer_data = client->writer_map.data;
+  client->writer_size = client->writer_map.size;
+#else
+  client->writer_data = GST_BUFFER_DATA (buf);
+  client->writer_size = GST_BUFFER_SIZE (buf);
+#endif
+  gst_http_sink_client_apply_pacing (client);
+  client->writer_buf = buf;
+  client->writer_arrival = arrival;
+  client->writer_offset = 0;
+  client->writer_header_len = 0;
+  if (client->is_chunked) {
+    len = g_snprintf (client->writer_header, sizeof (client->writer_header), "%X\r\n",
+        (guint) client->writer_size);
+    client->writer_header_len = len;
+  }
+  return TRUE;
+}
+
+static gsize
+gst_http_sink_writer_item_size (GstHttpSinkClient * client)
+{
+  return client->writer_header_len + client->writer_size + (client->is_chunked ? 2 : 0);
+}
+
+/* Fills iov with what is left of the current item: chunk header, payload
+ * and trailer. Returns the number of entries used */
+static int
+gst_http_sink_writer_fill_iov (GstHttpSinkClient * client, struct iovec *iov)
+{
+  static const gchar trailer[] = "\r\n";
+  gsize trailer_len = client->is_chunked ? 2 : 0;
+  gsize offset = client->writer_offset;
+  int n = 0;
+
+  if (offset < client->writer_header_len) {
+    iov[n].iov_base = client->writer_header + offset;
+    iov[n].iov_len = client->writer_header_len - offset;
+    n++;
+    offset = client->writer_header_len;
+  }
+  if (offset < client->writer_header_len + client->writer_size) {
+    gsize pos = offset - client->writer_header_len;
+    iov[n].iov_base = (void *) (client->writer_data + pos);
+    iov[n].iov_len = client->writer_size - pos;
+    n++;
+    offset = client->writer_header_len + client->writer_size;
+  }
+  if (trailer_len) {
+    gsize pos = offset - client->writer_header_len - client->writer_size;
+    iov[n].iov_base = (void *) (trailer + pos);
+    iov[n].iov_len = trailer_len - pos;
+    n++;
+  }
+  return n;
+}
+
+/* Accounts bytes sent of the current item. Returns TRUE when the item is
+ * complete, in which case it is released */
+static gboolean
+gst_http_sink_writer_advance (GstHttpSinkClient * client, gsize sent)
+{
+  client->writer_offset += sent;
+  client->sent_data_size += sent;
+  if (client->writer_offset < gst_http_sink_writer_item_size (client))
+    return FALSE;
+
+  gst_http_sink_client_count_latency (client, client->writer_arrival);
+  client->packetcount++;
+  gst_http_sink_writer_drop_item (client);
+  return TRUE;
+}
+
+/* Writes what is left of the current item. Returns TRUE once it is
+ * completely sent, FALSE when the socket is full or, with *failed set, when
+ * the send failed */
+static gboolean
+gst_http_sink_writer_send_item (GstHttpSinkClient * client, gboolean * failed)
+{
+  while (client->writer_buf) {
+    struct iovec iov[3];
+    struct msghdr msg;
+    gsize remaining = gst_http_sink_writer_item_size (client) - client->writer_offset;
+    gssize sockRet;
+    gint64 sendStart;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = gst_http_sink_writer_fill_iov (client, iov);
+
+    sendStart = g_get_monotonic_time ();
+    sockRet = sendmsg (client->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    gst_http_sink_client_count_send (client, sendStart, remaining, sockRet);
+    if (sockRet < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        *failed = TRUE;
+      return FALSE;
+    }
+    gst_http_sink_writer_advance (client, sockRet);
+  }
+  return TRUE;
+}
+
+/* Sends queued buffers of the client until its socket is full, its queue is
+ * empty or it used up its budget. Runs on an epoll writer thread */
+static void
+gst_http_sink_writer_flush (GstHttpSinkClient * client)
+{
+  guint budget = WRITER_CLIENT_BUDGET;
+  gboolean failed = FALSE;
+
+  g_static_rec_mutex_lock (&client->write_mutex);
+  while (client->writer_thread) {
+    if (client->fd == -1 || client->sendError) {
+      gst_http_sink_writer_discard (client);
+      break;
+    }
+
+    if (!client->writer_buf) {
+      if (!budget--) {
+        /* let the other clients of this thread have their turn */
+        gst_http_sink_writer_wakeup (client);
+        break;
+      }
+      if (!gst_http_sink_writer_next_item (client))
+        break;
+      if (!client->writer_buf)
+        continue;
+    }
+
+    if (!gst_http_sink_writer_send_item (client, &failed)) {
+      int err = errno;
+
+      if (!failed)
+        break;                  /* socket full, wait for EPOLLOUT */
+      GST_INFO_OBJECT (client->sink, "sendmsg on socket %x fails err %X", client->fd, err);
+      onError (client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror (err));
+    }
+  }
+  g_static_rec_mutex_unlock (&client->write_mutex);
+}
+
+/* Takes the ready list of the thread, called with wt->lock held */
+static GList *
+gst_http_sink_writer_take_ready (GstHttpSinkWriterThread * wt)
+{
+  GList *work, *l;
+
+  work = g_list_reverse (wt->ready);
+  wt->ready = NULL;
+  for (l = work; l; l = l->next)
+    ((GstHttpSinkClient *) l->data)->writer_scheduled = FALSE;
+  return work;
+}
+
+static gpointer
+gst_http_sink_writer_thread (gpointer data)
+{
+  GstHttpSinkWriterThread *wt = (GstHttpSinkWriterThread *) data;
+  struct epoll_event events[WRITER_MAX_EVENTS];
+
+  while (wt->running) {
+    GList *work, *l;
+    int i, n;
+
+    n = epoll_wait (wt->epfd, events, WRITER_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      GST_ERROR ("shared writer epoll_wait failed: %s", strerror (errno));
+      break;
+    }
+
+    g_static_mutex_lock (&wt->lock);
+    for (i = 0; i < n; i++) {
+      GstHttpSinkClient *client;
+
+      if (events[i].data.fd == wt->wakefd) {
+        eventfd_t value;
+        eventfd_read (wt->wakefd, &value);
+        continue;
+      }
+      client = (GstHttpSinkClient *) g_hash_table_lookup (wt->clients,
+          GINT_TO_POINTER (events[i].data.fd));
+      if (client && !client->writer_scheduled) {
+        client->writer_scheduled = TRUE;
+        wt->ready = g_list_prepend (wt->ready, gst_http_sink_client_ref (client));
+      }
+    }
+    work = gst_http_sink_writer_take_ready (wt);
+    g_static_mutex_unlock (&wt->lock);
+
+    for (l = work; l; l = l->next) {
+      gst_http_sink_writer_flush ((GstHttpSinkClient *) l->data);
+      gst_http_sink_client_unref ((GstHttpSinkClient *) l->data);
+    }
+    g_list_free (work);
+  }
+
+  return NULL;
+}
+
+#ifdef HAVE_LIBURING
+typedef struct
+{
+  struct iovec iov[3];
+  struct msghdr msg;
+} GstHttpSinkUringOp;
+
+/* user_data of the non-send operations */
+static gchar uring_wake_tag;
+static gchar uring_cancel_tag;
+
+static struct io_uring_sqe *
+gst_http_sink_uring_get_sqe (GstHttpSinkWriterThread * wt)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe (&wt->ring);
+
+  if (!sqe) {
+    /* submission queue full, flush it to the kernel */
+    io_uring_submit (&wt->ring);
+    sqe = io_uring_get_sqe (&wt->ring);
+  }
+  return sqe;
+}
+
+static void
+gst_http_sink_uring_arm_wake (GstHttpSinkWriterThread * wt)
+{
+  struct io_uring_sqe *sqe = gst_http_sink_uring_get_sqe (wt);
+
+  io_uring_prep_read (sqe, wt->wakefd, &wt->wake_value, sizeof (wt->wake_value), 0);
+  io_uring_sqe_set_data (sqe, &uring_wake_tag);
+}
+
+/* Queues a sendmsg of what is left of the current item, called with
+ * write_mutex held. The send holds a client reference until it completes */
+static void
+gst_http_sink_uring_submit_item (GstHttpSinkWriterThread * wt, GstHttpSinkClient * client)
+{
+  GstHttpSinkUringOp *op;
+  struct io_uring_sqe *sqe;
+
+  if (!client->writer_op)
+    client->writer_op = g_new0 (GstHttpSinkUringOp, 1);
+  op = (GstHttpSinkUringOp *) client->writer_op;
+
+  memset (&op->msg, 0, sizeof (op->msg));
+  op->msg.msg_iov = op->iov;
+  op->msg.msg_iovlen = gst_http_sink_writer_fill_iov (client, op->iov);
+
+  sqe = gst_http_sink_uring_get_sqe (wt);
+  io_uring_prep_sendmsg (sqe, client->fd, &op->msg, MSG_NOSIGNAL);
+  io_uring_sqe_set_data (sqe, gst_http_sink_client_ref (client));
+
+  client->writer_inflight = TRUE;
+  client->writer_submit_thread = wt;
+  client->writer_submit_fd = client->fd;
+  client->writer_submit_time = g_get_monotonic_time ();
+  client->writer_submit_len = gst_http_sink_writer_item_size (client) - client->writer_offset;
+  wt->inflight++;
+}
+
+/* Starts sending the next queued buffer if nothing is in flight, called
+ * with write_mutex held. Only the thread the client is attached to sends */
+static void
+gst_http_sink_uring_kick (GstHttpSinkWriterThread * wt, GstHttpSinkClient * client)
+{
+  if (client->writer_inflight)
+    return;
+
+  if (client->writer_thread && client->writer_thread != wt)
+    return;
+
+  if (!client->writer_thread || client->fd == -1 || client->sendError) {
+    gst_http_sink_writer_discard (client);
+    return;
+  }
+
+  while (!client->writer_buf) {
+    if (!gst_http_sink_writer_next_item (client))
+      return;
+  }
+  gst_http_sink_uring_submit_item (wt, client);
+}
+
+static void
+gst_http_sink_uring_complete (GstHttpSinkWriterThread * wt, GstHttpSinkClient * client, int res)
+{
+  g_static_rec_mutex_lock (&client->write_mutex);
+  client->writer_inflight = FALSE;
+  wt->inflight--;
+  gst_http_sink_client_count_send (client, client->writer_submit_time,
+      client->writer_submit_len, res < 0 ? -1 : res);
+
+  if (client->writer_thread && client->fd != -1 && !client->sendError &&
+      (res == -ECANCELED || client->writer_thread != wt || client->fd != client->writer_submit_fd)) {
+    /* detached and attached again, possibly with a new socket, while the
+     * send was in flight. What is left of the item belonged to the old
+     * attachment, the owner carries on with the queue */
+    gst_http_sink_writer_drop_item (client);
+    if (client->writer_thread == wt)
+      gst_http_sink_uring_kick (wt, client);
+    else
+      gst_http_sink_writer_wakeup (client);
+  } else if (res == -ECANCELED || !client->writer_thread || client->fd == -1 || client->sendError) {
+    /* detached or gone while the send was in flight */
+    gst_http_sink_writer_discard (client);
+  } else if (res < 0 && res != -EINTR && res != -EAGAIN) {
+    GST_INFO_OBJECT (client->sink, "io_uring sendmsg on socket %x fails err %X", client->fd, -res);
+    onError (client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, strerror (-res));
+    gst_http_sink_writer_discard (client);
+  } else {
+    if (res > 0)
+      gst_http_sink_writer_advance (client, res);
+    gst_http_sink_uring_kick (wt, client);
+  }
+  g_static_rec_mutex_unlock (&client->write_mutex);
+}
+
+static gpointer
+gst_http_sink_uring_thread (gpointer data)
+{
+  GstHttpSinkWriterThread *wt = (GstHttpSinkWriterThread *) data;
+
+  gst_http_sink_uring_arm_wake (wt);
+
+  while (wt->running || wt->inflight) {
+    struct io_uring_cqe *cqe;
+    GList *work, *cancel, *l;
+    unsigned head, count = 0;
+    gboolean woken = FALSE;
+    int ret;
+
+    ret = io_uring_submit_and_wait (&wt->ring, 1);
+    if (ret < 0 && ret != -EINTR) {
+      GST_ERROR ("shared writer io_uring_submit_and_wait failed: %s", strerror (-ret));
+      break;
+    }
+
+    io_uring_for_each_cqe (&wt->ring, head, cqe) {
+      void *tag = io_uring_cqe_get_data (cqe);
+
+      count++;
+      if (tag == &uring_wake_tag) {
+        woken = TRUE;
+      } else if (tag != &uring_cancel_tag) {
+        GstHttpSinkClient *client = (GstHttpSinkClient *) tag;
+
+        gst_http_sink_uring_complete (wt, client, cqe->res);
+        gst_http_sink_client_unref (client);
+      }
+    }
+    io_uring_cq_advance (&wt->ring, count);
+
+    if (!woken)
+      continue;
+    if (wt->running)
+      gst_http_sink_uring_arm_wake (wt);
+
+    g_static_mutex_lock (&wt->lock);
+    work = gst_http_sink_writer_take_ready (wt);
+    cancel = wt->cancel;
+    wt->cancel = NULL;
+    g_static_mutex_unlock (&wt->lock);
+
+    for (l = cancel; l; l = l->next) {
+      GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+      g_static_rec_mutex_lock (&client->write_mutex);
+      if (client->writer_inflight) {
+        struct io_uring_sqe *sqe = gst_http_sink_uring_get_sqe (wt);
+
+        io_uring_prep_cancel (sqe, client, 0);
+        io_uring_sqe_set_data (sqe, &uring_cancel_tag);
+      }
+      g_static_rec_mutex_unlock (&client->write_mutex);
+      gst_http_sink_client_unref (client);
+    }
+    g_list_free (cancel);
+
+    /* all sends prepared here go to the kernel with the next submit */
+    for (l = work; l; l = l->next) {
+      GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+      g_static_rec_mutex_lock (&client->write_mutex);
+      gst_http_sink_uring_kick (wt, client);
+      g_static_rec_mutex_unlock (&client->write_mutex);
+      gst_http_sink_client_unref (client);
+    }
+    g_list_free (work);
+  }
+
+  return NULL;
+}
+#endif
+
+static void
+gst_http_sink_writer_free (GstHttpSinkWriter * writer)
+{
+  guint i;
+
+  for (i = 0; i < writer->n_threads; i++) {
+    GstHttpSinkWriterThread *wt = &writer->threads[i];
+
+    if (wt->thread) {
+      wt->running = FALSE;
+      eventfd_write (wt->wakefd, 1);
+      g_thread_join (wt->thread);
+    }
+#ifdef HAVE_LIBURING
+    if (wt->ring_initialized)
+      io_uring_queue_exit (&wt->ring);
+#endif
+    if (wt->epfd != -1)
+      close (wt->epfd);
+    if (wt->wakefd != -1)
+      close (wt->wakefd);
+    g_list_foreach (wt->ready, (GFunc) gst_http_sink_client_unref, NULL);
+    g_list_free (wt->ready);
+    g_list_foreach (wt->cancel, (GFunc) gst_http_sink_client_unref, NULL);
+    g_list_free (wt->cancel);
+    if (wt->clients)
+      g_hash_table_destroy (wt->clients);
+    g_static_mutex_free (&wt->lock);
+  }
+  g_free (writer->threads);
+  g_free (writer);
+}
+
+/* Sets up the backend specific part of a writer thread */
+static gboolean
+gst_http_sink_writer_thread_init (GstHttpSinkWriterThread * wt)
+{
+  struct epoll_event ev;
+  GThreadFunc func = gst_http_sink_writer_thread;
+
+#ifdef HAVE_LIBURING
+  if (wt->backend == GST_HTTP_SINK_WRITER_IO_URING) {
+    int ret;
+
+    /* io_uring reads wakefd, a blocking eventfd makes the read wait */
+    wt->wakefd = eventfd (0, EFD_CLOEXEC);
+    if (wt->wakefd == -1)
+      return FALSE;
+    ret = io_uring_queue_init (WRITER_URING_ENTRIES, &wt->ring, 0);
+    if (ret < 0) {
+      errno = -ret;
+      return FALSE;
+    }
+    wt->ring_initialized = TRUE;
+    func = gst_http_sink_uring_thread;
+  } else
+#endif
+  {
+    wt->wakefd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wt->epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (wt->wakefd == -1 || wt->epfd == -1)
+      return FALSE;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wt->wakefd;
+    if (epoll_ctl (wt->epfd, EPOLL_CTL_ADD, wt->wakefd, &ev) < 0)
+      return FALSE;
+  }
+
+  wt->running = TRUE;
+#ifdef GLIB_VERSION_2_32
+  wt->thread = g_thread_try_new ("httpsink-writer", func, wt, NULL);
+#else
+  wt->thread = g_thread_create (func, wt, TRUE, NULL);
+#endif
+  return wt->thread != NULL;
+}
+
+static GstHttpSinkWriter *
+gst_http_sink_writer_new (GstHttpSinkWriterBackend backend, guint n_threads)
+{
+  GstHttpSinkWriter *writer;
+  guint i;
+
+  writer = g_new0 (GstHttpSinkWriter, 1);
+  writer->backend = backend;
+  writer->n_threads = n_threads;
+  writer->threads = g_new0 (GstHttpSinkWriterThread, n_threads);
+  for (i = 0; i < n_threads; i++) {
+    GstHttpSinkWriterThread *wt = &writer->threads[i];
+
+    wt->backend = backend;
+    g_static_mutex_init (&wt->lock);
+    wt->clients = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+        (GDestroyNotify) gst_http_sink_client_unref);
+    wt->epfd = -1;
+    wt->wakefd = -1;
+    if (!gst_http_sink_writer_thread_init (wt)) {
+      GST_WARNING ("unable to start shared writer thread: %s", strerror (errno));
+      writer->n_threads = i + 1;
+      gst_http_sink_writer_free (writer);
+      return NULL;
+    }
+  }
+  return writer;
+}
+
+/* Takes a reference on the shared writer, starting it with n_threads threads
+ * and the given backend if this is the first user. io_uring falls back to
+ * epoll when the kernel or the build lacks it */
+static gboolean
+gst_http_sink_writer_acquire (GstHttpSinkWriterBackend backend, guint n_threads)
+{
+  GstHttpSinkWriter *writer = NULL;
+
+  g_static_mutex_lock (&shared_writer_lock);
+  if (shared_writer) {
+    shared_writer->refcount++;
+    g_static_mutex_unlock (&shared_writer_lock);
+    return TRUE;
+  }
+
+  if (backend == GST_HTTP_SINK_WRITER_IO_URING) {
+#ifdef HAVE_LIBURING
+    writer = gst_http_sink_writer_new (GST_HTTP_SINK_WRITER_IO_URING, n_threads);
+    if (!writer)
+      GST_WARNING ("io_uring not usable, shared writer falls back to epoll");
+#else
+    GST_WARNING ("built without io_uring support, shared writer uses epoll");
+#endif
+  }
+  if (!writer)
+    writer = gst_http_sink_writer_new (GST_HTTP_SINK_WRITER_EPOLL, n_threads);
+  if (!writer) {
+    g_static_mutex_unlock (&shared_writer_lock);
+    GST_ERROR ("unable to start shared writer");
+    return FALSE;
+  }
+
+  writer->refcount = 1;
+  shared_writer = writer;
+  g_static_mutex_unlock (&shared_writer_lock);
+
+  GST_INFO ("shared writer started with %u %s threads", n_threads,
+      writer->backend == GST_HTTP_SINK_WRITER_IO_URING ? "io_uring" : "epoll");
+  return TRUE;
+}
+
+static void
+gst_http_sink_writer_release (void)
+{
+  g_static_mutex_lock (&shared_writer_lock);
+  if (shared_writer && --shared_writer->refcount == 0) {
+    gst_http_sink_writer_free (shared_writer);
+    shared_writer = NULL;
+    GST_INFO ("shared writer stopped");
+  }
+  g_static_mutex_unlock (&shared_writer_lock);
+}
+
+/* Registers the client socket with one of the writer threads, called with
+ * write_mutex held */
+static gboolean
+gst_http_sink_writer_attach (GstHttpSinkClient * client)
+{
+  GstHttpSinkWriterThread *wt;
+  struct epoll_event ev;
+
+  g_static_mutex_lock (&shared_writer_lock);
+  if (!shared_writer) {
+    g_static_mutex_unlock (&shared_writer_lock);
+    return FALSE;
+  }
+  wt = &shared_writer->threads[shared_writer->next_thread++ % shared_writer->n_threads];
+  g_static_mutex_unlock (&shared_writer_lock);
+
+  g_static_mutex_lock (&wt->lock);
+  if (wt->backend == GST_HTTP_SINK_WRITER_EPOLL) {
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.fd = client->fd;
+    if (epoll_ctl (wt->epfd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+      g_static_mutex_unlock (&wt->lock);
+      GST_WARNING_OBJECT (client->sink, "unable to add socket %x to the shared writer: %s",
+          client->fd, strerror (errno));
+      return FALSE;
+    }
+  }
+  g_hash_table_insert (wt->clients, GINT_TO_POINTER (client->fd),
+      gst_http_sink_client_ref (client));
+  client->writer_thread = wt;
+  client->writer_fd = client->fd;
+  g_static_mutex_unlock (&wt->lock);
+
+  /* data may have been queued before the socket was known */
+  gst_http_sink_writer_wakeup (client);
+  return TRUE;
+}
+
+/* Attaches the client to the shared writer. When the writer cannot take the
+ * socket the client gets a sender thread of its own instead, and if that
+ * cannot be started either the client is failed, so render never fills a
+ * queue nothing drains. Called with write_mutex held */
+static void
+gst_http_sink_writer_attach_or_fallback (GstHttpSinkClient * client)
+{
+  if (client->sender_thread || gst_http_sink_writer_attach (client))
+    return;
+
+  GST_WARNING_OBJECT (client->sink, "shared writer unavailable for socket %x, using a sender thread",
+      client->fd);
+#ifdef GLIB_VERSION_2_32
+  client->sender_thread = g_thread_try_new ("httpsink-sender", gst_http_sink_sender_thread, client, NULL);
+#else
+  client->sender_thread = g_thread_create (gst_http_sink_sender_thread, client, TRUE, NULL);
+#endif
+  if (!client->sender_thread && !client->sendError)
+    onError (client, GST_HTTPSINK_EVENT_CONNECTION_CLOSED, (char *) "no writer for socket");
+}
+
+/* Unregisters the client socket, called with write_mutex held. The writer
+ * thread starts no new send on the socket once this returns, an io_uring
+ * send still in flight is cancelled */
+static void
+gst_http_sink_writer_detach (GstHttpSinkClient * client)
+{
+  GstHttpSinkWriterThread *wt = client->writer_thread;
+
+  if (!wt)
+    return;
+
+  g_static_mutex_lock (&wt->lock);
+  if (wt->backend == GST_HTTP_SINK_WRITER_EPOLL)
+    epoll_ctl (wt->epfd, EPOLL_CTL_DEL, client->writer_fd, NULL);
+  g_hash_table_steal (wt->clients, GINT_TO_POINTER (client->writer_fd));
+  if (client->writer_inflight) {
+    wt->cancel = g_list_append (wt->cancel, gst_http_sink_client_ref (client));
+    eventfd_write (wt->wakefd, 1);
+  }
+  client->writer_thread = NULL;
+  client->writer_fd = -1;
+  g_static_mutex_unlock (&wt->lock);
+
+  gst_http_sink_client_unref (client);
+}
+
+/* Puts the client on the ready list of its writer thread */
+static void
+gst_http_sink_writer_wakeup (GstHttpSinkClient * client)
+{
+  GstHttpSinkWriterThread *wt = client->writer_thread;
+
+  if (!wt)
+    return;
+
+  g_static_mutex_lock (&wt->lock);
+  if (!client->writer_scheduled) {
+    client->writer_scheduled = TRUE;
+    wt->ready = g_list_append (wt->ready, gst_http_sink_client_ref (client));
+    eventfd_write (wt->wakefd, 1);
+  }
+  g_static_mutex_unlock (&wt->lock);
+}
+
+static GstHttpSinkClient *
+gst_http_sink_client_new (GstHttpSink * httpsink, gint fd, gboolean chunked)
+{
+  GstHttpSinkClient *client;
+
+  client = g_slice_new0 (GstHttpSinkClient);
+  client->sink = httpsink;
+  client->refcount = 1;
+  client->fd = fd;
+  client->is_chunked = chunked;
+  client->zerocopy_fd = -1;
+  client->zerocopy_failed_fd = -1;
+  client->zerocopy_pending = g_queue_new ();
+  client->writer_fd = -1;
+  client->writer_submit_fd = -1;
+  g_static_rec_mutex_init (&client->write_mutex);
+#ifdef GLIB_VERSION_2_32
+  g_mutex_init (&client->queue_lock);
+  g_cond_init (&client->queue_not_empty);
+  g_cond_init (&client->queue_not_full);
+#else
+  client->queue_lock = g_mutex_new ();
+  client->queue_not_empty = g_cond_new ();
+  client->queue_not_full = g_cond_new ();
+#endif
+
+  return client;
+}
+
+static GstHttpSinkClient *
+gst_http_sink_client_ref (GstHttpSinkClient * client)
+{
+  g_atomic_int_inc (&client->refcount);
+  return client;
+}
+
+static void
+gst_http_sink_client_unref (GstHttpSinkClient * client)
+{
+  if (!g_atomic_int_dec_and_test (&client->refcount))
+    return;
+
+  gst_http_sink_stop_sender (client);
+  g_static_rec_mutex_lock (&client->write_mutex);
+  gst_http_sink_writer_drop_item (client);
+  gst_http_sink_zerocopy_flush (client);
+  g_static_rec_mutex_unlock (&client->write_mutex);
+  g_queue_free (client->zerocopy_pending);
+  g_free (client->writer_op);
+
+  g_static_rec_mutex_free (&client->write_mutex);
+#ifdef GLIB_VERSION_2_32
+  g_mutex_clear (&client->queue_lock);
+  g_cond_clear (&client->queue_not_empty);
+  g_cond_clear (&client->queue_not_full);
+#else
+  g_mutex_free (client->queue_lock);
+  g_cond_free (client->queue_not_empty);
+  g_cond_free (client->queue_not_full);
+#endif
+  g_slice_free (GstHttpSinkClient, client);
+}
+
+/* Returns a referenced copy of the list of clients that still get data, so
+ * that render and the basesink vmethods can walk it without holding
+ * http_obj_mutex while they block */
+static GList *
+gst_http_sink_get_clients (GstHttpSink * httpsink)
+{
+  GList *l, *clients = NULL;
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+    if (client->fd != -1 && !client->sendError)
+      clients = g_list_prepend (clients, gst_http_sink_client_ref (client));
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  return g_list_reverse (clients);
+}
+
+static void
+gst_http_sink_release_clients (GList * clients)
+{
+  GList *l;
+
+  for (l = clients; l; l = l->next)
+    gst_http_sink_client_unref ((GstHttpSinkClient *) l->data);
+  g_list_free (clients);
+}
+
+/* Stops all writes to the client socket: once this returns the caller may
+ * close the fd */
+static void
+gst_http_sink_client_detach (GstHttpSinkClient * client)
+{
+  gst_http_sink_lock_queue (client);
+  if (client->queue_ring)
+    gst_http_sink_queue_clear (client);
+  gst_http_sink_unlock_queue (client);
+
+  g_static_rec_mutex_lock (&client->write_mutex);
+  gst_http_sink_writer_detach (client);
+  gst_http_sink_writer_drop_item (client);
+  gst_http_sink_zerocopy_flush (client);
+  client->fd = -1;
+  g_static_rec_mutex_unlock (&client->write_mutex);
+}
+
+static gboolean
+gst_http_sink_add_client (GstHttpSink * httpsink, gint fd, gboolean chunked)
+{
+  GstHttpSinkClient *client;
+  GList *l;
+
+  if (fd < 0)
+    return FALSE;
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    if (((GstHttpSinkClient *) l->data)->fd == fd) {
+      g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+      GST_WARNING_OBJECT (httpsink, "client %d already added", fd);
+      return FALSE;
+    }
+  }
+
+  client = gst_http_sink_client_new (httpsink, fd, chunked);
+  if (httpsink->started && (httpsink->async || httpsink->writer_acquired) &&
+      !gst_http_sink_start_sender (client)) {
+    g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+    GST_ERROR_OBJECT (httpsink, "unable to start sender thread for client %d", fd);
+    gst_http_sink_client_unref (client);
+    return FALSE;
+  }
+  httpsink->clients = g_list_append (httpsink->clients, client);
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  GST_INFO_OBJECT (httpsink, "added client %d, %s", fd, chunked ? "chunked" : "linear");
+  return TRUE;
+}
+
+static gboolean
+gst_http_sink_remove_client (GstHttpSink * httpsink, gint fd)
+{
+  GstHttpSinkClient *client = NULL;
+  GList *l;
+
+  if (fd < 0)
+    return FALSE;
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    if (((GstHttpSinkClient *) l->data)->fd == fd) {
+      client = (GstHttpSinkClient *) l->data;
+      break;
+    }
+  }
+  if (client && client != httpsink->http_client)
+    httpsink->clients = g_list_delete_link (httpsink->clients, l);
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  if (!client) {
+    GST_WARNING_OBJECT (httpsink, "no client %d to remove", fd);
+    return FALSE;
+  }
+
+  gst_http_sink_client_detach (client);
+  if (client != httpsink->http_client) {
+    gst_http_sink_stop_sender (client);
+    gst_http_sink_client_unref (client);
+  }
+
+  GST_INFO_OBJECT (httpsink, "removed client %d", fd);
+  return TRUE;
+}
+
+static gboolean
+gst_http_sink_unlock (GstBaseSink * bsink)
+{
+  GstHttpSink *httpsink = GST_HTTP_SINK (bsink);
+  GList *l;
+
+  /* flushing: wake up render blocked on a full queue, queued data is stale */
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+    gst_http_sink_lock_queue (client);
+    client->queue_flushing = TRUE;
+    if (client->queue_ring)
+      gst_http_sink_queue_clear (client);
+    HTTPSINK_QUEUE_SIGNAL (client, queue_not_full);
+    gst_http_sink_unlock_queue (client);
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  return TRUE;
+}
+
+static gboolean
+gst_http_sink_unlock_stop (GstBaseSink * bsink)
+{
+  GstHttpSink *httpsink = GST_HTTP_SINK (bsink);
+  GList *l;
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+    gst_http_sink_lock_queue (client);
+    client->queue_flushing = FALSE;
+    gst_http_sink_unlock_queue (client);
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  return TRUE;
+}
+
+static gboolean
+gst_http_sink_event (GstBaseSink * sink, GstEvent * event)
+{
+  GstHttpSink *httpsink = GST_HTTP_SINK (sink);
+
+  /* a BYTES segment tells where in the stream the next buffer starts */
+#ifdef USE_GST1
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+    const GstSegment *segment;
+
+    gst_event_parse_segment (event, &segment);
+    if (segment->format == GST_FORMAT_BYTES)
+      httpsink->byte_offset = segment->start;
+  }
+#else
+  if (GST_EVENT_TYPE (event) == GST_EVENT_NEWSEGMENT) {
+    GstFormat format;
+    gint64 start;
+
+    gst_event_parse_new_segment (event, NULL, NULL, &format, &start, NULL, NULL);
+    if (format == GST_FORMAT_BYTES && start >= 0)
+      httpsink->byte_offset = start;
+  }
+#endif
+
+  /* EOS is only posted once the clients got all the data */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && (httpsink->async || httpsink->writer_acquired)) {
+    GList *clients, *l;
+
+    clients = gst_http_sink_get_clients (httpsink);
+    for (l = clients; l; l = l->next)
+      gst_http_sink_queue_drain ((GstHttpSinkClient *) l->data);
+    gst_http_sink_release_clients (clients);
+  }
+
+  return GST_HTTP_SINK_GET_CLASS (httpsink)->parent_event (sink, event);
+}
+
+static GstStructure *
+gst_http_sink_client_create_stats (GstHttpSinkClient * client)
+{
+  GstStructure *s;
+  guint64 average = 0, bitrate;
+  guint queue_buffers;
+  guint64 queue_bytes, dropped_bytes;
+  gint64 elapsed, now;
+
+  gst_http_sink_lock_queue (client);
+  queue_buffers = client->queue_count;
+  queue_bytes = client->queue_bytes;
+  dropped_bytes = client->dropped_bytes;
+  gst_http_sink_unlock_queue (client);
+
+  now = g_get_monotonic_time ();
+  elapsed = now - client->first_send_time;
+  if (client->first_send_time && elapsed > 0)
+    average = client->sent_data_size * 8 * G_USEC_PER_SEC / elapsed;
+
+  /* only a send closes the bitrate window, when none did for a while the
+   * client is stalled and gets the rate since the window opened */
+  bitrate = client->bitrate;
+  if (client->rate_window_start && now - client->rate_window_start >= 2 * G_USEC_PER_SEC)
+    bitrate = (client->sent_data_size - client->rate_window_bytes) * 8 *
+        G_USEC_PER_SEC / (now - client->rate_window_start);
+
+  s = gst_structure_new ("httpsink-client-stats",
+      "fd", G_TYPE_INT, client->fd,
+      "bytes-sent", G_TYPE_UINT64, client->sent_data_size,
+      "bitrate", G_TYPE_UINT64, bitrate,
+      "average-bitrate", G_TYPE_UINT64, average,
+      "send-calls", G_TYPE_UINT64, client->send_calls,
+      "short-writes", G_TYPE_UINT64, client->short_writes,
+      "blocked-time", G_TYPE_UINT64, (guint64) client->blocked_time * GST_USECOND,
+      "max-block-time", G_TYPE_UINT64, (guint64) client->max_block_time * GST_USECOND,
+      "queue-level-buffers", G_TYPE_UINT, queue_buffers,
+      "queue-level-bytes", G_TYPE_UINT64, queue_bytes,
+      "dropped-bytes", G_TYPE_UINT64, dropped_bytes,
+      "latency-p50", G_TYPE_UINT64, gst_http_sink_client_latency_percentile (client, 50),
+      "latency-p90", G_TYPE_UINT64, gst_http_sink_client_latency_percentile (client, 90),
+      "latency-p99", G_TYPE_UINT64, gst_http_sink_client_latency_percentile (client, 99),
+      "send-error", G_TYPE_BOOLEAN, client->sendError,
+      NULL);
+  return s;
+}
+
+/* Builds the stats property and periodic message: per client figures in the
+ * clients array plus totals at the top level. Times are in ns, bitrates in
+ * bit/s, latency percentiles are log2 bucket upper bounds */
+static GstStructure *
+gst_http_sink_create_stats (GstHttpSink * httpsink)
+{
+  GstStructure *s;
+  GValue clients = { 0, };
+  GValue item = { 0, };
+  guint64 bytes = 0, bitrate = 0, queue_bytes = 0, dropped_bytes = 0;
+  guint num_clients = 0;
+  GList *l;
+
+  g_value_init (&clients, GST_TYPE_ARRAY);
+
+  g_static_rec_mutex_lock (&httpsink->http_obj_mutex);
+  for (l = httpsink->clients; l; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+    GstStructure *cs;
+    guint64 value;
+
+    if (client->fd == -1)
+      continue;
+
+    cs = gst_http_sink_client_create_stats (client);
+    gst_structure_get_uint64 (cs, "bytes-sent", &value);
+    bytes += value;
+    gst_structure_get_uint64 (cs, "bitrate", &value);
+    bitrate += value;
+    gst_structure_get_uint64 (cs, "queue-level-bytes", &value);
+    queue_bytes += value;
+    gst_structure_get_uint64 (cs, "dropped-bytes", &value);
+    dropped_bytes += value;
+    num_clients++;
+
+    g_value_init (&item, GST_TYPE_STRUCTURE);
+    gst_value_set_structure (&item, cs);
+    gst_value_array_append_value (&clients, &item);
+    g_value_unset (&item);
+    gst_structure_free (cs);
+  }
+  g_static_rec_mutex_unlock (&httpsink->http_obj_mutex);
+
+  s = gst_structure_new ("httpsink-stats",
+      "num-clients", G_TYPE_UINT, num_clients,
+      "bytes-sent", G_TYPE_UINT64, bytes,
+      "bitrate", G_TYPE_UINT64, bitrate,
+      "queue-level-bytes", G_TYPE_UINT64, queue_bytes,
+      "dropped-bytes", G_TYPE_UINT64, dropped_bytes,
+      NULL);
+  gst_structure_set_value (s, "clients", &clients);
+  g_value_unset (&clients);
+
+  return s;
+}
+
+/* Posts the stats message every stats_interval ms from start to stop,
+ * whether buffers arrive or not, so a stalled stream is reported too */
+static gpointer
+gst_http_sink_stats_thread (gpointer data)
+{
+  GstHttpSink *httpsink = (GstHttpSink *) data;
+  gint64 now, due;
+
+  gst_http_sink_lock_stats (httpsink);
+  while (httpsink->stats_running) {
+    if (!httpsink->stats_interval) {
+      HTTPSINK_STATS_WAIT (httpsink);
+      continue;
+    }
+
+    now = g_get_monotonic_time ();
+    due = httpsink->last_stats_post + (gint64) httpsink->stats_interval * 1000;
+    if (now < due) {
+      gst_http_sink_stats_wait_until (httpsink, due);
+      continue;
+    }
+
+    httpsink->last_stats_post = now;
+    gst_http_sink_unlock_stats (httpsink);
+    gst_element_post_message (GST_ELEMENT (httpsink),
+        gst_message_new_element (GST_OBJECT (httpsink), gst_http_sink_create_stats (httpsink)));
+    gst_http_sink_lock_stats (httpsink);
+  }
+  gst_http_sink_unlock_stats (httpsink);
+
+  return NULL;
+}
+
+static void
+gst_http_sink_start_stats (GstHttpSink * httpsink)
+{
+  gst_http_sink_lock_stats (httpsink);
+  httpsink->stats_running = TRUE;
+  httpsink->last_stats_post = g_get_monotonic_time ();
+  gst_http_sink_unlock_stats (httpsink);
+
+#ifdef GLIB_VERSION_2_32
+  httpsink->stats_thread = g_thread_try_new ("httpsink-stats", gst_http_sink_stats_thread, httpsink, NULL);
+#else
+  httpsink->stats_thread = g_thread_create (gst_http_sink_stats_thread, httpsink, TRUE, NULL);
+#endif
+  if (!httpsink->stats_thread)
+    GST_WARNING_OBJECT (httpsink, "unable to start the stats thread, no stats messages");
+}
+
+static void
+gst_http_sink_stop_stats (GstHttpSink * httpsink)
+{
+  gst_http_sink_lock_stats (httpsink);
+  httpsink->stats_running = FALSE;
+  HTTPSINK_STATS_SIGNAL (httpsink);
+  gst_http_sink_unlock_stats (httpsink);
+
+  if (httpsink->stats_thread) {
+    g_thread_join (httpsink->stats_thread);
+    httpsink->stats_thread = NULL;
+  }
+}
+
+/* A running stats thread picks up the new period at once */
+static void
+gst_http_sink_set_stats_interval (GstHttpSink * httpsink, guint interval)
+{
+  gst_http_sink_lock_stats (httpsink);
+  httpsink->stats_interval = interval;
+  HTTPSINK_STATS_SIGNAL (httpsink);
+  gst_http_sink_unlock_stats (httpsink);
+}
+
+/* Logs the first bytes of the stream once */
+static void
+gst_http_sink_dump_first_packet (GstHttpSink * httpsink, GstBuffer * buf)
+{
+#ifdef USE_GST1
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READ))
+    return;
+  if(map.size >=16)
+#else
+  if(buf->size >=16)
+#endif
+  {
+#ifdef USE_GST1
+    GST_INFO_OBJECT(httpsink, "httpsink::Received first packet[%d]: ", map.size);
+#else
+    GST_INFO_OBJECT(httpsink, "httpsink::Received first packet[%d]: ", buf->size);
+#endif
+	int ix;
+    for(ix=0; ix<16; ix++)
+#ifdef USE_GST1
+      g_print("%02X ", map.data[ix]);
+#else
+      g_print("%02X ", buf->data[ix]);
+#endif
+    g_print("\n");
+	httpsink->isFirstPacket = FALSE;
+  }
+#ifdef USE_GST1
+  gst_buffer_unmap (buf, &map);
+#endif
+}
+
+static GstFlowReturn
+gst_http_sink_render (GstBaseSink * sink, GstBuffer * buf)
+{
+  GstHttpSink *httpsink;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GList *clients, *l;
+  gint64 arrival = g_get_monotonic_time ();
+  GstBuffer *sub = NULL;
+  guint64 offset;
+  gsize size;
+
+  httpsink = GST_HTTP_SINK (sink);
+
+  if(buf == NULL)
+  {
+     GST_ERROR("NULL buf passed Error!!!");
+     return GST_FLOW_ERROR;
+  }
+
+  httpsink->last_timestamp= GST_BUFFER_TIMESTAMP(buf);
+
+  /* byte offset of the buffer in the stream, upstream knows it in a BYTES
+   * segment, otherwise the buffers are counted */
+  size = gst_http_sink_buffer_size (buf);
+  if (GST_BUFFER_OFFSET_IS_VALID (buf) && sink->segment.format == GST_FORMAT_BYTES)
+    offset = GST_BUFFER_OFFSET (buf);
+  else
+    offset = httpsink->byte_offset;
+  httpsink->byte_offset = offset + size;
+
+  /* skip what the client already got before resuming */
+  if (offset < httpsink->start_offset) {
+    guint64 skip = httpsink->start_offset - offset;
+
+    if (skip >= size) {
+      GST_LOG_OBJECT (httpsink, "skipping buffer at offset %" G_GUINT64_FORMAT " before start-offset", offset);
+      return GST_FLOW_OK;
+    }
+#ifdef USE_GST1
+    sub = gst_buffer_copy_region (buf, GST_BUFFER_COPY_ALL, skip, size - skip);
+#else
+    sub = gst_buffer_create_sub (buf, skip, size - skip);
+#endif
+    if (!sub) {
+      GST_ERROR_OBJECT (httpsink, "unable to trim buffer to start-offset");
+      return GST_FLOW_ERROR;
+    }
+    GST_DEBUG_OBJECT (httpsink, "resuming at offset %" G_GUINT64_FORMAT, httpsink->start_offset);
+    buf = sub;
+  }
+
+  if(httpsink->isFirstPacket)
+    gst_http_sink_dump_first_packet (httpsink, buf);
+
+  if (httpsink->pacing != GST_HTTP_SINK_PACING_NONE)
+    gst_http_sink_estimate_rate (httpsink, buf, arrival);
+
+  /* every client gets the same buffer, in async mode each queue holds a ref */
+  clients = gst_http_sink_get_clients (httpsink);
+  for (l = clients; l && ret == GST_FLOW_OK; l = l->next) {
+    GstHttpSinkClient *client = (GstHttpSinkClient *) l->data;
+
+    if (httpsink->async || httpsink->writer_acquired) {
+      ret = gst_http_sink_queue_buffer (client, buf, arrival);
+    } else if (gst_http_sink_send_buffer (client, buf)) {
+      gst_http_sink_client_count_latency (client, arrival);
+    }
+  }
+  gst_http_sink_release_clients (clients);
+  if (sub)
+    gst_buffer_unref (sub);
+
+  return ret;
+}
+
+/* Answers BYTES position and duration queries. The position is the stream
+ * offset up to which data went to the default client, data still waiting in
+ * its queue excluded; the duration is the one of upstream */
+static gboolean
+gst_http_sink_query_bytes (GstHttpSink * self, GstQuery * query)
+{
+  GstHttpSinkClient *client = self->http_client;
+  gint64 value;
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_DURATION) {
+#ifdef USE_GST1
+    if (!gst_pad_peer_query_duration (GST_BASE_SINK_PAD (self), GST_FORMAT_BYTES, &value))
+#else
+    GstFormat format = GST_FORMAT_BYTES;
+
+    if (!gst_pad_query_peer_duration (GST_BASE_SINK_PAD (self), &format, &value))
+#endif
+      return FALSE;
+    gst_query_set_duration (query, GST_FORMAT_BYTES, value);
+    return TRUE;
+  }
+
+  value = self->byte_offset;
+  gst_http_sink_lock_queue (client);
+  if (client->queue_ring)
+    value -= MIN ((guint64) value, client->queue_bytes);
+  gst_http_sink_unlock_queue (client);
+  gst_query_set_position (query, GST_FORMAT_BYTES, value);
+  GST_INFO_OBJECT (self, "GST_FORMAT_BYTES position %" G_GINT64_FORMAT, value);
+  return TRUE;
+}
+
+static gboolean
+gst_http_sink_query (GstElement * element, GstQuery * query)
+{
+  GstHttpSink *self;
+  GstFormat format;
+
+  self = GST_HTTP_SINK (element);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, NULL);
+      switch (format) {
+        case GST_FORMAT_DEFAULT:
+        case GST_FORMAT_TIME:
+          gst_query_set_position (query, GST_FORMAT_TIME, self->last_timestamp);
+         GST_INFO_OBJECT(self, "gst_http_sink_query: GST_FORMAT_TIME position %llx", self->last_timestamp);
+          return TRUE;
+        case GST_FORMAT_BYTES:
+          return gst_http_sink_query_bytes (self, query);
+        default:
+          return FALSE;
+      }
+
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, NULL);
+      if (format == GST_FORMAT_BYTES)
+        return gst_http_sink_query_bytes (self, query);
+      return GST_HTTP_SINK_GET_CLASS(self)->parent_query(element,query);
+
+    case GST_QUERY_FORMATS:
+      gst_query_set_formats (query, 3, GST_FORMAT_DEFAULT, GST_FORMAT_TIME, GST_FORMAT_BYTES);
+      return TRUE;
+    default:
+      return GST_HTTP_SINK_GET_CLASS(self)->parent_query(element,query);
+  }
+}
+
+static gboolean
+#ifdef USE_GST1
+gst_http_sink_pad_query (GstPad * pad, GstObject *parent, GstQuery * query)
+#else
+gst_http_sink_pad_query (GstPad * pad, GstQuery * query)
+#endif
+{
+  GstHttpSink *self;
+  GstFormat format;
+
+  self = GST_HTTP_SINK (GST_PAD_PARENT (pad));
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, NULL);
+      switch (format) {
+        case GST_FORMAT_DEFAULT:
+        case GST_FORMAT_TIME:
+          gst_query_set_position (query, GST_FORMAT_TIME, self->last_timestamp);
+         GST_INFO_OBJECT(self, "gst_http_sink_pad_query: GST_FORMAT_TIME position %llx", self->last_timestamp);
+          return TRUE;
+        case GST_FORMAT_BYTES:
+          return gst_http_sink_query_bytes (self, query);
+        default:
+          return FALSE;
+      }
+
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, NULL);
+      if (format == GST_FORMAT_BYTES)
+        return gst_http_sink_query_bytes (self, query);
+      break;
+
+    case GST_QUERY_FORMATS:
+      gst_query_set_formats (query, 3, GST_FORMAT_DEFAULT, GST_FORMAT_TIME, GST_FORMAT_BYTES);
+      return TRUE;
+    default:
+      break;
+  }
+#ifdef USE_GST1
+  return gst_pad_query_default (pad, parent, query);
+#else
+  return gst_pad_query_default (pad, query);
+#endif
 }
 
 static gboolean
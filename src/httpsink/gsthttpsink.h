@@ -29,6 +29,27 @@
   *  - source-id      : The source id info used when logging first packet, like ocap://0xXXXX, dvr://local/xxxx#0, vod://<string>
   *  - send_data_time : Last time data written to socket
   *  - send_status    : Current send status
+  *  - use-sendfile   : Use sendfile() for fd-backed buffers in linear mode
+  *  - zerocopy-threshold : Send buffers of at least this size with MSG_ZEROCOPY (0: disabled)
+  *  - async          : Send from a dedicated thread fed by a bounded queue
+  *  - max-queue-buffers / max-queue-bytes : Limits of the async send queue
+  *  - overflow-policy : What to do when the async queue is full: block, drop-to-keyframe, disconnect
+  *  - queue-level-buffers / queue-level-bytes : Current async queue depth
+  *  - dropped-buffers / dropped-bytes : Data discarded by the drop-to-keyframe policy
+  *  - num-clients    : Number of connected clients, including http-obj
+  *  - stats          : Per client throughput, send and latency statistics (GstStructure)
+  *  - stats-interval : Post the stats as element message every N ms (0: disabled)
+  *  - shared-writer  : Hand buffers to the process wide epoll writer instead of sending from render
+  *  - writer-threads : Number of threads of the shared writer
+  *  - writer-backend : How the shared writer sends: epoll + sendmsg() or io_uring
+  *  - start-offset   : Byte offset the client already has, earlier data is not sent
+  *  - pacing         : Spread sends to the estimated stream bitrate: none, kernel, userspace
+  *  - pacing-burst   : Bytes userspace pacing sends back to back
+  *  - stream-bitrate : Stream bitrate estimated from the buffer timestamps
+  *  Queries: position in TIME and BYTES, duration in BYTES (from upstream)
+  *  Action signals:
+  *  - add-client (fd, chunked)  : Also send the stream to another socket
+  *  - remove-client (fd)        : Stop sending to a socket added with add-client
   *  @ingroup  GST_PLUGINS
  **/
 
@@ -68,28 +89,179 @@ G_BEGIN_DECLS
 #define GST_HTTPSINK_EVENT_BASE    (0x0600)
 #define GST_HTTPSINK_EVENT_CONNECTION_CLOSED (GST_HTTPSINK_EVENT_BASE + 1)
 
+/* Number of log2 microsecond buckets of the arrival-to-wire latency histogram */
+#define HTTPSINK_LATENCY_BUCKETS 32
+
+#define GST_TYPE_HTTP_SINK_OVERFLOW_POLICY (gst_http_sink_overflow_policy_get_type())
+
+/**
+ * GstHttpSinkOverflowPolicy:
+ * Action taken by render when the async send queue is full
+ */
+typedef enum
+{
+  GST_HTTP_SINK_OVERFLOW_BLOCK,             /**<  Wait for the sender thread to make room               */
+  GST_HTTP_SINK_OVERFLOW_DROP_TO_KEYFRAME,  /**<  Drop oldest buffers, resume the queue at a keyframe   */
+  GST_HTTP_SINK_OVERFLOW_DISCONNECT         /**<  Give up on the client as if the connection closed     */
+} GstHttpSinkOverflowPolicy;
+
+#define GST_TYPE_HTTP_SINK_WRITER_BACKEND (gst_http_sink_writer_backend_get_type())
+
+/**
+ * GstHttpSinkWriterBackend:
+ * Mechanism the shared writer uses to send
+ */
+typedef enum
+{
+  GST_HTTP_SINK_WRITER_EPOLL,               /**<  Non-blocking sendmsg() when epoll reports the socket writable */
+  GST_HTTP_SINK_WRITER_IO_URING             /**<  IORING_OP_SENDMSG, submitted in batches across clients      */
+} GstHttpSinkWriterBackend;
+
+#define GST_TYPE_HTTP_SINK_PACING (gst_http_sink_pacing_get_type())
+
+/**
+ * GstHttpSinkPacing:
+ * How sends are spread to the estimated stream bitrate.
+ */
+typedef enum
+{
+  GST_HTTP_SINK_PACING_NONE,                /**<  Forward upstream bursts at line rate                    */
+  GST_HTTP_SINK_PACING_KERNEL,              /**<  SO_MAX_PACING_RATE on the client sockets (fq qdisc)      */
+  GST_HTTP_SINK_PACING_USERSPACE            /**<  Token bucket with pacing-burst slices in httpsink        */
+} GstHttpSinkPacing;
+
 typedef struct _GstHttpSink GstHttpSink;
 typedef struct _GstHttpSinkClass GstHttpSinkClass;
+typedef struct _GstHttpSinkClient GstHttpSinkClient;
+typedef struct _GstHttpSinkWriterThread GstHttpSinkWriterThread;
+
+/**
+ * GstHttpSinkClient:
+ * State of one connection the stream is written to. The http-obj property
+ * drives the default client, add-client creates further ones. All clients
+ * share the upstream buffers.
+ */
+struct _GstHttpSinkClient
+{
+  GstHttpSink *sink;                 /**<  Element the client belongs to                            */
+  gint refcount;                     /**<  Render and the basesink vmethods hold a ref while in use */
+  gint fd;                           /**<  Socket the stream is written to, -1 if none              */
+  GStaticRecMutex write_mutex;       /**<  Serialises writes and socket state of this client       */
+  gboolean is_chunked;               /**<  Send with HTTP chunked transfer encoding                 */
+  gboolean sendError;                /**<  A send failed, nothing more is written to the client     */
+  guint64 sent_data_size;            /**<  Total size of data written to socket                     */
+  guint64 last_send_time;            /**<  Last time data written to socket                         */
+  gboolean is_blocked;               /**<  Indicates data transfer is blocked                       */
+  gint packetcount;                  /**<  Count of number of packets sent                          */
+  guint64 send_calls;                /**<  Number of socket write calls                             */
+  guint64 short_writes;              /**<  Socket writes that sent less than asked                  */
+  gint64 blocked_time;               /**<  Total time spent in socket writes, us                    */
+  gint64 max_block_time;             /**<  Longest single socket write, us                          */
+  gint64 first_send_time;            /**<  Monotonic time of the first write, us                    */
+  gint64 rate_window_start;          /**<  Start of the current bitrate measurement window, us      */
+  guint64 rate_window_bytes;         /**<  sent_data_size at rate_window_start                      */
+  guint64 bitrate;                   /**<  Bitrate over the last complete window, bit/s             */
+  guint64 latency_hist[HTTPSINK_LATENCY_BUCKETS]; /**< Arrival-to-wire latency histogram           */
+  guint64 latency_count;             /**<  Number of samples in latency_hist                        */
+
+  gint zerocopy_fd;                  /**<  Socket SO_ZEROCOPY was enabled on                        */
+  gint zerocopy_failed_fd;           /**<  Socket that refused SO_ZEROCOPY, -1 if none              */
+  guint32 zerocopy_next_id;          /**<  Id the kernel will report for the next zerocopy send     */
+  GQueue *zerocopy_pending;          /**<  Buffers held until the kernel releases their pages       */
+  guint64 zerocopy_copied;           /**<  Zerocopy sends the kernel fell back to copying           */
+
+#ifdef GLIB_VERSION_2_32
+  GMutex queue_lock;                 /**<  Protects the async queue                                 */
+  GCond queue_not_empty;             /**<  Signalled when a buffer is queued                        */
+  GCond queue_not_full;              /**<  Signalled when the sender thread takes a buffer          */
+#else
+  GMutex *queue_lock;                /**<  Protects the async queue                                 */
+  GCond *queue_not_empty;            /**<  Signalled when a buffer is queued                        */
+  GCond *queue_not_full;             /**<  Signalled when the sender thread takes a buffer          */
+#endif
+  GstBuffer **queue_ring;            /**<  Ring of queued buffers, max_queue_buffers entries        */
+  gint64 *queue_arrival;             /**<  Time render queued each buffer of queue_ring             */
+  guint queue_capacity;              /**<  Number of entries in queue_ring                          */
+  guint queue_head;                  /**<  Ring index of the oldest queued buffer                   */
+  guint queue_count;                 /**<  Number of queued buffers                                 */
+  guint64 queue_bytes;               /**<  Number of queued bytes                                   */
+  gboolean queue_writing;            /**<  Sender thread is writing a buffer it took off the queue  */
+  gboolean queue_flushing;           /**<  Render must not block on the queue                       */
+  gboolean sender_running;           /**<  Sender thread should keep running                        */
+  GThread *sender_thread;            /**<  Drains the async queue to the socket                     */
+  guint64 dropped_buffers;           /**<  Buffers discarded because the queue was full             */
+  gboolean drop_to_keyframe;         /**<  Discard incoming delta units until the next keyframe     */
+  guint64 dropped_bytes;             /**<  Bytes discarded because the queue was full               */
+
+  GstHttpSinkWriterThread *writer_thread; /**< Shared writer thread the socket is attached to      */
+  gint writer_fd;                    /**<  Socket registered with the shared writer                 */
+  gboolean writer_scheduled;         /**<  Client is on the ready list of writer_thread             */
+  GstBuffer *writer_buf;             /**<  Buffer the shared writer is sending, NULL if none        */
+#ifdef USE_GST1
+  GstMapInfo writer_map;             /**<  Mapping of writer_buf                                    */
+#endif
+  const guint8 *writer_data;         /**<  Payload of writer_buf                                    */
+  gsize writer_size;                 /**<  Payload size of writer_buf                               */
+  gchar writer_header[16];           /**<  Chunk header of writer_buf                               */
+  gsize writer_header_len;           /**<  Length of writer_header, 0 when not chunked              */
+  gsize writer_offset;               /**<  Bytes of header, payload and trailer already sent        */
+  gint64 writer_arrival;             /**<  Time render queued writer_buf                            */
+  gboolean writer_inflight;          /**<  An io_uring send of writer_buf is in flight              */
+  GstHttpSinkWriterThread *writer_submit_thread; /**< Writer thread the in flight send was submitted on */
+  gint writer_submit_fd;             /**<  Socket the in flight io_uring send was submitted on      */
+  gint64 writer_submit_time;         /**<  Time the in flight io_uring send was submitted           */
+  gsize writer_submit_len;           /**<  Bytes the in flight io_uring send was asked to write     */
+  gpointer writer_op;                /**<  iovec and msghdr of the in flight io_uring send          */
+  guint64 pacing_applied;            /**<  SO_MAX_PACING_RATE set on the socket, bytes/s, 0 if none */
+  gint64 pacing_tokens;              /**<  Bytes userspace pacing may send right now                */
+  gint64 pacing_last;                /**<  Monotonic time pacing_tokens was refilled, us            */
+};
 
 struct _GstHttpSink
 {
   GstBaseSink parent;                /**<  Gstreamer Object                                         */
 
   gboolean silent;                   /**<  Indicates verbose output                                 */
-  gint http_obj;                     /**<  Gets the http request instance from http server          */
-  GStaticRecMutex http_obj_mutex;    /**<  Mutex object                                             */
-  gboolean is_chunked;               /**<  Boolean value indicates packet is chunked or not         */
+  GStaticRecMutex http_obj_mutex;    /**<  Protects the client list                                 */
+  GstHttpSinkClient *http_client;    /**<  Default client, driven by the http-obj property          */
+  GList *clients;                    /**<  All clients, http_client first                           */
+  gboolean started;                  /**<  Between start and stop, new clients get a sender thread  */
   long long last_timestamp;          /**<  Value from GST_BUFFER_TIMESTAMP                          */
-  guint64 sent_data_size;            /**<  Total size of data written to socket                     */
-  gint packetcount;                  /**<  Count of  number of packets received                     */
   gboolean isFirstPacket;            /**<  Boolean value checks the first packet                    */
   gchar source_type[32];             /**<  Name of the source type used when logging first packet,
                                            like QAM, DVR, VOD, TSB, IPPV, VPOP                      */
   gchar source_id[1024];             /**<  The source id info used when logging first packet,
 										   like ocap://0xXXXX, dvr://local/xxxx#0, vod://<string>   */
-  gboolean sendError;                /**<  Flag indicates error report to be send or not            */
-  guint64 last_send_time;            /**<  Last time data written to socket                         */
-  gboolean is_blocked;               /**<  Indicates data transfer is blocked                       */
+  gboolean use_sendfile;             /**<  Send fd-backed buffers with sendfile() in linear mode    */
+  guint zerocopy_threshold;          /**<  Minimum payload size sent with MSG_ZEROCOPY, 0 disables  */
+
+  gboolean async;                    /**<  Send from a sender thread per client                     */
+  guint max_queue_buffers;           /**<  Capacity of each async send queue in buffers            */
+  guint max_queue_bytes;             /**<  Capacity of each async send queue in bytes              */
+  GstHttpSinkOverflowPolicy overflow_policy; /**< Action taken when an async queue is full         */
+  guint stats_interval;              /**<  Period of the stats element message in ms, 0 disables    */
+  gint64 last_stats_post;            /**<  Monotonic time the last stats message was posted         */
+#ifdef GLIB_VERSION_2_32
+  GMutex stats_lock;                 /**<  Protects stats_interval and stats_running                */
+  GCond stats_cond;                  /**<  Signalled when either of them changes                    */
+#else
+  GMutex *stats_lock;                /**<  Protects stats_interval and stats_running                */
+  GCond *stats_cond;                 /**<  Signalled when either of them changes                    */
+#endif
+  GThread *stats_thread;             /**<  Posts the stats message between start and stop           */
+  gboolean stats_running;            /**<  Cleared to end stats_thread                              */
+  gboolean shared_writer;            /**<  Send through the process wide writer                     */
+  guint writer_threads;              /**<  Threads of the shared writer when this element creates it */
+  GstHttpSinkWriterBackend writer_backend; /**< Backend of the shared writer when this element creates it */
+  gboolean writer_acquired;          /**<  Holds a reference on the shared writer                   */
+  guint64 start_offset;              /**<  Stream bytes before this offset are not sent             */
+  guint64 byte_offset;               /**<  Stream offset of the end of the last rendered buffer     */
+  GstHttpSinkPacing pacing;          /**<  How sends are spread to the stream bitrate               */
+  guint pacing_burst;                /**<  Bytes userspace pacing sends back to back                */
+  guint64 stream_rate;               /**<  Estimated stream bitrate, bytes/s                        */
+  guint64 rate_bytes;                /**<  Bytes rendered in the current estimation window          */
+  GstClockTime rate_base_ts;         /**<  Timestamp of the first buffer of the window              */
+  gint64 rate_base_arrival;          /**<  Arrival time of the first buffer of the window, us       */
 
   GstCaps *caps;                     /**<  For media types                                          */
 };
@@ -104,9 +276,16 @@ struct _GstHttpSinkClass
   dispose_func parent_dispose;
   event_func parent_event;
   query_func parent_query;
+
+  /* actions */
+  gboolean (*add_client) (GstHttpSink *sink, gint fd, gboolean chunked);
+  gboolean (*remove_client) (GstHttpSink *sink, gint fd);
 };
 
 GType gst_http_sink_get_type (void);  /**< Used for registering the http sink element                 */
+GType gst_http_sink_overflow_policy_get_type (void);  /**< GEnum type of the overflow-policy property */
+GType gst_http_sink_writer_backend_get_type (void);   /**< GEnum type of the writer-backend property  */
+GType gst_http_sink_pacing_get_type (void);           /**< GEnum type of the pacing property          */
 
 G_END_DECLS
 
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Loopback benchmark for httpsink.
+ *
+ * Streams fakesrc buffers through httpsink into TCP loopback connections
+ * drained by a child process and reports throughput and sender CPU time
+ * per Gbit: once with plain send() and once with MSG_ZEROCOPY on a single
+ * connection, then with --instances pipelines at a time, each sending from
+ * its streaming thread, from its own sender thread (async) and through the
+ * shared writer with the epoll and the io_uring backend.
+ *
+ * Build, from the configured build tree:
+ *   make -C src/httpsink httpsink_loopback_bench
+ * or standalone:
+ *   gcc -O2 -o httpsink_loopback_bench httpsink_loopback_bench.c \
+ *       $(pkg-config --cflags --libs gstreamer-1.0)
+ *
+ * Run with the httpsink plugin in GST_PLUGIN_PATH, e.g.
+ *   GST_PLUGIN_PATH=src/httpsink/.libs ./httpsink_loopback_bench -n 32 -w 2
+ * Compare the "async" line (a sender thread per client) with the
+ * "shared-writer" and "io-uring" lines; the gain grows with -n and is
+ * mostly fewer context switches, so measure on a box with several cores.
+ *
+ * Note: the kernel copies MSG_ZEROCOPY payloads sent over loopback, so on lo
+ * the zerocopy run only measures the notification overhead and its CPU time
+ * per Gbit is not reported. To see the copy savings, send to a remote reader
+ * over a real NIC with --host/--port, e.g. one started on the other box with
+ *   socat -u TCP-LISTEN:5000,fork,reuseaddr OPEN:/dev/null
+ * and
+ *   ./httpsink_loopback_bench --host 192.168.1.20 --port 5000
+ */
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+static gint buffer_size = 188 * 7 * 50;
+static gint megabytes = 2048;
+static gint zerocopy_threshold = 64 * 1024;
+static gint instances = 32;
+static gint writer_threads = 2;
+static gchar *host = NULL;
+static gint port = 5000;
+
+static GOptionEntry entries[] = {
+  { "buffer-size", 'b', 0, G_OPTION_ARG_INT, &buffer_size, "Size of each buffer in bytes", "N" },
+  { "megabytes", 'm', 0, G_OPTION_ARG_INT, &megabytes, "Amount of data to stream per run", "N" },
+  { "zerocopy-threshold", 'z', 0, G_OPTION_ARG_INT, &zerocopy_threshold, "httpsink zerocopy-threshold for the zerocopy run", "N" },
+  { "instances", 'n', 0, G_OPTION_ARG_INT, &instances, "Concurrent pipelines/clients for the multi client runs", "N" },
+  { "writer-threads", 'w', 0, G_OPTION_ARG_INT, &writer_threads, "httpsink writer-threads for the shared writer run", "N" },
+  { "host", 'H', 0, G_OPTION_ARG_STRING, &host, "Send to a reader on this host instead of a local one over loopback", "ADDR" },
+  { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Port of the --host reader, one connection per client", "N" },
+  { NULL }
+};
+
+/* Returns a connected pair: *sender is the accepted server side httpsink
+ * writes to, *receiver is the client side drained by the reader */
+static gboolean
+make_loopback_pair (int *sender, int *receiver)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof (addr);
+  int listener;
+
+  listener = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (listener < 0 || bind (listener, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (listener, 1) < 0 || getsockname (listener, (struct sockaddr *) &addr, &len) < 0)
+    return FALSE;
+
+  *receiver = socket (AF_INET, SOCK_STREAM, 0);
+  if (*receiver < 0 || connect (*receiver, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    return FALSE;
+  *sender = accept (listener, NULL, NULL);
+  close (listener);
+  return (*sender >= 0);
+}
+
+/* Returns in *sender a connection to the --host reader */
+static gboolean
+make_remote_connection (int *sender)
+{
+  struct addrinfo hints, *res;
+  gchar service[16];
+  int ret;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  g_snprintf (service, sizeof (service), "%d", port);
+  ret = getaddrinfo (host, service, &hints, &res);
+  if (ret != 0) {
+    g_printerr ("%s: %s\n", host, gai_strerror (ret));
+    return FALSE;
+  }
+
+  *sender = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (*sender >= 0 && connect (*sender, res->ai_addr, res->ai_addrlen) < 0) {
+    close (*sender);
+    *sender = -1;
+  }
+  freeaddrinfo (res);
+  return (*sender >= 0);
+}
+
+/* Forks a child that drains all fds until every one of them is closed */
+static pid_t
+start_reader (int *fds, int n)
+{
+  pid_t pid = fork ();
+
+  if (pid == 0) {
+    static char data[256 * 1024];
+    struct pollfd *pfds = g_new0 (struct pollfd, n);
+    int i, open_fds = n;
+
+    for (i = 0; i < n; i++) {
+      pfds[i].fd = fds[i];
+      pfds[i].events = POLLIN;
+    }
+    while (open_fds > 0 && poll (pfds, n, -1) > 0) {
+      for (i = 0; i < n; i++) {
+        if (pfds[i].fd >= 0 && pfds[i].revents &&
+            read (pfds[i].fd, data, sizeof (data)) <= 0) {
+          pfds[i].fd = -1;
+          open_fds--;
+        }
+      }
+    }
+    _exit (0);
+  }
+  return pid;
+}
+
+static double
+cpu_seconds (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+typedef enum
+{
+  MODE_SYNC,
+  MODE_ASYNC,
+  MODE_SHARED_WRITER,
+  MODE_IO_URING
+} Mode;
+
+/* Streams megabytes through n pipelines running at the same time, each with
+ * one httpsink writing to its own loopback connection */
+static void
+run (const gchar * label, gint n, Mode mode, guint threshold)
+{
+  GstElement **pipelines, **sinks;
+  int *senders, *receivers;
+  pid_t reader = -1;
+  gint num_buffers, i;
+  guint64 sent = 0;
+  double cpu, gbit;
+  gint64 start, wall;
+
+  pipelines = g_new0 (GstElement *, n);
+  sinks = g_new0 (GstElement *, n);
+  senders = g_new0 (int, n);
+  receivers = g_new0 (int, n);
+
+  for (i = 0; i < n; i++) {
+    if (host ? !make_remote_connection (&senders[i]) : !make_loopback_pair (&senders[i], &receivers[i])) {
+      g_printerr ("unable to set up %s connection\n", host ? "remote" : "loopback");
+      exit (1);
+    }
+  }
+  if (!host) {
+    reader = start_reader (receivers, n);
+    for (i = 0; i < n; i++)
+      close (receivers[i]);
+  }
+
+  num_buffers = (gint) (((gint64) megabytes * 1024 * 1024) / buffer_size / n);
+  for (i = 0; i < n; i++) {
+    gchar *desc = g_strdup_printf ("fakesrc sizetype=fixed sizemax=%d filltype=zero num-buffers=%d "
+        "! httpsink name=sink", buffer_size, num_buffers);
+    pipelines[i] = gst_parse_launch (desc, NULL);
+    g_free (desc);
+
+    sinks[i] = gst_bin_get_by_name (GST_BIN (pipelines[i]), "sink");
+    g_object_set (sinks[i], "http-obj", senders[i], "stream-type", FALSE,
+        "zerocopy-threshold", threshold,
+        "async", mode == MODE_ASYNC,
+        "shared-writer", mode == MODE_SHARED_WRITER || mode == MODE_IO_URING,
+        "writer-threads", (guint) writer_threads, NULL);
+    if (mode == MODE_IO_URING)
+      gst_util_set_object_arg (G_OBJECT (sinks[i]), "writer-backend", "io-uring");
+  }
+
+  cpu = cpu_seconds ();
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n; i++)
+    gst_element_set_state (pipelines[i], GST_STATE_PLAYING);
+  for (i = 0; i < n; i++) {
+    GstMessage *msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipelines[i]), GST_CLOCK_TIME_NONE,
+        (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    gst_message_unref (msg);
+  }
+  wall = g_get_monotonic_time () - start;
+  for (i = 0; i < n; i++) {
+    guint64 size = 0;
+
+    g_object_get (sinks[i], "sent_data_size", &size, NULL);
+    sent += size;
+    gst_element_set_state (pipelines[i], GST_STATE_NULL);
+  }
+  cpu = cpu_seconds () - cpu;
+
+  for (i = 0; i < n; i++) {
+    shutdown (senders[i], SHUT_RDWR);
+    close (senders[i]);
+    gst_object_unref (sinks[i]);
+    gst_object_unref (pipelines[i]);
+  }
+  if (reader != -1)
+    waitpid (reader, NULL, 0);
+  g_free (pipelines);
+  g_free (sinks);
+  g_free (senders);
+  g_free (receivers);
+
+  gbit = sent * 8 / 1e9;
+  if (threshold && !host) {
+    /* lo copies the zerocopy payloads in the kernel, the CPU time would
+     * be the one of a copying send plus the notifications */
+    g_print ("%-14s %3d x  %8.2f Gbit/s     n/a CPU-s/Gbit  (%" G_GUINT64_FORMAT " bytes)\n",
+        label, n, gbit / (wall / 1e6), sent);
+    g_print ("%-14s        not comparable: loopback copies MSG_ZEROCOPY payloads, use --host\n", "");
+    return;
+  }
+  g_print ("%-14s %3d x  %8.2f Gbit/s  %6.3f CPU-s/Gbit  (%" G_GUINT64_FORMAT " bytes)\n",
+      label, n, gbit / (wall / 1e6), gbit > 0 ? cpu / gbit : 0.0, sent);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+
+  ctx = g_option_context_new ("- httpsink loopback benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  signal (SIGPIPE, SIG_IGN);
+  if (host)
+    g_print ("sending to %s port %d\n", host, port);
+
+  run ("send", 1, MODE_SYNC, 0);
+  run ("zerocopy", 1, MODE_SYNC, zerocopy_threshold);
+  run ("send", instances, MODE_SYNC, 0);
+  run ("async", instances, MODE_ASYNC, 0);
+  run ("shared-writer", instances, MODE_SHARED_WRITER, 0);
+  run ("io-uring", instances, MODE_IO_URING, 0);
+
+  return 0;
+}
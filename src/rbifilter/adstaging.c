@@ -0,0 +1,661 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "adstaging.h"
+
+#define TS_PACKET_SIZE (188)
+#define TTS_PACKET_SIZE (192)
+#define TS_SYNC_BYTE (0x47)
+
+#define AD_STAGING_READ_SIZE (64*1024)
+#define AD_STAGING_CONNECT_TIMEOUT (10)
+
+/* A failed fetch is retried after 0.5s, doubling up to 8s, at most 5 times */
+#define AD_STAGING_RETRY_DELAY (G_GINT64_CONSTANT(500000))
+#define AD_STAGING_RETRY_DELAY_MAX (G_GINT64_CONSTANT(8000000))
+#define AD_STAGING_RETRY_LIMIT (5)
+
+struct _AdStagingSegment
+{
+   gint refs;
+   AdStaging *staging;
+   gchar *uri;
+   GPtrArray *blocks;
+   gsize size;
+   gboolean complete;
+   gboolean failed;
+   guint failures;
+   gint64 retryTime;
+   int packetSize;
+   unsigned char carry[TTS_PACKET_SIZE];
+   int carryLen;
+};
+
+struct _AdStaging
+{
+   gint refs;
+   #ifdef GLIB_VERSION_2_32
+   GMutex lock;
+   GCond cond;
+   #else
+   GMutex *lock;
+   GCond *cond;
+   #endif
+   GThread *thread;
+   gboolean quit;
+   gchar **uris;
+   GList *segments;
+   AdStagingSegment *fetching;
+   guint64 budget;
+   guint64 bytes;
+   guint64 underruns;
+};
+
+static void ad_staging_lock( AdStaging *staging )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_lock( &staging->lock );
+   #else
+   g_mutex_lock( staging->lock );
+   #endif
+}
+
+static void ad_staging_unlock( AdStaging *staging )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_unlock( &staging->lock );
+   #else
+   g_mutex_unlock( staging->lock );
+   #endif
+}
+
+static void ad_staging_wait( AdStaging *staging )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_cond_wait( &staging->cond, &staging->lock );
+   #else
+   g_cond_wait( staging->cond, staging->lock );
+   #endif
+}
+
+/* Waits until signalled or until the monotonic time endTime, in us */
+static void ad_staging_wait_until( AdStaging *staging, gint64 endTime )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_cond_wait_until( &staging->cond, &staging->lock, endTime );
+   #else
+   GTimeVal tv;
+   gint64 delay= endTime - g_get_monotonic_time();
+
+   g_get_current_time( &tv );
+   g_time_val_add( &tv, MAX( delay, 0 ) );
+   g_cond_timed_wait( staging->cond, staging->lock, &tv );
+   #endif
+}
+
+static void ad_staging_signal( AdStaging *staging )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_cond_broadcast( &staging->cond );
+   #else
+   g_cond_broadcast( staging->cond );
+   #endif
+}
+
+static void ad_staging_unref( AdStaging *staging )
+{
+   if ( g_atomic_int_dec_and_test( &staging->refs ) ) {
+      g_strfreev( staging->uris );
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_clear( &staging->lock );
+      g_cond_clear( &staging->cond );
+      #else
+      g_mutex_free( staging->lock );
+      g_cond_free( staging->cond );
+      #endif
+      g_free( staging );
+   }
+}
+
+static gboolean ad_staging_in_list( AdStaging *staging, const gchar *uri )
+{
+   int i;
+
+   for( i= 0; staging->uris && staging->uris[i]; ++i ) {
+      if ( !strcmp( staging->uris[i], uri ) ) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+static AdStagingSegment* ad_staging_find( AdStaging *staging, const gchar *uri )
+{
+   GList *l;
+
+   for( l= staging->segments; l; l= l->next ) {
+      AdStagingSegment *segment= (AdStagingSegment*)l->data;
+      if ( !strcmp( segment->uri, uri ) ) {
+         return segment;
+      }
+   }
+   return NULL;
+}
+
+/* Called with the lock held, releases the memory of a segment nobody else references */
+static void ad_staging_segment_destroy( AdStagingSegment *segment )
+{
+   AdStaging *staging= segment->staging;
+
+   staging->bytes -= (guint64)segment->blocks->len * AD_STAGING_BLOCK_SIZE;
+   g_ptr_array_free( segment->blocks, TRUE );
+   g_free( segment->uri );
+   g_free( segment );
+   g_atomic_int_add( &staging->refs, -1 );
+   ad_staging_signal( staging );
+}
+
+/*
+ * Called with the lock held. Drops the oldest segment that is no longer
+ * in the URI list and only referenced by the cache
+ */
+static gboolean ad_staging_evict( AdStaging *staging )
+{
+   GList *l;
+
+   for( l= staging->segments; l; l= l->next ) {
+      AdStagingSegment *segment= (AdStagingSegment*)l->data;
+      if ( (segment != staging->fetching) &&
+           (g_atomic_int_get( &segment->refs ) == 1) &&
+           !ad_staging_in_list( staging, segment->uri ) ) {
+         staging->segments= g_list_delete_link( staging->segments, l );
+         ad_staging_segment_destroy( segment );
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/* Stores count packets of 188 bytes, stride bytes apart. Returns FALSE to stop the fetch */
+static gboolean ad_staging_store( AdStagingSegment *segment, const unsigned char *packets, int count, int stride )
+{
+   AdStaging *staging= segment->staging;
+   gboolean result= TRUE;
+
+   ad_staging_lock( staging );
+   while( count > 0 ) {
+      gsize within= segment->size % AD_STAGING_BLOCK_SIZE;
+      unsigned char *block;
+
+      if ( !within && (segment->size == (gsize)segment->blocks->len * AD_STAGING_BLOCK_SIZE) ) {
+         while( !staging->quit && (staging->bytes + AD_STAGING_BLOCK_SIZE > staging->budget) &&
+                ad_staging_in_list( staging, segment->uri ) ) {
+            if ( !ad_staging_evict( staging ) ) {
+               ad_staging_wait( staging );
+            }
+         }
+         /* give up on shutdown or when the segment was dropped from the list meanwhile */
+         if ( staging->quit || !ad_staging_in_list( staging, segment->uri ) ) {
+            result= FALSE;
+            break;
+         }
+         g_ptr_array_add( segment->blocks, g_malloc( AD_STAGING_BLOCK_SIZE ) );
+         staging->bytes += AD_STAGING_BLOCK_SIZE;
+      }
+
+      block= (unsigned char*)g_ptr_array_index( segment->blocks, segment->size / AD_STAGING_BLOCK_SIZE );
+      if ( stride == TS_PACKET_SIZE ) {
+         int n= MIN( count, (int)((AD_STAGING_BLOCK_SIZE - within) / TS_PACKET_SIZE) );
+         memcpy( block + within, packets, n * TS_PACKET_SIZE );
+         segment->size += n * TS_PACKET_SIZE;
+         packets += n * TS_PACKET_SIZE;
+         count -= n;
+      } else {
+         memcpy( block + within, packets, TS_PACKET_SIZE );
+         segment->size += TS_PACKET_SIZE;
+         packets += stride;
+         --count;
+      }
+   }
+   ad_staging_unlock( staging );
+
+   return result;
+}
+
+/*
+ * Packetizes fetched data: whole packets are stored straight from the
+ * fetch buffer, a packet split across reads goes through carry. Data that
+ * does not start with a sync byte is skipped byte by byte until it does
+ */
+static gboolean ad_staging_append( AdStagingSegment *segment, const unsigned char *data, gsize len )
+{
+   int offset;
+
+   if ( !segment->packetSize ) {
+      if ( segment->carryLen + len < 5 ) {
+         memcpy( segment->carry + segment->carryLen, data, len );
+         segment->carryLen += len;
+         return TRUE;
+      }
+      memcpy( segment->carry + segment->carryLen, data, 5 - segment->carryLen );
+      segment->packetSize= ((segment->carry[0] != TS_SYNC_BYTE) && (segment->carry[4] == TS_SYNC_BYTE)) ? TTS_PACKET_SIZE : TS_PACKET_SIZE;
+      data += 5 - segment->carryLen;
+      len -= 5 - segment->carryLen;
+      segment->carryLen= 5;
+   }
+   offset= segment->packetSize - TS_PACKET_SIZE;
+
+   while( len > 0 ) {
+      if ( !segment->carryLen && (len >= (gsize)segment->packetSize) && (data[offset] == TS_SYNC_BYTE) ) {
+         int count= 1;
+
+         while( ((gsize)(count + 1) * segment->packetSize <= len) && (data[count * segment->packetSize + offset] == TS_SYNC_BYTE) ) {
+            ++count;
+         }
+         if ( !ad_staging_store( segment, data + offset, count, segment->packetSize ) ) {
+            return FALSE;
+         }
+         data += count * segment->packetSize;
+         len -= count * segment->packetSize;
+      } else {
+         int n= MIN( (gsize)(segment->packetSize - segment->carryLen), len );
+
+         memcpy( segment->carry + segment->carryLen, data, n );
+         segment->carryLen += n;
+         data += n;
+         len -= n;
+         if ( segment->carryLen == segment->packetSize ) {
+            if ( segment->carry[offset] == TS_SYNC_BYTE ) {
+               if ( !ad_staging_store( segment, segment->carry + offset, 1, segment->packetSize ) ) {
+                  return FALSE;
+               }
+               segment->carryLen= 0;
+            } else {
+               memmove( segment->carry, segment->carry + 1, --segment->carryLen );
+            }
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+static size_t ad_staging_curl_write( void *ptr, size_t size, size_t nmemb, void *userData )
+{
+   AdStagingSegment *segment= (AdStagingSegment*)userData;
+
+   if ( !ad_staging_append( segment, (const unsigned char*)ptr, size * nmemb ) ) {
+      return 0;
+   }
+   return size * nmemb;
+}
+
+static gboolean ad_staging_fetch( AdStagingSegment *segment )
+{
+   gboolean result= FALSE;
+
+   if ( !strncmp( segment->uri, "http://", 7 ) || !strncmp( segment->uri, "https://", 8 ) ) {
+      CURL *curl= curl_easy_init();
+
+      if ( curl ) {
+         curl_easy_setopt( curl, CURLOPT_URL, segment->uri );
+         curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, ad_staging_curl_write );
+         curl_easy_setopt( curl, CURLOPT_WRITEDATA, segment );
+         curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
+         curl_easy_setopt( curl, CURLOPT_FAILONERROR, 1L );
+         curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+         curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT, (long)AD_STAGING_CONNECT_TIMEOUT );
+         result= (curl_easy_perform( curl ) == CURLE_OK);
+         curl_easy_cleanup( curl );
+      }
+   } else {
+      const gchar *path= segment->uri;
+      unsigned char *data;
+      ssize_t len;
+      int fd;
+
+      if ( !strncmp( path, "file://", 7 ) ) {
+         path += 7;
+      }
+      fd= open( path, O_RDONLY | O_CLOEXEC );
+      if ( fd >= 0 ) {
+         data= (unsigned char*)g_malloc( AD_STAGING_READ_SIZE );
+         result= TRUE;
+         while( (len= read( fd, data, AD_STAGING_READ_SIZE )) > 0 ) {
+            if ( !ad_staging_append( segment, data, len ) ) {
+               result= FALSE;
+               break;
+            }
+         }
+         if ( len < 0 ) {
+            result= FALSE;
+         }
+         g_free( data );
+         close( fd );
+      }
+   }
+
+   return result;
+}
+
+/*
+ * Called with the lock held. Drops the cache reference to a failed segment
+ * so that it can be fetched again; readers still holding it keep what was
+ * staged before the failure
+ */
+static void ad_staging_drop( AdStaging *staging, AdStagingSegment *segment )
+{
+   staging->segments= g_list_remove( staging->segments, segment );
+   if ( g_atomic_int_dec_and_test( &segment->refs ) ) {
+      ad_staging_segment_destroy( segment );
+   }
+}
+
+/*
+ * Fetches the listed segments that are not staged yet, in list order. A
+ * segment whose fetch failed is fetched again once its retry time has
+ * come, until AD_STAGING_RETRY_LIMIT failures
+ */
+static gpointer ad_staging_thread( gpointer data )
+{
+   AdStaging *staging= (AdStaging*)data;
+
+   ad_staging_lock( staging );
+   while( !staging->quit ) {
+      AdStagingSegment *segment= NULL, *staged;
+      gint64 now= g_get_monotonic_time(), retryTime= 0;
+      guint failures;
+      gboolean ok;
+      int i;
+
+      for( i= 0; staging->uris && staging->uris[i]; ++i ) {
+         failures= 0;
+         staged= ad_staging_find( staging, staging->uris[i] );
+         if ( staged && staged->failed && (staged->failures < AD_STAGING_RETRY_LIMIT) ) {
+            if ( staged->retryTime > now ) {
+               if ( !retryTime || (staged->retryTime < retryTime) ) {
+                  retryTime= staged->retryTime;
+               }
+               continue;
+            }
+            failures= staged->failures;
+            ad_staging_drop( staging, staged );
+            staged= NULL;
+         }
+         if ( !staged ) {
+            segment= (AdStagingSegment*)g_malloc0( sizeof(AdStagingSegment) );
+            segment->refs= 1;
+            segment->staging= staging;
+            segment->uri= g_strdup( staging->uris[i] );
+            segment->blocks= g_ptr_array_new_with_free_func( g_free );
+            segment->failures= failures;
+            g_atomic_int_inc( &staging->refs );
+            staging->segments= g_list_append( staging->segments, segment );
+            break;
+         }
+      }
+      if ( !segment ) {
+         if ( retryTime ) {
+            ad_staging_wait_until( staging, retryTime );
+         } else {
+            ad_staging_wait( staging );
+         }
+         continue;
+      }
+
+      staging->fetching= segment;
+      ad_staging_unlock( staging );
+
+      ok= ad_staging_fetch( segment );
+
+      ad_staging_lock( staging );
+      staging->fetching= NULL;
+      segment->complete= ok;
+      segment->failed= !ok;
+      if ( !ok ) {
+         ++segment->failures;
+         segment->retryTime= g_get_monotonic_time() +
+                             MIN( AD_STAGING_RETRY_DELAY << (segment->failures - 1), AD_STAGING_RETRY_DELAY_MAX );
+         if ( !staging->quit && ad_staging_in_list( staging, segment->uri ) ) {
+            if ( segment->failures < AD_STAGING_RETRY_LIMIT ) {
+               g_warning( "rbifilter: unable to stage ad segment %s, retrying", segment->uri );
+            } else {
+               g_warning( "rbifilter: unable to stage ad segment %s, giving up", segment->uri );
+            }
+         }
+      }
+   }
+   ad_staging_unlock( staging );
+
+   return NULL;
+}
+
+AdStaging* ad_staging_new( guint64 budget )
+{
+   AdStaging *staging;
+
+   staging= (AdStaging*)g_malloc0( sizeof(AdStaging) );
+   if ( staging ) {
+      staging->refs= 1;
+      staging->budget= budget;
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_init( &staging->lock );
+      g_cond_init( &staging->cond );
+      #else
+      staging->lock= g_mutex_new();
+      staging->cond= g_cond_new();
+      #endif
+   }
+
+   return staging;
+}
+
+void ad_staging_free( AdStaging *staging )
+{
+   GList *segments;
+
+   ad_staging_lock( staging );
+   staging->quit= TRUE;
+   ad_staging_signal( staging );
+   ad_staging_unlock( staging );
+
+   if ( staging->thread ) {
+      g_thread_join( staging->thread );
+      staging->thread= NULL;
+   }
+
+   ad_staging_lock( staging );
+   segments= staging->segments;
+   staging->segments= NULL;
+   ad_staging_unlock( staging );
+
+   g_list_foreach( segments, (GFunc)ad_staging_segment_unref, NULL );
+   g_list_free( segments );
+
+   ad_staging_unref( staging );
+}
+
+void ad_staging_set_uris( AdStaging *staging, const gchar *uris )
+{
+   gchar **list= NULL;
+   GList *l;
+   int i, count= 0;
+
+   if ( uris ) {
+      list= g_strsplit_set( uris, ",; \t\n", -1 );
+      for( i= 0; list[i]; ++i ) {
+         if ( list[i][0] ) {
+            list[count++]= list[i];
+         } else {
+            g_free( list[i] );
+         }
+      }
+      list[count]= NULL;
+   }
+
+   ad_staging_lock( staging );
+   g_strfreev( staging->uris );
+   staging->uris= list;
+   /* a new list gets segments that gave up a fresh set of retries */
+   for( l= staging->segments; l; l= l->next ) {
+      AdStagingSegment *segment= (AdStagingSegment*)l->data;
+      if ( segment->failed ) {
+         segment->failures= 0;
+         segment->retryTime= 0;
+      }
+   }
+   if ( count && !staging->thread && !staging->quit ) {
+      #ifdef GLIB_VERSION_2_32
+      staging->thread= g_thread_new( "rbi-prefetch", ad_staging_thread, staging );
+      #else
+      staging->thread= g_thread_create( ad_staging_thread, staging, TRUE, NULL );
+      #endif
+   }
+   ad_staging_signal( staging );
+   ad_staging_unlock( staging );
+}
+
+void ad_staging_set_budget( AdStaging *staging, guint64 budget )
+{
+   ad_staging_lock( staging );
+   staging->budget= budget;
+   ad_staging_signal( staging );
+   ad_staging_unlock( staging );
+}
+
+guint64 ad_staging_get_bytes( AdStaging *staging )
+{
+   guint64 bytes;
+
+   ad_staging_lock( staging );
+   bytes= staging->bytes;
+   ad_staging_unlock( staging );
+
+   return bytes;
+}
+
+guint64 ad_staging_get_underruns( AdStaging *staging )
+{
+   guint64 underruns;
+
+   ad_staging_lock( staging );
+   underruns= staging->underruns;
+   ad_staging_unlock( staging );
+
+   return underruns;
+}
+
+AdStagingSegment* ad_staging_lookup( AdStaging *staging, const gchar *uri )
+{
+   AdStagingSegment *segment;
+
+   ad_staging_lock( staging );
+   segment= ad_staging_find( staging, uri );
+   if ( segment && !segment->failed ) {
+      g_atomic_int_inc( &segment->refs );
+   } else {
+      segment= NULL;
+      ++staging->underruns;
+   }
+   ad_staging_unlock( staging );
+
+   return segment;
+}
+
+const unsigned char* ad_staging_segment_data( AdStagingSegment *segment, gsize offset, gsize *avail )
+{
+   AdStaging *staging= segment->staging;
+   const unsigned char *data= NULL;
+
+   ad_staging_lock( staging );
+   if ( offset < segment->size ) {
+      gsize within= offset % AD_STAGING_BLOCK_SIZE;
+
+      data= (const unsigned char*)g_ptr_array_index( segment->blocks, offset / AD_STAGING_BLOCK_SIZE ) + within;
+      *avail= MIN( AD_STAGING_BLOCK_SIZE - within, segment->size - offset );
+   } else {
+      *avail= 0;
+      if ( !segment->complete ) {
+         ++staging->underruns;
+      }
+   }
+   ad_staging_unlock( staging );
+
+   return data;
+}
+
+gboolean ad_staging_segment_is_complete( AdStagingSegment *segment )
+{
+   gboolean complete;
+
+   ad_staging_lock( segment->staging );
+   complete= segment->complete;
+   ad_staging_unlock( segment->staging );
+
+   return complete;
+}
+
+gsize ad_staging_segment_get_size( AdStagingSegment *segment )
+{
+   gsize size;
+
+   ad_staging_lock( segment->staging );
+   size= segment->size;
+   ad_staging_unlock( segment->staging );
+
+   return size;
+}
+
+AdStagingSegment* ad_staging_segment_ref( AdStagingSegment *segment )
+{
+   g_atomic_int_inc( &segment->refs );
+   return segment;
+}
+
+void ad_staging_segment_unref( AdStagingSegment *segment )
+{
+   AdStaging *staging= segment->staging;
+
+   g_atomic_int_inc( &staging->refs );
+   ad_staging_lock( staging );
+   if ( g_atomic_int_dec_and_test( &segment->refs ) ) {
+      ad_staging_segment_destroy( segment );
+   } else {
+      /* a segment only the cache holds can be evicted for a fetch waiting on the budget */
+      ad_staging_signal( staging );
+   }
+   ad_staging_unlock( staging );
+   ad_staging_unref( staging );
+}
+
+/** @} */
+/** @} */
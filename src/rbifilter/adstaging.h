@@ -0,0 +1,86 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+
+#ifndef __RMF_ADSTAGING_H__
+#define __RMF_ADSTAGING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+  *  @addtogroup RBI_FILTER
+  * @{
+ **/
+
+/* Staged data is kept in blocks of whole 188 byte packets that never move */
+#define AD_STAGING_BLOCK_PACKETS (1024)
+#define AD_STAGING_BLOCK_SIZE (188*AD_STAGING_BLOCK_PACKETS)
+
+typedef struct _AdStaging AdStaging;
+typedef struct _AdStagingSegment AdStagingSegment;
+
+/**
+ * In-memory staging cache for upcoming ad segments. A prefetch thread
+ * fetches the segments of the URI list (file paths, file://, http:// and
+ * https:// URIs) in order, within a memory budget, and stores them as
+ * 188 byte transport packets; 192 byte timestamped packets are stripped
+ * to 188. A segment that fails to fetch is fetched again with growing
+ * delays, up to a few times; setting the list again retries it anew.
+ * Segments no longer in the list are evicted, oldest first, when room is
+ * needed and no reader holds them
+*/
+AdStaging* ad_staging_new( guint64 budget );
+void ad_staging_free( AdStaging *staging );
+void ad_staging_set_uris( AdStaging *staging, const gchar *uris );
+void ad_staging_set_budget( AdStaging *staging, guint64 budget );
+guint64 ad_staging_get_bytes( AdStaging *staging );
+guint64 ad_staging_get_underruns( AdStaging *staging );
+
+/**
+ * Reader side, e.g. the RBI processor. ad_staging_lookup returns the
+ * staged segment for uri with a reference, or NULL (counted as underrun)
+ * if it has not been fetched yet. ad_staging_segment_data returns a
+ * pointer to the packets at offset, valid while the reference is held,
+ * and sets *avail to the number of bytes readable there in one piece.
+ * Reading ahead of the prefetch counts as underrun and returns NULL
+*/
+AdStagingSegment* ad_staging_lookup( AdStaging *staging, const gchar *uri );
+const unsigned char* ad_staging_segment_data( AdStagingSegment *segment, gsize offset, gsize *avail );
+gboolean ad_staging_segment_is_complete( AdStagingSegment *segment );
+gsize ad_staging_segment_get_size( AdStagingSegment *segment );
+AdStagingSegment* ad_staging_segment_ref( AdStagingSegment *segment );
+void ad_staging_segment_unref( AdStagingSegment *segment );
+
+/** @} */
+
+G_END_DECLS
+
+#endif /* __RMF_ADSTAGING_H__ */
+
+/** @} */
+/** @} */
@@ -38,6 +38,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 typedef unsigned char uint8_t;
 
@@ -45,6 +46,25 @@ typedef unsigned char uint8_t;
 
 #define GST_PACKAGE_ORIGIN "http://gstreamer.net/"
 
+#define DEFAULT_MAX_SIZE_BUFFERS 200
+#define DEFAULT_MAX_SIZE_BYTES (10 * 1024 * 1024)
+#define DEFAULT_MAX_SIZE_TIME GST_SECOND
+#define DEFAULT_PASSTHROUGH_FAST_PATH TRUE
+#define OUT_POOL_MIN_BUFFERS (4)
+#define DEFAULT_SCTE35_PID (-1)
+#define DEFAULT_SPLICE_PREROLL (2 * GST_SECOND)
+#define DEFAULT_STAGING_BUDGET (32 * 1024 * 1024)
+#define DEFAULT_EVENT_DRIVEN FALSE
+
+/* Without notifications, how long an insertion with no output ready waits before asking again */
+#define RBI_IDLE_POLL_US (2000)
+
+/* Initial size of the pending item ring */
+#define PENDING_ITEMS_MIN 64
+
+/* Most buffers the task takes off the queue and pushes per iteration */
+#define RBI_BATCH_MAX 64
+
 #define STATIC_CAPS \
            "video/mpegts;" \
            "video/mpegts, " \
@@ -77,9 +97,45 @@ enum
   PROP_PACKET_IN_CALLBACK,
   PROP_PACKET_OUT_SIZE_CALLBACK,
   PROP_PACKET_OUT_DATA_CALLBACK,
-  PROP_CONTEXT
+  PROP_CONTEXT,
+  PROP_MAX_SIZE_BUFFERS,
+  PROP_MAX_SIZE_BYTES,
+  PROP_MAX_SIZE_TIME,
+  PROP_CURRENT_LEVEL_BUFFERS,
+  PROP_CURRENT_LEVEL_BYTES,
+  PROP_PASSTHROUGH_FAST_PATH,
+  PROP_PACKET_SCAN_CALLBACK,
+  PROP_BUFFER_COPIES,
+  PROP_BUFFER_COPIES_AVOIDED,
+  PROP_OUT_POOL_BUFFERS,
+  PROP_OUT_POOL_FALLBACKS,
+  PROP_SCTE35_PID,
+  PROP_SPLICE_PREROLL,
+  PROP_SCTE35_SECTIONS,
+  PROP_SCTE35_CRC_ERRORS,
+  PROP_PACKET_OUT_STAGED_CALLBACK,
+  PROP_AD_SEGMENT_URIS,
+  PROP_STAGING_BUDGET,
+  PROP_AD_STAGING,
+  PROP_STAGING_BYTES,
+  PROP_STAGING_UNDERRUNS,
+  PROP_SPLICE_IN_LATENCY,
+  PROP_EVENT_DRIVEN,
+  PROP_STATS,
+  PROP_PROGRAM_UNDERRUNS
+};
+
+enum
+{
+  SIGNAL_INSERTION_STATE,
+  SIGNAL_OUTPUT_READY,
+  SIGNAL_ADD_PROGRAM,
+  SIGNAL_REMOVE_PROGRAM,
+  LAST_SIGNAL
 };
 
+static guint gst_rbifilter_signals[LAST_SIGNAL] = { 0 };
+
 #ifdef USE_GST1
 #define gst_rbifilter_parent_class parent_class
 G_DEFINE_TYPE (GstRBIFilter, gst_rbifilter, GST_TYPE_ELEMENT);
@@ -98,9 +154,18 @@ typedef enum _PendingItemType
    pendingItem_Buffer,
 } PendingItemType;
 
+struct _GstRBIFilterItem
+{
+   PendingItemType type;
+   gpointer data;
+   guint64 time;
+};
+
 typedef gboolean (*packetInCB)( void *ctx, unsigned char *packets, int* len );
 typedef int (*packetOutSizeCB)( void *ctx );
 typedef int (*packetOutDataCB)( void *ctx, unsigned char *packets, int len );
+typedef gboolean (*packetScanCB)( void *ctx, const unsigned char *packets, int len );
+typedef int (*packetOutStagedCB)( void *ctx, const unsigned char **packets, AdStagingSegment **segment );
 
 static void gst_rbifilter_finalize (GObject * object);
 static void gst_rbifilter_set_property (GObject * object, guint prop_id,
@@ -119,9 +184,23 @@ static void
 gst_rbifilter_waitNotEmpty( GstRBIFilter * rbifilter );
 static void 
 gst_rbifilter_signalNotEmpty( GstRBIFilter * rbifilter );
+static void 
+gst_rbifilter_waitNotEmptyTimed( GstRBIFilter * rbifilter, gint64 timeout );
+static void
+gst_rbifilter_insertion_state( GstRBIFilter *rbifilter, gboolean inserting );
+static void
+gst_rbifilter_output_ready( GstRBIFilter *rbifilter );
+static gboolean
+gst_rbifilter_add_program( GstRBIFilter *rbifilter, gpointer context, const gchar *pids );
+static gboolean
+gst_rbifilter_remove_program( GstRBIFilter *rbifilter, gpointer context );
+static void 
+gst_rbifilter_waitNotFull( GstRBIFilter * rbifilter );
+static void 
+gst_rbifilter_signalNotFull( GstRBIFilter * rbifilter );
 static gboolean 
 gst_rbifilter_add_event( GstRBIFilter *rbifilter, GstEvent *event );
-static gboolean 
+static GstFlowReturn 
 gst_rbifilter_add_buffer( GstRBIFilter *rbifilter, GstBuffer *buffer );
 static void
 gst_rbifilter_flush( GstRBIFilter *rbifilter );
@@ -139,6 +218,16 @@ gst_rbifilter_chain (GstPad * pad, GstBuffer * buffer);
 #endif
 static void
 gst_rbifilter_loop( GstPad * pad );
+static GstFlowReturn
+gst_rbifilter_fast_path( GstRBIFilter *rbifilter, GstBuffer *buffer, gboolean *handled );
+static void
+gst_rbifilter_post_insertion( GstRBIFilter *rbifilter );
+static GstStructure*
+gst_rbifilter_create_stats( GstRBIFilter *rbifilter );
+#ifdef USE_GST1
+static void
+gst_rbifilter_release_pool( GstRBIFilter *rbifilter );
+#endif
 
 #ifndef USE_GST1
 static void
@@ -166,13 +255,47 @@ gst_rbifilter_finalize (GObject * object)
   GstRBIFilter *rbifilter;
 
   rbifilter = GST_RBIFILTER (object);
+
+  while ( rbifilter->pendingCount ) {
+     GstRBIFilterItem *item= &rbifilter->pendingItems[rbifilter->pendingHead];
+     if ( item->type == pendingItem_Buffer ) {
+        gst_buffer_unref( (GstBuffer*)item->data );
+     } else if ( item->type == pendingItem_Event ) {
+        gst_event_unref( (GstEvent*)item->data );
+     }
+     rbifilter->pendingHead= (rbifilter->pendingHead + 1) % rbifilter->pendingCapacity;
+     rbifilter->pendingCount--;
+  }
+  g_free( rbifilter->pendingItems );
+
+  if ( rbifilter->insertionMessage ) {
+     gst_structure_free( rbifilter->insertionMessage );
+     rbifilter->insertionMessage= NULL;
+  }
+
+  #ifdef USE_GST1
+  gst_rbifilter_release_pool( rbifilter );
+  #endif
+
+  if ( rbifilter->scte35Parser ) {
+     scte35_parser_free( rbifilter->scte35Parser );
+     rbifilter->scte35Parser= NULL;
+  }
+
+  ad_staging_free( rbifilter->adStaging );
+  rbifilter->adStaging= NULL;
+  rbi_programs_free( rbifilter->programs );
+  rbifilter->programs= NULL;
+  g_free( rbifilter->adSegmentUris );
   
   #ifdef GLIB_VERSION_2_32 
   g_mutex_clear( &rbifilter->lockItems );
   g_cond_clear( &rbifilter->condNotEmpty );
+  g_cond_clear( &rbifilter->condNotFull );
   #else
   g_mutex_free( rbifilter->lockItems );
   g_cond_free( rbifilter->condNotEmpty );
+  g_cond_free( rbifilter->condNotFull );
   #endif  
   
   G_OBJECT_CLASS (parent_class)->finalize (object);
@@ -214,6 +337,245 @@ gst_rbifilter_class_init (GstRBIFilterClass * klass)
           "RBI packet output data callback",
           "RBI packet output data callback of form int (*cb)( void *ctx, unsigned char* packets, int len ).",
           (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BUFFERS,
+      g_param_spec_uint (
+          "max-size-buffers",
+          "Max. size (buffers)",
+          "Max. number of buffers waiting for the task before chain blocks (0=disable).",
+          0, G_MAXUINT, DEFAULT_MAX_SIZE_BUFFERS,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BYTES,
+      g_param_spec_uint (
+          "max-size-bytes",
+          "Max. size (kB)",
+          "Max. amount of data waiting for the task before chain blocks (bytes, 0=disable).",
+          0, G_MAXUINT, DEFAULT_MAX_SIZE_BYTES,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_TIME,
+      g_param_spec_uint64 (
+          "max-size-time",
+          "Max. size (ns)",
+          "Max. amount of data waiting for the task before chain blocks (ns, 0=disable).",
+          0, G_MAXUINT64, DEFAULT_MAX_SIZE_TIME,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_BUFFERS,
+      g_param_spec_uint (
+          "current-level-buffers",
+          "Current level (buffers)",
+          "Number of buffers waiting for the task.",
+          0, G_MAXUINT, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_BYTES,
+      g_param_spec_uint64 (
+          "current-level-bytes",
+          "Current level (bytes)",
+          "Amount of data waiting for the task.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH_FAST_PATH,
+      g_param_spec_boolean (
+          "passthrough-fast-path",
+          "Pass-through fast path",
+          "Process and push buffers from the chain thread while no insertion is pending or active.",
+          DEFAULT_PASSTHROUGH_FAST_PATH,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_PACKET_SCAN_CALLBACK,
+      g_param_spec_pointer (
+          "rbi-packet-scan-callback",
+          "RBI packet scan callback",
+          "Optional RBI packet scan callback of form gboolean (*cb)( void *ctx, const unsigned char* packets, int len ), "
+          "returns TRUE when the packet input callback needs to rewrite these packets.",
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_BUFFER_COPIES,
+      g_param_spec_uint64 (
+          "buffer-copies",
+          "Buffer copies",
+          "Number of shared input buffers copied to make them writable.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_BUFFER_COPIES_AVOIDED,
+      g_param_spec_uint64 (
+          "buffer-copies-avoided",
+          "Buffer copies avoided",
+          "Number of shared input buffers passed read only because the scan callback found nothing to rewrite.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_OUT_POOL_BUFFERS,
+      g_param_spec_uint64 (
+          "out-pool-buffers",
+          "Output pool buffers",
+          "Number of inserted packet buffers taken from the output buffer pool.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_OUT_POOL_FALLBACKS,
+      g_param_spec_uint64 (
+          "out-pool-fallbacks",
+          "Output pool fallbacks",
+          "Number of inserted packet buffers allocated outside the output buffer pool.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_SCTE35_PID,
+      g_param_spec_int (
+          "scte35-pid",
+          "SCTE-35 PID",
+          "PID carrying SCTE-35 splice_info_sections to parse (-1=disable).",
+          -1, 0x1FFF, DEFAULT_SCTE35_PID,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_SPLICE_PREROLL,
+      g_param_spec_uint64 (
+          "splice-preroll",
+          "Splice pre-roll",
+          "Time in ns before a signalled splice time at which insertion is armed.",
+          0, G_MAXUINT64, DEFAULT_SPLICE_PREROLL,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_SCTE35_SECTIONS,
+      g_param_spec_uint64 (
+          "scte35-sections",
+          "SCTE-35 sections",
+          "Number of SCTE-35 sections parsed.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_SCTE35_CRC_ERRORS,
+      g_param_spec_uint64 (
+          "scte35-crc-errors",
+          "SCTE-35 CRC errors",
+          "Number of SCTE-35 sections dropped for a bad CRC_32.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_PACKET_OUT_STAGED_CALLBACK,
+      g_param_spec_pointer (
+          "rbi-packet-out-staged-callback",
+          "RBI packet output staged callback",
+          "Optional RBI packet output callback of form int (*cb)( void *ctx, const unsigned char** packets, AdStagingSegment** segment ), "
+          "returns packets of a staged segment to push without copying, passing on a segment reference.",
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_AD_SEGMENT_URIS,
+      g_param_spec_string (
+          "ad-segment-uris",
+          "Ad segment URIs",
+          "List of upcoming ad segments (paths, file, http or https URIs separated by ';', ',' or spaces) to prefetch into the staging cache.",
+          NULL,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_STAGING_BUDGET,
+      g_param_spec_uint64 (
+          "staging-budget",
+          "Staging budget",
+          "Max. memory in bytes for staged ad segments.",
+          0, G_MAXUINT64, DEFAULT_STAGING_BUDGET,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_AD_STAGING,
+      g_param_spec_pointer (
+          "ad-staging",
+          "Ad staging cache",
+          "AdStaging cache the RBI packet processor reads staged ad segments from.",
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_STAGING_BYTES,
+      g_param_spec_uint64 (
+          "staging-bytes",
+          "Staging bytes",
+          "Memory in bytes held by staged ad segments.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_STAGING_UNDERRUNS,
+      g_param_spec_uint64 (
+          "staging-underruns",
+          "Staging underruns",
+          "Number of reads of ad segment data the prefetch had not staged yet.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_SPLICE_IN_LATENCY,
+      g_param_spec_uint64 (
+          "splice-in-latency",
+          "Splice-in latency",
+          "Time in ns from the start of the last insertion to its first output buffer.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_EVENT_DRIVEN,
+      g_param_spec_boolean (
+          "event-driven",
+          "Event driven",
+          "The RBI processor reports insertion start/stop and ready output with the insertion-state and output-ready "
+          "signals instead of being probed with a null buffer.",
+          DEFAULT_EVENT_DRIVEN,
+          (GParamFlags)G_PARAM_READWRITE ));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed (
+          "stats",
+          "Stats",
+          "Insertions, splice accuracy, packets and bytes replaced and inserted, max. queue depth, and time buffers "
+          "spent queued and RBI callback execution time as percentiles and log2 histograms.",
+          GST_TYPE_STRUCTURE,
+          (GParamFlags)G_PARAM_READABLE ));
+  g_object_class_install_property (gobject_class, PROP_PROGRAM_UNDERRUNS,
+      g_param_spec_uint64 (
+          "program-underruns",
+          "Program underruns",
+          "Number of packets of inserting program contexts filled with null packets for lack of inserted packets.",
+          0, G_MAXUINT64, 0,
+          (GParamFlags)G_PARAM_READABLE ));
+
+  /**
+   * GstRBIFilter::insertion-state:
+   * @inserting: an insertion starts (TRUE) or ended (FALSE)
+   *
+   * Emitted by the RBI processor when event-driven is set. An insertion
+   * that consumes an input buffer must be reported before the packet
+   * input callback returns. Starting an insertion also counts as
+   * output-ready.
+   */
+  gst_rbifilter_signals[SIGNAL_INSERTION_STATE] =
+      g_signal_new ("insertion-state", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstRBIFilterClass, insertion_state), NULL, NULL,
+      NULL, G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
+
+  /**
+   * GstRBIFilter::output-ready:
+   *
+   * Emitted by the RBI processor when it has inserted packets to hand out
+   * after the packet output size callback last returned 0. Wakes the task.
+   */
+  gst_rbifilter_signals[SIGNAL_OUTPUT_READY] =
+      g_signal_new ("output-ready", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstRBIFilterClass, output_ready), NULL, NULL,
+      NULL, G_TYPE_NONE, 0);
+
+  /**
+   * GstRBIFilter::add-program:
+   * @context: RBI context for the program
+   * @pids: PIDs the context owns, separated by commas or spaces
+   *
+   * Adds an RBI context that independently processes and inserts on its
+   * PIDs, e.g. one program of a multi program transport stream, using the
+   * same packet callbacks as rbi-context. Its packets are handed to the
+   * packet input callback gathered into one block; when the context
+   * consumes them its inserted packets take their place in the stream.
+   * Returns FALSE if the context was already added or no PID was valid.
+   */
+  gst_rbifilter_signals[SIGNAL_ADD_PROGRAM] =
+      g_signal_new ("add-program", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstRBIFilterClass, add_program), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 2, G_TYPE_POINTER, G_TYPE_STRING);
+
+  /**
+   * GstRBIFilter::remove-program:
+   * @context: RBI context given to add-program
+   *
+   * Removes a program context. Once this returns the packet callbacks are
+   * no longer called with it. Must not be emitted from within a callback.
+   */
+  gst_rbifilter_signals[SIGNAL_REMOVE_PROGRAM] =
+      g_signal_new ("remove-program", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstRBIFilterClass, remove_program), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 1, G_TYPE_POINTER);
+
+  klass->insertion_state = gst_rbifilter_insertion_state;
+  klass->output_ready = gst_rbifilter_output_ready;
+  klass->add_program = gst_rbifilter_add_program;
+  klass->remove_program = gst_rbifilter_remove_program;
 
   gobject_class->finalize = gst_rbifilter_finalize;
 
@@ -269,12 +631,67 @@ gst_rbifilter_init (GstRBIFilter * rbifilter, GstRBIFilterClass * g_class)
 
   #ifdef GLIB_VERSION_2_32 
   g_cond_init( &rbifilter->condNotEmpty );
+  g_cond_init( &rbifilter->condNotFull );
   g_mutex_init( &rbifilter->lockItems );
   #else
   rbifilter->condNotEmpty= g_cond_new();
+  rbifilter->condNotFull= g_cond_new();
   rbifilter->lockItems= g_mutex_new();
   #endif
   rbifilter->pendingItems= NULL;
+  rbifilter->pendingCapacity= 0;
+  rbifilter->pendingHead= 0;
+  rbifilter->pendingCount= 0;
+  rbifilter->pendingBuffers= 0;
+  rbifilter->pendingBytes= 0;
+  rbifilter->pendingTimeIn= GST_CLOCK_TIME_NONE;
+  rbifilter->pendingTimeOut= GST_CLOCK_TIME_NONE;
+  rbifilter->maxSizeBuffers= DEFAULT_MAX_SIZE_BUFFERS;
+  rbifilter->maxSizeBytes= DEFAULT_MAX_SIZE_BYTES;
+  rbifilter->maxSizeTime= DEFAULT_MAX_SIZE_TIME;
+  rbifilter->flushing= FALSE;
+  rbifilter->passthroughFastPath= DEFAULT_PASSTHROUGH_FAST_PATH;
+  rbifilter->chainProcessing= FALSE;
+  rbifilter->taskProcessing= FALSE;
+  rbifilter->bufferCopies= 0;
+  rbifilter->bufferCopiesAvoided= 0;
+  rbifilter->outPool= NULL;
+  rbifilter->outPoolSize= 0;
+  rbifilter->outPoolPrivate= FALSE;
+  rbifilter->outPoolBuffers= 0;
+  rbifilter->outPoolFallbacks= 0;
+  rbifilter->scte35Pid= DEFAULT_SCTE35_PID;
+  rbifilter->splicePreroll= DEFAULT_SPLICE_PREROLL;
+  rbifilter->scte35Parser= NULL;
+  rbifilter->scte35Sections= 0;
+  rbifilter->scte35CrcErrors= 0;
+  rbifilter->splicePending= FALSE;
+  rbifilter->spliceArmed= FALSE;
+  rbifilter->spliceStarted= FALSE;
+  rbifilter->adSegmentUris= NULL;
+  rbifilter->adStaging= ad_staging_new( DEFAULT_STAGING_BUDGET );
+  rbifilter->stagingBudget= DEFAULT_STAGING_BUDGET;
+  rbifilter->spliceInStart= 0;
+  rbifilter->spliceInLatency= 0;
+  rbifilter->rbiPacketOutStagedCallback= 0;
+  rbifilter->eventDriven= DEFAULT_EVENT_DRIVEN;
+  rbifilter->notifiedInserting= FALSE;
+  rbifilter->outputReady= FALSE;
+  rbifilter->outputIdle= FALSE;
+  rbifilter->taskWaiting= FALSE;
+  memset( &rbifilter->insertion, 0, sizeof(rbifilter->insertion) );
+  rbifilter->insertions= 0;
+  rbifilter->totalPacketsReplaced= 0;
+  rbifilter->totalBytesReplaced= 0;
+  rbifilter->totalBytesInserted= 0;
+  rbifilter->maxQueueDepth= 0;
+  rbifilter->lastSpliceError= 0;
+  rbifilter->maxSpliceError= 0;
+  memset( &rbifilter->queueTime, 0, sizeof(rbifilter->queueTime) );
+  memset( &rbifilter->packetInTime, 0, sizeof(rbifilter->packetInTime) );
+  memset( &rbifilter->packetOutTime, 0, sizeof(rbifilter->packetOutTime) );
+  rbifilter->insertionMessage= NULL;
+  rbifilter->programs= rbi_programs_new();
 
   rbifilter->playing = FALSE;
   rbifilter->inserting = FALSE;
@@ -282,6 +699,7 @@ gst_rbifilter_init (GstRBIFilter * rbifilter, GstRBIFilterClass * g_class)
   rbifilter->rbiContext = 0;
   rbifilter->rbiPacketOutSizeCallback = 0;
   rbifilter->rbiPacketOutDataCallback = 0;
+  rbifilter->rbiPacketScanCallback = 0;
 }
 
 static void
@@ -302,9 +720,59 @@ gst_rbifilter_set_property (GObject * object, guint prop_id,
     case PROP_PACKET_OUT_DATA_CALLBACK:
       rbifilter->rbiPacketOutDataCallback= g_value_get_pointer (value);
       break;
+    case PROP_PACKET_SCAN_CALLBACK:
+      rbifilter->rbiPacketScanCallback= g_value_get_pointer (value);
+      break;
+    case PROP_SCTE35_PID:
+      rbifilter->scte35Pid= g_value_get_int (value);
+      break;
+    case PROP_SPLICE_PREROLL:
+      rbifilter->splicePreroll= g_value_get_uint64 (value);
+      break;
+    case PROP_PACKET_OUT_STAGED_CALLBACK:
+      rbifilter->rbiPacketOutStagedCallback= g_value_get_pointer (value);
+      break;
+    case PROP_AD_SEGMENT_URIS:
+      g_free( rbifilter->adSegmentUris );
+      rbifilter->adSegmentUris= g_value_dup_string (value);
+      ad_staging_set_uris( rbifilter->adStaging, rbifilter->adSegmentUris );
+      break;
+    case PROP_STAGING_BUDGET:
+      rbifilter->stagingBudget= g_value_get_uint64 (value);
+      ad_staging_set_budget( rbifilter->adStaging, rbifilter->stagingBudget );
+      break;
+    case PROP_EVENT_DRIVEN:
+      gst_rbifilter_lockItems( rbifilter );
+      rbifilter->eventDriven= g_value_get_boolean (value);
+      gst_rbifilter_signalNotEmpty( rbifilter );
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
     case PROP_CONTEXT:
       rbifilter->rbiContext= g_value_get_pointer (value);
       break;
+    case PROP_PASSTHROUGH_FAST_PATH:
+      gst_rbifilter_lockItems( rbifilter );
+      rbifilter->passthroughFastPath= g_value_get_boolean (value);
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
+    case PROP_MAX_SIZE_BUFFERS:
+      gst_rbifilter_lockItems( rbifilter );
+      rbifilter->maxSizeBuffers= g_value_get_uint (value);
+      gst_rbifilter_signalNotFull( rbifilter );
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      gst_rbifilter_lockItems( rbifilter );
+      rbifilter->maxSizeBytes= g_value_get_uint (value);
+      gst_rbifilter_signalNotFull( rbifilter );
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
+    case PROP_MAX_SIZE_TIME:
+      gst_rbifilter_lockItems( rbifilter );
+      rbifilter->maxSizeTime= g_value_get_uint64 (value);
+      gst_rbifilter_signalNotFull( rbifilter );
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -329,9 +797,88 @@ gst_rbifilter_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_PACKET_OUT_DATA_CALLBACK:
       g_value_set_pointer (value, rbifilter->rbiPacketOutDataCallback);
       break;
+    case PROP_PACKET_SCAN_CALLBACK:
+      g_value_set_pointer (value, rbifilter->rbiPacketScanCallback);
+      break;
+    case PROP_BUFFER_COPIES:
+      g_value_set_uint64 (value, rbifilter->bufferCopies);
+      break;
+    case PROP_BUFFER_COPIES_AVOIDED:
+      g_value_set_uint64 (value, rbifilter->bufferCopiesAvoided);
+      break;
+    case PROP_OUT_POOL_BUFFERS:
+      g_value_set_uint64 (value, rbifilter->outPoolBuffers);
+      break;
+    case PROP_OUT_POOL_FALLBACKS:
+      g_value_set_uint64 (value, rbifilter->outPoolFallbacks);
+      break;
+    case PROP_SCTE35_PID:
+      g_value_set_int (value, rbifilter->scte35Pid);
+      break;
+    case PROP_SPLICE_PREROLL:
+      g_value_set_uint64 (value, rbifilter->splicePreroll);
+      break;
+    case PROP_SCTE35_SECTIONS:
+      g_value_set_uint64 (value, rbifilter->scte35Sections);
+      break;
+    case PROP_SCTE35_CRC_ERRORS:
+      g_value_set_uint64 (value, rbifilter->scte35CrcErrors);
+      break;
+    case PROP_PACKET_OUT_STAGED_CALLBACK:
+      g_value_set_pointer (value, rbifilter->rbiPacketOutStagedCallback);
+      break;
+    case PROP_AD_SEGMENT_URIS:
+      g_value_set_string (value, rbifilter->adSegmentUris);
+      break;
+    case PROP_STAGING_BUDGET:
+      g_value_set_uint64 (value, rbifilter->stagingBudget);
+      break;
+    case PROP_AD_STAGING:
+      g_value_set_pointer (value, rbifilter->adStaging);
+      break;
+    case PROP_STAGING_BYTES:
+      g_value_set_uint64 (value, ad_staging_get_bytes( rbifilter->adStaging ));
+      break;
+    case PROP_STAGING_UNDERRUNS:
+      g_value_set_uint64 (value, ad_staging_get_underruns( rbifilter->adStaging ));
+      break;
+    case PROP_SPLICE_IN_LATENCY:
+      g_value_set_uint64 (value, rbifilter->spliceInLatency);
+      break;
+    case PROP_EVENT_DRIVEN:
+      g_value_set_boolean (value, rbifilter->eventDriven);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_rbifilter_create_stats( rbifilter ));
+      break;
+    case PROP_PROGRAM_UNDERRUNS:
+      g_value_set_uint64 (value, rbi_programs_get_underruns( rbifilter->programs ));
+      break;
     case PROP_CONTEXT:
       g_value_set_pointer (value, rbifilter->rbiContext);
       break;
+    case PROP_PASSTHROUGH_FAST_PATH:
+      g_value_set_boolean (value, rbifilter->passthroughFastPath);
+      break;
+    case PROP_MAX_SIZE_BUFFERS:
+      g_value_set_uint (value, rbifilter->maxSizeBuffers);
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      g_value_set_uint (value, rbifilter->maxSizeBytes);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      g_value_set_uint64 (value, rbifilter->maxSizeTime);
+      break;
+    case PROP_CURRENT_LEVEL_BUFFERS:
+      gst_rbifilter_lockItems( rbifilter );
+      g_value_set_uint (value, rbifilter->pendingBuffers);
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
+    case PROP_CURRENT_LEVEL_BYTES:
+      gst_rbifilter_lockItems( rbifilter );
+      g_value_set_uint64 (value, rbifilter->pendingBytes);
+      gst_rbifilter_unlockItems( rbifilter );
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -411,9 +958,10 @@ gst_rbifilter_change_state (GstElement * element, GstStateChange transition)
       {
          rbifilter->playing = FALSE;          
 
-         // Wake task if waiting for items
+         // Wake task if waiting for items and chain if waiting for room
          gst_rbifilter_lockItems( rbifilter );
          gst_rbifilter_signalNotEmpty( rbifilter );
+         gst_rbifilter_signalNotFull( rbifilter );
          gst_rbifilter_unlockItems( rbifilter );
          
          GST_DEBUG_OBJECT(element, "rbifilter: change_state: stopping task\n");
@@ -427,6 +975,17 @@ gst_rbifilter_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       rbifilter->inserting = FALSE;
       rbifilter->srcRet= GST_FLOW_OK;
+      rbifilter->splicePending= FALSE;
+      rbifilter->spliceArmed= FALSE;
+      rbifilter->spliceStarted= FALSE;
+      rbifilter->insertion.active= FALSE;
+      rbi_programs_reset( rbifilter->programs );
+      if ( rbifilter->scte35Parser ) {
+         scte35_parser_reset( rbifilter->scte35Parser );
+      }
+      #ifdef USE_GST1
+      gst_rbifilter_release_pool( rbifilter );
+      #endif
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       break;
@@ -459,15 +1018,35 @@ static void gst_rbifilter_unlockItems( GstRBIFilter * rbifilter )
 
 static void gst_rbifilter_waitNotEmpty( GstRBIFilter * rbifilter )
 {
+  rbifilter->taskWaiting= TRUE;
   #ifdef GLIB_VERSION_2_32
   g_cond_wait( &rbifilter->condNotEmpty, &rbifilter->lockItems );
   #else
   g_cond_wait( rbifilter->condNotEmpty, rbifilter->lockItems );
   #endif 
+  rbifilter->taskWaiting= FALSE;
 }
 
+static void gst_rbifilter_waitNotEmptyTimed( GstRBIFilter * rbifilter, gint64 timeout )
+{
+  rbifilter->taskWaiting= TRUE;
+  #ifdef GLIB_VERSION_2_32
+  g_cond_wait_until( &rbifilter->condNotEmpty, &rbifilter->lockItems, g_get_monotonic_time() + timeout );
+  #else
+  GTimeVal deadline;
+  g_get_current_time( &deadline );
+  g_time_val_add( &deadline, timeout );
+  g_cond_timed_wait( rbifilter->condNotEmpty, rbifilter->lockItems, &deadline );
+  #endif 
+  rbifilter->taskWaiting= FALSE;
+}
+
+/* Only the task waits for items; while it is busy there is nobody to wake */
 static void gst_rbifilter_signalNotEmpty( GstRBIFilter * rbifilter )
 {
+  if ( !rbifilter->taskWaiting ) {
+     return;
+  }
   #ifdef GLIB_VERSION_2_32
   g_cond_signal( &rbifilter->condNotEmpty );
   #else
@@ -475,15 +1054,224 @@ static void gst_rbifilter_signalNotEmpty( GstRBIFilter * rbifilter )
   #endif
 }
 
+static void gst_rbifilter_waitNotFull( GstRBIFilter * rbifilter )
+{
+  #ifdef GLIB_VERSION_2_32
+  g_cond_wait( &rbifilter->condNotFull, &rbifilter->lockItems );
+  #else
+  g_cond_wait( rbifilter->condNotFull, rbifilter->lockItems );
+  #endif 
+}
+
+static void gst_rbifilter_signalNotFull( GstRBIFilter * rbifilter )
+{
+  #ifdef GLIB_VERSION_2_32
+  g_cond_broadcast( &rbifilter->condNotFull );
+  #else
+  g_cond_broadcast( rbifilter->condNotFull );
+  #endif
+}
+
+static guint64 gst_rbifilter_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (guint64)ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+static void gst_rbifilter_timing_add( GstRBIFilterTiming *timing, guint64 duration )
+{
+  guint64 d= duration;
+  guint bucket= 0;
+
+  /* bucket n holds durations in [2^(n-1), 2^n) ns */
+  while ( d > 0 && bucket < RBI_TIMING_BUCKETS - 1 ) {
+     d >>= 1;
+     bucket++;
+  }
+  timing->hist[bucket]++;
+  timing->count++;
+  timing->total += duration;
+  if ( duration > timing->max ) {
+     timing->max= duration;
+  }
+}
+
+/* Upper bound of the bucket the given percentile falls into, in ns */
+static guint64 gst_rbifilter_timing_percentile( const GstRBIFilterTiming *timing, guint percent )
+{
+  guint64 target, seen= 0;
+  guint bucket;
+
+  if ( !timing->count ) {
+     return 0;
+  }
+
+  target= (timing->count * percent + 99) / 100;
+  for( bucket= 0; bucket < RBI_TIMING_BUCKETS; bucket++ ) {
+     seen += timing->hist[bucket];
+     if ( seen >= target ) {
+        break;
+     }
+  }
+  return G_GUINT64_CONSTANT(1) << bucket;
+}
+
+/*
+ * Adds name-count, name-mean, name-p50/p90/p99 and name-max to the
+ * structure and, if asked, the histogram up to its last used bucket as
+ * name-histogram, an array of counts where entry n covers [2^(n-1), 2^n) ns
+ */
+static void gst_rbifilter_timing_set( GstStructure *structure, const char *name, const GstRBIFilterTiming *timing, gboolean histogram )
+{
+  static const guint percents[]= { 50, 90, 99 };
+  gchar *field;
+  guint i, used;
+
+  field= g_strdup_printf( "%s-count", name );
+  gst_structure_set( structure, field, G_TYPE_UINT64, timing->count, NULL );
+  g_free( field );
+  field= g_strdup_printf( "%s-mean", name );
+  gst_structure_set( structure, field, G_TYPE_UINT64, timing->count ? timing->total / timing->count : 0, NULL );
+  g_free( field );
+  for( i= 0; i < G_N_ELEMENTS(percents); ++i ) {
+     field= g_strdup_printf( "%s-p%u", name, percents[i] );
+     gst_structure_set( structure, field, G_TYPE_UINT64, gst_rbifilter_timing_percentile( timing, percents[i] ), NULL );
+     g_free( field );
+  }
+  field= g_strdup_printf( "%s-max", name );
+  gst_structure_set( structure, field, G_TYPE_UINT64, timing->max, NULL );
+  g_free( field );
+
+  if ( histogram ) {
+     GValue hist= { 0, };
+     GValue item= { 0, };
+
+     for( used= RBI_TIMING_BUCKETS; used > 0 && !timing->hist[used-1]; --used );
+
+     g_value_init( &hist, GST_TYPE_ARRAY );
+     for( i= 0; i < used; ++i ) {
+        g_value_init( &item, G_TYPE_UINT64 );
+        g_value_set_uint64( &item, timing->hist[i] );
+        gst_value_array_append_value( &hist, &item );
+        g_value_unset( &item );
+     }
+     field= g_strdup_printf( "%s-histogram", name );
+     gst_structure_set_value( structure, field, &hist );
+     g_value_unset( &hist );
+     g_free( field );
+  }
+}
+
+/* Appends an item to the pending ring, growing it when full. Called with
+ * lockItems held */
+static void gst_rbifilter_pushItem( GstRBIFilter *rbifilter, PendingItemType type, gpointer data )
+{
+  GstRBIFilterItem *item;
+
+  if ( rbifilter->pendingCount == rbifilter->pendingCapacity ) {
+     guint capacity= MAX( rbifilter->pendingCapacity * 2, PENDING_ITEMS_MIN );
+     GstRBIFilterItem *items= g_new( GstRBIFilterItem, capacity );
+     guint i;
+
+     for( i= 0; i < rbifilter->pendingCount; ++i ) {
+        items[i]= rbifilter->pendingItems[(rbifilter->pendingHead + i) % rbifilter->pendingCapacity];
+     }
+     g_free( rbifilter->pendingItems );
+     rbifilter->pendingItems= items;
+     rbifilter->pendingCapacity= capacity;
+     rbifilter->pendingHead= 0;
+  }
+
+  item= &rbifilter->pendingItems[(rbifilter->pendingHead + rbifilter->pendingCount) % rbifilter->pendingCapacity];
+  item->type= type;
+  item->data= data;
+  item->time= gst_rbifilter_now();
+  rbifilter->pendingCount++;
+
+  if ( type == pendingItem_Buffer ) {
+     GstBuffer *buffer= (GstBuffer*)data;
+     rbifilter->pendingBuffers++;
+     #ifdef USE_GST1
+     rbifilter->pendingBytes += gst_buffer_get_size( buffer );
+     #else
+     rbifilter->pendingBytes += GST_BUFFER_SIZE( buffer );
+     #endif
+     if ( GST_BUFFER_TIMESTAMP_IS_VALID( buffer ) ) {
+        rbifilter->pendingTimeIn= GST_BUFFER_TIMESTAMP( buffer );
+     }
+  }
+}
+
+/* Takes the oldest item off the pending ring, called with lockItems held.
+ * Returns pendingItem_None when the ring is empty */
+static PendingItemType gst_rbifilter_popItem( GstRBIFilter *rbifilter, gpointer *data )
+{
+  GstRBIFilterItem *item;
+
+  if ( !rbifilter->pendingCount ) {
+     return pendingItem_None;
+  }
+
+  item= &rbifilter->pendingItems[rbifilter->pendingHead];
+  rbifilter->pendingHead= (rbifilter->pendingHead + 1) % rbifilter->pendingCapacity;
+  rbifilter->pendingCount--;
+
+  if ( item->type == pendingItem_Buffer ) {
+     GstBuffer *buffer= (GstBuffer*)item->data;
+     rbifilter->pendingBuffers--;
+     #ifdef USE_GST1
+     rbifilter->pendingBytes -= gst_buffer_get_size( buffer );
+     #else
+     rbifilter->pendingBytes -= GST_BUFFER_SIZE( buffer );
+     #endif
+     if ( GST_BUFFER_TIMESTAMP_IS_VALID( buffer ) ) {
+        rbifilter->pendingTimeOut= GST_BUFFER_TIMESTAMP( buffer );
+     }
+     gst_rbifilter_signalNotFull( rbifilter );
+  }
+
+  *data= item->data;
+  return item->type;
+}
+
+/* Whether chain has to wait before queueing another buffer, called with
+ * lockItems held. A single buffer always fits so that oversized buffers
+ * cannot stall the stream */
+static gboolean gst_rbifilter_isFull( GstRBIFilter *rbifilter )
+{
+  if ( !rbifilter->pendingBuffers ) {
+     return FALSE;
+  }
+  if ( rbifilter->maxSizeBuffers && rbifilter->pendingBuffers >= rbifilter->maxSizeBuffers ) {
+     return TRUE;
+  }
+  if ( rbifilter->maxSizeBytes && rbifilter->pendingBytes >= rbifilter->maxSizeBytes ) {
+     return TRUE;
+  }
+  if ( rbifilter->maxSizeTime &&
+       GST_CLOCK_TIME_IS_VALID( rbifilter->pendingTimeIn ) &&
+       GST_CLOCK_TIME_IS_VALID( rbifilter->pendingTimeOut ) &&
+       rbifilter->pendingTimeIn > rbifilter->pendingTimeOut &&
+       rbifilter->pendingTimeIn - rbifilter->pendingTimeOut >= rbifilter->maxSizeTime ) {
+     return TRUE;
+  }
+  return FALSE;
+}
+
 static gboolean gst_rbifilter_add_event( GstRBIFilter *rbifilter, GstEvent *event )
 {
   gboolean ret = TRUE;
   
   gst_rbifilter_lockItems( rbifilter );
 
+  if ( GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP ) {
+     rbifilter->flushing= FALSE;
+  }
+
   if ( rbifilter->playing ) {
-     rbifilter->pendingItems= g_list_append( rbifilter->pendingItems, GINT_TO_POINTER(pendingItem_Event) );
-     rbifilter->pendingItems= g_list_append( rbifilter->pendingItems, event );
+     gst_rbifilter_pushItem( rbifilter, pendingItem_Event, event );
      gst_rbifilter_signalNotEmpty( rbifilter );
   } else {
      ret = gst_pad_push_event( rbifilter->srcpad, event );
@@ -494,15 +1282,31 @@ static gboolean gst_rbifilter_add_event( GstRBIFilter *rbifilter, GstEvent *even
   return ret;
 }
 
-static gboolean gst_rbifilter_add_buffer( GstRBIFilter *rbifilter, GstBuffer *buffer )
+static GstFlowReturn gst_rbifilter_add_buffer( GstRBIFilter *rbifilter, GstBuffer *buffer )
 {
-  gboolean ret = TRUE;
+  GstFlowReturn ret = GST_FLOW_OK;
   
   gst_rbifilter_lockItems( rbifilter );
 
-  if ( rbifilter->playing ) {
-     rbifilter->pendingItems= g_list_append( rbifilter->pendingItems, GINT_TO_POINTER(pendingItem_Buffer) );
-     rbifilter->pendingItems= g_list_append( rbifilter->pendingItems, buffer );
+  /* back-pressure: wait until the task caught up */
+  while ( rbifilter->playing && !rbifilter->flushing && (rbifilter->srcRet == GST_FLOW_OK) &&
+          gst_rbifilter_isFull( rbifilter ) )
+  {
+     gst_rbifilter_waitNotFull( rbifilter );
+  }
+
+  if ( rbifilter->srcRet != GST_FLOW_OK ) {
+     gst_buffer_unref( buffer );
+     ret = rbifilter->srcRet;
+  } else if ( rbifilter->flushing ) {
+     gst_buffer_unref( buffer );
+     #ifdef USE_GST1
+     ret = GST_FLOW_FLUSHING;
+     #else
+     ret = GST_FLOW_WRONG_STATE;
+     #endif
+  } else if ( rbifilter->playing ) {
+     gst_rbifilter_pushItem( rbifilter, pendingItem_Buffer, buffer );
      gst_rbifilter_signalNotEmpty( rbifilter );
   } else {
      ret = gst_pad_push( rbifilter->srcpad, buffer );
@@ -513,33 +1317,30 @@ static gboolean gst_rbifilter_add_buffer( GstRBIFilter *rbifilter, GstBuffer *bu
   return ret;
 }
 
+/* Drops the pending buffers, pending events still go downstream in order */
 static void
 gst_rbifilter_flush( GstRBIFilter *rbifilter )
 {
-  GList *walk, *free= NULL;
+  guint count;
   
   GST_DEBUG_OBJECT(rbifilter, "rbifilter: flush: enter\n");
   gst_rbifilter_lockItems( rbifilter );
 
-  walk= rbifilter->pendingItems;
-  while( walk )
+  rbifilter->flushing= TRUE;
+  for( count= rbifilter->pendingCount; count > 0; --count )
   {
-     if ( GPOINTER_TO_INT(walk->data) == pendingItem_Buffer ) {
-        free= walk;
-     }
-     walk= g_list_next( walk );
-     if ( free ) {
-        rbifilter->pendingItems= g_list_delete_link( rbifilter->pendingItems, free );
-        free= walk;
-     }
-     walk= g_list_next( walk );
-     if ( free ) {
-        GstBuffer *buffer= (GstBuffer*)free->data;
-        gst_buffer_unref( buffer );
-        rbifilter->pendingItems= g_list_delete_link( rbifilter->pendingItems, free );
+     gpointer data= NULL;
+     PendingItemType type= gst_rbifilter_popItem( rbifilter, &data );
+
+     if ( type == pendingItem_Buffer ) {
+        gst_buffer_unref( (GstBuffer*)data );
+     } else {
+        gst_rbifilter_pushItem( rbifilter, type, data );
      }
-     free= NULL;
   }
+  rbifilter->pendingTimeIn= GST_CLOCK_TIME_NONE;
+  rbifilter->pendingTimeOut= GST_CLOCK_TIME_NONE;
+  gst_rbifilter_signalNotFull( rbifilter );
 
   gst_rbifilter_unlockItems( rbifilter );
   GST_DEBUG_OBJECT(rbifilter, "rbifilter: flush: exit\n");
@@ -620,8 +1421,12 @@ gst_rbifilter_chain (GstPad * pad, GstBuffer * buffer)
   if ( rbifilter->srcRet == GST_FLOW_OK ) {
   
     if ( rbifilter->rbiContext ) {
-    
-      gst_rbifilter_add_buffer( rbifilter, buffer );
+      gboolean handled= FALSE;
+
+      ret= gst_rbifilter_fast_path( rbifilter, buffer, &handled );
+      if ( !handled ) {
+         ret= gst_rbifilter_add_buffer( rbifilter, buffer );
+      }
       
     }
   } else {
@@ -634,175 +1439,938 @@ gst_rbifilter_chain (GstPad * pad, GstBuffer * buffer)
   return ret;
 }
 
+/*
+ * Called by the parser for each splice_info_section. Every section is
+ * posted as an rbifilter-scte35 element message; splice_insert and
+ * time_signal schedule a splice that gst_rbifilter_scte35_check arms once
+ * the stream is within splice-preroll of the splice time
+ */
 static void
-gst_rbifilter_loop( GstPad * pad )
+gst_rbifilter_scte35_splice( void *userData, const Scte35SpliceInfo *info )
 {
-  GstFlowReturn ret;
-  GstRBIFilter *rbifilter;
-  rbifilter = GST_RBIFILTER (gst_pad_get_parent (pad));
+  GstRBIFilter *rbifilter= (GstRBIFilter*)userData;
+  GstStructure *structure;
+
+  GST_DEBUG_OBJECT(rbifilter, "splice info: command 0x%02X event %u cancel %d out %d immediate %d pts %" G_GUINT64_FORMAT,
+                   info->commandType, info->eventId, info->cancel, info->outOfNetwork, info->immediate, info->ptsTime );
+
+  structure= gst_structure_new( "rbifilter-scte35",
+                                "command-type", G_TYPE_INT, info->commandType,
+                                "event-id", G_TYPE_UINT, info->eventId,
+                                "cancel", G_TYPE_BOOLEAN, info->cancel,
+                                "out-of-network", G_TYPE_BOOLEAN, info->outOfNetwork,
+                                "immediate", G_TYPE_BOOLEAN, info->immediate,
+                                "unique-program-id", G_TYPE_UINT, info->uniqueProgramId,
+                                "avail-num", G_TYPE_UINT, info->availNum,
+                                "avails-expected", G_TYPE_UINT, info->availsExpected,
+                                NULL );
+  if ( info->hasPts ) {
+     gst_structure_set( structure, "pts-time", G_TYPE_UINT64, info->ptsTime, NULL );
+  }
+  if ( info->hasDuration ) {
+     gst_structure_set( structure,
+                        "duration", G_TYPE_UINT64, info->duration,
+                        "auto-return", G_TYPE_BOOLEAN, info->autoReturn,
+                        NULL );
+  }
+  gst_element_post_message( GST_ELEMENT(rbifilter), gst_message_new_element( GST_OBJECT(rbifilter), structure ) );
+
+  switch( info->commandType ) {
+     case scte35Command_SpliceInsert:
+        if ( info->cancel ) {
+           if ( rbifilter->spliceEventId == info->eventId ) {
+              rbifilter->splicePending= FALSE;
+              if ( !rbifilter->spliceStarted ) {
+                 rbifilter->spliceArmed= FALSE;
+              }
+           }
+           break;
+        }
+        /* fall through */
+     case scte35Command_TimeSignal:
+        rbifilter->splicePending= TRUE;
+        rbifilter->spliceEventId= info->eventId;
+        rbifilter->spliceHasPts= info->hasPts;
+        rbifilter->splicePts= info->ptsTime;
+        rbifilter->spliceDuration= info->hasDuration ? info->duration : 0;
+        break;
+     default:
+        break;
+  }
+}
 
-  if ( rbifilter->rbiContext ) {
-    GList *first;
-    PendingItemType type= pendingItem_None;
-    GstEvent *event= NULL;
-    GstBuffer *buffer= NULL;
-    gboolean usePendingItems;
+/*
+ * Arms a pending splice once the stream time, the last PCR, is within
+ * splice-preroll of its splice time, so the RBI processor can get ready
+ * and the task takes over before the splice point. Disarms once the
+ * insertion ran, or when the splice window passed without one
+ */
+static void
+gst_rbifilter_scte35_check( GstRBIFilter *rbifilter )
+{
+  guint64 pcr= 0, preroll;
+  gboolean havePcr;
 
-    /*
-     * Calling packet in callback with null buffer checks if we are currently inserting
-     */
-    rbifilter->inserting = ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, 0, 0 );;
+  havePcr= scte35_parser_get_pcr( rbifilter->scte35Parser, &pcr );
+  preroll= gst_util_uint64_scale( rbifilter->splicePreroll, 90000, GST_SECOND );
 
-    gst_rbifilter_lockItems( rbifilter );
+  if ( rbifilter->splicePending ) {
+     gint64 lead= 0;
 
-    while( !rbifilter->inserting && !rbifilter->pendingItems && rbifilter->playing )
-    {
-       gst_rbifilter_waitNotEmpty( rbifilter );
-    }
+     if ( rbifilter->spliceHasPts && havePcr ) {
+        lead= scte35_time_diff( rbifilter->splicePts, pcr );
+     }
+     if ( !rbifilter->spliceHasPts || !havePcr || (lead <= (gint64)preroll) ) {
+        GstStructure *structure;
+        guint64 base= rbifilter->spliceHasPts ? rbifilter->splicePts : pcr;
+
+        rbifilter->splicePending= FALSE;
+        rbifilter->spliceArmed= TRUE;
+        rbifilter->spliceStarted= FALSE;
+        rbifilter->spliceEnd= (base + rbifilter->spliceDuration + preroll) & SCTE35_PTS_MASK;
+        rbifilter->spliceEndValid= havePcr;
+
+        GST_INFO_OBJECT(rbifilter, "arming splice event %u, %" G_GINT64_FORMAT " ticks ahead", rbifilter->spliceEventId, lead );
+        structure= gst_structure_new( "rbifilter-splice-prearm",
+                                      "event-id", G_TYPE_UINT, rbifilter->spliceEventId,
+                                      "lead-time", G_TYPE_UINT64, (guint64)(lead > 0 ? gst_util_uint64_scale( lead, GST_SECOND, 90000 ) : 0),
+                                      NULL );
+        if ( rbifilter->spliceHasPts ) {
+           gst_structure_set( structure, "pts-time", G_TYPE_UINT64, rbifilter->splicePts, NULL );
+        }
+        gst_element_post_message( GST_ELEMENT(rbifilter), gst_message_new_element( GST_OBJECT(rbifilter), structure ) );
+     }
+  }
 
-    if ( rbifilter->pendingItems ) {
-    
-       first= rbifilter->pendingItems;
-       type= (PendingItemType)GPOINTER_TO_INT(first->data);
-       rbifilter->pendingItems= g_list_delete_link( rbifilter->pendingItems, first );
-       first= rbifilter->pendingItems;
-       switch( type ) {
-          case pendingItem_Event:
-             event= (GstEvent*)first->data;
-             break;
-          case pendingItem_Buffer:
-             buffer= (GstBuffer*)first->data;
-             break;
-          case pendingItem_None:
-          default:
-             break;
-       }
-       rbifilter->pendingItems= g_list_delete_link( rbifilter->pendingItems, first );
-       
-    }
+  if ( rbifilter->spliceArmed ) {
+     if ( rbifilter->inserting ) {
+        rbifilter->spliceStarted= TRUE;
+     } else if ( rbifilter->spliceStarted ||
+                 (rbifilter->spliceEndValid && havePcr && (scte35_time_diff( pcr, rbifilter->spliceEnd ) > 0)) ) {
+        GST_INFO_OBJECT(rbifilter, "disarming splice event %u", rbifilter->spliceEventId );
+        rbifilter->spliceArmed= FALSE;
+        rbifilter->spliceStarted= FALSE;
+     }
+  }
+}
 
-    gst_rbifilter_unlockItems( rbifilter );
+/* Feeds the packets to the SCTE-35 parser, following scte35-pid changes */
+static void
+gst_rbifilter_scte35_push( GstRBIFilter *rbifilter, const unsigned char *packets, int len )
+{
+  int pid= rbifilter->scte35Pid;
+
+  if ( pid < 0 ) {
+     if ( rbifilter->scte35Parser ) {
+        scte35_parser_free( rbifilter->scte35Parser );
+        rbifilter->scte35Parser= NULL;
+        rbifilter->splicePending= FALSE;
+        rbifilter->spliceArmed= FALSE;
+     }
+     return;
+  }
 
-    if ( type == pendingItem_Buffer ) {
-      gboolean pushBuffer;
-       
-      #ifdef USE_GST1
-      GstMapInfo map;
-      int size;
-      
-      /*Ensure buffer writable before passing it*/      
-      if (FALSE == gst_buffer_is_writable (buffer))  {
-          buffer = gst_buffer_make_writable (buffer);
-      }
-      gst_buffer_map (buffer, &map, (GstMapFlags)GST_MAP_READWRITE);
-      
-      size= map.size;
-      pushBuffer= ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, map.data, &size );
-      
-      if ( size != map.size )
-      {
-         gst_buffer_set_size( buffer, size );
-      }
-      gst_buffer_unmap (buffer, &map);
-      #else
-      unsigned char *data;
-      int size, originalSize;
-      data = GST_BUFFER_DATA(buffer);
-      originalSize = size = GST_BUFFER_SIZE(buffer);
-      
-      pushBuffer= ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, data, &size );
-      
-      if ( size != originalSize )
-      {
-         GST_BUFFER_SIZE(buffer)= size;
-      }
-      #endif
-      
-      if ( !pushBuffer ) {
-         gst_buffer_unref( buffer );
-         type = pendingItem_None;
-      }
-    }
+  if ( !rbifilter->scte35Parser ) {
+     rbifilter->scte35Parser= scte35_parser_new( pid, gst_rbifilter_scte35_splice, rbifilter );
+  } else {
+     scte35_parser_set_pid( rbifilter->scte35Parser, pid );
+  }
+  scte35_parser_push( rbifilter->scte35Parser, packets, len );
+  rbifilter->scte35Sections= scte35_parser_get_sections( rbifilter->scte35Parser );
+  rbifilter->scte35CrcErrors= scte35_parser_get_crc_errors( rbifilter->scte35Parser );
 
-    if ( (type == pendingItem_None) && (rbifilter->inserting == TRUE) ) {
-      int size= 0;
+  gst_rbifilter_scte35_check( rbifilter );
+}
 
-      size = ((packetOutSizeCB)rbifilter->rbiPacketOutSizeCallback)( rbifilter->rbiContext );
-      if ( size > 0 ) {
-        
-        #ifdef USE_GST1
-        buffer= gst_buffer_new_allocate( 0,  // default allocator
-                                         size,
-                                         0 ); // no GstAllocationParams
-        #else
-        buffer= gst_buffer_new_and_alloc( size );
-        #endif
-      
-        if ( buffer ) {
-          
-          #ifdef USE_GST1
-          GstMapInfo map;
-        
-          gst_buffer_map (buffer, &map, (GstMapFlags)GST_MAP_READWRITE);
-        
-          size= ((packetOutDataCB)rbifilter->rbiPacketOutDataCallback)( rbifilter->rbiContext, map.data, map.size );
-          
-          if ( size != map.size )
-          {
-             gst_buffer_set_size( buffer, size );
-          }
-        
-          gst_buffer_unmap (buffer, &map);
-          #else
-          unsigned char *data;
-          data = GST_BUFFER_DATA(buffer);
-
-          size= ((packetOutDataCB)rbifilter->rbiPacketOutDataCallback)( rbifilter->rbiContext, data, size );
-          
-          if ( size != (int)GST_BUFFER_SIZE(buffer) )
-          {
-             GST_BUFFER_SIZE(buffer)= size;
-          }
-          #endif
+/*
+ * Starts the record of an insertion, at the first input buffer it replaced
+ * or at its start. The splice time of an armed SCTE-35 splice is taken as
+ * the trigger PTS
+ */
+static void
+gst_rbifilter_insertion_begin( GstRBIFilter *rbifilter )
+{
+  GstRBIFilterInsertion *insertion= &rbifilter->insertion;
 
-          if ( size ) {          
-             type= pendingItem_Buffer;
-          } else {
-             type= pendingItem_None;
-             if ( buffer ) {
-                gst_buffer_unref( buffer );
-                buffer= NULL;
-             }
-          }
-          
-        } else {
-          GST_ERROR_OBJECT(rbifilter, "unable to alloc output gst buffer");
+  if ( insertion->active ) {
+     return;
+  }
+  memset( insertion, 0, sizeof(*insertion) );
+  insertion->active= TRUE;
+  insertion->startTime= g_get_monotonic_time();
+  if ( rbifilter->scte35Parser && (rbifilter->spliceArmed || rbifilter->splicePending) && rbifilter->spliceHasPts ) {
+     insertion->hasTriggerPts= TRUE;
+     insertion->triggerPts= rbifilter->splicePts;
+  }
+}
+
+/*
+ * Ends the record of an insertion: adds it to the totals and keeps it as
+ * rbifilter-insertion element message for gst_rbifilter_post_insertion.
+ * Times are in ns, PTS in 90kHz ticks. Called with lockItems held
+ */
+static void
+gst_rbifilter_insertion_end( GstRBIFilter *rbifilter )
+{
+  GstRBIFilterInsertion *insertion= &rbifilter->insertion;
+  GstStructure *structure;
+
+  insertion->active= FALSE;
+
+  rbifilter->insertions++;
+  rbifilter->totalPacketsReplaced += insertion->packetsReplaced;
+  rbifilter->totalBytesReplaced += insertion->bytesReplaced;
+  rbifilter->totalBytesInserted += insertion->bytesInserted;
+  if ( insertion->maxQueueDepth > rbifilter->maxQueueDepth ) {
+     rbifilter->maxQueueDepth= insertion->maxQueueDepth;
+  }
+
+  structure= gst_structure_new( "rbifilter-insertion",
+                                "duration", G_TYPE_UINT64, (guint64)(g_get_monotonic_time() - insertion->startTime) * GST_USECOND,
+                                "packets-replaced", G_TYPE_UINT64, insertion->packetsReplaced,
+                                "bytes-replaced", G_TYPE_UINT64, insertion->bytesReplaced,
+                                "bytes-inserted", G_TYPE_UINT64, insertion->bytesInserted,
+                                "max-queue-depth", G_TYPE_UINT, insertion->maxQueueDepth,
+                                NULL );
+  if ( insertion->hasTriggerPts ) {
+     gst_structure_set( structure, "trigger-pts", G_TYPE_UINT64, insertion->triggerPts, NULL );
+  }
+  if ( insertion->hasFirstPts ) {
+     gst_structure_set( structure, "first-replaced-pts", G_TYPE_UINT64, insertion->firstPts, NULL );
+  }
+  if ( insertion->hasTriggerPts && insertion->hasFirstPts ) {
+     gint64 error= scte35_time_diff( insertion->firstPts, insertion->triggerPts ) * (gint64)GST_SECOND / 90000;
+
+     rbifilter->lastSpliceError= error;
+     if ( (guint64)ABS(error) > rbifilter->maxSpliceError ) {
+        rbifilter->maxSpliceError= ABS(error);
+     }
+     gst_structure_set( structure, "splice-error", G_TYPE_INT64, error, NULL );
+  }
+  gst_rbifilter_timing_set( structure, "queue-time", &insertion->queueTime, FALSE );
+  gst_rbifilter_timing_set( structure, "packet-in-time", &insertion->packetIn, TRUE );
+  gst_rbifilter_timing_set( structure, "packet-out-time", &insertion->packetOut, TRUE );
+
+  GST_INFO_OBJECT(rbifilter, "insertion ended: %" G_GUINT64_FORMAT " bytes replaced, %" G_GUINT64_FORMAT " bytes inserted",
+                  insertion->bytesReplaced, insertion->bytesInserted );
+
+  if ( rbifilter->insertionMessage ) {
+     gst_structure_free( rbifilter->insertionMessage );
+  }
+  rbifilter->insertionMessage= structure;
+}
+
+/* Posts the record of a finished insertion, called without lockItems held */
+static void
+gst_rbifilter_post_insertion( GstRBIFilter *rbifilter )
+{
+  GstStructure *structure;
+
+  gst_rbifilter_lockItems( rbifilter );
+  structure= rbifilter->insertionMessage;
+  rbifilter->insertionMessage= NULL;
+  gst_rbifilter_unlockItems( rbifilter );
+
+  if ( structure ) {
+     gst_element_post_message( GST_ELEMENT(rbifilter), gst_message_new_element( GST_OBJECT(rbifilter), structure ) );
+  }
+}
+
+/*
+ * Notes when an insertion starts, for splice-in-latency, and starts or ends
+ * its record. Must be called with lockItems held unless inserting is TRUE
+ */
+static void
+gst_rbifilter_set_inserting( GstRBIFilter *rbifilter, gboolean inserting )
+{
+  if ( inserting && !rbifilter->inserting ) {
+     rbifilter->spliceInStart= g_get_monotonic_time();
+     gst_rbifilter_insertion_begin( rbifilter );
+  } else if ( !inserting && rbifilter->inserting && rbifilter->insertion.active ) {
+     gst_rbifilter_insertion_end( rbifilter );
+  }
+  rbifilter->inserting= inserting;
+}
+
+/*
+ * Accounts a packet input callback call that took the time since start: of
+ * len bytes of packets the RBI processor passed the first passed. Consuming
+ * the buffer starts the record of an insertion; the first PTS found in
+ * replaced input is the first replaced PTS
+ */
+static void
+gst_rbifilter_count_packet_in( GstRBIFilter *rbifilter, const unsigned char *packets, int len, int passed, guint64 start )
+{
+  GstRBIFilterInsertion *insertion= &rbifilter->insertion;
+  guint64 duration= gst_rbifilter_now() - start;
+
+  gst_rbifilter_timing_add( &rbifilter->packetInTime, duration );
+  if ( !passed ) {
+     gst_rbifilter_insertion_begin( rbifilter );
+  }
+  if ( insertion->active ) {
+     gst_rbifilter_timing_add( &insertion->packetIn, duration );
+     if ( (passed < len) && (len > 0) ) {
+        insertion->bytesReplaced += len - passed;
+        insertion->packetsReplaced += (len - passed) / scte35_packet_size( packets, len );
+        if ( !insertion->hasFirstPts ) {
+           insertion->hasFirstPts= scte35_find_pts( packets, len, &insertion->firstPts );
         }
+     }
+  }
+}
+
+/* Builds the stats property, see gst_rbifilter_timing_set for the timings */
+static GstStructure*
+gst_rbifilter_create_stats( GstRBIFilter *rbifilter )
+{
+  GstStructure *structure;
+
+  gst_rbifilter_lockItems( rbifilter );
+  structure= gst_structure_new( "rbifilter-stats",
+                                "insertions", G_TYPE_UINT, rbifilter->insertions,
+                                "packets-replaced", G_TYPE_UINT64, rbifilter->totalPacketsReplaced,
+                                "bytes-replaced", G_TYPE_UINT64, rbifilter->totalBytesReplaced,
+                                "bytes-inserted", G_TYPE_UINT64, rbifilter->totalBytesInserted,
+                                "max-queue-depth", G_TYPE_UINT, rbifilter->maxQueueDepth,
+                                "last-splice-error", G_TYPE_INT64, rbifilter->lastSpliceError,
+                                "max-splice-error", G_TYPE_UINT64, rbifilter->maxSpliceError,
+                                NULL );
+  gst_rbifilter_timing_set( structure, "queue-time", &rbifilter->queueTime, TRUE );
+  /* updated by the thread inside the RBI processor without the lock, may be a call behind */
+  gst_rbifilter_timing_set( structure, "packet-in-time", &rbifilter->packetInTime, TRUE );
+  gst_rbifilter_timing_set( structure, "packet-out-time", &rbifilter->packetOutTime, TRUE );
+  gst_rbifilter_unlockItems( rbifilter );
+
+  return structure;
+}
+
+/*
+ * Calling packet in callback with null buffer checks if we are currently inserting.
+ * With the SCTE-35 parser active this is only needed while a signalled splice
+ * is armed or an insertion runs; an insertion the RBI processor starts by
+ * itself still shows up as a consumed buffer
+ */
+static gboolean
+gst_rbifilter_probe( GstRBIFilter *rbifilter )
+{
+  if ( rbifilter->eventDriven ) {
+     return g_atomic_int_get( &rbifilter->notifiedInserting );
+  }
+  if ( rbifilter->scte35Parser && !rbifilter->inserting && !rbifilter->spliceArmed ) {
+     return FALSE;
+  }
+  return ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, 0, 0 );
+}
+
+/* After the RBI processor consumed an input buffer: has an insertion started? */
+static gboolean
+gst_rbifilter_reprobe( GstRBIFilter *rbifilter )
+{
+  if ( rbifilter->eventDriven ) {
+     return g_atomic_int_get( &rbifilter->notifiedInserting );
+  }
+  return ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, 0, 0 );
+}
+
+static void
+gst_rbifilter_insertion_state( GstRBIFilter *rbifilter, gboolean inserting )
+{
+  GST_DEBUG_OBJECT(rbifilter, "insertion-state %d", inserting);
+  g_atomic_int_set( &rbifilter->notifiedInserting, inserting ? TRUE : FALSE );
+
+  gst_rbifilter_lockItems( rbifilter );
+  rbifilter->outputReady= TRUE;
+  gst_rbifilter_signalNotEmpty( rbifilter );
+  gst_rbifilter_unlockItems( rbifilter );
+}
+
+static void
+gst_rbifilter_output_ready( GstRBIFilter *rbifilter )
+{
+  gst_rbifilter_lockItems( rbifilter );
+  rbifilter->outputReady= TRUE;
+  gst_rbifilter_signalNotEmpty( rbifilter );
+  gst_rbifilter_unlockItems( rbifilter );
+}
+
+static gboolean
+gst_rbifilter_add_program( GstRBIFilter *rbifilter, gpointer context, const gchar *pids )
+{
+  gboolean result;
+
+  result= rbi_programs_add( rbifilter->programs, context, pids );
+  GST_INFO_OBJECT(rbifilter, "add-program %p pids '%s': %d", context, pids, result);
+
+  return result;
+}
+
+static gboolean
+gst_rbifilter_remove_program( GstRBIFilter *rbifilter, gpointer context )
+{
+  gboolean result;
+
+  result= rbi_programs_remove( rbifilter->programs, context );
+  GST_INFO_OBJECT(rbifilter, "remove-program %p: %d", context, result);
+
+  return result;
+}
+
+/*
+ * Passes what rbi-context passed on to the program contexts, which replace
+ * their packets in place
+ */
+static void
+gst_rbifilter_process_programs( GstRBIFilter *rbifilter, unsigned char *packets, int len )
+{
+  rbi_programs_process( rbifilter->programs,
+                        (RbiProgramInCB)rbifilter->rbiPacketInCallback,
+                        (RbiProgramOutSizeCB)rbifilter->rbiPacketOutSizeCallback,
+                        (RbiProgramOutDataCB)rbifilter->rbiPacketOutDataCallback,
+                        packets, len );
+}
+
+/* Runs the packet in callback over a pending buffer. Returns the buffer to
+ * push, or NULL when the RBI processor consumed it */
+static GstBuffer*
+gst_rbifilter_process_buffer( GstRBIFilter *rbifilter, GstBuffer *buffer )
+{
+  gboolean pushBuffer;
+   
+  #ifdef USE_GST1
+  GstMapInfo map;
+  int size;
+  gboolean readOnly= FALSE;
+  gboolean programs= (rbi_programs_count( rbifilter->programs ) > 0);
+  guint64 start;
+
+  if ( rbifilter->scte35Pid >= 0 || rbifilter->scte35Parser ) {
+     gst_buffer_map (buffer, &map, GST_MAP_READ);
+     gst_rbifilter_scte35_push( rbifilter, map.data, map.size );
+     gst_buffer_unmap (buffer, &map);
+  }
+  
+  /*
+   * A shared buffer, e.g. behind a tee, would have to be copied before the
+   * packet input callback may touch it. If the RBI processor has a scan
+   * callback it is asked first; packets it does not need to rewrite are
+   * passed through a read only mapping and the input callback must then
+   * leave them unmodified. Program contexts always need a writable buffer.
+   */
+  if (FALSE == gst_buffer_is_writable (buffer))  {
+      if ( rbifilter->rbiPacketScanCallback && !programs ) {
+         gst_buffer_map (buffer, &map, GST_MAP_READ);
+         readOnly= !((packetScanCB)rbifilter->rbiPacketScanCallback)( rbifilter->rbiContext, map.data, map.size );
+         if ( !readOnly ) {
+            gst_buffer_unmap (buffer, &map);
+         }
+      }
+      if ( readOnly ) {
+         ++rbifilter->bufferCopiesAvoided;
+      } else {
+         /*Ensure buffer writable before passing it*/      
+         buffer = gst_buffer_make_writable (buffer);
+         ++rbifilter->bufferCopies;
+      }
+  }
+  if ( !readOnly ) {
+     gst_buffer_map (buffer, &map, (GstMapFlags)GST_MAP_READWRITE);
+  }
+  
+  size= map.size;
+  start= gst_rbifilter_now();
+  pushBuffer= ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, map.data, &size );
+  gst_rbifilter_count_packet_in( rbifilter, map.data, map.size, pushBuffer ? size : 0, start );
+  if ( pushBuffer && programs ) {
+     gst_rbifilter_process_programs( rbifilter, map.data, size );
+  }
+  gst_buffer_unmap (buffer, &map);
+  
+  if ( pushBuffer && (size != map.size) )
+  {
+     if ( readOnly ) {
+        GST_WARNING_OBJECT(rbifilter, "packet input callback resized a buffer the scan found nothing to rewrite in");
+        buffer = gst_buffer_make_writable (buffer);
+        ++rbifilter->bufferCopies;
+     }
+     gst_buffer_set_size( buffer, size );
+  }
+  #else
+  unsigned char *data;
+  int size, originalSize;
+  guint64 start;
+  data = GST_BUFFER_DATA(buffer);
+  originalSize = size = GST_BUFFER_SIZE(buffer);
+
+  if ( rbifilter->scte35Pid >= 0 || rbifilter->scte35Parser ) {
+     gst_rbifilter_scte35_push( rbifilter, data, size );
+  }
+  
+  start= gst_rbifilter_now();
+  pushBuffer= ((packetInCB)rbifilter->rbiPacketInCallback)( rbifilter->rbiContext, data, &size );
+  gst_rbifilter_count_packet_in( rbifilter, data, originalSize, pushBuffer ? size : 0, start );
+  if ( pushBuffer && rbi_programs_count( rbifilter->programs ) ) {
+     gst_rbifilter_process_programs( rbifilter, data, size );
+  }
+  
+  if ( size != originalSize )
+  {
+     GST_BUFFER_SIZE(buffer)= size;
+  }
+  #endif
+  
+  if ( !pushBuffer ) {
+     gst_buffer_unref( buffer );
+     buffer= NULL;
+  }
+
+  return buffer;
+}
+
+#ifdef USE_GST1
+static void
+gst_rbifilter_release_pool( GstRBIFilter *rbifilter )
+{
+  if ( rbifilter->outPool ) {
+     gst_buffer_pool_set_active( rbifilter->outPool, FALSE );
+     gst_object_unref( rbifilter->outPool );
+     rbifilter->outPool= NULL;
+     rbifilter->outPoolSize= 0;
+     rbifilter->outPoolPrivate= FALSE;
+  }
+}
+
+/*
+ * Ad breaks run at full bitrate, so inserted packets are put into buffers
+ * from a pool rather than a fresh allocation each. The pool downstream
+ * offers in the ALLOCATION query is used if its buffers are big enough,
+ * otherwise a private pool sized to the output is created, using the
+ * allocator downstream asked for. A private pool is recreated when the
+ * output grows beyond its buffer size. Called from the task only
+ */
+static void
+gst_rbifilter_setup_pool( GstRBIFilter *rbifilter, int size )
+{
+  GstCaps *caps;
+  GstQuery *query;
+  GstBufferPool *pool= NULL;
+  GstAllocator *allocator= NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  guint poolSize= 0, minBuffers= OUT_POOL_MIN_BUFFERS, maxBuffers= 0;
+
+  gst_rbifilter_release_pool( rbifilter );
+
+  gst_allocation_params_init( &params );
+  caps= gst_pad_get_current_caps( rbifilter->srcpad );
+  query= gst_query_new_allocation( caps, TRUE );
+  if ( gst_pad_peer_query( rbifilter->srcpad, query ) ) {
+     if ( gst_query_get_n_allocation_pools( query ) > 0 ) {
+        gst_query_parse_nth_allocation_pool( query, 0, &pool, &poolSize, &minBuffers, &maxBuffers );
+        if ( pool && (poolSize < (guint)size) ) {
+           gst_object_unref( pool );
+           pool= NULL;
+        }
+     }
+     if ( gst_query_get_n_allocation_params( query ) > 0 ) {
+        gst_query_parse_nth_allocation_param( query, 0, &allocator, &params );
+     }
+  }
+  gst_query_unref( query );
+
+  rbifilter->outPoolPrivate= (pool == NULL);
+  if ( !pool ) {
+     pool= gst_buffer_pool_new();
+     poolSize= size;
+     minBuffers= OUT_POOL_MIN_BUFFERS;
+     maxBuffers= 0;
+  }
+
+  config= gst_buffer_pool_get_config( pool );
+  gst_buffer_pool_config_set_params( config, caps, poolSize, minBuffers, maxBuffers );
+  gst_buffer_pool_config_set_allocator( config, allocator, &params );
+  if ( gst_buffer_pool_set_config( pool, config ) && gst_buffer_pool_set_active( pool, TRUE ) ) {
+     GST_DEBUG_OBJECT(rbifilter, "output pool %s: buffer size %u min %u max %u",
+                      rbifilter->outPoolPrivate ? "private" : "downstream", poolSize, minBuffers, maxBuffers );
+     rbifilter->outPool= pool;
+     rbifilter->outPoolSize= poolSize;
+  } else {
+     GST_WARNING_OBJECT(rbifilter, "unable to activate output pool, allocating output buffers");
+     gst_object_unref( pool );
+  }
+
+  if ( allocator ) {
+     gst_object_unref( allocator );
+  }
+  if ( caps ) {
+     gst_caps_unref( caps );
+  }
+}
+
+static GstBuffer*
+gst_rbifilter_alloc_output( GstRBIFilter *rbifilter, int size )
+{
+  GstBuffer *buffer= NULL;
+
+  if ( !rbifilter->outPool || (rbifilter->outPoolPrivate && (rbifilter->outPoolSize < (guint)size)) ) {
+     gst_rbifilter_setup_pool( rbifilter, size );
+  }
+  if ( rbifilter->outPool && (rbifilter->outPoolSize >= (guint)size) &&
+       (gst_buffer_pool_acquire_buffer( rbifilter->outPool, &buffer, NULL ) == GST_FLOW_OK) ) {
+     ++rbifilter->outPoolBuffers;
+     gst_buffer_set_size( buffer, size );
+  } else {
+     ++rbifilter->outPoolFallbacks;
+     buffer= gst_buffer_new_allocate( 0,  // default allocator
+                                      size,
+                                      0 ); // no GstAllocationParams
+  }
+
+  return buffer;
+}
+#endif
+
+/*
+ * Packets the RBI processor takes from the staging cache are pushed
+ * without copying: the buffer wraps the staged block and holds the
+ * segment reference the callback passed on
+ */
+static GstBuffer*
+gst_rbifilter_staged_buffer( GstRBIFilter *rbifilter )
+{
+  GstBuffer *buffer= NULL;
+  const unsigned char *packets= NULL;
+  AdStagingSegment *segment= NULL;
+  int size;
+
+  size= ((packetOutStagedCB)rbifilter->rbiPacketOutStagedCallback)( rbifilter->rbiContext, &packets, &segment );
+  if ( (size > 0) && packets && segment ) {
+     #ifdef USE_GST1
+     buffer= gst_buffer_new_wrapped_full( GST_MEMORY_FLAG_READONLY, (gpointer)packets, size, 0, size,
+                                          segment, (GDestroyNotify)ad_staging_segment_unref );
+     #else
+     /* 0.10 buffers can't hold a reference to the block, copy */
+     buffer= gst_buffer_new_and_alloc( size );
+     if ( buffer ) {
+        memcpy( GST_BUFFER_DATA(buffer), packets, size );
+     }
+     ad_staging_segment_unref( segment );
+     #endif
+  } else if ( segment ) {
+     ad_staging_segment_unref( segment );
+  }
+
+  return buffer;
+}
+
+/* Fetches the next block of inserted packets from the RBI processor.
+ * Returns NULL when it has none */
+static GstBuffer*
+gst_rbifilter_output_buffer( GstRBIFilter *rbifilter )
+{
+  GstBuffer *buffer= NULL;
+  int size= 0;
+  guint64 start, duration;
+
+  start= gst_rbifilter_now();
+
+  if ( rbifilter->rbiPacketOutStagedCallback ) {
+     buffer= gst_rbifilter_staged_buffer( rbifilter );
+  }
+
+  if ( !buffer ) {
+     size = ((packetOutSizeCB)rbifilter->rbiPacketOutSizeCallback)( rbifilter->rbiContext );
+  }
+  if ( size > 0 ) {
+    
+    #ifdef USE_GST1
+    buffer= gst_rbifilter_alloc_output( rbifilter, size );
+    #else
+    buffer= gst_buffer_new_and_alloc( size );
+    #endif
+  
+    if ( buffer ) {
+      
+      #ifdef USE_GST1
+      GstMapInfo map;
+    
+      gst_buffer_map (buffer, &map, (GstMapFlags)GST_MAP_READWRITE);
+    
+      size= ((packetOutDataCB)rbifilter->rbiPacketOutDataCallback)( rbifilter->rbiContext, map.data, map.size );
+    
+      gst_buffer_unmap (buffer, &map);
+      
+      if ( size && (size != map.size) )
+      {
+         gst_buffer_set_size( buffer, size );
       }
+      #else
+      unsigned char *data;
+      data = GST_BUFFER_DATA(buffer);
+
+      size= ((packetOutDataCB)rbifilter->rbiPacketOutDataCallback)( rbifilter->rbiContext, data, size );
+      
+      if ( size != (int)GST_BUFFER_SIZE(buffer) )
+      {
+         GST_BUFFER_SIZE(buffer)= size;
+      }
+      #endif
+
+      if ( !size ) {
+         gst_buffer_unref( buffer );
+         buffer= NULL;
+      }
+      
+    } else {
+      GST_ERROR_OBJECT(rbifilter, "unable to alloc output gst buffer");
     }
+  }
 
-    switch( type ) {
-       case pendingItem_Event:
-          if ( event ) {
-             gst_pad_push_event( rbifilter->srcpad, event );
-          }
+  duration= gst_rbifilter_now() - start;
+  gst_rbifilter_timing_add( &rbifilter->packetOutTime, duration );
+  if ( rbifilter->insertion.active ) {
+     gst_rbifilter_timing_add( &rbifilter->insertion.packetOut, duration );
+     if ( buffer ) {
+        #ifdef USE_GST1
+        rbifilter->insertion.bytesInserted += gst_buffer_get_size( buffer );
+        #else
+        rbifilter->insertion.bytesInserted += GST_BUFFER_SIZE( buffer );
+        #endif
+     }
+  }
+
+  if ( buffer && rbifilter->spliceInStart ) {
+     rbifilter->spliceInLatency= (g_get_monotonic_time() - rbifilter->spliceInStart) * GST_USECOND;
+     rbifilter->spliceInStart= 0;
+     GST_INFO_OBJECT(rbifilter, "splice-in latency %" GST_TIME_FORMAT, GST_TIME_ARGS(rbifilter->spliceInLatency));
+  }
+
+  return buffer;
+}
+
+/*
+ * Linear TV without an insertion does not need the task: when nothing is
+ * queued, the task is idle and the RBI processor reports no insertion, the
+ * buffer is processed and pushed from the chain thread. Only one thread
+ * calls into the RBI processor at a time, chainProcessing and
+ * taskProcessing hand it over under lockItems. Once the processor reports
+ * an insertion the task is woken and further buffers are queued.
+ * Sets *handled to FALSE when the buffer has to take the queued path
+ */
+static GstFlowReturn
+gst_rbifilter_fast_path( GstRBIFilter *rbifilter, GstBuffer *buffer, gboolean *handled )
+{
+  GstFlowReturn ret= GST_FLOW_OK;
+  gboolean inserting;
+
+  *handled= FALSE;
+
+  gst_rbifilter_lockItems( rbifilter );
+  if ( !rbifilter->passthroughFastPath || !rbifilter->playing || rbifilter->flushing ||
+       rbifilter->inserting || rbifilter->spliceArmed || rbifilter->pendingCount || rbifilter->taskProcessing ||
+       (rbifilter->srcRet != GST_FLOW_OK) ) {
+     gst_rbifilter_unlockItems( rbifilter );
+     return ret;
+  }
+  rbifilter->chainProcessing= TRUE;
+  gst_rbifilter_unlockItems( rbifilter );
+
+  inserting= gst_rbifilter_probe( rbifilter );
+  if ( !inserting ) {
+     *handled= TRUE;
+     buffer= gst_rbifilter_process_buffer( rbifilter, buffer );
+     if ( buffer ) {
+        ret= gst_pad_push( rbifilter->srcpad, buffer );
+     } else {
+        /* consumed: the splice starts here, the task produces the output */
+        inserting= gst_rbifilter_reprobe( rbifilter );
+     }
+  }
+
+  gst_rbifilter_lockItems( rbifilter );
+  rbifilter->chainProcessing= FALSE;
+  gst_rbifilter_set_inserting( rbifilter, inserting );
+  if ( ret != GST_FLOW_OK ) {
+     GST_ERROR_OBJECT(rbifilter, "error pushing buffer: %d", ret);
+     rbifilter->srcRet= ret;
+  }
+  gst_rbifilter_signalNotEmpty( rbifilter );
+  gst_rbifilter_unlockItems( rbifilter );
+
+  gst_rbifilter_post_insertion( rbifilter );
+
+  return ret;
+}
+
+static void
+gst_rbifilter_loop( GstPad * pad )
+{
+  GstFlowReturn ret= GST_FLOW_OK;
+  GstRBIFilter *rbifilter;
+  rbifilter = GST_RBIFILTER (gst_pad_get_parent (pad));
+
+  if ( rbifilter->rbiContext ) {
+    gpointer data= NULL;
+    GstEvent *event= NULL;
+    GstBuffer *batch[RBI_BATCH_MAX];
+    GstBuffer *buffer;
+    int count= 0, out= 0, i;
+    guint64 now;
+    gboolean inserting;
+
+    /* take the RBI processor over from the chain fast path */
+    gst_rbifilter_lockItems( rbifilter );
+    while( rbifilter->chainProcessing && rbifilter->playing )
+    {
+       gst_rbifilter_waitNotEmpty( rbifilter );
+    }
+    rbifilter->taskProcessing= TRUE;
+    gst_rbifilter_unlockItems( rbifilter );
+
+    inserting= gst_rbifilter_probe( rbifilter );
+
+    gst_rbifilter_lockItems( rbifilter );
+    gst_rbifilter_set_inserting( rbifilter, inserting );
+
+    /*
+     * Wait while there is no input and no output to expect: not inserting,
+     * or inserting but the last attempt produced nothing and the RBI
+     * processor has not signalled output-ready since. Without
+     * notifications the processor is asked again after RBI_IDLE_POLL_US
+     * rather than in a busy loop
+     */
+    while( rbifilter->playing && !rbifilter->pendingCount &&
+           (!rbifilter->inserting || (rbifilter->outputIdle && !rbifilter->outputReady)) )
+    {
+       gboolean poll= rbifilter->inserting && !rbifilter->eventDriven;
+
+       /* idle: the chain thread may use the fast path meanwhile */
+       rbifilter->taskProcessing= FALSE;
+       if ( poll ) {
+          gst_rbifilter_waitNotEmptyTimed( rbifilter, RBI_IDLE_POLL_US );
+       } else {
+          gst_rbifilter_waitNotEmpty( rbifilter );
+       }
+       while( rbifilter->chainProcessing && rbifilter->playing )
+       {
+          gst_rbifilter_waitNotEmpty( rbifilter );
+       }
+       rbifilter->taskProcessing= TRUE;
+       if ( rbifilter->eventDriven ) {
+          gst_rbifilter_set_inserting( rbifilter, g_atomic_int_get( &rbifilter->notifiedInserting ) );
+       }
+       if ( poll ) {
           break;
-       case pendingItem_Buffer:
-          if ( buffer ) {    
-            ret = gst_pad_push( rbifilter->srcpad, buffer );
-            if ( ret != GST_FLOW_OK ) {
-              GST_ERROR_OBJECT(rbifilter, "error pushing buffer: %d: pausing task", ret);
-              
-              rbifilter->srcRet = ret;
-              
-              gst_task_pause( GST_PAD_TASK(pad) );
-            }                
+       }
+    }
+    rbifilter->outputReady= FALSE;
+
+    if ( rbifilter->insertion.active && (rbifilter->pendingCount > rbifilter->insertion.maxQueueDepth) ) {
+       rbifilter->insertion.maxQueueDepth= rbifilter->pendingCount;
+    }
+
+    /*
+     * Take the run of buffers at the head of the queue in one go. An event
+     * ends the run and is handled on its own so that ordering is kept
+     */
+    now= gst_rbifilter_now();
+    while( rbifilter->pendingCount && count < RBI_BATCH_MAX )
+    {
+       GstRBIFilterItem *item= &rbifilter->pendingItems[rbifilter->pendingHead];
+
+       if ( item->type == pendingItem_Event ) {
+          if ( !count ) {
+             gst_rbifilter_popItem( rbifilter, &data );
+             event= (GstEvent*)data;
           }
           break;
-       case pendingItem_None:
-       default:
-          break;
+       }
+       gst_rbifilter_timing_add( &rbifilter->queueTime, now - item->time );
+       if ( rbifilter->insertion.active ) {
+          gst_rbifilter_timing_add( &rbifilter->insertion.queueTime, now - item->time );
+       }
+       if ( gst_rbifilter_popItem( rbifilter, &data ) == pendingItem_Buffer ) {
+          batch[count++]= (GstBuffer*)data;
+       }
+    }
+
+    gst_rbifilter_unlockItems( rbifilter );
+
+    if ( event ) {
+       gst_pad_push_event( rbifilter->srcpad, event );
+       gst_rbifilter_lockItems( rbifilter );
+       rbifilter->taskProcessing= FALSE;
+       gst_rbifilter_unlockItems( rbifilter );
+       gst_rbifilter_post_insertion( rbifilter );
+       gst_object_unref (rbifilter);
+       return;
+    }
+
+    /*
+     * Results are written back into batch: each pending buffer either passes
+     * or, when consumed by an insertion, makes room for a block of inserted
+     * packets. Without pending buffers an insertion still produces output
+     */
+    for( i= 0; i < count; ++i )
+    {
+       buffer= gst_rbifilter_process_buffer( rbifilter, batch[i] );
+       if ( !buffer && !rbifilter->inserting ) {
+          /* the insertion may have started within this batch */
+          inserting= gst_rbifilter_reprobe( rbifilter );
+          gst_rbifilter_lockItems( rbifilter );
+          gst_rbifilter_set_inserting( rbifilter, inserting );
+          gst_rbifilter_unlockItems( rbifilter );
+       }
+       if ( !buffer && rbifilter->inserting ) {
+          buffer= gst_rbifilter_output_buffer( rbifilter );
+       }
+       if ( buffer ) {
+          batch[out++]= buffer;
+       }
     }
+    if ( !count && rbifilter->inserting ) {
+       buffer= gst_rbifilter_output_buffer( rbifilter );
+       if ( buffer ) {
+          batch[out++]= buffer;
+       }
+    }
+    rbifilter->outputIdle= rbifilter->inserting && !out;
+
+    if ( out == 1 ) {
+       ret = gst_pad_push( rbifilter->srcpad, batch[0] );
+    } else if ( out > 1 ) {
+       #ifdef USE_GST1
+       GstBufferList *list= gst_buffer_list_new_sized( out );
+       for( i= 0; i < out; ++i ) {
+          gst_buffer_list_add( list, batch[i] );
+       }
+       ret = gst_pad_push_list( rbifilter->srcpad, list );
+       #else
+       for( i= 0; i < out; ++i ) {
+          if ( ret == GST_FLOW_OK ) {
+             ret = gst_pad_push( rbifilter->srcpad, batch[i] );
+          } else {
+             gst_buffer_unref( batch[i] );
+          }
+       }
+       #endif
+    }
+
+    gst_rbifilter_lockItems( rbifilter );
+    rbifilter->taskProcessing= FALSE;
+    if ( ret != GST_FLOW_OK ) {
+      GST_ERROR_OBJECT(rbifilter, "error pushing buffer: %d: pausing task", ret);
+      
+      rbifilter->srcRet = ret;
+      gst_rbifilter_signalNotFull( rbifilter );
+    }
+    gst_rbifilter_unlockItems( rbifilter );
+
+    gst_rbifilter_post_insertion( rbifilter );
+
+    if ( ret != GST_FLOW_OK ) {
+      gst_task_pause( GST_PAD_TASK(pad) );
+    }                
   }  
 
 
@@ -37,6 +37,31 @@
   *  - rbi-packet-out-size-callback -  RBI packet output size callback.
   *  - rbi-packet-out-data-callback -  RBI packet output data callback.
   *  - rbi-context - Context to pass to RBI packet processor.
+  *  - max-size-buffers - Max. number of buffers waiting for the task (0=disable).
+  *  - max-size-bytes - Max. amount of data waiting for the task (0=disable).
+  *  - max-size-time - Max. amount of data waiting for the task in ns (0=disable).
+  *  - current-level-buffers - Number of buffers waiting for the task.
+  *  - current-level-bytes - Amount of data waiting for the task.
+  *  - passthrough-fast-path - Skip the queue and task while no insertion is pending or active.
+  *  - rbi-packet-scan-callback - Optional read only scan telling whether packets need rewriting.
+  *  - buffer-copies - Shared input buffers copied to make them writable.
+  *  - buffer-copies-avoided - Shared input buffers passed read only after the scan.
+  *  - out-pool-buffers - Inserted packet buffers taken from the output buffer pool.
+  *  - out-pool-fallbacks - Inserted packet buffers allocated outside the pool.
+  *  - scte35-pid - PID carrying SCTE-35 splice_info_sections to parse (-1=disable).
+  *  - splice-preroll - Time before a signalled splice at which insertion is armed.
+  *  - scte35-sections - SCTE-35 sections parsed.
+  *  - scte35-crc-errors - SCTE-35 sections dropped for a bad CRC.
+  *  - rbi-packet-out-staged-callback - Optional output callback handing out staged packets without copying.
+  *  - ad-segment-uris - Upcoming ad segments to prefetch into the staging cache.
+  *  - staging-budget - Max. memory for staged ad segments.
+  *  - ad-staging - Staging cache for the RBI packet processor.
+  *  - staging-bytes - Memory held by staged ad segments.
+  *  - staging-underruns - Reads of ad segment data not staged yet.
+  *  - splice-in-latency - Start of the last insertion to its first output buffer.
+  *  - event-driven - The RBI processor emits insertion-state and output-ready instead of being probed.
+  *  - stats - Splice accuracy, replaced and inserted data, queue depth, queueing time and callback time histograms.
+  *  - program-underruns - Packets of inserting program contexts filled with null packets.
   *  @ingroup  GST_PLUGINS
  **/
 
@@ -55,6 +80,10 @@
 #include <glib.h>
 #include <gst/gst.h>
 
+#include "scte35parser.h"
+#include "adstaging.h"
+#include "rbiprograms.h"
+
 G_BEGIN_DECLS
 
 /**
@@ -74,6 +103,46 @@ G_BEGIN_DECLS
 
 typedef struct _GstRBIFilter GstRBIFilter;
 typedef struct _GstRBIFilterClass GstRBIFilterClass;
+typedef struct _GstRBIFilterItem GstRBIFilterItem;
+
+/* Log2 histogram buckets of GstRBIFilterTiming, bucket n holds [2^(n-1), 2^n) ns */
+#define RBI_TIMING_BUCKETS (32)
+
+/**
+ * GstRBIFilterTiming:
+ *
+ * Distribution of a duration in ns
+*/
+typedef struct _GstRBIFilterTiming
+{
+   guint64 count;                             /**< Durations recorded */
+   guint64 total;                             /**< Sum of the durations */
+   guint64 max;                               /**< Longest duration */
+   guint64 hist[RBI_TIMING_BUCKETS];          /**< Log2 histogram of the durations */
+} GstRBIFilterTiming;
+
+/**
+ * GstRBIFilterInsertion:
+ *
+ * Figures of one insertion, from the first input buffer it replaced or
+ * its start, whichever comes first, to its end
+*/
+typedef struct _GstRBIFilterInsertion
+{
+   gboolean active;                           /**< An insertion is being recorded */
+   gint64 startTime;                          /**< Monotonic time in us the record started */
+   gboolean hasTriggerPts;                    /**< triggerPts is valid */
+   guint64 triggerPts;                        /**< Splice time signalled for the insertion, 90kHz */
+   gboolean hasFirstPts;                      /**< firstPts is valid */
+   guint64 firstPts;                          /**< PTS of the first replaced input, 90kHz */
+   guint64 packetsReplaced;                   /**< Input packets consumed or dropped by the RBI processor */
+   guint64 bytesReplaced;                     /**< Input bytes consumed or dropped by the RBI processor */
+   guint64 bytesInserted;                     /**< Bytes of inserted packets pushed */
+   guint maxQueueDepth;                       /**< Most items pending for the task */
+   GstRBIFilterTiming queueTime;              /**< Time buffers spent pending */
+   GstRBIFilterTiming packetIn;               /**< Packet input callback execution time */
+   GstRBIFilterTiming packetOut;              /**< Packet output callbacks execution time */
+} GstRBIFilterInsertion;
 
 /**
  * GstRBIFilter:
@@ -88,12 +157,76 @@ struct _GstRBIFilter {
   
   #ifdef GLIB_VERSION_2_32 
   GCond condNotEmpty;                         /**< Gcond structure that represents the condition */
+  GCond condNotFull;                          /**< Signalled when the task took items off a full queue */
   GMutex lockItems;                           /**< Mutex variable */
   #else
   GCond *condNotEmpty;                        /**< Gcond structure that represents the condition */ 
+  GCond *condNotFull;                         /**< Signalled when the task took items off a full queue */
   GMutex *lockItems;                          /**< Mutex variable */
   #endif
-  GList *pendingItems;                        /**< Doubly Linked list */
+  GstRBIFilterItem *pendingItems;             /**< Ring of events and buffers waiting for the task */
+  guint pendingCapacity;                      /**< Size of the pendingItems ring, grows on demand */
+  guint pendingHead;                          /**< Index of the oldest pending item */
+  guint pendingCount;                         /**< Number of pending items */
+  guint pendingBuffers;                       /**< Number of pending buffers */
+  guint64 pendingBytes;                       /**< Size of the pending buffers */
+  GstClockTime pendingTimeIn;                 /**< Timestamp of the last buffer queued */
+  GstClockTime pendingTimeOut;                /**< Timestamp of the last buffer taken by the task */
+  guint maxSizeBuffers;                       /**< Chain blocks at this many pending buffers, 0 disables */
+  guint maxSizeBytes;                         /**< Chain blocks at this many pending bytes, 0 disables */
+  guint64 maxSizeTime;                        /**< Chain blocks at this much pending time, 0 disables */
+  gboolean flushing;                          /**< Between flush start and stop, chain drops buffers */
+  gboolean passthroughFastPath;               /**< Process in the chain thread while not inserting */
+  gboolean chainProcessing;                   /**< The chain thread is inside the RBI processor */
+  gboolean taskProcessing;                    /**< The task is inside the RBI processor */
+  guint64 bufferCopies;                       /**< Shared input buffers copied to make them writable */
+  guint64 bufferCopiesAvoided;                /**< Shared input buffers passed read only after the scan */
+  #ifdef USE_GST1
+  GstBufferPool *outPool;                     /**< Pool for inserted packet buffers, set up by the task */
+  #else
+  void *outPool;                              /**< Unused with gstreamer 0.10 */
+  #endif
+  guint outPoolSize;                          /**< Buffer size of outPool */
+  gboolean outPoolPrivate;                    /**< outPool was created here, not offered by downstream */
+  guint64 outPoolBuffers;                     /**< Output buffers taken from outPool */
+  guint64 outPoolFallbacks;                   /**< Output buffers allocated outside outPool */
+  int scte35Pid;                              /**< PID carrying SCTE-35 sections, -1 disables the parser */
+  guint64 splicePreroll;                      /**< Arm a signalled splice this long (ns) ahead of its time */
+  Scte35Parser *scte35Parser;                 /**< Owned by whichever thread is inside the RBI processor */
+  guint64 scte35Sections;                     /**< SCTE-35 sections parsed */
+  guint64 scte35CrcErrors;                    /**< SCTE-35 sections dropped for a bad CRC */
+  gboolean splicePending;                     /**< A splice was signalled, waiting for its pre-roll */
+  gboolean spliceArmed;                       /**< A signalled splice is near or running: probe the RBI processor */
+  gboolean spliceStarted;                     /**< The armed splice saw the insertion start */
+  guint32 spliceEventId;                      /**< splice_event_id of the pending or armed splice */
+  gboolean spliceHasPts;                      /**< splicePts is valid */
+  guint64 splicePts;                          /**< Splice time of the pending splice, 90kHz */
+  guint64 spliceDuration;                     /**< Break duration of the pending splice, 90kHz, 0 if unknown */
+  gboolean spliceEndValid;                    /**< spliceEnd is valid */
+  guint64 spliceEnd;                          /**< Stream time an armed splice without insertion is given up, 90kHz */
+  gchar *adSegmentUris;                       /**< Upcoming ad segments to prefetch */
+  AdStaging *adStaging;                       /**< Staging cache filled by the prefetch thread */
+  guint64 stagingBudget;                      /**< Max. memory for adStaging */
+  gint64 spliceInStart;                       /**< Monotonic time in us the current insertion started, 0 once output */
+  guint64 spliceInLatency;                    /**< Start of the last insertion to its first output buffer, ns */
+  gboolean eventDriven;                       /**< The RBI processor signals insertion-state and output-ready */
+  gint notifiedInserting;                     /**< Last insertion-state, atomic */
+  gboolean outputReady;                       /**< output-ready since the task last looked */
+  gboolean outputIdle;                        /**< The task's last attempt while inserting produced no output */
+  gboolean taskWaiting;                       /**< The task waits on condNotEmpty */
+  GstRBIFilterInsertion insertion;            /**< Record of the current insertion, owned by the thread inside the RBI processor */
+  guint insertions;                           /**< Insertions recorded, totals below are updated under lockItems */
+  guint64 totalPacketsReplaced;               /**< Input packets replaced by all insertions */
+  guint64 totalBytesReplaced;                 /**< Input bytes replaced by all insertions */
+  guint64 totalBytesInserted;                 /**< Bytes inserted by all insertions */
+  guint maxQueueDepth;                        /**< Most items pending for the task during an insertion */
+  gint64 lastSpliceError;                     /**< First replaced PTS minus trigger PTS of the last insertion, ns */
+  guint64 maxSpliceError;                     /**< Largest absolute splice error, ns */
+  GstRBIFilterTiming queueTime;               /**< Time buffers spent pending, all buffers, under lockItems */
+  GstRBIFilterTiming packetInTime;            /**< Packet input callback execution time, all calls */
+  GstRBIFilterTiming packetOutTime;           /**< Packet output callbacks execution time, all calls */
+  GstStructure *insertionMessage;             /**< Record of a finished insertion waiting to be posted */
+  RbiPrograms *programs;                      /**< Program contexts inserting independently on their PIDs */
   gboolean inserting;                         /**< Boolean flag indicates ad is inserted or not */
   gboolean playing;                           /**< Ad is playing or not */
   GstFlowReturn srcRet;                       /**< Result of passing data to a pad */ 
@@ -102,10 +235,18 @@ struct _GstRBIFilter {
   void *rbiPacketInCallback;                   /**< RBI packet input callback of form gboolean (*cb)( void *ctx, unsigned char* packet													s, int* len )*/
   void *rbiPacketOutSizeCallback;              /**< RBI packet output size callback of form int (*cb)( void *ctx ) */
   void *rbiPacketOutDataCallback;              /**< RBI packet output data callback of form int (*cb)( void *ctx, unsigned char* packe													ts, int len ) */
+  void *rbiPacketScanCallback;                 /**< Optional RBI packet scan callback of form gboolean (*cb)( void *ctx, const unsigned char* packets, int len ) */
+  void *rbiPacketOutStagedCallback;           /**< Optional RBI packet output callback of form int (*cb)( void *ctx, const unsigned char** packets, AdStagingSegment** segment ) */
 };
 
 struct _GstRBIFilterClass {
   GstElementClass parent_class;
+
+  /* actions */
+  void (*insertion_state) (GstRBIFilter *filter, gboolean inserting);
+  void (*output_ready) (GstRBIFilter *filter);
+  gboolean (*add_program) (GstRBIFilter *filter, gpointer context, const gchar *pids);
+  gboolean (*remove_program) (GstRBIFilter *filter, gpointer context);
 };
 
 G_GNUC_INTERNAL GType gst_rbifilter_get_type (void); /**< GType element used with gst_element_register() 
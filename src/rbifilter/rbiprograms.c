@@ -0,0 +1,417 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rbiprograms.h"
+#include "scte35parser.h"
+
+#define TS_PACKET_SIZE (188)
+#define TS_SYNC_BYTE (0x47)
+#define TS_PID_COUNT (8192)
+#define TS_PID_NULL (0x1FFF)
+
+typedef struct _RbiProgram
+{
+   void *ctx;
+   guint16 *pids;
+   int pidCount;
+   gboolean inserting;
+   int *slots;
+   int slotCount;
+   int slotCapacity;
+   unsigned char *gather;
+   int gatherCapacity;
+   GByteArray *carry;
+} RbiProgram;
+
+struct _RbiPrograms
+{
+   #ifdef GLIB_VERSION_2_32
+   GMutex lock;
+   #else
+   GMutex *lock;
+   #endif
+   RbiProgram *programs[RBI_PROGRAMS_MAX];
+   gint count;
+   guint inserting;
+   guint64 underruns;
+   /* program index + 1 of each PID, 0 for PIDs no program owns */
+   guint8 pidMap[TS_PID_COUNT];
+};
+
+static void rbi_programs_lock( RbiPrograms *programs )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_lock( &programs->lock );
+   #else
+   g_mutex_lock( programs->lock );
+   #endif
+}
+
+static void rbi_programs_unlock( RbiPrograms *programs )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_mutex_unlock( &programs->lock );
+   #else
+   g_mutex_unlock( programs->lock );
+   #endif
+}
+
+static void rbi_program_free( RbiProgram *program )
+{
+   g_free( program->pids );
+   g_free( program->slots );
+   g_free( program->gather );
+   g_byte_array_free( program->carry, TRUE );
+   g_free( program );
+}
+
+static void rbi_programs_map( RbiPrograms *programs )
+{
+   int i, j;
+
+   memset( programs->pidMap, 0, sizeof(programs->pidMap) );
+   for( i= 0; i < programs->count; ++i ) {
+      RbiProgram *program= programs->programs[i];
+
+      for( j= 0; j < program->pidCount; ++j ) {
+         if ( programs->pidMap[program->pids[j]] ) {
+            g_warning( "rbifilter: PID 0x%04X belongs to more than one program context", program->pids[j] );
+            continue;
+         }
+         programs->pidMap[program->pids[j]]= i + 1;
+      }
+   }
+}
+
+/* Hands out up to want bytes of inserted packets, fewer if the RBI processor has no more yet */
+static void rbi_program_fill( RbiProgram *program, RbiProgramOutSizeCB outSizeCB, RbiProgramOutDataCB outDataCB, int want )
+{
+   while( (int)program->carry->len < want ) {
+      guint len= program->carry->len;
+      int size;
+
+      size= outSizeCB( program->ctx );
+      if ( size <= 0 ) {
+         break;
+      }
+      g_byte_array_set_size( program->carry, len + size );
+      size= outDataCB( program->ctx, program->carry->data + len, size );
+      g_byte_array_set_size( program->carry, len + MAX( size, 0 ) );
+      if ( size <= 0 ) {
+         break;
+      }
+   }
+}
+
+static void rbi_program_null_packet( unsigned char *packet )
+{
+   packet[0]= TS_SYNC_BYTE;
+   packet[1]= (TS_PID_NULL >> 8) & 0x1F;
+   packet[2]= TS_PID_NULL & 0xFF;
+   packet[3]= 0x10;
+   memset( packet + 4, 0xFF, TS_PACKET_SIZE - 4 );
+}
+
+/* Runs one context over its packets of the buffer and writes the result back into their slots */
+static void rbi_program_process( RbiPrograms *programs, RbiProgram *program,
+                                 RbiProgramInCB inCB, RbiProgramOutSizeCB outSizeCB, RbiProgramOutDataCB outDataCB,
+                                 unsigned char *packets, int packetSize )
+{
+   int offset= packetSize - TS_PACKET_SIZE;
+   int blockLen= program->slotCount * packetSize;
+   int len, avail, k;
+   const unsigned char *src;
+   gboolean pass;
+
+   if ( program->gatherCapacity < blockLen ) {
+      g_free( program->gather );
+      program->gather= (unsigned char*)g_malloc( blockLen );
+      program->gatherCapacity= blockLen;
+   }
+   for( k= 0; k < program->slotCount; ++k ) {
+      memcpy( program->gather + k * packetSize, packets + program->slots[k] * packetSize, packetSize );
+   }
+
+   len= blockLen;
+   pass= inCB( program->ctx, program->gather, &len );
+   if ( pass ) {
+      if ( program->inserting ) {
+         /* insertion over, inserted packets that did not fit are dropped */
+         program->inserting= FALSE;
+         --programs->inserting;
+         g_byte_array_set_size( program->carry, 0 );
+      }
+      src= program->gather;
+      avail= MIN( MAX( len, 0 ) / packetSize, program->slotCount );
+   } else {
+      if ( !program->inserting ) {
+         program->inserting= TRUE;
+         ++programs->inserting;
+      }
+      rbi_program_fill( program, outSizeCB, outDataCB, blockLen );
+      src= program->carry->data;
+      avail= MIN( (int)program->carry->len / packetSize, program->slotCount );
+   }
+
+   for( k= 0; k < program->slotCount; ++k ) {
+      unsigned char *slot= packets + program->slots[k] * packetSize;
+
+      if ( k >= avail ) {
+         /* keep a timestamp prefix, the slot stays in the multiplex */
+         rbi_program_null_packet( slot + offset );
+         if ( !pass ) {
+            ++programs->underruns;
+         }
+      } else if ( pass ) {
+         memcpy( slot, src + k * packetSize, packetSize );
+      } else {
+         /* inserted packets take the arrival timestamp of the slot they fill */
+         memcpy( slot + offset, src + k * packetSize + offset, TS_PACKET_SIZE );
+      }
+   }
+
+   if ( !pass && avail ) {
+      g_byte_array_remove_range( program->carry, 0, avail * packetSize );
+   }
+}
+
+RbiPrograms* rbi_programs_new( void )
+{
+   RbiPrograms *programs;
+
+   programs= (RbiPrograms*)g_malloc0( sizeof(RbiPrograms) );
+   if ( programs ) {
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_init( &programs->lock );
+      #else
+      programs->lock= g_mutex_new();
+      #endif
+   }
+
+   return programs;
+}
+
+void rbi_programs_free( RbiPrograms *programs )
+{
+   int i;
+
+   if ( programs ) {
+      for( i= 0; i < programs->count; ++i ) {
+         rbi_program_free( programs->programs[i] );
+      }
+      #ifdef GLIB_VERSION_2_32
+      g_mutex_clear( &programs->lock );
+      #else
+      g_mutex_free( programs->lock );
+      #endif
+      g_free( programs );
+   }
+}
+
+/* pids is a list of PIDs separated by commas or spaces, decimal or 0x hex */
+gboolean rbi_programs_add( RbiPrograms *programs, void *ctx, const gchar *pids )
+{
+   RbiProgram *program;
+   gchar **tokens;
+   gboolean result= FALSE;
+   int i, count;
+
+   if ( !ctx || !pids ) {
+      return FALSE;
+   }
+
+   tokens= g_strsplit_set( pids, ", ;", -1 );
+   count= g_strv_length( tokens );
+
+   program= (RbiProgram*)g_malloc0( sizeof(RbiProgram) );
+   program->ctx= ctx;
+   program->pids= g_new( guint16, MAX( count, 1 ) );
+   program->carry= g_byte_array_new();
+   for( i= 0; i < count; ++i ) {
+      char *end= NULL;
+      long pid;
+
+      if ( !tokens[i][0] ) {
+         continue;
+      }
+      pid= strtol( tokens[i], &end, 0 );
+      if ( !end || *end || (pid < 0) || (pid >= TS_PID_NULL) ) {
+         g_warning( "rbifilter: bad PID '%s' for program context %p", tokens[i], ctx );
+         continue;
+      }
+      program->pids[program->pidCount++]= (guint16)pid;
+   }
+   g_strfreev( tokens );
+
+   rbi_programs_lock( programs );
+   if ( program->pidCount && (programs->count < RBI_PROGRAMS_MAX) ) {
+      result= TRUE;
+      for( i= 0; i < programs->count; ++i ) {
+         if ( programs->programs[i]->ctx == ctx ) {
+            result= FALSE;
+            break;
+         }
+      }
+      if ( result ) {
+         programs->programs[programs->count]= program;
+         g_atomic_int_set( &programs->count, programs->count + 1 );
+         rbi_programs_map( programs );
+      }
+   }
+   rbi_programs_unlock( programs );
+
+   if ( !result ) {
+      rbi_program_free( program );
+   }
+
+   return result;
+}
+
+/* Once this returns the callbacks are no longer called with ctx */
+gboolean rbi_programs_remove( RbiPrograms *programs, void *ctx )
+{
+   gboolean result= FALSE;
+   int i;
+
+   rbi_programs_lock( programs );
+   for( i= 0; i < programs->count; ++i ) {
+      RbiProgram *program= programs->programs[i];
+
+      if ( program->ctx == ctx ) {
+         if ( program->inserting ) {
+            --programs->inserting;
+         }
+         rbi_program_free( program );
+         memmove( &programs->programs[i], &programs->programs[i+1], (programs->count - i - 1) * sizeof(RbiProgram*) );
+         g_atomic_int_set( &programs->count, programs->count - 1 );
+         rbi_programs_map( programs );
+         result= TRUE;
+         break;
+      }
+   }
+   rbi_programs_unlock( programs );
+
+   return result;
+}
+
+guint rbi_programs_count( RbiPrograms *programs )
+{
+   return g_atomic_int_get( &programs->count );
+}
+
+/* Ends all insertions, e.g. when the stream stops */
+void rbi_programs_reset( RbiPrograms *programs )
+{
+   int i;
+
+   rbi_programs_lock( programs );
+   for( i= 0; i < programs->count; ++i ) {
+      programs->programs[i]->inserting= FALSE;
+      g_byte_array_set_size( programs->programs[i]->carry, 0 );
+   }
+   programs->inserting= 0;
+   rbi_programs_unlock( programs );
+}
+
+void rbi_programs_process( RbiPrograms *programs,
+                           RbiProgramInCB inCB, RbiProgramOutSizeCB outSizeCB, RbiProgramOutDataCB outDataCB,
+                           unsigned char *packets, int len )
+{
+   int packetSize, offset, count, i;
+
+   rbi_programs_lock( programs );
+   if ( !programs->count || (len <= 0) ) {
+      rbi_programs_unlock( programs );
+      return;
+   }
+
+   packetSize= scte35_packet_size( packets, len );
+   offset= packetSize - TS_PACKET_SIZE;
+   count= len / packetSize;
+
+   for( i= 0; i < programs->count; ++i ) {
+      RbiProgram *program= programs->programs[i];
+
+      program->slotCount= 0;
+      if ( program->slotCapacity < count ) {
+         g_free( program->slots );
+         program->slots= g_new( int, count );
+         program->slotCapacity= count;
+      }
+   }
+
+   /* one pass routes every packet to the context owning its PID */
+   for( i= 0; i < count; ++i ) {
+      const unsigned char *packet= packets + i * packetSize + offset;
+      int index;
+
+      if ( packet[0] != TS_SYNC_BYTE ) {
+         continue;
+      }
+      index= programs->pidMap[((packet[1] & 0x1F) << 8) | packet[2]];
+      if ( index ) {
+         RbiProgram *program= programs->programs[index-1];
+         program->slots[program->slotCount++]= i;
+      }
+   }
+
+   for( i= 0; i < programs->count; ++i ) {
+      RbiProgram *program= programs->programs[i];
+
+      if ( program->slotCount ) {
+         rbi_program_process( programs, program, inCB, outSizeCB, outDataCB, packets, packetSize );
+      }
+   }
+   rbi_programs_unlock( programs );
+}
+
+guint rbi_programs_get_inserting( RbiPrograms *programs )
+{
+   guint inserting;
+
+   rbi_programs_lock( programs );
+   inserting= programs->inserting;
+   rbi_programs_unlock( programs );
+
+   return inserting;
+}
+
+guint64 rbi_programs_get_underruns( RbiPrograms *programs )
+{
+   guint64 underruns;
+
+   rbi_programs_lock( programs );
+   underruns= programs->underruns;
+   rbi_programs_unlock( programs );
+
+   return underruns;
+}
+
+/** @} */
+/** @} */
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+
+#ifndef __RMF_RBIPROGRAMS_H__
+#define __RMF_RBIPROGRAMS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+  *  @addtogroup RBI_FILTER
+  * @{
+ **/
+
+/* Most program contexts in one set */
+#define RBI_PROGRAMS_MAX (64)
+
+/* Same form as the rbifilter RBI packet callbacks */
+typedef gboolean (*RbiProgramInCB)( void *ctx, unsigned char *packets, int *len );
+typedef int (*RbiProgramOutSizeCB)( void *ctx );
+typedef int (*RbiProgramOutDataCB)( void *ctx, unsigned char *packets, int len );
+
+typedef struct _RbiPrograms RbiPrograms;
+
+/**
+ * Independent RBI contexts, each owning a set of PIDs of a multi program
+ * transport stream, e.g. the PIDs of one program. Each buffer is walked
+ * once to route its packets to the contexts; every context with packets
+ * in the buffer gets them gathered into one block for the packet input
+ * callback. A context passing them may rewrite or drop packets. A context
+ * consuming them is inserting: its packets are replaced by the packets its
+ * output callbacks hand out. Either way the result goes straight back into
+ * the slots the context's packets had, so the other programs and the
+ * multiplex timing are untouched. Slots left over are filled with null
+ * packets; inserted packets beyond the slots are kept for the next buffer.
+ * Contexts are added and removed from any thread but not from within the
+ * callbacks
+*/
+RbiPrograms* rbi_programs_new( void );
+void rbi_programs_free( RbiPrograms *programs );
+gboolean rbi_programs_add( RbiPrograms *programs, void *ctx, const gchar *pids );
+gboolean rbi_programs_remove( RbiPrograms *programs, void *ctx );
+guint rbi_programs_count( RbiPrograms *programs );
+void rbi_programs_reset( RbiPrograms *programs );
+void rbi_programs_process( RbiPrograms *programs,
+                           RbiProgramInCB inCB, RbiProgramOutSizeCB outSizeCB, RbiProgramOutDataCB outDataCB,
+                           unsigned char *packets, int len );
+
+/* Contexts currently inserting */
+guint rbi_programs_get_inserting( RbiPrograms *programs );
+
+/* Slots an inserting context had no packets for */
+guint64 rbi_programs_get_underruns( RbiPrograms *programs );
+
+/** @} */
+
+G_END_DECLS
+
+#endif /* __RMF_RBIPROGRAMS_H__ */
+
+/** @} */
+/** @} */
@@ -0,0 +1,360 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+#include <string.h>
+
+#include "scte35parser.h"
+#include "tspsi.h"
+#include "crc32mpeg.h"
+
+#define TS_PACKET_SIZE (188)
+#define TTS_PACKET_SIZE (192)
+#define TS_SYNC_BYTE (0x47)
+
+#define SCTE35_TABLE_ID (0xFC)
+
+struct _Scte35Parser
+{
+   int pid;
+   Scte35SpliceCB cb;
+   void *userData;
+   TsPsi *psi;
+   int pcrPid;
+   gboolean havePcr;
+   guint64 pcr;
+   guint64 sections;
+   guint64 crcErrors;
+};
+
+typedef struct _Scte35Bits
+{
+   const unsigned char *data;
+   int size;
+   int bitPos;
+   gboolean error;
+} Scte35Bits;
+
+static guint64 scte35_bits_read( Scte35Bits *bits, int count )
+{
+   guint64 value= 0;
+
+   if ( bits->bitPos + count > bits->size * 8 ) {
+      bits->error= TRUE;
+      return 0;
+   }
+   while( count-- > 0 ) {
+      value= (value << 1) | ((bits->data[bits->bitPos >> 3] >> (7 - (bits->bitPos & 7))) & 1);
+      ++bits->bitPos;
+   }
+
+   return value;
+}
+
+static void scte35_bits_skip( Scte35Bits *bits, int count )
+{
+   if ( bits->bitPos + count > bits->size * 8 ) {
+      bits->error= TRUE;
+      return;
+   }
+   bits->bitPos += count;
+}
+
+static void scte35_read_splice_time( Scte35Bits *bits, Scte35SpliceInfo *info )
+{
+   if ( scte35_bits_read( bits, 1 ) ) {
+      scte35_bits_skip( bits, 6 );
+      info->ptsTime= (scte35_bits_read( bits, 33 ) + info->ptsAdjustment) & SCTE35_PTS_MASK;
+      info->hasPts= TRUE;
+   } else {
+      scte35_bits_skip( bits, 7 );
+   }
+}
+
+static void scte35_read_splice_insert( Scte35Bits *bits, Scte35SpliceInfo *info )
+{
+   gboolean programSplice, durationFlag;
+   int componentCount, i;
+
+   info->eventId= (guint32)scte35_bits_read( bits, 32 );
+   info->cancel= (gboolean)scte35_bits_read( bits, 1 );
+   scte35_bits_skip( bits, 7 );
+   if ( info->cancel ) {
+      return;
+   }
+
+   info->outOfNetwork= (gboolean)scte35_bits_read( bits, 1 );
+   programSplice= (gboolean)scte35_bits_read( bits, 1 );
+   durationFlag= (gboolean)scte35_bits_read( bits, 1 );
+   info->immediate= (gboolean)scte35_bits_read( bits, 1 );
+   scte35_bits_skip( bits, 4 );
+
+   if ( programSplice ) {
+      if ( !info->immediate ) {
+         scte35_read_splice_time( bits, info );
+      }
+   } else {
+      /* component splice: the first component's time stands for the splice */
+      componentCount= (int)scte35_bits_read( bits, 8 );
+      for( i= 0; i < componentCount && !bits->error; ++i ) {
+         scte35_bits_skip( bits, 8 );
+         if ( !info->immediate ) {
+            if ( info->hasPts ) {
+               Scte35SpliceInfo ignored= *info;
+               scte35_read_splice_time( bits, &ignored );
+            } else {
+               scte35_read_splice_time( bits, info );
+            }
+         }
+      }
+   }
+
+   if ( durationFlag ) {
+      info->autoReturn= (gboolean)scte35_bits_read( bits, 1 );
+      scte35_bits_skip( bits, 6 );
+      info->duration= scte35_bits_read( bits, 33 );
+      info->hasDuration= TRUE;
+   }
+
+   info->uniqueProgramId= (guint)scte35_bits_read( bits, 16 );
+   info->availNum= (guint)scte35_bits_read( bits, 8 );
+   info->availsExpected= (guint)scte35_bits_read( bits, 8 );
+}
+
+/*
+ * Called by the section assembler for each complete section on the PID.
+ * splice_info_section has section_syntax_indicator clear, so its CRC_32 is
+ * checked here
+ */
+static void scte35_parser_section( void *userData, int pid, const unsigned char *section, int len )
+{
+   Scte35Parser *parser= (Scte35Parser*)userData;
+   Scte35SpliceInfo info;
+   Scte35Bits bits;
+   gboolean encrypted;
+   int commandLength;
+
+   (void)pid;
+
+   if ( (len < 4) || (section[0] != SCTE35_TABLE_ID) ) {
+      return;
+   }
+
+   if ( crc32_mpeg( section, len ) != 0 ) {
+      ++parser->crcErrors;
+      return;
+   }
+   ++parser->sections;
+
+   memset( &info, 0, sizeof(info) );
+   bits.data= section;
+   bits.size= len - 4;
+   bits.bitPos= 0;
+   bits.error= FALSE;
+
+   /* table_id, section_syntax_indicator, private_indicator, sap_type, section_length, protocol_version */
+   scte35_bits_skip( &bits, 8+1+1+2+12+8 );
+   encrypted= (gboolean)scte35_bits_read( &bits, 1 );
+   scte35_bits_skip( &bits, 6 );
+   info.ptsAdjustment= scte35_bits_read( &bits, 33 );
+   /* cw_index, tier */
+   scte35_bits_skip( &bits, 8+12 );
+   commandLength= (int)scte35_bits_read( &bits, 12 );
+   info.commandType= (int)scte35_bits_read( &bits, 8 );
+   if ( encrypted || bits.error ) {
+      return;
+   }
+   if ( (commandLength != 0xFFF) && ((bits.bitPos >> 3) + commandLength <= bits.size) ) {
+      bits.size= (bits.bitPos >> 3) + commandLength;
+   }
+
+   switch( info.commandType ) {
+      case scte35Command_SpliceInsert:
+         scte35_read_splice_insert( &bits, &info );
+         break;
+      case scte35Command_TimeSignal:
+         scte35_read_splice_time( &bits, &info );
+         break;
+      default:
+         break;
+   }
+
+   if ( !bits.error && parser->cb ) {
+      parser->cb( parser->userData, &info );
+   }
+}
+
+/* Tracks the PCR and hands the packet to the section assembler, which
+ * ignores it unless it is on the splice PID */
+static void scte35_parser_packet( Scte35Parser *parser, const unsigned char *packet )
+{
+   int pid, afLen;
+
+   pid= ((packet[1] & 0x1F) << 8) | packet[2];
+
+   if ( packet[3] & 0x20 ) {
+      afLen= packet[4];
+      if ( (afLen >= 7) && (packet[5] & 0x10) && ((parser->pcrPid < 0) || (parser->pcrPid == pid)) ) {
+         parser->pcrPid= pid;
+         parser->pcr= ((guint64)packet[6] << 25) | ((guint64)packet[7] << 17) |
+                      ((guint64)packet[8] << 9) | ((guint64)packet[9] << 1) | (packet[10] >> 7);
+         parser->havePcr= TRUE;
+      }
+   }
+
+   ts_psi_push_packet( parser->psi, packet );
+}
+
+Scte35Parser* scte35_parser_new( int pid, Scte35SpliceCB cb, void *userData )
+{
+   Scte35Parser *parser;
+
+   parser= (Scte35Parser*)g_malloc0( sizeof(Scte35Parser) );
+   if ( parser ) {
+      parser->psi= ts_psi_new( scte35_parser_section, parser );
+      parser->cb= cb;
+      parser->userData= userData;
+      parser->pid= pid;
+      scte35_parser_reset( parser );
+   }
+
+   return parser;
+}
+
+void scte35_parser_free( Scte35Parser *parser )
+{
+   ts_psi_free( parser->psi );
+   g_free( parser );
+}
+
+void scte35_parser_set_pid( Scte35Parser *parser, int pid )
+{
+   if ( parser->pid != pid ) {
+      ts_psi_remove_pid( parser->psi, parser->pid );
+      parser->pid= pid;
+      ts_psi_add_pid( parser->psi, pid );
+   }
+}
+
+void scte35_parser_reset( Scte35Parser *parser )
+{
+   ts_psi_reset( parser->psi );
+   ts_psi_add_pid( parser->psi, parser->pid );
+   parser->pcrPid= -1;
+   parser->havePcr= FALSE;
+   parser->pcr= 0;
+}
+
+int scte35_packet_size( const unsigned char *packets, int len )
+{
+   if ( (len >= TTS_PACKET_SIZE) && (packets[4] == TS_SYNC_BYTE) &&
+        ((packets[0] != TS_SYNC_BYTE) ||
+         ((len >= 2*TTS_PACKET_SIZE) && (packets[TS_PACKET_SIZE] != TS_SYNC_BYTE) && (packets[TTS_PACKET_SIZE+4] == TS_SYNC_BYTE))) ) {
+      /* timestamped packets: 4 byte prefix */
+      return TTS_PACKET_SIZE;
+   }
+   return TS_PACKET_SIZE;
+}
+
+void scte35_parser_push( Scte35Parser *parser, const unsigned char *packets, int len )
+{
+   int packetSize, offset;
+
+   packetSize= scte35_packet_size( packets, len );
+   offset= packetSize - TS_PACKET_SIZE;
+
+   while( len >= packetSize ) {
+      if ( packets[offset] == TS_SYNC_BYTE ) {
+         scte35_parser_packet( parser, packets + offset );
+      }
+      packets += packetSize;
+      len -= packetSize;
+   }
+}
+
+gboolean scte35_parser_get_pcr( Scte35Parser *parser, guint64 *pcr )
+{
+   if ( parser->havePcr ) {
+      *pcr= parser->pcr;
+   }
+   return parser->havePcr;
+}
+
+guint64 scte35_parser_get_sections( Scte35Parser *parser )
+{
+   return parser->sections;
+}
+
+guint64 scte35_parser_get_crc_errors( Scte35Parser *parser )
+{
+   return parser->crcErrors;
+}
+
+gboolean scte35_find_pts( const unsigned char *packets, int len, guint64 *pts )
+{
+   int packetSize, offset;
+
+   packetSize= scte35_packet_size( packets, len );
+   offset= packetSize - TS_PACKET_SIZE;
+
+   while( len >= packetSize ) {
+      const unsigned char *packet= packets + offset;
+
+      /* payload_unit_start_indicator with a payload */
+      if ( (packet[0] == TS_SYNC_BYTE) && (packet[1] & 0x40) && (packet[3] & 0x10) ) {
+         const unsigned char *pes= packet + 4;
+         int pesLen= TS_PACKET_SIZE - 4;
+
+         if ( packet[3] & 0x20 ) {
+            pesLen -= 1 + packet[4];
+            pes += 1 + packet[4];
+         }
+         /* packet_start_code_prefix, then PTS_DTS_flags of the optional header */
+         if ( (pesLen >= 14) && (pes[0] == 0x00) && (pes[1] == 0x00) && (pes[2] == 0x01) &&
+              ((pes[6] & 0xC0) == 0x80) && (pes[7] & 0x80) ) {
+            *pts= ((guint64)(pes[9] & 0x0E) << 29) | ((guint64)pes[10] << 22) | ((guint64)(pes[11] & 0xFE) << 14) |
+                  ((guint64)pes[12] << 7) | (pes[13] >> 1);
+            return TRUE;
+         }
+      }
+      packets += packetSize;
+      len -= packetSize;
+   }
+
+   return FALSE;
+}
+
+gint64 scte35_time_diff( guint64 a, guint64 b )
+{
+   guint64 diff= (a - b) & SCTE35_PTS_MASK;
+
+   if ( diff & (((guint64)1) << 32) ) {
+      return (gint64)diff - (gint64)(((guint64)1) << 33);
+   }
+   return (gint64)diff;
+}
+
+/** @} */
+/** @} */
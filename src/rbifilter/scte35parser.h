@@ -0,0 +1,116 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+* @defgroup gst-plugins-rdk
+* @{
+* @defgroup rbifilter
+* @{
+**/
+
+
+#ifndef __RMF_SCTE35PARSER_H__
+#define __RMF_SCTE35PARSER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+  *  @addtogroup RBI_FILTER
+  * @{
+ **/
+
+/* 90kHz clock wraps at 2^33 */
+#define SCTE35_PTS_MASK ((((guint64)1)<<33)-1)
+
+typedef enum _Scte35CommandType
+{
+   scte35Command_SpliceNull= 0x00,
+   scte35Command_SpliceSchedule= 0x04,
+   scte35Command_SpliceInsert= 0x05,
+   scte35Command_TimeSignal= 0x06,
+   scte35Command_BandwidthReservation= 0x07,
+   scte35Command_PrivateCommand= 0xFF
+} Scte35CommandType;
+
+/**
+ * Scte35SpliceInfo:
+ *
+ * Decoded splice_info_section, SCTE 35 section 9.2. Times are 90kHz ticks
+ * with pts_adjustment already applied
+*/
+typedef struct _Scte35SpliceInfo
+{
+   int commandType;                 /**< splice_command_type */
+   guint64 ptsAdjustment;           /**< pts_adjustment of the section */
+   guint32 eventId;                 /**< splice_event_id, splice_insert only */
+   gboolean cancel;                 /**< splice_event_cancel_indicator */
+   gboolean outOfNetwork;           /**< out_of_network_indicator: TRUE for a splice out of the network into an avail */
+   gboolean immediate;              /**< splice_immediate_flag */
+   gboolean hasPts;                 /**< A splice time with pts_time was given */
+   guint64 ptsTime;                 /**< Splice time, program splice or first component */
+   gboolean hasDuration;            /**< A break_duration was given */
+   gboolean autoReturn;             /**< break_duration auto_return */
+   guint64 duration;                /**< break_duration duration */
+   guint uniqueProgramId;           /**< unique_program_id */
+   guint availNum;                  /**< avail_num */
+   guint availsExpected;            /**< avails_expected */
+} Scte35SpliceInfo;
+
+typedef void (*Scte35SpliceCB)( void *userData, const Scte35SpliceInfo *info );
+
+typedef struct _Scte35Parser Scte35Parser;
+
+/**
+ * Incremental parser for splice_info_sections carried on one PID of an
+ * MPEG-2 transport stream. Feed it every packet of the stream, 188 or 192
+ * byte packets; sections may span packets and buffers. Each section with
+ * a valid CRC_32 is decoded and handed to the callback. The parser also
+ * keeps the last PCR seen in the stream as the current stream time
+*/
+Scte35Parser* scte35_parser_new( int pid, Scte35SpliceCB cb, void *userData );
+void scte35_parser_free( Scte35Parser *parser );
+void scte35_parser_set_pid( Scte35Parser *parser, int pid );
+void scte35_parser_reset( Scte35Parser *parser );
+void scte35_parser_push( Scte35Parser *parser, const unsigned char *packets, int len );
+
+/* Last PCR base seen (90kHz), returns FALSE before the first PCR */
+gboolean scte35_parser_get_pcr( Scte35Parser *parser, guint64 *pcr );
+
+guint64 scte35_parser_get_sections( Scte35Parser *parser );
+guint64 scte35_parser_get_crc_errors( Scte35Parser *parser );
+
+/* 188, or 192 for timestamped packets */
+int scte35_packet_size( const unsigned char *packets, int len );
+
+/* PTS of the first PES packet header with one, returns FALSE if there is none */
+gboolean scte35_find_pts( const unsigned char *packets, int len, guint64 *pts );
+
+/* Signed difference a - b of two 33 bit 90kHz times */
+gint64 scte35_time_diff( guint64 a, guint64 b );
+
+/** @} */
+
+G_END_DECLS
+
+#endif /* __RMF_SCTE35PARSER_H__ */
+
+/** @} */
+/** @} */
@@ -0,0 +1,411 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Unit test for the ad staging cache in src/rbifilter/adstaging.c.
+ *
+ * Fetch attempts are observed by interposing open(): opens of the watched
+ * path are timestamped and the first ones can be made to fail. Checks that
+ * a failing segment is fetched again after 0.5, 1, 2 and 4s, gives up
+ * after 5 failures, gets a fresh set of retries when the URI list is set
+ * again and is staged once a retry succeeds. Then checks the memory
+ * budget: segments dropped from the list are evicted oldest first when
+ * room is needed, segments a reader holds are not, and a fetch waits
+ * while nothing can be evicted. The retry part runs for about 16s.
+ *
+ * Build:
+ *   make check in src/rbifilter
+ * or
+ *   gcc -o adstaging_test adstaging_test.c ../adstaging.c -I.. \
+ *       $(pkg-config --cflags --libs glib-2.0 libcurl)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "adstaging.h"
+
+#define MAX_ATTEMPTS (16)
+/* Scheduling slack allowed on top of each retry delay */
+#define RETRY_SLACK (400000)
+
+typedef struct _TestState
+{
+   GMutex lock;
+   char watched[256];
+   int failOpens;
+   int attempts;
+   gint64 attemptTime[MAX_ATTEMPTS];
+   char dir[64];
+   guint errors;
+} TestState;
+
+static TestState state;
+
+static int forward_open( const char *path, int flags, va_list args )
+{
+   mode_t mode= 0;
+
+   if ( flags & O_CREAT ) {
+      mode= va_arg( args, mode_t );
+   }
+   return (int)syscall( SYS_openat, AT_FDCWD, path, flags, mode );
+}
+
+/* Records opens of the watched path, failing the first failOpens of them */
+static int watched_open( const char *path, int flags, va_list args )
+{
+   gboolean fail= FALSE;
+
+   g_mutex_lock( &state.lock );
+   if ( state.watched[0] && !strcmp( path, state.watched ) ) {
+      if ( state.attempts < MAX_ATTEMPTS ) {
+         state.attemptTime[state.attempts]= g_get_monotonic_time();
+      }
+      ++state.attempts;
+      if ( state.failOpens > 0 ) {
+         --state.failOpens;
+         fail= TRUE;
+      }
+   }
+   g_mutex_unlock( &state.lock );
+
+   if ( fail ) {
+      errno= ENOENT;
+      return -1;
+   }
+   return forward_open( path, flags, args );
+}
+
+int open( const char *path, int flags, ... )
+{
+   va_list args;
+   int fd;
+
+   va_start( args, flags );
+   fd= watched_open( path, flags, args );
+   va_end( args );
+
+   return fd;
+}
+
+int open64( const char *path, int flags, ... )
+{
+   va_list args;
+   int fd;
+
+   va_start( args, flags );
+   fd= watched_open( path, flags, args );
+   va_end( args );
+
+   return fd;
+}
+
+static void watch( const char *path, int failOpens )
+{
+   g_mutex_lock( &state.lock );
+   snprintf( state.watched, sizeof(state.watched), "%s", path );
+   state.failOpens= failOpens;
+   state.attempts= 0;
+   g_mutex_unlock( &state.lock );
+}
+
+static int get_attempts( void )
+{
+   int attempts;
+
+   g_mutex_lock( &state.lock );
+   attempts= state.attempts;
+   g_mutex_unlock( &state.lock );
+
+   return attempts;
+}
+
+/* Waits up to timeout microseconds for count attempts */
+static gboolean wait_attempts( int count, gint64 timeout )
+{
+   gint64 end= g_get_monotonic_time() + timeout;
+
+   while( get_attempts() < count ) {
+      if ( g_get_monotonic_time() > end ) {
+         return FALSE;
+      }
+      g_usleep( 10000 );
+   }
+   return TRUE;
+}
+
+/* Writes a segment of count 188 byte packets, numbered in their second byte */
+static void make_segment( char *path, gsize pathSize, const char *name, int count )
+{
+   unsigned char packet[188];
+   FILE *file;
+   int i;
+
+   snprintf( path, pathSize, "%s/%s", state.dir, name );
+   file= fopen( path, "wb" );
+   for( i= 0; i < count; ++i ) {
+      memset( packet, 0xFF, sizeof(packet) );
+      packet[0]= 0x47;
+      packet[1]= i & 0xFF;
+      fwrite( packet, 1, sizeof(packet), file );
+   }
+   fclose( file );
+}
+
+/* Waits for uri to be staged completely, returns it with a reference */
+static AdStagingSegment* wait_staged( AdStaging *staging, const char *uri )
+{
+   AdStagingSegment *segment= NULL;
+   int i;
+
+   for( i= 0; i < 500; ++i ) {
+      segment= ad_staging_lookup( staging, uri );
+      if ( segment && ad_staging_segment_is_complete( segment ) ) {
+         return segment;
+      }
+      if ( segment ) {
+         ad_staging_segment_unref( segment );
+         segment= NULL;
+      }
+      g_usleep( 10000 );
+   }
+   return NULL;
+}
+
+static void expect_staged( const char *name, AdStaging *staging, const char *uri, gboolean staged )
+{
+   AdStagingSegment *segment= ad_staging_lookup( staging, uri );
+
+   if ( (segment != NULL) != staged ) {
+      printf( "%s: %s %s\n", name, uri, staged ? "not staged" : "still staged" );
+      ++state.errors;
+   }
+   if ( segment ) {
+      ad_staging_segment_unref( segment );
+   }
+}
+
+static void expect_bytes( const char *name, AdStaging *staging, int blocks )
+{
+   guint64 bytes= ad_staging_get_bytes( staging );
+
+   if ( bytes != (guint64)blocks * AD_STAGING_BLOCK_SIZE ) {
+      printf( "%s: %llu bytes staged, expected %d blocks\n", name, (unsigned long long)bytes, blocks );
+      ++state.errors;
+   }
+}
+
+static int report( const char *name )
+{
+   int failed= (state.errors != 0);
+
+   printf( "%s: %s\n", name, failed ? "FAIL" : "PASS" );
+   state.errors= 0;
+   return failed;
+}
+
+static int test_retry_backoff( void )
+{
+   static const gint64 delays[]= { 500000, 1000000, 2000000, 4000000 };
+   AdStaging *staging= ad_staging_new( 4ULL*AD_STAGING_BLOCK_SIZE );
+   char path[256];
+   int i;
+
+   snprintf( path, sizeof(path), "%s/missing.ts", state.dir );
+   watch( path, MAX_ATTEMPTS );
+   ad_staging_set_uris( staging, path );
+
+   if ( !wait_attempts( 5, 10000000 ) ) {
+      printf( "retry_backoff: %d attempts\n", get_attempts() );
+      ++state.errors;
+   } else {
+      for( i= 0; i < 4; ++i ) {
+         gint64 interval= state.attemptTime[i+1] - state.attemptTime[i];
+         if ( (interval < delays[i]) || (interval > delays[i] + RETRY_SLACK) ) {
+            printf( "retry_backoff: retry %d after %lldus, expected %lldus\n", i + 1,
+                    (long long)interval, (long long)delays[i] );
+            ++state.errors;
+         }
+      }
+   }
+
+   /* no sixth attempt, not even after the 8s the next delay would be */
+   g_usleep( 8000000 + RETRY_SLACK );
+   if ( get_attempts() != 5 ) {
+      printf( "retry_backoff: %d attempts after giving up\n", get_attempts() );
+      ++state.errors;
+   }
+   expect_staged( "retry_backoff", staging, path, FALSE );
+
+   /* setting the list again retries at once */
+   ad_staging_set_uris( staging, path );
+   if ( !wait_attempts( 6, RETRY_SLACK ) ) {
+      printf( "retry_backoff: no new attempt after setting the list again\n" );
+      ++state.errors;
+   }
+
+   ad_staging_free( staging );
+
+   return report( "retry_backoff" );
+}
+
+static int test_retry_success( void )
+{
+   AdStaging *staging= ad_staging_new( 4ULL*AD_STAGING_BLOCK_SIZE );
+   AdStagingSegment *segment;
+   char path[256];
+
+   make_segment( path, sizeof(path), "late.ts", 100 );
+   watch( path, 2 );
+   ad_staging_set_uris( staging, path );
+
+   segment= wait_staged( staging, path );
+   if ( !segment || (ad_staging_segment_get_size( segment ) != 100*188) ) {
+      printf( "retry_success: segment %s\n", segment ? "incomplete" : "not staged" );
+      ++state.errors;
+   }
+   if ( get_attempts() != 3 ) {
+      printf( "retry_success: %d attempts, expected 3\n", get_attempts() );
+      ++state.errors;
+   }
+   if ( segment ) {
+      ad_staging_segment_unref( segment );
+   }
+
+   watch( "", 0 );
+   ad_staging_free( staging );
+
+   return report( "retry_success" );
+}
+
+static int test_budget( void )
+{
+   AdStaging *staging= ad_staging_new( 4ULL*AD_STAGING_BLOCK_SIZE );
+   AdStagingSegment *segment, *heldB, *heldD;
+   char a[256], b[256], c[256], d[256], e[256], list[600];
+   int i;
+
+   /* two blocks each */
+   make_segment( a, sizeof(a), "a.ts", AD_STAGING_BLOCK_PACKETS + 100 );
+   make_segment( b, sizeof(b), "b.ts", AD_STAGING_BLOCK_PACKETS + 100 );
+   make_segment( c, sizeof(c), "c.ts", AD_STAGING_BLOCK_PACKETS + 100 );
+   make_segment( d, sizeof(d), "d.ts", AD_STAGING_BLOCK_PACKETS + 100 );
+   make_segment( e, sizeof(e), "e.ts", AD_STAGING_BLOCK_PACKETS + 100 );
+
+   snprintf( list, sizeof(list), "%s;%s", a, b );
+   ad_staging_set_uris( staging, list );
+   for( i= 0; i < 2; ++i ) {
+      segment= wait_staged( staging, i ? b : a );
+      if ( !segment ) {
+         printf( "budget: %s not staged\n", i ? b : a );
+         ++state.errors;
+      } else {
+         ad_staging_segment_unref( segment );
+      }
+   }
+   expect_bytes( "budget", staging, 4 );
+
+   /* c needs room: a goes first, b stays while the budget allows */
+   ad_staging_set_uris( staging, c );
+   segment= wait_staged( staging, c );
+   if ( segment ) {
+      ad_staging_segment_unref( segment );
+   }
+   expect_staged( "budget", staging, c, TRUE );
+   expect_staged( "budget", staging, a, FALSE );
+   expect_staged( "budget", staging, b, TRUE );
+   expect_bytes( "budget", staging, 4 );
+
+   /* a reader holds b, so d evicts c although b is older */
+   heldB= ad_staging_lookup( staging, b );
+   ad_staging_set_uris( staging, d );
+   heldD= wait_staged( staging, d );
+   expect_staged( "budget", staging, b, TRUE );
+   expect_staged( "budget", staging, c, FALSE );
+   expect_bytes( "budget", staging, 4 );
+
+   /* with b and d held nothing can go, e waits until b is released */
+   ad_staging_set_uris( staging, e );
+   g_usleep( 300000 );
+   expect_bytes( "budget", staging, 4 );
+   segment= ad_staging_lookup( staging, e );
+   if ( segment ) {
+      if ( ad_staging_segment_get_size( segment ) != 0 ) {
+         printf( "budget: e staged past the budget\n" );
+         ++state.errors;
+      }
+      ad_staging_segment_unref( segment );
+   }
+   if ( heldB ) {
+      ad_staging_segment_unref( heldB );
+   }
+   segment= wait_staged( staging, e );
+   if ( !segment ) {
+      printf( "budget: e not staged after b was released\n" );
+      ++state.errors;
+   } else {
+      ad_staging_segment_unref( segment );
+   }
+   expect_bytes( "budget", staging, 4 );
+   if ( heldD ) {
+      ad_staging_segment_unref( heldD );
+   }
+
+   ad_staging_free( staging );
+   unlink( a );
+   unlink( b );
+   unlink( c );
+   unlink( d );
+   unlink( e );
+
+   return report( "budget" );
+}
+
+int main( int argc, char **argv )
+{
+   char path[256];
+   int failed= 0;
+
+   (void)argc;
+   (void)argv;
+
+   g_mutex_init( &state.lock );
+   snprintf( state.dir, sizeof(state.dir), "/tmp/adstaging_test.XXXXXX" );
+   if ( !mkdtemp( state.dir ) ) {
+      printf( "unable to create a directory for the test segments\n" );
+      return 1;
+   }
+
+   failed |= test_retry_backoff();
+   failed |= test_retry_success();
+   failed |= test_budget();
+
+   snprintf( path, sizeof(path), "%s/late.ts", state.dir );
+   unlink( path );
+   rmdir( state.dir );
+
+   return failed;
+}
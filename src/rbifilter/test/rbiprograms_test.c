@@ -0,0 +1,479 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Unit test for the PID to program routing in src/rbifilter/rbiprograms.c.
+ *
+ * Runs numbered packets of several PIDs through rbi_programs_process with
+ * test contexts behind the callbacks. Checks each context gets exactly the
+ * packets of its PIDs, in order and in one block per buffer, that packets
+ * no context owns are left alone, that rewritten and dropped packets go
+ * back into the slots they came from, that inserted packets fill the
+ * slots of the inserting context, keep the slot timestamps of 192 byte
+ * packets and carry over to the next buffer, and how PID lists are parsed
+ * and shared PIDs are resolved when contexts are added and removed.
+ *
+ * Build:
+ *   make check in src/rbifilter
+ * or
+ *   gcc -o rbiprograms_test rbiprograms_test.c ../rbiprograms.c ../scte35parser.c \
+ *       ../../common/tspsi.c -I.. -I../../common $(pkg-config --cflags --libs glib-2.0)
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "rbiprograms.h"
+
+#define MAX_PACKETS (32)
+#define PID_NULL (0x1FFF)
+
+typedef enum _TestMode
+{
+   MODE_PASS,
+   MODE_MARK,
+   MODE_TRUNCATE,
+   MODE_INSERT
+} TestMode;
+
+typedef struct _TestContext
+{
+   TestMode mode;
+   int packetSize;
+   int calls;
+   int received;
+   int seqs[MAX_PACKETS];
+   /* MODE_TRUNCATE: packets passed on */
+   int keep;
+   /* MODE_INSERT: PID, next sequence number and packets left to hand out */
+   int insertPid;
+   int insertNext;
+   int insertLeft;
+} TestContext;
+
+typedef struct _TestState
+{
+   int packetSize;
+   guint errors;
+} TestState;
+
+static TestState state;
+
+static int packet_pid( const unsigned char *packet )
+{
+   return ((packet[1] & 0x1F) << 8) | packet[2];
+}
+
+static int packet_seq( const unsigned char *packet )
+{
+   return (packet[4] << 8) | packet[5];
+}
+
+/* TS packet of pid numbered seq in its first payload bytes */
+static void make_packet( unsigned char *packet, int pid, int seq )
+{
+   memset( packet, 0xFF, 188 );
+   packet[0]= 0x47;
+   packet[1]= (pid >> 8) & 0x1F;
+   packet[2]= pid & 0xFF;
+   packet[3]= 0x10;
+   packet[4]= (seq >> 8) & 0xFF;
+   packet[5]= seq & 0xFF;
+   packet[6]= 0x00;
+}
+
+/* Packet i has PID pids[i] and sequence number i, 192 byte packets are prefixed with 0x100+i */
+static int make_buffer( unsigned char *packets, const int *pids, int count )
+{
+   int offset= state.packetSize - 188, i;
+
+   for( i= 0; i < count; ++i ) {
+      unsigned char *slot= packets + i * state.packetSize;
+
+      if ( offset ) {
+         slot[0]= 0x00;
+         slot[1]= 0x00;
+         slot[2]= ((0x100 + i) >> 8) & 0xFF;
+         slot[3]= (0x100 + i) & 0xFF;
+      }
+      make_packet( slot + offset, pids[i], i );
+   }
+
+   return count * state.packetSize;
+}
+
+static const unsigned char* slot_packet( const unsigned char *packets, int i )
+{
+   return packets + i * state.packetSize + (state.packetSize - 188);
+}
+
+static gboolean in_cb( void *ctx, unsigned char *packets, int *len )
+{
+   TestContext *context= (TestContext*)ctx;
+   int offset= context->packetSize - 188, count= *len / context->packetSize, i;
+
+   ++context->calls;
+   context->received= count;
+   for( i= 0; i < count; ++i ) {
+      unsigned char *packet= packets + i * context->packetSize + offset;
+
+      if ( i < MAX_PACKETS ) {
+         context->seqs[i]= packet_seq( packet );
+      }
+      if ( context->mode == MODE_MARK ) {
+         packet[6]= 0xAA;
+      }
+   }
+
+   switch( context->mode ) {
+      case MODE_TRUNCATE:
+         *len= MIN( context->keep, count ) * context->packetSize;
+         break;
+      case MODE_INSERT:
+         return FALSE;
+      default:
+         break;
+   }
+
+   return TRUE;
+}
+
+/* Inserting contexts hand out everything they have left at once */
+static int out_size_cb( void *ctx )
+{
+   TestContext *context= (TestContext*)ctx;
+
+   return context->insertLeft * context->packetSize;
+}
+
+static int out_data_cb( void *ctx, unsigned char *packets, int len )
+{
+   TestContext *context= (TestContext*)ctx;
+   int offset= context->packetSize - 188, count= 0;
+
+   while( (len >= context->packetSize) && context->insertLeft ) {
+      memset( packets, 0xEE, offset );
+      make_packet( packets + offset, context->insertPid, context->insertNext++ );
+      --context->insertLeft;
+      packets += context->packetSize;
+      len -= context->packetSize;
+      ++count;
+   }
+
+   return count * context->packetSize;
+}
+
+static void process( RbiPrograms *programs, TestContext **contexts, unsigned char *packets, int len )
+{
+   int i;
+
+   for( i= 0; contexts[i]; ++i ) {
+      contexts[i]->packetSize= state.packetSize;
+      contexts[i]->calls= 0;
+      contexts[i]->received= 0;
+   }
+   rbi_programs_process( programs, in_cb, out_size_cb, out_data_cb, packets, len );
+}
+
+static void expect_received( const char *name, const char *ctxName, TestContext *context,
+                             const int *seqs, int count )
+{
+   int i;
+
+   if ( count && (context->calls != 1) ) {
+      printf( "%s: context %s called %d times\n", name, ctxName, context->calls );
+      ++state.errors;
+   } else if ( !count && context->calls ) {
+      printf( "%s: context %s called without packets\n", name, ctxName );
+      ++state.errors;
+   }
+   if ( context->received != count ) {
+      printf( "%s: context %s got %d packets, expected %d\n", name, ctxName, context->received, count );
+      ++state.errors;
+      return;
+   }
+   for( i= 0; i < count; ++i ) {
+      if ( context->seqs[i] != seqs[i] ) {
+         printf( "%s: context %s packet %d is %d, expected %d\n", name, ctxName, i, context->seqs[i], seqs[i] );
+         ++state.errors;
+      }
+   }
+}
+
+/* Slot i holds pid with sequence number seq, and its original timestamp prefix */
+static void expect_slot( const char *name, const unsigned char *packets, int i, int pid, int seq )
+{
+   const unsigned char *packet= slot_packet( packets, i );
+   const unsigned char *slot= packets + i * state.packetSize;
+
+   if ( (packet[0] != 0x47) || (packet_pid( packet ) != pid) ||
+        ((pid != PID_NULL) && (packet_seq( packet ) != seq)) ) {
+      printf( "%s: slot %d holds PID 0x%04X packet %d, expected PID 0x%04X packet %d\n",
+              name, i, packet_pid( packet ), packet_seq( packet ), pid, seq );
+      ++state.errors;
+   }
+   if ( (state.packetSize == 192) && (((slot[2] << 8) | slot[3]) != 0x100 + i) ) {
+      printf( "%s: slot %d lost its timestamp\n", name, i );
+      ++state.errors;
+   }
+}
+
+static int report( const char *name )
+{
+   int failed= (state.errors != 0);
+
+   printf( "%s: %s\n", name, failed ? "FAIL" : "PASS" );
+   state.errors= 0;
+   return failed;
+}
+
+static int test_routing( void )
+{
+   static const int pids[]= { 0x100, 0x200, 0x000, 0x101, PID_NULL, 0x200, 0x100, 0x400, 0x100 };
+   static const int seqsA[]= { 0, 3, 6 };
+   static const int seqsB[]= { 1, 5 };
+   int count= sizeof(pids)/sizeof(pids[0]), len;
+   unsigned char packets[MAX_PACKETS*192], copy[MAX_PACKETS*192];
+   TestContext a, b, c;
+   TestContext *contexts[]= { &a, &b, &c, NULL };
+   RbiPrograms *programs= rbi_programs_new();
+
+   memset( &a, 0, sizeof(a) );
+   memset( &b, 0, sizeof(b) );
+   memset( &c, 0, sizeof(c) );
+   state.packetSize= 188;
+   rbi_programs_add( programs, &a, "0x100, 257" );
+   rbi_programs_add( programs, &b, "0x200" );
+   rbi_programs_add( programs, &c, "0x300" );
+
+   /* the last packet has lost sync and is not routed */
+   len= make_buffer( packets, pids, count );
+   packets[(count - 1) * 188]= 0x00;
+   memcpy( copy, packets, len );
+   process( programs, contexts, packets, len );
+
+   expect_received( "routing", "a", &a, seqsA, 3 );
+   expect_received( "routing", "b", &b, seqsB, 2 );
+   expect_received( "routing", "c", &c, NULL, 0 );
+   if ( memcmp( packets, copy, len ) ) {
+      printf( "routing: packets changed by passing contexts\n" );
+      ++state.errors;
+   }
+
+   /* 192 byte packets route the same way */
+   state.packetSize= 192;
+   len= make_buffer( packets, pids, count - 1 );
+   process( programs, contexts, packets, len );
+   expect_received( "routing", "a", &a, seqsA, 3 );
+   expect_received( "routing", "b", &b, seqsB, 2 );
+
+   rbi_programs_free( programs );
+
+   return report( "routing" );
+}
+
+static int test_rewrite( void )
+{
+   static const int pids[]= { 0x100, 0x200, 0x100, 0x000, 0x200, 0x200 };
+   int count= sizeof(pids)/sizeof(pids[0]), len;
+   unsigned char packets[MAX_PACKETS*192];
+   TestContext a, b;
+   TestContext *contexts[]= { &a, &b, NULL };
+   RbiPrograms *programs= rbi_programs_new();
+
+   memset( &a, 0, sizeof(a) );
+   memset( &b, 0, sizeof(b) );
+   a.mode= MODE_MARK;
+   b.mode= MODE_TRUNCATE;
+   b.keep= 1;
+   rbi_programs_add( programs, &a, "0x100" );
+   rbi_programs_add( programs, &b, "0x200" );
+
+   state.packetSize= 188;
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+
+   /* a's changes land in a's slots, b's dropped packets become null packets */
+   if ( (slot_packet( packets, 0 )[6] != 0xAA) || (slot_packet( packets, 2 )[6] != 0xAA) ) {
+      printf( "rewrite: rewritten packets not written back\n" );
+      ++state.errors;
+   }
+   if ( (slot_packet( packets, 1 )[6] != 0x00) || (slot_packet( packets, 3 )[6] != 0x00) ) {
+      printf( "rewrite: packets of other PIDs rewritten\n" );
+      ++state.errors;
+   }
+   expect_slot( "rewrite", packets, 0, 0x100, 0 );
+   expect_slot( "rewrite", packets, 1, 0x200, 1 );
+   expect_slot( "rewrite", packets, 2, 0x100, 2 );
+   expect_slot( "rewrite", packets, 3, 0x000, 3 );
+   expect_slot( "rewrite", packets, 4, PID_NULL, 0 );
+   expect_slot( "rewrite", packets, 5, PID_NULL, 0 );
+   if ( rbi_programs_get_underruns( programs ) ) {
+      printf( "rewrite: dropped packets counted as underruns\n" );
+      ++state.errors;
+   }
+
+   rbi_programs_free( programs );
+
+   return report( "rewrite" );
+}
+
+static int test_insert( void )
+{
+   static const int pids[]= { 0x100, 0x200, 0x000, 0x200, 0x100 };
+   int count= sizeof(pids)/sizeof(pids[0]), len;
+   unsigned char packets[MAX_PACKETS*192];
+   TestContext a, b;
+   TestContext *contexts[]= { &a, &b, NULL };
+   RbiPrograms *programs= rbi_programs_new();
+
+   memset( &a, 0, sizeof(a) );
+   memset( &b, 0, sizeof(b) );
+   b.mode= MODE_INSERT;
+   b.insertPid= 0x210;
+   b.insertLeft= 3;
+   rbi_programs_add( programs, &a, "0x100" );
+   rbi_programs_add( programs, &b, "0x200" );
+
+   /* three inserted packets for two slots, the third is kept */
+   state.packetSize= 192;
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_slot( "insert", packets, 0, 0x100, 0 );
+   expect_slot( "insert", packets, 1, 0x210, 0 );
+   expect_slot( "insert", packets, 2, 0x000, 2 );
+   expect_slot( "insert", packets, 3, 0x210, 1 );
+   expect_slot( "insert", packets, 4, 0x100, 4 );
+   if ( rbi_programs_get_inserting( programs ) != 1 ) {
+      printf( "insert: %u contexts inserting, expected 1\n", rbi_programs_get_inserting( programs ) );
+      ++state.errors;
+   }
+
+   /* the kept packet goes first, the slot after it underruns */
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_slot( "insert", packets, 1, 0x210, 2 );
+   expect_slot( "insert", packets, 3, PID_NULL, 0 );
+   if ( rbi_programs_get_underruns( programs ) != 1 ) {
+      printf( "insert: %llu underruns, expected 1\n", (unsigned long long)rbi_programs_get_underruns( programs ) );
+      ++state.errors;
+   }
+
+   /* passing again ends the insertion and drops what is left */
+   b.insertLeft= 3;
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   b.mode= MODE_PASS;
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_slot( "insert", packets, 1, 0x200, 1 );
+   expect_slot( "insert", packets, 3, 0x200, 3 );
+   if ( rbi_programs_get_inserting( programs ) != 0 ) {
+      printf( "insert: insertion not ended\n" );
+      ++state.errors;
+   }
+
+   /* the next insertion starts with fresh packets */
+   b.mode= MODE_INSERT;
+   b.insertLeft= 1;
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_slot( "insert", packets, 1, 0x210, 6 );
+
+   /* reset ends an insertion the same way */
+   rbi_programs_reset( programs );
+   if ( rbi_programs_get_inserting( programs ) != 0 ) {
+      printf( "insert: insertion not ended by reset\n" );
+      ++state.errors;
+   }
+
+   rbi_programs_free( programs );
+
+   return report( "insert" );
+}
+
+static int test_add_remove( void )
+{
+   static const int pids[]= { 0x100, 0x200, 0x1FFE, 0x300 };
+   static const int seqsA[]= { 0, 2 };
+   static const int seqsB[]= { 1, 3 };
+   static const int seqsBAll[]= { 0, 1, 3 };
+   int count= sizeof(pids)/sizeof(pids[0]), len;
+   unsigned char packets[MAX_PACKETS*192];
+   TestContext a, b;
+   TestContext *contexts[]= { &a, &b, NULL };
+   RbiPrograms *programs= rbi_programs_new();
+
+   memset( &a, 0, sizeof(a) );
+   memset( &b, 0, sizeof(b) );
+   state.packetSize= 188;
+
+   /* bad entries are skipped, the null PID included; a list without a good one is refused */
+   if ( !rbi_programs_add( programs, &a, "0x100;8190, 0x1FFF foo" ) ||
+        rbi_programs_add( programs, &b, "" ) || rbi_programs_add( programs, &b, "0x1FFF" ) ||
+        rbi_programs_add( programs, &a, "0x400" ) || (rbi_programs_count( programs ) != 1) ) {
+      printf( "add_remove: PID lists not parsed as expected\n" );
+      ++state.errors;
+   }
+
+   /* 0x100 stays with a, which had it first */
+   if ( !rbi_programs_add( programs, &b, "0x200 0x100 0x300" ) ) {
+      printf( "add_remove: context with a shared PID refused\n" );
+      ++state.errors;
+   }
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_received( "add_remove", "a", &a, seqsA, 2 );
+   expect_received( "add_remove", "b", &b, seqsB, 2 );
+
+   /* once a is gone b owns 0x100 too */
+   if ( !rbi_programs_remove( programs, &a ) || rbi_programs_remove( programs, &a ) ||
+        (rbi_programs_count( programs ) != 1) ) {
+      printf( "add_remove: remove did not find a exactly once\n" );
+      ++state.errors;
+   }
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_received( "add_remove", "a", &a, NULL, 0 );
+   expect_received( "add_remove", "b", &b, seqsBAll, 3 );
+
+   rbi_programs_remove( programs, &b );
+   len= make_buffer( packets, pids, count );
+   process( programs, contexts, packets, len );
+   expect_received( "add_remove", "b", &b, NULL, 0 );
+
+   rbi_programs_free( programs );
+
+   return report( "add_remove" );
+}
+
+int main( int argc, char **argv )
+{
+   int failed= 0;
+
+   (void)argc;
+   (void)argv;
+
+   failed |= test_routing();
+   failed |= test_rewrite();
+   failed |= test_insert();
+   failed |= test_add_remove();
+
+   return failed;
+}
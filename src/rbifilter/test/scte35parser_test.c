@@ -0,0 +1,546 @@
+/*
+ * Copyright 2014 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation, version 2
+ * of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/*
+ * Unit test for the SCTE-35 parser in src/rbifilter/scte35parser.c.
+ *
+ * Carries the splice_insert and time_signal sample sections of SCTE 35
+ * section 14 on a PID and checks what reaches the splice callback when
+ * sections start behind a non zero pointer_field, span packets and push
+ * calls, follow each other in one packet, come in 192 byte timestamped
+ * packets, lose a packet or fail their CRC_32. Then checks the decoded
+ * fields of both samples and of generated splice_insert and time_signal
+ * commands: pts_adjustment and its 33 bit wrap, cancel, immediate and
+ * component splices, and a time_signal without a time.
+ *
+ * Build:
+ *   make check in src/rbifilter
+ * or
+ *   gcc -o scte35parser_test scte35parser_test.c ../scte35parser.c ../../common/tspsi.c \
+ *       -I.. -I../../common $(pkg-config --cflags --libs glib-2.0)
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "scte35parser.h"
+#include "crc32mpeg.h"
+
+#define SPLICE_PID (0x1F0)
+
+/* SCTE 35 14.1: time_signal with a segmentation_descriptor */
+static const unsigned char timeSignal[]=
+{
+   0xFC, 0x30, 0x34, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xF0, 0x05, 0x06, 0xFE, 0x72,
+   0xBD, 0x00, 0x50, 0x00, 0x1E, 0x02, 0x1C, 0x43, 0x55, 0x45, 0x49, 0x48, 0x00, 0x00, 0x8E, 0x7F,
+   0xCF, 0x00, 0x01, 0xA5, 0x99, 0xB0, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x2C, 0xA0, 0xA1, 0x8A,
+   0x34, 0x02, 0x00, 0x9A, 0xC9, 0xD1, 0x7E
+};
+
+/* SCTE 35 14.2: splice_insert out of network with a break_duration */
+static const unsigned char spliceInsert[]=
+{
+   0xFC, 0x30, 0x2F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xF0, 0x14, 0x05, 0x48, 0x00,
+   0x00, 0x8F, 0x7F, 0xEF, 0xFE, 0x73, 0x69, 0xC0, 0x2E, 0xFE, 0x00, 0x52, 0xCC, 0xF5, 0x00, 0x00,
+   0x00, 0x00, 0x00, 0x0A, 0x00, 0x08, 0x43, 0x55, 0x45, 0x49, 0x00, 0x00, 0x01, 0x35, 0x62, 0xDB,
+   0xA3, 0x0A
+};
+
+/* Bit writer for generated sections */
+typedef struct _BitWriter
+{
+   unsigned char data[256];
+   int bitPos;
+} BitWriter;
+
+static void put_bits( BitWriter *writer, guint64 value, int count )
+{
+   while( count-- > 0 ) {
+      if ( (value >> count) & 1 ) {
+         writer->data[writer->bitPos >> 3] |= (0x80 >> (writer->bitPos & 7));
+      } else {
+         writer->data[writer->bitPos >> 3] &= ~(0x80 >> (writer->bitPos & 7));
+      }
+      ++writer->bitPos;
+   }
+}
+
+typedef struct _TestState
+{
+   int count;
+   Scte35SpliceInfo info[4];
+   guint errors;
+} TestState;
+
+static TestState state;
+
+static void splice_cb( void *userData, const Scte35SpliceInfo *info )
+{
+   (void)userData;
+
+   if ( state.count < 4 ) {
+      state.info[state.count]= *info;
+   }
+   ++state.count;
+}
+
+/* Clears what the callback saw, errors add up until report */
+static Scte35Parser* start( void )
+{
+   guint errors= state.errors;
+
+   memset( &state, 0, sizeof(state) );
+   state.errors= errors;
+   return scte35_parser_new( SPLICE_PID, splice_cb, NULL );
+}
+
+/* Builds one packet around len payload bytes, padded with stuffing */
+static void make_packet( unsigned char *packet, gboolean pusi, int cc, const unsigned char *payload, int len )
+{
+   memset( packet, 0xFF, 188 );
+   packet[0]= 0x47;
+   packet[1]= (pusi ? 0x40 : 0x00) | ((SPLICE_PID >> 8) & 0x1F);
+   packet[2]= SPLICE_PID & 0xFF;
+   packet[3]= 0x10 | (cc & 0x0F);
+   memcpy( packet + 4, payload, len );
+}
+
+/* Starts section behind pointer bytes of filler so that only its first
+   head bytes fit into the first packet; the rest goes in a second one */
+static void make_split( unsigned char *packets, int cc, const unsigned char *section, int len, int head )
+{
+   unsigned char payload[184];
+   int pointer= 183 - head;
+
+   memset( payload, 0xAA, sizeof(payload) );
+   payload[0]= pointer;
+   memcpy( payload + 1 + pointer, section, head );
+   make_packet( packets, TRUE, cc, payload, 184 );
+   make_packet( packets + 188, FALSE, cc + 1, section + head, len - head );
+}
+
+static void expect( const char *name, Scte35Parser *parser, int count, guint64 sections, guint64 crcErrors )
+{
+   if ( (state.count != count) ||
+        (scte35_parser_get_sections( parser ) != sections) ||
+        (scte35_parser_get_crc_errors( parser ) != crcErrors) ) {
+      printf( "%s: %d splices, %llu sections, %llu crc errors, expected %d, %llu, %llu\n",
+              name, state.count, (unsigned long long)scte35_parser_get_sections( parser ),
+              (unsigned long long)scte35_parser_get_crc_errors( parser ), count,
+              (unsigned long long)sections, (unsigned long long)crcErrors );
+      ++state.errors;
+   }
+}
+
+static void expect_command( const char *name, int index, int commandType )
+{
+   if ( (index >= state.count) || (state.info[index].commandType != commandType) ) {
+      printf( "%s: splice %d is not command 0x%02X\n", name, index, commandType );
+      ++state.errors;
+   }
+}
+
+static int report( const char *name, Scte35Parser *parser )
+{
+   int failed= (state.errors != 0);
+
+   scte35_parser_free( parser );
+   printf( "%s: %s\n", name, failed ? "FAIL" : "PASS" );
+   state.errors= 0;
+   return failed;
+}
+
+static int test_pointer_field_split( void )
+{
+   Scte35Parser *parser= start();
+   unsigned char packets[2*188];
+
+   make_split( packets, 0, spliceInsert, sizeof(spliceInsert), 12 );
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "pointer_field_split", parser, 1, 1, 0 );
+   expect_command( "pointer_field_split", 0, scte35Command_SpliceInsert );
+   if ( (state.count == 1) && (state.info[0].eventId != 0x4800008F) ) {
+      printf( "pointer_field_split: event id 0x%08X\n", state.info[0].eventId );
+      ++state.errors;
+   }
+
+   /* one packet per push call */
+   make_split( packets, 2, timeSignal, sizeof(timeSignal), 1 );
+   scte35_parser_push( parser, packets, 188 );
+   expect( "pointer_field_split", parser, 1, 1, 0 );
+   scte35_parser_push( parser, packets + 188, 188 );
+   expect( "pointer_field_split", parser, 2, 2, 0 );
+   expect_command( "pointer_field_split", 1, scte35Command_TimeSignal );
+
+   return report( "pointer_field_split", parser );
+}
+
+static int test_back_to_back( void )
+{
+   Scte35Parser *parser= start();
+   unsigned char packets[2*188], payload[184];
+   int head= 20, tail= sizeof(spliceInsert) - head;
+
+   /* splice_insert ends behind pointer_field in the packet that starts
+      the time_signal */
+   memset( payload, 0xAA, sizeof(payload) );
+   payload[0]= 183 - head;
+   memcpy( payload + 1 + payload[0], spliceInsert, head );
+   make_packet( packets, TRUE, 5, payload, 184 );
+   payload[0]= tail;
+   memcpy( payload + 1, spliceInsert + head, tail );
+   memcpy( payload + 1 + tail, timeSignal, sizeof(timeSignal) );
+   make_packet( packets + 188, TRUE, 6, payload, 1 + tail + sizeof(timeSignal) );
+
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "back_to_back", parser, 2, 2, 0 );
+   expect_command( "back_to_back", 0, scte35Command_SpliceInsert );
+   expect_command( "back_to_back", 1, scte35Command_TimeSignal );
+
+   return report( "back_to_back", parser );
+}
+
+static int test_timestamped( void )
+{
+   Scte35Parser *parser= start();
+   unsigned char packets[2*188], stamped[2*192];
+   int i;
+
+   make_split( packets, 0, spliceInsert, sizeof(spliceInsert), 30 );
+   for( i= 0; i < 2; ++i ) {
+      memset( stamped + i*192, 0x12, 4 );
+      memcpy( stamped + i*192 + 4, packets + i*188, 188 );
+   }
+   if ( scte35_packet_size( stamped, sizeof(stamped) ) != 192 ) {
+      printf( "timestamped: packet size %d\n", scte35_packet_size( stamped, sizeof(stamped) ) );
+      ++state.errors;
+   }
+   scte35_parser_push( parser, stamped, sizeof(stamped) );
+   expect( "timestamped", parser, 1, 1, 0 );
+   expect_command( "timestamped", 0, scte35Command_SpliceInsert );
+
+   return report( "timestamped", parser );
+}
+
+static int test_continuity( void )
+{
+   Scte35Parser *parser= start();
+   unsigned char packets[2*188];
+
+   /* the continuation arrives with a gap in continuity_counter */
+   make_split( packets, 0, spliceInsert, sizeof(spliceInsert), 12 );
+   packets[188+3]= 0x10 | 0x05;
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "continuity", parser, 0, 0, 0 );
+
+   /* the next section is parsed again */
+   make_split( packets, 6, spliceInsert, sizeof(spliceInsert), 12 );
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "continuity", parser, 1, 1, 0 );
+
+   return report( "continuity", parser );
+}
+
+static int test_crc( void )
+{
+   Scte35Parser *parser= start();
+   unsigned char section[sizeof(spliceInsert)], packets[2*188];
+
+   memcpy( section, spliceInsert, sizeof(section) );
+   section[20] ^= 0x01;
+   make_split( packets, 0, section, sizeof(section), 12 );
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "crc", parser, 0, 0, 1 );
+
+   make_split( packets, 2, spliceInsert, sizeof(spliceInsert), 12 );
+   scte35_parser_push( parser, packets, sizeof(packets) );
+   expect( "crc", parser, 1, 1, 1 );
+
+   return report( "crc", parser );
+}
+
+/* splice_info_section around a command, returns its length */
+static int make_section( unsigned char *section, guint64 ptsAdjustment, int commandType,
+                         const unsigned char *command, int commandLength )
+{
+   BitWriter writer;
+   int len= 3 + 11 + commandLength + 2 + 4;
+   uint32_t crc;
+
+   memset( &writer, 0, sizeof(writer) );
+   put_bits( &writer, 0xFC, 8 );
+   put_bits( &writer, 0, 2 );
+   put_bits( &writer, 3, 2 );
+   put_bits( &writer, len - 3, 12 );
+   put_bits( &writer, 0, 8 );
+   put_bits( &writer, 0, 7 );
+   put_bits( &writer, ptsAdjustment, 33 );
+   put_bits( &writer, 0, 8 );
+   put_bits( &writer, 0xFFF, 12 );
+   put_bits( &writer, commandLength, 12 );
+   put_bits( &writer, commandType, 8 );
+   memcpy( writer.data + (writer.bitPos >> 3), command, commandLength );
+   writer.bitPos += commandLength * 8;
+   put_bits( &writer, 0, 16 );
+   crc= crc32_mpeg( writer.data, len - 4 );
+   put_bits( &writer, crc, 32 );
+   memcpy( section, writer.data, len );
+
+   return len;
+}
+
+static void put_splice_time( BitWriter *writer, gboolean timeSpecified, guint64 pts )
+{
+   put_bits( writer, timeSpecified, 1 );
+   if ( timeSpecified ) {
+      put_bits( writer, 0x3F, 6 );
+      put_bits( writer, pts, 33 );
+   } else {
+      put_bits( writer, 0x7F, 7 );
+   }
+}
+
+/* Parses one section carried in a single packet */
+static Scte35Parser* parse( const unsigned char *section, int len )
+{
+   Scte35Parser *parser= start();
+   unsigned char packet[188], payload[184];
+
+   payload[0]= 0;
+   memcpy( payload + 1, section, len );
+   make_packet( packet, TRUE, 0, payload, len + 1 );
+   scte35_parser_push( parser, packet, sizeof(packet) );
+
+   return parser;
+}
+
+static void expect_value( const char *name, const char *field, guint64 value, guint64 expected )
+{
+   if ( value != expected ) {
+      printf( "%s: %s is %llu, expected %llu\n", name, field,
+              (unsigned long long)value, (unsigned long long)expected );
+      ++state.errors;
+   }
+}
+
+static int test_splice_insert_sample( void )
+{
+   Scte35Parser *parser= parse( spliceInsert, sizeof(spliceInsert) );
+   const Scte35SpliceInfo *info= &state.info[0];
+   const char *name= "splice_insert_sample";
+
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "commandType", info->commandType, scte35Command_SpliceInsert );
+      expect_value( name, "ptsAdjustment", info->ptsAdjustment, 0 );
+      expect_value( name, "eventId", info->eventId, 0x4800008F );
+      expect_value( name, "cancel", info->cancel, FALSE );
+      expect_value( name, "outOfNetwork", info->outOfNetwork, TRUE );
+      expect_value( name, "immediate", info->immediate, FALSE );
+      expect_value( name, "hasPts", info->hasPts, TRUE );
+      expect_value( name, "ptsTime", info->ptsTime, 0x07369C02EULL );
+      expect_value( name, "hasDuration", info->hasDuration, TRUE );
+      expect_value( name, "autoReturn", info->autoReturn, TRUE );
+      expect_value( name, "duration", info->duration, 0x00052CCF5ULL );
+      expect_value( name, "uniqueProgramId", info->uniqueProgramId, 0 );
+      expect_value( name, "availNum", info->availNum, 0 );
+      expect_value( name, "availsExpected", info->availsExpected, 0 );
+   }
+
+   return report( name, parser );
+}
+
+static int test_splice_insert( void )
+{
+   unsigned char section[256];
+   BitWriter command;
+   Scte35Parser *parser;
+   const Scte35SpliceInfo *info= &state.info[0];
+   const char *name= "splice_insert";
+   int len;
+
+   /* program splice back into the network, pts_adjustment wrapping the
+      splice time past 2^33, unique_program_id and avails */
+   memset( &command, 0, sizeof(command) );
+   put_bits( &command, 0x12345678, 32 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0x7F, 7 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0xF, 4 );
+   put_splice_time( &command, TRUE, SCTE35_PTS_MASK - 100 );
+   put_bits( &command, 0xBEEF, 16 );
+   put_bits( &command, 2, 8 );
+   put_bits( &command, 4, 8 );
+   len= make_section( section, 1000, scte35Command_SpliceInsert, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "eventId", info->eventId, 0x12345678 );
+      expect_value( name, "outOfNetwork", info->outOfNetwork, FALSE );
+      expect_value( name, "ptsAdjustment", info->ptsAdjustment, 1000 );
+      expect_value( name, "ptsTime", info->ptsTime, 899 );
+      expect_value( name, "hasDuration", info->hasDuration, FALSE );
+      expect_value( name, "uniqueProgramId", info->uniqueProgramId, 0xBEEF );
+      expect_value( name, "availNum", info->availNum, 2 );
+      expect_value( name, "availsExpected", info->availsExpected, 4 );
+   }
+   scte35_parser_free( parser );
+
+   /* cancel carries nothing after the indicator */
+   memset( &command, 0, sizeof(command) );
+   put_bits( &command, 0x42, 32 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 0x7F, 7 );
+   len= make_section( section, 0, scte35Command_SpliceInsert, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "eventId", info->eventId, 0x42 );
+      expect_value( name, "cancel", info->cancel, TRUE );
+      expect_value( name, "hasPts", info->hasPts, FALSE );
+   }
+   scte35_parser_free( parser );
+
+   /* immediate out of network splice with a duration, no splice_time */
+   memset( &command, 0, sizeof(command) );
+   put_bits( &command, 7, 32 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0x7F, 7 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 0xF, 4 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0x3F, 6 );
+   put_bits( &command, 30*90000, 33 );
+   put_bits( &command, 1, 16 );
+   put_bits( &command, 0, 8 );
+   put_bits( &command, 0, 8 );
+   len= make_section( section, 0, scte35Command_SpliceInsert, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "immediate", info->immediate, TRUE );
+      expect_value( name, "outOfNetwork", info->outOfNetwork, TRUE );
+      expect_value( name, "hasPts", info->hasPts, FALSE );
+      expect_value( name, "autoReturn", info->autoReturn, FALSE );
+      expect_value( name, "duration", info->duration, 30*90000 );
+   }
+   scte35_parser_free( parser );
+
+   /* component splice: the first component's time stands for the splice */
+   memset( &command, 0, sizeof(command) );
+   put_bits( &command, 9, 32 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0x7F, 7 );
+   put_bits( &command, 1, 1 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0, 1 );
+   put_bits( &command, 0xF, 4 );
+   put_bits( &command, 2, 8 );
+   put_bits( &command, 0x01, 8 );
+   put_splice_time( &command, TRUE, 5000 );
+   put_bits( &command, 0x02, 8 );
+   put_splice_time( &command, TRUE, 6000 );
+   put_bits( &command, 0x0003, 16 );
+   put_bits( &command, 0, 8 );
+   put_bits( &command, 0, 8 );
+   len= make_section( section, 0, scte35Command_SpliceInsert, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "hasPts", info->hasPts, TRUE );
+      expect_value( name, "ptsTime", info->ptsTime, 5000 );
+      expect_value( name, "uniqueProgramId", info->uniqueProgramId, 3 );
+   }
+   scte35_parser_free( parser );
+
+   /* a command cut short is not reported */
+   len= make_section( section, 0, scte35Command_SpliceInsert, command.data, 6 );
+   parser= parse( section, len );
+   expect( name, parser, 0, 1, 0 );
+
+   return report( name, parser );
+}
+
+static int test_time_signal( void )
+{
+   unsigned char section[256];
+   BitWriter command;
+   Scte35Parser *parser= parse( timeSignal, sizeof(timeSignal) );
+   const Scte35SpliceInfo *info= &state.info[0];
+   const char *name= "time_signal";
+   int len;
+
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "commandType", info->commandType, scte35Command_TimeSignal );
+      expect_value( name, "hasPts", info->hasPts, TRUE );
+      expect_value( name, "ptsTime", info->ptsTime, 0x072BD0050ULL );
+   }
+   scte35_parser_free( parser );
+
+   /* pts_adjustment applies to time_signal too */
+   memset( &command, 0, sizeof(command) );
+   put_splice_time( &command, TRUE, 90000 );
+   len= make_section( section, 45000, scte35Command_TimeSignal, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "ptsTime", info->ptsTime, 135000 );
+   }
+   scte35_parser_free( parser );
+
+   /* time_specified_flag clear */
+   memset( &command, 0, sizeof(command) );
+   put_splice_time( &command, FALSE, 0 );
+   len= make_section( section, 0, scte35Command_TimeSignal, command.data, command.bitPos/8 );
+   parser= parse( section, len );
+   expect( name, parser, 1, 1, 0 );
+   if ( state.count == 1 ) {
+      expect_value( name, "commandType", info->commandType, scte35Command_TimeSignal );
+      expect_value( name, "hasPts", info->hasPts, FALSE );
+   }
+
+   return report( name, parser );
+}
+
+int main( int argc, char **argv )
+{
+   int failed= 0;
+
+   (void)argc;
+   (void)argv;
+
+   failed |= test_pointer_field_split();
+   failed |= test_back_to_back();
+   failed |= test_timestamped();
+   failed |= test_continuity();
+   failed |= test_crc();
+   failed |= test_splice_insert_sample();
+   failed |= test_splice_insert();
+   failed |= test_time_signal();
+
+   return failed;
+}